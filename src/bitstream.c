@@ -8,8 +8,21 @@
 
 #include "bitstream.h"
 
-#define mBitstreamBytesDoFit(stream, bytes) ((bytes) <= (stream->bound-stream->offset))
-#define mBitstreamHasEnoughBytes(stream, bytes) ((bytes) <= (stream->bound-stream->offset))
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#include <pthread.h>
+#define kBitstreamX86 1
+#else
+#define kBitstreamX86 0
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// False (and sets the sticky error) if it doesn't fit or a previous operation failed
+#define mBitstreamBytesDoFit(stream, bytes) ((!(stream)->error && (bytes) <= ((stream)->bound-(stream)->offset)) || ((stream)->error = 1, 0))
+#define mBitstreamHasEnoughBytes(stream, bytes) mBitstreamBytesDoFit(stream, bytes)
 
 bitstream_t bitstream_create(uint8_t * data, size_t bound)
 {
@@ -17,12 +30,23 @@ bitstream_t bitstream_create(uint8_t * data, size_t bound)
 	b.offset = 0; 	 // First byte
 	b.bound = bound; // Offset bound (ie. Bound = 10, means last valid offset should be 10, 10 Byte packet)
 	b.data = data;
+	b.scratch = 0;
+	b.scratch_bits = 0;
+	b.error = 0;
 	return b;
 }
 
 void bitstream_reset(bitstream_t * stream)
 {
 	stream->offset = 0;
+	stream->scratch = 0;
+	stream->scratch_bits = 0;
+	stream->error = 0;
+}
+
+int bitstream_error(const bitstream_t * stream)
+{
+	return stream->error;
 }
 
 void bitstream_skip_bytes(bitstream_t * stream, size_t length)
@@ -62,14 +86,108 @@ void bitstream_rollover(bitstream_t * stream, bitstream_snapshot_t * snapshot)
 	}
 }
 
+#pragma mark -
+#pragma mark Byte order
+
+// Big-endian (mBitstreamNetwork16/32/64) is defined in the header for the inline writer/reader
+#ifdef __LITTLE_ENDIAN__
+#define mBitstreamLittle16(x) (x)
+#define mBitstreamLittle32(x) (x)
+#else
+#define mBitstreamLittle16(x) __builtin_bswap16(x)
+#define mBitstreamLittle32(x) __builtin_bswap32(x)
+#endif
+
+// Unaligned load/store at offset, memcpy compiles to a single mov
+#define mBitstreamStore(stream, value) do { memcpy(&stream->data[stream->offset], &(value), sizeof(value)); stream->offset += sizeof(value); } while(0)
+#define mBitstreamLoad(stream, value) do { memcpy(&(value), &stream->data[stream->offset], sizeof(value)); stream->offset += sizeof(value); } while(0)
+
+#ifdef __LITTLE_ENDIAN__
+#if kBitstreamX86
+static pthread_once_t bitstream_once = PTHREAD_ONCE_INIT;
+static int bitstream_has_ssse3 = 0;
+static int bitstream_has_avx2 = 0;
+
+static void bitstream_init(void)
+{
+	__builtin_cpu_init();
+	bitstream_has_ssse3 = __builtin_cpu_supports("ssse3");
+	bitstream_has_avx2 = __builtin_cpu_supports("avx2");
+}
+
+// Reverses 32 byte blocks from offset i, returns the offset of the first byte left
+__attribute__((target("avx2")))
+static size_t bitstream_reverse_copy_avx2(uint8_t * dest, const uint8_t * src, size_t length, size_t i)
+{
+	const __m256i reverse256 = _mm256_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+	for(; i+32 <= length; i+=32)
+	{
+		__m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)&src[i]), reverse256); // Reverse each lane
+		v = _mm256_permute2x128_si256(v, v, 0x01); // Swap lanes
+		_mm256_storeu_si256((__m256i *)&dest[length-i-32], v);
+	}
+	return i;
+}
+
+// Reverses 16 byte blocks from offset i, returns the offset of the first byte left
+__attribute__((target("ssse3")))
+static size_t bitstream_reverse_copy_ssse3(uint8_t * dest, const uint8_t * src, size_t length, size_t i)
+{
+	const __m128i reverse128 = _mm_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+	for(; i+16 <= length; i+=16)
+		_mm_storeu_si128((__m128i *)&dest[length-i-16], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&src[i]), reverse128));
+	return i;
+}
+#endif
+
+/*
+ * Copies src to dest in reverse byte order, dest[length-1-i] = src[i]
+ * Blocks of 32/16 bytes are reversed with a single shuffle (AVX2 or SSSE3 when the CPU supports them, or NEON), the rest 8 bytes at a time with bswap
+ */
+static void bitstream_reverse_copy(uint8_t * dest, const uint8_t * src, size_t length)
+{
+	size_t i = 0;
+	
+#if kBitstreamX86
+	if(length >= 16)
+	{
+		pthread_once(&bitstream_once, bitstream_init);
+		if(bitstream_has_avx2)
+			i = bitstream_reverse_copy_avx2(dest, src, length, i);
+		if(bitstream_has_ssse3)
+			i = bitstream_reverse_copy_ssse3(dest, src, length, i);
+	}
+#elif defined(__ARM_NEON)
+	for(; i+16 <= length; i+=16)
+	{
+		uint8x16_t v = vrev64q_u8(vld1q_u8(&src[i])); // Reverse each half
+		vst1q_u8(&dest[length-i-16], vextq_u8(v, v, 8)); // Swap halves
+	}
+#endif
+
+	for(; i+8 <= length; i+=8)
+	{
+		uint64_t v;
+		memcpy(&v, &src[i], 8);
+		v = __builtin_bswap64(v);
+		memcpy(&dest[length-i-8], &v, 8);
+	}
+	
+	for(; i<length; ++i)
+		dest[length-i-1] = src[i];
+}
+#endif
+
+#pragma mark -
+#pragma mark Bytes
+
 int bitstream_write_bytes(bitstream_t * stream, uint8_t * src, size_t length)
 {
 	if(!mBitstreamBytesDoFit(stream, length)) // Either write all bytes or nothing if doesn't fit
 		return 0;
 		
 #ifdef __LITTLE_ENDIAN__
-	for(int b=0; b<length; ++b)
-		stream->data[stream->offset+length-b-1] = src[b]; // Swaps byte order
+	bitstream_reverse_copy(&stream->data[stream->offset], src, length); // Swaps byte order
 #else
 	memcpy(&stream->data[stream->offset], src, length); // DOES NOT Swap byte order (only works in big-endian systems)
 #endif
@@ -84,8 +202,7 @@ int bitstream_read_bytes(bitstream_t * stream, uint8_t * dest, size_t length)
 		return 0;
 		
 #ifdef __LITTLE_ENDIAN__
-	for(int b=0; b<length; ++b)
-		dest[b] = stream->data[stream->offset+length-b-1]; // Swaps byte order
+	bitstream_reverse_copy(dest, &stream->data[stream->offset], length); // Swaps byte order
 #else
 	memcpy(dest, &stream->data[stream->offset], length); // DOES NOT Swap byte order (only works in big-endian systems)
 #endif		
@@ -94,6 +211,31 @@ int bitstream_read_bytes(bitstream_t * stream, uint8_t * dest, size_t length)
 	return length;
 }
 
+int bitstream_write_raw(bitstream_t * stream, const uint8_t * src, size_t length)
+{
+	if(!mBitstreamBytesDoFit(stream, length)) // Either write all bytes or nothing if doesn't fit
+		return 0;
+	
+	memcpy(&stream->data[stream->offset], src, length);
+	stream->offset += length;
+	
+	return length;
+}
+
+int bitstream_read_raw(bitstream_t * stream, uint8_t * dest, size_t length)
+{
+	if(!mBitstreamHasEnoughBytes(stream, length)) // Either read all bytes or nothing if there's less then 'length' bytes left in bitstream
+		return 0;
+	
+	memcpy(dest, &stream->data[stream->offset], length);
+	stream->offset += length;
+	
+	return length;
+}
+
+#pragma mark -
+#pragma mark Integers
+
 void bitstream_write_uint8(bitstream_t * stream, unsigned int src)
 {
 	if(!mBitstreamBytesDoFit(stream, 1)) // Do nothing if doesn't fit
@@ -104,6 +246,12 @@ void bitstream_write_uint8(bitstream_t * stream, unsigned int src)
 
 void bitstream_read_uint8(bitstream_t * stream, unsigned int * dest)
 {
+	if(!mBitstreamHasEnoughBytes(stream, 1)) // Zero if there's not enough bytes left
+	{
+		*dest = 0;
+		return;
+	}
+	
 	*dest = (unsigned int)(stream->data[stream->offset++]);
 }
 
@@ -111,169 +259,478 @@ void bitstream_write_uint16(bitstream_t * stream, unsigned int src)
 {
 	if(!mBitstreamBytesDoFit(stream, 2)) // Do nothing if doesn't fit
 		return;
-		
-#ifdef __LITTLE_ENDIAN__
-	stream->data[stream->offset++] = (uint8_t)((src >> 8) & 0xFF); // Swaps byte order (only works in little-endian systems)
-	stream->data[stream->offset++]= (uint8_t)(src & 0xFF);
-#else
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF); // Don't swap byte order
-	stream->data[stream->offset++]= (uint8_t)((src >> 8) & 0xFF);
-#endif
+	
+	uint16_t value = mBitstreamNetwork16((uint16_t)src);
+	mBitstreamStore(stream, value);
 }
 
 void bitstream_read_uint16(bitstream_t * stream, unsigned int * dest)
 {
-#ifdef __LITTLE_ENDIAN__
-	*dest = (((unsigned int) stream->data[stream->offset++] << 8) | // Swaps byte order (only works in little-endian systems)
-             ((unsigned int) stream->data[stream->offset++] ));
-#else
-	*dest = (((unsigned int) stream->data[stream->offset++]) | // Don't swap byte order
-             ((unsigned int) stream->data[stream->offset++] << 8 ));
-#endif
+	if(!mBitstreamHasEnoughBytes(stream, 2)) // Zero if there's not enough bytes left
+	{
+		*dest = 0;
+		return;
+	}
+	
+	uint16_t value;
+	mBitstreamLoad(stream, value);
+	*dest = mBitstreamNetwork16(value);
 }
 
 void bitstream_write_uint16_endian(bitstream_t * stream, unsigned int src)
 {
 	if(!mBitstreamBytesDoFit(stream, 2)) // Do nothing if doesn't fit
 		return;
-		
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF); // Don't swap byte order
-	stream->data[stream->offset++]= (uint8_t)((src >> 8) & 0xFF);
+	
+	uint16_t value = mBitstreamLittle16((uint16_t)src); // Least significant byte first
+	mBitstreamStore(stream, value);
 }
 
 void bitstream_read_uint16_endian(bitstream_t * stream, unsigned int * dest)
 {
-	*dest = (((unsigned int) stream->data[stream->offset++]) | // Don't swap byte order
-             ((unsigned int) stream->data[stream->offset++] << 8 ));
+	if(!mBitstreamHasEnoughBytes(stream, 2)) // Zero if there's not enough bytes left
+	{
+		*dest = 0;
+		return;
+	}
+	
+	uint16_t value;
+	mBitstreamLoad(stream, value);
+	*dest = mBitstreamLittle16(value);
 }
 
 void bitstream_write_uint32(bitstream_t * stream, unsigned int src)
 {
 	if(!mBitstreamBytesDoFit(stream, 4)) // Do nothing if doesn't fit
 		return;
-		
-#ifdef __LITTLE_ENDIAN__
-	stream->data[stream->offset++] = (uint8_t)(src >> 24);// Swaps byte order (only works in little-endian systems)
-	stream->data[stream->offset++] = (uint8_t)((src >> 16) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)((src >> 8) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF);
-#else
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF);// Don't swap byte order
-	stream->data[stream->offset++] = (uint8_t)((src >> 8) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)((src >> 16) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)(src >> 24);
-#endif
+	
+	uint32_t value = mBitstreamNetwork32((uint32_t)src);
+	mBitstreamStore(stream, value);
 }
 
 void bitstream_read_uint32(bitstream_t * stream, uint32_t * dest)
 {
-#ifdef __LITTLE_ENDIAN__
-	*dest = (((unsigned int)stream->data[stream->offset++] << 24) | // WEAK Swaps byte order (only works in little-endian systems)
-             ((unsigned int)stream->data[stream->offset++] << 16) | 
-             ((unsigned int)stream->data[stream->offset++] << 8)  | 
-             ((unsigned int)stream->data[stream->offset++]));
-#else
-	*dest = (((unsigned int)stream->data[stream->offset++]) | // WEAK Swaps byte order (only works in little-endian systems)
-             ((unsigned int)stream->data[stream->offset++] << 8) | 
-             ((unsigned int)stream->data[stream->offset++] << 16) | 
-             ((unsigned int)stream->data[stream->offset++] << 24));
-#endif
+	if(!mBitstreamHasEnoughBytes(stream, 4)) // Zero if there's not enough bytes left
+	{
+		*dest = 0;
+		return;
+	}
+	
+	uint32_t value;
+	mBitstreamLoad(stream, value);
+	*dest = mBitstreamNetwork32(value);
 }
 
 void bitstream_write_uint32_endian(bitstream_t * stream, unsigned int src)
 {
 	if(!mBitstreamBytesDoFit(stream, 4)) // Do nothing if doesn't fit
 		return;
-		
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF);// Don't swap byte order
-	stream->data[stream->offset++] = (uint8_t)((src >> 8) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)((src >> 16) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)(src >> 24);
+	
+	uint32_t value = mBitstreamLittle32((uint32_t)src); // Least significant byte first
+	mBitstreamStore(stream, value);
 }
 
 void bitstream_read_uint32_endian(bitstream_t * stream, uint32_t * dest)
 {
-	*dest = (((unsigned int)stream->data[stream->offset++]) | // WEAK Swaps byte order (only works in little-endian systems)
-             ((unsigned int)stream->data[stream->offset++] << 8) | 
-             ((unsigned int)stream->data[stream->offset++] << 16) | 
-             ((unsigned int)stream->data[stream->offset++] << 24));
+	if(!mBitstreamHasEnoughBytes(stream, 4)) // Zero if there's not enough bytes left
+	{
+		*dest = 0;
+		return;
+	}
+	
+	uint32_t value;
+	mBitstreamLoad(stream, value);
+	*dest = mBitstreamLittle32(value);
 }
 
 void bitstream_write_uint64(bitstream_t * stream, uint64_t src)
 {
 	if(!mBitstreamBytesDoFit(stream, 8)) // Do nothing if doesn't fit
 		return;
-		
+	
+	uint64_t value = mBitstreamNetwork64(src);
+	mBitstreamStore(stream, value);
+}
+
+void bitstream_read_uint64(bitstream_t * stream, uint64_t * dest)
+{
+	if(!mBitstreamHasEnoughBytes(stream, 8)) // Zero if there's not enough bytes left
+	{
+		*dest = 0;
+		return;
+	}
+	
+	uint64_t value;
+	mBitstreamLoad(stream, value);
+	*dest = mBitstreamNetwork64(value);
+}
+
+#pragma mark -
+#pragma mark Reserve
+
+int bitstream_reserve(bitstream_t * stream, bitstream_writer_t * writer, size_t length)
+{
+	writer->data = &stream->data[stream->offset];
+	writer->offset = 0;
+	writer->length = 0;
+	
+	if(!mBitstreamBytesDoFit(stream, length)) // Writer stays empty, must not be written to
+		return 0;
+	
+	writer->length = length;
+	return 1;
+}
+
+void bitstream_commit(bitstream_t * stream, bitstream_writer_t * writer)
+{
+	if(writer->offset > writer->length) // Wrote past reservation, data beyond it is not committed
+		stream->error = 1;
+	
+	stream->offset += writer->offset <= writer->length ? writer->offset : writer->length;
+}
+
+int bitstream_require(bitstream_t * stream, bitstream_reader_t * reader, size_t length)
+{
+	return bitstream_reserve(stream, reader, length);
+}
+
+void bitstream_consume(bitstream_t * stream, bitstream_reader_t * reader)
+{
+	bitstream_commit(stream, reader);
+}
+
+void bitstream_writer_bytes(bitstream_writer_t * writer, const uint8_t * src, size_t length)
+{
 #ifdef __LITTLE_ENDIAN__
-	stream->data[stream->offset++] = (uint8_t)(src >> 56);// Swaps byte order (only works in little-endian systems)
-	stream->data[stream->offset++] = (uint8_t)(src >> 48);
-	stream->data[stream->offset++] = (uint8_t)(src >> 40);
-	stream->data[stream->offset++] = (uint8_t)(src >> 32);
-	stream->data[stream->offset++] = (uint8_t)(src >> 24);
-	stream->data[stream->offset++] = (uint8_t)((src >> 16) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)((src >> 8) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF);
+	bitstream_reverse_copy(&writer->data[writer->offset], src, length); // Swaps byte order
 #else
-	stream->data[stream->offset++] = (uint8_t)(src & 0xFF);// Don't swap byte order
-	stream->data[stream->offset++] = (uint8_t)((src >> 8) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)((src >> 16) & 0xFF);
-	stream->data[stream->offset++] = (uint8_t)(src >> 24);
-	stream->data[stream->offset++] = (uint8_t)(src >> 32);
-	stream->data[stream->offset++] = (uint8_t)(src >> 40);
-	stream->data[stream->offset++] = (uint8_t)(src >> 48);
-	stream->data[stream->offset++] = (uint8_t)(src >> 56);
+	memcpy(&writer->data[writer->offset], src, length);
 #endif
+	writer->offset += length;
 }
 
-void bitstream_read_uint64(bitstream_t * stream, uint64_t * dest)
+void bitstream_reader_bytes(bitstream_reader_t * reader, uint8_t * dest, size_t length)
 {
 #ifdef __LITTLE_ENDIAN__
-	*dest = (((uint64_t)stream->data[stream->offset++] << 56) | // Swaps byte order (only works in little-endian systems)
-			 ((uint64_t)stream->data[stream->offset++] << 48) |
-			 ((uint64_t)stream->data[stream->offset++] << 40) |
-			 ((uint64_t)stream->data[stream->offset++] << 32) |
-		     ((uint64_t)stream->data[stream->offset++] << 24) | 
-             ((uint64_t)stream->data[stream->offset++] << 16) | 
-             ((uint64_t)stream->data[stream->offset++] << 8)  | 
-             ((uint64_t)stream->data[stream->offset++]));
+	bitstream_reverse_copy(dest, &reader->data[reader->offset], length); // Swaps byte order
 #else
-	*dest = (((uint64_t)stream->data[stream->offset++]) |
-             ((uint64_t)stream->data[stream->offset++] << 8) | 
-             ((uint64_t)stream->data[stream->offset++] << 16) | 
-             ((uint64_t)stream->data[stream->offset++] << 24) |
-			 ((uint64_t)stream->data[stream->offset++] << 32) |
-			 ((uint64_t)stream->data[stream->offset++] << 40) |
-			 ((uint64_t)stream->data[stream->offset++] << 48) |
-			 ((uint64_t)stream->data[stream->offset++] << 56));
+	memcpy(dest, &reader->data[reader->offset], length);
 #endif
+	reader->offset += length;
 }
 
-void bitstream_write_float32(bitstream_t * stream, float src)
+#pragma mark -
+#pragma mark Bits
+
+#define mBitstreamBitsDoFit(stream, bits) ((!(stream)->error && (bits) + (stream)->scratch_bits <= ((stream)->bound-(stream)->offset)*8) || ((stream)->error = 1, 0))
+
+int bitstream_write_bits(bitstream_t * stream, uint32_t src, unsigned int bits)
 {
-	uint32_t p;
-	uint32_t sign;
+	if(bits == 0 || bits > 32 || !mBitstreamBitsDoFit(stream, bits)) // Either write whole field or nothing if doesn't fit
+		return 0;
+	
+	uint64_t value = bits < 32 ? (src & ((1U << bits) - 1)) : src;
+	stream->scratch = (stream->scratch << bits) | value; // At most 31+32 bits
+	stream->scratch_bits += bits;
+	
+	if(stream->scratch_bits >= 32) // Write 4 bytes at once
+	{
+		stream->scratch_bits -= 32;
+		uint32_t word = mBitstreamNetwork32((uint32_t)(stream->scratch >> stream->scratch_bits));
+		mBitstreamStore(stream, word);
+	}
+	
+	return bits;
+}
 
-	if (src < 0) { sign = 1; src = -src; }
-	else { sign = 0; }
+int bitstream_read_bits(bitstream_t * stream, uint32_t * dest, unsigned int bits)
+{
+	if(bits == 0 || bits > 32 || stream->error)
+		return 0;
+	
+	if(stream->scratch_bits < bits) // Load as many bytes as fit in scratch
+	{
+		while(stream->scratch_bits <= 56 && stream->offset < stream->bound)
+		{
+			stream->scratch = (stream->scratch << 8) | stream->data[stream->offset++];
+			stream->scratch_bits += 8;
+		}
+		
+		if(stream->scratch_bits < bits) // Either read whole field or nothing if there's not enough bits left
+		{
+			stream->error = 1;
+			return 0;
+		}
+	}
+	
+	stream->scratch_bits -= bits;
+	uint64_t value = stream->scratch >> stream->scratch_bits;
+	*dest = (uint32_t)(bits < 32 ? (value & ((1U << bits) - 1)) : value);
+	
+	return bits;
+}
 
-	p = ((((uint32_t)src)&0x7fff)<<16) | (sign<<31); // whole part and sign
-	p |= (uint32_t)(((src - (int)src) * 65537.0f))&0xffff; // fraction
+void bitstream_flush_bits(bitstream_t * stream)
+{
+	while(stream->scratch_bits > 0) // Last byte padded with zeroes
+	{
+		unsigned int shift = stream->scratch_bits >= 8 ? stream->scratch_bits - 8 : 0;
+		uint8_t byte = (uint8_t)(stream->scratch >> shift);
+		if(stream->scratch_bits < 8)
+			byte <<= 8 - stream->scratch_bits;
+		
+		stream->data[stream->offset++] = byte; // Always fits, checked on write
+		stream->scratch_bits = shift;
+	}
+	stream->scratch = 0;
+}
 
+void bitstream_align_bits(bitstream_t * stream)
+{
+	stream->offset -= stream->scratch_bits / 8; // Whole bytes loaded but not read
+	stream->scratch = 0;
+	stream->scratch_bits = 0;
+}
+
+unsigned int bitstream_bits_required(uint32_t range)
+{
+	return range == 0 ? 0 : 32 - __builtin_clz(range);
+}
+
+int bitstream_write_bool(bitstream_t * stream, int src)
+{
+	return bitstream_write_bits(stream, src ? 1 : 0, 1);
+}
+
+int bitstream_read_bool(bitstream_t * stream, int * dest)
+{
+	uint32_t value;
+	if(!bitstream_read_bits(stream, &value, 1))
+		return 0;
+	
+	*dest = (int)value;
+	return 1;
+}
+
+int bitstream_write_int_bounded(bitstream_t * stream, int32_t src, int32_t min, int32_t max)
+{
+	if(src < min) src = min;
+	if(src > max) src = max;
+	
+	unsigned int bits = bitstream_bits_required((uint32_t)max - (uint32_t)min);
+	if(bits == 0)
+		return 0; // Single value, nothing to write
+	
+	return bitstream_write_bits(stream, (uint32_t)src - (uint32_t)min, bits);
+}
+
+int bitstream_read_int_bounded(bitstream_t * stream, int32_t * dest, int32_t min, int32_t max)
+{
+	unsigned int bits = bitstream_bits_required((uint32_t)max - (uint32_t)min);
+	if(bits == 0)
+	{
+		*dest = min; // Single value
+		return 0;
+	}
+	
+	uint32_t value;
+	if(!bitstream_read_bits(stream, &value, bits))
+		return 0;
+	
+	*dest = (int32_t)((uint32_t)min + value);
+	if(*dest > max)
+		*dest = max; // Out of range in stream
+	
+	return bits;
+}
+
+int bitstream_write_float_quantized(bitstream_t * stream, float src, float min, float max, unsigned int bits)
+{
+	if(bits == 0 || bits > 32 || !(max > min))
+		return 0;
+	
+	double steps = bits < 32 ? (double)((1U << bits) - 1) : 4294967295.0;
+	double normalized = ((double)src - min) / ((double)max - min); // NaN is written as min
+	if(!(normalized > 0.0)) normalized = 0.0;
+	if(normalized > 1.0) normalized = 1.0;
+	
+	return bitstream_write_bits(stream, (uint32_t)(normalized * steps + 0.5), bits); // Round to nearest step
+}
+
+int bitstream_read_float_quantized(bitstream_t * stream, float * dest, float min, float max, unsigned int bits)
+{
+	if(bits == 0 || bits > 32 || !(max > min))
+		return 0;
+	
+	uint32_t value;
+	if(!bitstream_read_bits(stream, &value, bits))
+		return 0;
+	
+	double steps = bits < 32 ? (double)((1U << bits) - 1) : 4294967295.0;
+	*dest = (float)(min + (value / steps) * ((double)max - min));
+	
+	return bits;
+}
+
+#pragma mark -
+#pragma mark Varint
+
+#define kBitstreamVarintMaxLength 10 // 64 bits, 7 bits per byte
+
+static inline size_t bitstream_varint_decode(const uint8_t * src, size_t available, uint64_t * dest)
+{
+	uint64_t value = 0;
+	
+	for(size_t b=0; b<available && b<kBitstreamVarintMaxLength; ++b)
+	{
+		value |= (uint64_t)(src[b] & 0x7F) << (7 * b);
+		if(!(src[b] & 0x80)) // Last byte
+		{
+			*dest = value;
+			return b + 1;
+		}
+	}
+	
+	return 0; // Truncated or too long
+}
+
+size_t bitstream_varint_length(uint64_t value)
+{
+	size_t length = 1;
+	while(value >= 0x80)
+	{
+		value >>= 7;
+		++length;
+	}
+	return length;
+}
+
+int bitstream_write_varint(bitstream_t * stream, uint64_t src)
+{
+	size_t length = bitstream_varint_length(src);
+	if(!mBitstreamBytesDoFit(stream, length)) // Either write all bytes or nothing if doesn't fit
+		return 0;
+	
+	uint8_t * dest = &stream->data[stream->offset];
+	while(src >= 0x80)
+	{
+		*dest++ = (uint8_t)(src | 0x80); // Continuation bit
+		src >>= 7;
+	}
+	*dest = (uint8_t)src;
+	
+	stream->offset += length;
+	return length;
+}
+
+int bitstream_read_varint(bitstream_t * stream, uint64_t * dest)
+{
+	size_t length = stream->error ? 0 : bitstream_varint_decode(&stream->data[stream->offset], stream->bound - stream->offset, dest);
+	if(length == 0)
+	{
+		stream->error = 1;
+		*dest = 0;
+		return 0;
+	}
+	
+	stream->offset += length;
+	return length;
+}
+
+int bitstream_write_varint_signed(bitstream_t * stream, int64_t src)
+{
+	return bitstream_write_varint(stream, mBitstreamZigzag(src));
+}
+
+int bitstream_read_varint_signed(bitstream_t * stream, int64_t * dest)
+{
+	uint64_t value;
+	int length = bitstream_read_varint(stream, &value);
+	*dest = mBitstreamUnzigzag(value);
+	return length;
+}
+
+size_t bitstream_read_varints(bitstream_t * stream, uint64_t * dest, size_t count)
+{
+	if(stream->error)
+		return 0;
+	
+	const uint8_t * src = &stream->data[stream->offset];
+	size_t available = stream->bound - stream->offset;
+	size_t position = 0;
+	size_t n = 0;
+	
+#if defined(__SSE2__)
+	// 16 bytes at a time, the movemask of the continuation bits marks where each varint ends
+	while(n < count && available - position >= 16)
+	{
+		unsigned int ends = ~_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&src[position])) & 0xFFFF;
+		
+		if(ends == 0xFFFF && count - n >= 16) // All single byte
+		{
+			for(int b=0; b<16; ++b)
+				dest[n+b] = src[position+b];
+			n += 16;
+			position += 16;
+			continue;
+		}
+		
+		size_t start = 0;
+		while(ends && n < count)
+		{
+			unsigned int end = __builtin_ctz(ends);
+			if(end - start >= kBitstreamVarintMaxLength)
+				break; // Too long, scalar loop fails on it
+			
+			uint64_t value = 0;
+			for(unsigned int b=start; b<=end; ++b)
+				value |= (uint64_t)(src[position+b] & 0x7F) << (7 * (b - start));
+			
+			dest[n++] = value;
+			start = end + 1;
+			ends &= ends - 1;
+		}
+		
+		if(start == 0)
+			break; // No varint ends in this block
+		position += start;
+	}
+#endif
+	
+	while(n < count)
+	{
+		size_t length = bitstream_varint_decode(&src[position], available - position, &dest[n]);
+		if(length == 0) // Truncated or too long, keeps what was decoded
+		{
+			stream->error = 1;
+			break;
+		}
+		position += length;
+		++n;
+	}
+	
+	stream->offset += position;
+	return n;
+}
+
+#pragma mark -
+#pragma mark Float and string
+
+void bitstream_write_float32(bitstream_t * stream, float src)
+{
+	uint32_t p;
+	memcpy(&p, &src, sizeof(p)); // IEEE 754 single precision bits, exact
+	
 	bitstream_write_uint32(stream, p);
 }
 
 void bitstream_read_float32(bitstream_t * stream, float * dest)
 {
-	uint32_t p;
+	uint32_t p = 0; // 0.0f if it doesn't fit
 	
 	bitstream_read_uint32(stream, &p);
 	
-	float f = ((p>>16)&0x7fff); // whole part
-	f += (p&0xffff) / 65536.0f; // fraction
-
-	if (((p>>31)&0x1) == 0x1) { f = -f; } // sign bit set
-	
-	*dest = f; // copy
+	memcpy(dest, &p, sizeof(p)); // copy
 }
 
 int bitstream_write_str(bitstream_t * stream, const char * src)
@@ -291,14 +748,24 @@ int bitstream_write_str(bitstream_t * stream, const char * src)
 
 int bitstream_read_str(bitstream_t * stream, char * dest, const size_t maxlength)
 {
-	size_t strlength = 0;
+	unsigned int strlength = 0;
 	
-	bitstream_read_uint8(stream, (unsigned int *)&strlength); // string length
+	bitstream_read_uint8(stream, &strlength); // string length
 	
 	if(strlength+1 > maxlength) // Either read entire string or nothing if doesn't fit destination
+	{
+		stream->error = 1;
+		if(maxlength > 0)
+			dest[0] = '\0';
 		return 0;
+	}
 	
 	bitstream_read_bytes(stream, (uint8_t *)dest, strlength); // string bytes
+	if(bitstream_error(stream)) // Truncated, or a previous operation failed
+	{
+		dest[0] = '\0';
+		return 0;
+	}
 	dest[strlength] = '\0'; // Null terminating character
 	
 	return strlength;
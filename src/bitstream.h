@@ -38,15 +38,21 @@ extern "C" {
  * bitstream_t is always associated to a block of memory 'data' and has a memory size 'bound' defined to avoid overflow.
  * It is used for network serialization purposes. All serialized data is in big-endian format.
  * Whether reading/writing it always starts at 'data' first byte and updates 'offset' by the respective nr. of bytes after each operation.
+ * Bit fields are packed most significant bit first through a 64 bit scratch word, see bit operations below.
+ * Any write that doesn't fit or read past bound sets 'error', every later operation then fails until reset.
  */
 typedef struct {
 	uint8_t * data; // Data containing serialized values
 	size_t offset;  // Byte offset (read or write)
 	size_t bound; 	// Byte bound of memory pointed by data
+	uint64_t scratch; // Pending bits, not yet written to data (write) or already loaded from data (read)
+	unsigned int scratch_bits; // Nr. of valid bits in scratch (lowest bits)
+	int error; // Sticky, an operation didn't fit
 } bitstream_t;
 
 bitstream_t bitstream_create(uint8_t * data, size_t bound);
-void bitstream_reset(bitstream_t * stream);
+void bitstream_reset(bitstream_t * stream); // Back to first byte, clears error
+int bitstream_error(const bitstream_t * stream); // Non-zero if any write/read didn't fit since create/reset
 void bitstream_skip_bytes(bitstream_t * stream, size_t length);
 
 /*!
@@ -72,10 +78,65 @@ bitstream_snapshot_t bitstream_snapshot(bitstream_t * stream);
 void bitstream_rollback(bitstream_t * stream, bitstream_snapshot_t * snapshot);
 void bitstream_rollover(bitstream_t * stream, bitstream_snapshot_t * snapshot);
 
+/*!
+ * @typedef bitstream_writer_t
+ *
+ * @abstract Unchecked writer/reader over a reserved range of a bitstream
+ * @discussion 
+ * bitstream_reserve/bitstream_require do a single bounds check for a whole message (sets error and
+ * returns 0 if it doesn't fit). The inline bitstream_writer_* and bitstream_reader_* functions then skip
+ * per-field checks, the caller must stay within the reserved length. bitstream_commit/bitstream_consume
+ * move the bitstream past the bytes written/read. Same byte order as the checked functions.
+ */
+typedef struct {
+	uint8_t * data; // First reserved byte
+	size_t offset;  // Bytes written/read
+	size_t length;  // Reserved bytes
+} bitstream_writer_t;
+
+typedef bitstream_writer_t bitstream_reader_t;
+
+int bitstream_reserve(bitstream_t * stream, bitstream_writer_t * writer, size_t length);
+void bitstream_commit(bitstream_t * stream, bitstream_writer_t * writer);
+int bitstream_require(bitstream_t * stream, bitstream_reader_t * reader, size_t length);
+void bitstream_consume(bitstream_t * stream, bitstream_reader_t * reader);
+
+#ifdef __LITTLE_ENDIAN__
+#define mBitstreamNetwork16(x) __builtin_bswap16(x)
+#define mBitstreamNetwork32(x) __builtin_bswap32(x)
+#define mBitstreamNetwork64(x) __builtin_bswap64(x)
+#else
+#define mBitstreamNetwork16(x) (x)
+#define mBitstreamNetwork32(x) (x)
+#define mBitstreamNetwork64(x) (x)
+#endif
+
+static inline void bitstream_writer_uint8(bitstream_writer_t * writer, unsigned int src) { writer->data[writer->offset++] = (uint8_t)src; }
+static inline void bitstream_writer_uint16(bitstream_writer_t * writer, unsigned int src) { uint16_t v = mBitstreamNetwork16((uint16_t)src); memcpy(&writer->data[writer->offset], &v, 2); writer->offset += 2; }
+static inline void bitstream_writer_uint32(bitstream_writer_t * writer, unsigned int src) { uint32_t v = mBitstreamNetwork32((uint32_t)src); memcpy(&writer->data[writer->offset], &v, 4); writer->offset += 4; }
+static inline void bitstream_writer_uint64(bitstream_writer_t * writer, uint64_t src) { uint64_t v = mBitstreamNetwork64(src); memcpy(&writer->data[writer->offset], &v, 8); writer->offset += 8; }
+static inline void bitstream_writer_uint16_endian(bitstream_writer_t * writer, unsigned int src) { writer->data[writer->offset++] = (uint8_t)src; writer->data[writer->offset++] = (uint8_t)(src >> 8); }
+static inline void bitstream_writer_uint32_endian(bitstream_writer_t * writer, unsigned int src) { bitstream_writer_uint16_endian(writer, src & 0xFFFF); bitstream_writer_uint16_endian(writer, src >> 16); }
+static inline void bitstream_writer_raw(bitstream_writer_t * writer, const uint8_t * src, size_t length) { memcpy(&writer->data[writer->offset], src, length); writer->offset += length; }
+void bitstream_writer_bytes(bitstream_writer_t * writer, const uint8_t * src, size_t length); // Swapped, as bitstream_write_bytes
+
+static inline void bitstream_reader_uint8(bitstream_reader_t * reader, unsigned int * dest) { *dest = reader->data[reader->offset++]; }
+static inline void bitstream_reader_uint16(bitstream_reader_t * reader, unsigned int * dest) { uint16_t v; memcpy(&v, &reader->data[reader->offset], 2); reader->offset += 2; *dest = mBitstreamNetwork16(v); }
+static inline void bitstream_reader_uint32(bitstream_reader_t * reader, unsigned int * dest) { uint32_t v; memcpy(&v, &reader->data[reader->offset], 4); reader->offset += 4; *dest = mBitstreamNetwork32(v); }
+static inline void bitstream_reader_uint64(bitstream_reader_t * reader, uint64_t * dest) { uint64_t v; memcpy(&v, &reader->data[reader->offset], 8); reader->offset += 8; *dest = mBitstreamNetwork64(v); }
+static inline void bitstream_reader_uint16_endian(bitstream_reader_t * reader, unsigned int * dest) { *dest = (unsigned int)reader->data[reader->offset] | ((unsigned int)reader->data[reader->offset+1] << 8); reader->offset += 2; }
+static inline void bitstream_reader_uint32_endian(bitstream_reader_t * reader, unsigned int * dest) { unsigned int low, high; bitstream_reader_uint16_endian(reader, &low); bitstream_reader_uint16_endian(reader, &high); *dest = low | (high << 16); }
+static inline void bitstream_reader_raw(bitstream_reader_t * reader, uint8_t * dest, size_t length) { memcpy(dest, &reader->data[reader->offset], length); reader->offset += length; }
+void bitstream_reader_bytes(bitstream_reader_t * reader, uint8_t * dest, size_t length); // Swapped, as bitstream_read_bytes
+
 // n Bytes
 int bitstream_write_bytes(bitstream_t * stream, uint8_t * src, size_t length);
 int bitstream_read_bytes(bitstream_t * stream, uint8_t * dest, size_t length);
 
+// n Bytes, opaque byte array (no byte order convertion, same bytes in memory and in stream)
+int bitstream_write_raw(bitstream_t * stream, const uint8_t * src, size_t length);
+int bitstream_read_raw(bitstream_t * stream, uint8_t * dest, size_t length);
+
 // 1 Byte, unsigned integer
 void bitstream_write_uint8(bitstream_t * stream, unsigned int src);
 void bitstream_read_uint8(bitstream_t * stream, unsigned int * dest);
@@ -100,10 +161,55 @@ void bitstream_read_uint32_endian(bitstream_t * stream, unsigned int * dest);
 void bitstream_write_uint64(bitstream_t * stream, uint64_t src);
 void bitstream_read_uint64(bitstream_t * stream, uint64_t * dest);
 
-// 4 Byte, float
+// 4 Byte, float (IEEE 754 bits, network byte order)
 void bitstream_write_float32(bitstream_t * stream, float src);
 void bitstream_read_float32(bitstream_t * stream, float * dest);
 
+/*!
+ * Bit operations
+ * @discussion
+ * Fields of 1 to 32 bits, packed without padding. Bits are written to data in whole bytes as the scratch
+ * fills up, call bitstream_flush_bits after the last write (pads the last byte with zeroes) and
+ * bitstream_align_bits after the last read, before any byte operation or snapshot.
+ * Either the whole field is written/read or nothing if it doesn't fit, returns nr. of bits.
+ */
+int bitstream_write_bits(bitstream_t * stream, uint32_t src, unsigned int bits);
+int bitstream_read_bits(bitstream_t * stream, uint32_t * dest, unsigned int bits);
+void bitstream_flush_bits(bitstream_t * stream); // Write pending bits, next write is byte aligned
+void bitstream_align_bits(bitstream_t * stream); // Discard rest of current byte, next read is byte aligned
+
+unsigned int bitstream_bits_required(uint32_t range); // ceil(log2(range+1)), 0 if range is 0
+
+// 1 Bit, bool
+int bitstream_write_bool(bitstream_t * stream, int src);
+int bitstream_read_bool(bitstream_t * stream, int * dest);
+
+// ceil(log2(max-min+1)) Bits, integer in [min, max] (clamped)
+int bitstream_write_int_bounded(bitstream_t * stream, int32_t src, int32_t min, int32_t max);
+int bitstream_read_int_bounded(bitstream_t * stream, int32_t * dest, int32_t min, int32_t max);
+
+// n Bits, float in [min, max] (clamped) quantized to 2^bits-1 steps, max error (max-min)/(2^bits-1)/2
+int bitstream_write_float_quantized(bitstream_t * stream, float src, float min, float max, unsigned int bits);
+int bitstream_read_float_quantized(bitstream_t * stream, float * dest, float min, float max, unsigned int bits);
+
+/*!
+ * Varint
+ * @discussion
+ * LEB128, 7 bits per byte least significant group first, high bit set on all but the last byte.
+ * Values below 128 take 1 byte, 64 bit values up to 10 bytes. Signed values are zigzag encoded
+ * first (0, -1, 1, -2... as 0, 1, 2, 3...) so small magnitudes stay short.
+ * Returns nr. of bytes written/read, 0 if it doesn't fit or is truncated.
+ */
+#define mBitstreamZigzag(value) (((uint64_t)(value) << 1) ^ (uint64_t)((int64_t)(value) >> 63))
+#define mBitstreamUnzigzag(value) ((int64_t)((value) >> 1) ^ -(int64_t)((value) & 1))
+
+size_t bitstream_varint_length(uint64_t value);
+int bitstream_write_varint(bitstream_t * stream, uint64_t src);
+int bitstream_read_varint(bitstream_t * stream, uint64_t * dest);
+int bitstream_write_varint_signed(bitstream_t * stream, int64_t src);
+int bitstream_read_varint_signed(bitstream_t * stream, int64_t * dest);
+size_t bitstream_read_varints(bitstream_t * stream, uint64_t * dest, size_t count); // Batch decode (SSE2 when available), returns nr. of values read
+
 // n Bytes, string, char *
 int bitstream_write_str(bitstream_t * stream, const char * src);
 int bitstream_read_str(bitstream_t * stream, char * dest, const size_t maxlength);
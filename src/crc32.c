@@ -0,0 +1,180 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* crc32.c
+* universal-network-c
+*/
+
+#include "crc32.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define kCrc32Pclmul 1
+#else
+#define kCrc32Pclmul 0
+#endif
+
+#define kCrc32Polynomial 0xEDB88320 // Reflected
+
+static uint32_t crc32_table[8][256]; // Slicing-by-8
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+static int crc32_has_pclmul = 0;
+
+static void crc32_init(void)
+{
+	for(unsigned int n=0; n<256; ++n)
+	{
+		uint32_t crc = n;
+		for(int k=0; k<8; ++k)
+			crc = (crc & 1) ? (crc >> 1) ^ kCrc32Polynomial : crc >> 1;
+		crc32_table[0][n] = crc;
+	}
+	
+	for(unsigned int n=0; n<256; ++n)
+	{
+		for(int t=1; t<8; ++t)
+			crc32_table[t][n] = (crc32_table[t-1][n] >> 8) ^ crc32_table[0][crc32_table[t-1][n] & 0xFF];
+	}
+	
+#if kCrc32Pclmul
+	__builtin_cpu_init();
+	crc32_has_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static uint32_t crc32_table_update(uint32_t crc, const uint8_t * data, size_t length) // crc is inverted
+{
+	while(length >= 8)
+	{
+		uint32_t low = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+		uint32_t high = (uint32_t)data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+		
+		crc = crc32_table[7][low & 0xFF] ^ crc32_table[6][(low >> 8) & 0xFF] ^ crc32_table[5][(low >> 16) & 0xFF] ^ crc32_table[4][low >> 24] ^
+		      crc32_table[3][high & 0xFF] ^ crc32_table[2][(high >> 8) & 0xFF] ^ crc32_table[1][(high >> 16) & 0xFF] ^ crc32_table[0][high >> 24];
+		
+		data += 8;
+		length -= 8;
+	}
+	
+	while(length--)
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data++) & 0xFF];
+	
+	return crc;
+}
+
+#if kCrc32Pclmul
+// Folding with carry-less multiplication, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ" (Intel)
+// Length is a multiple of 16, at least 64. crc is inverted
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_update(uint32_t crc, const uint8_t * data, size_t length)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4); // x^(4*128+32) and x^(4*128-32) mod P, reflected
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0); // x^(128+32) and x^(128-32) mod P, reflected
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124); // x^64 mod P, reflected
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641); // Barrett, mu and P
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+	
+	x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	data += 64;
+	length -= 64;
+	
+	// Four lanes, 64 bytes at a time
+	x0 = k1k2;
+	while(length >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + 0x30)));
+		
+		data += 64;
+		length -= 64;
+	}
+	
+	// Four lanes into one
+	x0 = k3k4;
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	
+	// 16 bytes at a time
+	while(length >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data)), x5);
+		
+		data += 16;
+		length -= 16;
+	}
+	
+	// 128 to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const uint8_t * data, size_t length)
+{
+	pthread_once(&crc32_once, crc32_init);
+	
+	crc = ~crc;
+	
+#if kCrc32Pclmul
+	if(crc32_has_pclmul && length >= 64)
+	{
+		size_t folded = length & ~(size_t)15;
+		crc = crc32_pclmul_update(crc, data, folded);
+		data += folded;
+		length -= folded;
+	}
+#endif
+	
+	return ~crc32_table_update(crc, data, length);
+}
+
+uint32_t crc32_compute(const uint8_t * data, size_t length)
+{
+	return crc32_update(0, data, length);
+}
@@ -0,0 +1,28 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* crc32.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_crc32_h__
+#define __universal_network_crc32_h__
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+/*!
+ * @header
+ *
+ * CRC-32 (ISO/IEC 3309, ITU-T V.42, reflected polynomial 0xEDB88320), as used by STUN FINGERPRINT.
+ *
+ * Buffers of 64 bytes or more are folded 64 bytes at a time with carry-less multiplication (PCLMULQDQ) on x86-64
+ * processors that have it, checked once at run time. The rest is slicing-by-8 with 8 KB of tables built on first use.
+ * The SSE4.2 crc32 instruction is NOT used, it computes CRC-32C (Castagnoli polynomial).
+ */
+
+uint32_t crc32_update(uint32_t crc, const uint8_t * data, size_t length); // Continues a crc, start with 0
+uint32_t crc32_compute(const uint8_t * data, size_t length);
+
+#endif
@@ -27,5 +27,6 @@
 #include "net_addr.h"
 #include "net_packet.h"
 #include "net_socket.h"
+#include "net_time.h"
 
 #endif
\ No newline at end of file
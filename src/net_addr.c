@@ -67,6 +67,20 @@ bool net_addr_is_valid(net_addr_t * addr)
 	return net_addr_is_equal(addr, &zeroAddr) == false;
 }
 
+unsigned int net_addr_hash(const net_addr_t * addr)
+{
+	uint64_t key = ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+	
+	// 64 bit finalizer (MurmurHash3 fmix64)
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	
+	return (unsigned int)key;
+}
+
 NetError net_addr_resolve(net_addr_t * addr, const char * name, const unsigned short port)
 {
     struct addrinfo *result;
@@ -47,6 +47,7 @@ unsigned short net_addr_get_port(net_addr_t * addr);
 
 bool net_addr_is_equal(const net_addr_t *, const net_addr_t *);
 bool net_addr_is_valid(net_addr_t *); // Not zeroes
+unsigned int net_addr_hash(const net_addr_t *); // Host and port, well mixed (any bit range can be used as index)
 
 NetError net_addr_resolve(net_addr_t * addr, const char * name, const unsigned short port);
 NetError net_addr_local(net_addr_t * addr);
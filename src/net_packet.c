@@ -22,20 +22,57 @@
 
 #include "net_packet.h"
 
-void net_packet_init(net_packet_t p)
+#include <stdlib.h>
+
+void net_packet_init(net_packet_t p, size_t capacity)
 {
 	if(p)
-		p->bitstream = bitstream_create(p->data, kNetPacketMaxLen);
+	{
+		p->capacity = capacity;
+		p->bitstream = bitstream_create(p->data, capacity);
+	}
 }
 
 size_t net_packet_len(net_packet_t p)
 {
-	return p->length; // Set before sendto or after recvfrom
+	return p->length + (p->body ? p->body->length : 0); // Set before sendto or after recvfrom
+}
+
+net_packet_body_t net_packet_body_create(size_t capacity)
+{
+	net_packet_body_t body = (net_packet_body_t)malloc(sizeof(struct net_packet_body_s) + capacity);
+	if(body)
+	{
+		body->retainCount = 1;
+		body->length = 0;
+		body->capacity = capacity;
+	}
+	
+	return body;
+}
+
+void net_packet_body_retain(net_packet_body_t body)
+{
+	__sync_add_and_fetch(&body->retainCount, 1); // Packets are released on socket queue
+}
+
+void net_packet_body_release(net_packet_body_t body)
+{
+	if(body && __sync_sub_and_fetch(&body->retainCount, 1) == 0)
+		free(body);
+}
+
+void net_packet_set_body(net_packet_t p, net_packet_body_t body)
+{
+	if(body)
+		net_packet_body_retain(body);
+	net_packet_body_release(p->body);
+	p->body = body;
 }
 
 void net_packet_set_data(net_packet_t packet, uint8_t * data, size_t length)
 {
-	if(length <= kNetPacketMaxLen)
+	if(length <= packet->capacity)
 	{	
 		memcpy(packet->data, data, length);
 		packet->length = length;
@@ -28,20 +28,59 @@
 #include "bitstream.h"
 #include "net_error.h"
 #include "net_addr.h"
+#include "net_time.h"
 
-#define kNetPacketMaxLen 256
+#define kNetPacketMaxLen 1472 // Largest UDP payload in a 1500 bytes Ethernet frame (1500 - 20 IPv4 header - 8 UDP header)
+#define kNetPacketDefaultLen 256 // Default packet size class
 
+/*!
+ * @typedef net_packet_body_t
+ *
+ * @abstract Reference counted payload shared by many packets
+ * @discussion
+ * Sent right after the packet data (scatter/gather), so the same payload can be sent to many
+ * destinations with a different header each, without copying it into every packet.
+ */
+struct net_packet_body_s {
+	volatile int retainCount;
+	size_t length; // Length <= capacity
+	size_t capacity;
+	uint8_t data[];
+};
+
+typedef struct net_packet_body_s * net_packet_body_t;
+
+/*!
+ * @typedef net_packet_t
+ *
+ * @abstract Datagram buffer allocated from a socket packet pool
+ * @discussion
+ * The packet data size is not fixed at compile-time, each socket pool has its own size class (capacity)
+ * which is set on socket creation. Any size class is bounded by kNetPacketMaxLen.
+ */
 struct net_packet_s {
 	struct sockaddr_in addr;
-	uint8_t data[kNetPacketMaxLen];
-	size_t length; // Length <= kNetPacketMaxLen, set when sent or received
+	size_t length;   // Length <= capacity, set when sent or received
+	size_t capacity; // Size class, max. number of bytes in data
+	net_time_t time; // Monotonic time when received
+	net_time_t txtime; // Monotonic time when it should be sent, 0 sends as soon as possible (pacing)
 	bitstream_t bitstream;
+	struct pool_s * pool; // Owner pool, the packet is retained/released on the pool it was allocated from
+	net_packet_body_t body; // Shared payload sent after data, NULL if none
+	uint8_t data[];  // Packet data, capacity bytes
 };
 
 typedef struct net_packet_s * net_packet_t;
 
-void net_packet_init(net_packet_t p);
-size_t net_packet_len(net_packet_t p);
+#define mNetPacketAllocSize(capacity) ((sizeof(struct net_packet_s) + (capacity) + 7) & ~((size_t)7)) // Packet struct + data, 8 byte aligned
+
+void net_packet_init(net_packet_t p, size_t capacity);
+size_t net_packet_len(net_packet_t p); // Datagram length, including shared body
+
+net_packet_body_t net_packet_body_create(size_t capacity); // Retain count is 1
+void net_packet_body_retain(net_packet_body_t);
+void net_packet_body_release(net_packet_body_t); // Freed when retain count reaches 0, NULL is ignored
+void net_packet_set_body(net_packet_t, net_packet_body_t); // Retains body until packet is freed
 
 void net_packet_set_data(net_packet_t, uint8_t *, size_t);
 
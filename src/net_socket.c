@@ -20,6 +20,10 @@
  
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg
+#endif
+
 #include "net_socket.h"
 #include "net_socket_internal.h"
 #include "universal_network_c.h"
@@ -36,19 +40,38 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#if defined(__linux__)
+#include <linux/net_tstamp.h> // struct sock_txtime
+#endif
 
 #pragma mark -
 #pragma mark Initialization
 
 net_socket_t net_socket_create(NetError * error, int domain, const char * host, const int port)
+{
+	return net_socket_create_size(error, domain, host, port, kNetPacketDefaultLen);
+}
+
+net_socket_t net_socket_create_size(NetError * error, int domain, const char * host, const int port, size_t packetSize)
 {	
+	if(packetSize == 0 || packetSize > kNetPacketMaxLen) // Size class must fit a single datagram
+	{
+		netErrorSet(error, NetInvalidError);
+		return NULL;
+	}
+	
 	net_socket_t s = (net_socket_t)calloc(1, sizeof(struct net_socket_s));	
 	
 	if(s) 
 	{
         s->socketDispatchQueue = dispatch_queue_create("com.laugga.socketDispatchQueue", NULL); // Create send dispatch queue
 		s->pendingPackets = queue_create();
-		s->poolPackets = pool_create(sizeof(struct net_packet_s), kNetPacketPoolCapacity);
+		s->packetSize = packetSize;
+		s->poolPackets = pool_create(mNetPacketAllocSize(packetSize), kNetPacketPoolCapacity + kNetSocketReceiveBatch); // Receive buffers on top
+		pthread_mutex_init(&s->demuxLock, NULL);
 		
 		if ((s->fd = socket(domain, SOCK_DGRAM, 0)) == -1) {
 	        netErrorSetPosix(error, errno);
@@ -134,6 +157,12 @@ void net_socket_destroy(net_socket_t s)
 		net_socket_resume_write(s); // MUST resume write dispatch source before, so cancel handler is called
         dispatch_source_cancel(s->writeDispatchSource);
     }
+    
+    // Cancel pacing dispatch_source
+    if(s->pacingDispatchSource)
+    {
+        dispatch_source_cancel(s->pacingDispatchSource);
+    }
 }
 
 void net_socket_destroy_async(net_socket_t s)
@@ -145,15 +174,33 @@ void net_socket_destroy_async(net_socket_t s)
     // Release write dispatch_source
     if(s->writeDispatchSource)
 		dispatch_release(s->writeDispatchSource);
+    
+    // Release pacing dispatch_source
+    if(s->pacingDispatchSource)
+		dispatch_release(s->pacingDispatchSource);
 	
 	// Release send dispatch queue
 	dispatch_release(s->socketDispatchQueue);
 
 	// Free pendingPackets 
 	queue_destroy(s->pendingPackets);
+	free(s->pacedPackets);
 
-	// Free packets pool
+	// Free receive buffers and packets pool
+	for(unsigned int i=0; i<kNetSocketReceiveBatch; ++i)
+		if(s->receivePackets[i])
+			net_packet_free(s, s->receivePackets[i]);
 	pool_destroy(s->poolPackets);
+	
+	// Release demux blocks and table
+	if(s->demuxTable)
+	{
+		for(unsigned int i=0; i<kNetSocketDemuxMaxProtocols; ++i)
+			if(s->demuxTable->entries[i].isRegistered && s->demuxTable->entries[i].receiveBlock)
+				Block_release(s->demuxTable->entries[i].receiveBlock);
+		free(s->demuxTable);
+	}
+	pthread_mutex_destroy(&s->demuxLock);
 
 	// Free socket
 	free(s);
@@ -166,25 +213,44 @@ void net_socket_destroy_async(net_socket_t s)
 
 net_packet_t net_packet_alloc(net_socket_t s)
 {
-	net_packet_t packet = (net_packet_t)pool_alloc(s->poolPackets); // Alloc from pool
-	net_packet_init(packet); // Set or Reset packet bitstream
+	return net_packet_alloc_pool(s, s->poolPackets);
+}
+
+net_packet_t net_packet_alloc_pool(net_socket_t s, pool_t pool)
+{
+	net_packet_t packet = (net_packet_t)pool_alloc(pool); // Alloc from pool
+	if(packet)
+	{
+		net_packet_init(packet, s->packetSize); // Set or Reset packet bitstream
+		packet->pool = pool;
+		packet->body = NULL;
+	}
 
 	return packet;
 }
 
+pool_t net_packet_pool_create(net_socket_t s, size_t capacity)
+{
+	return pool_create(mNetPacketAllocSize(s->packetSize), capacity);
+}
+
 void net_packet_release(net_socket_t s, net_packet_t p)
 {
-	pool_release(s->poolPackets, p);
+	net_packet_body_t body = p->body; // Packet may be re-used once released
+	if(pool_release(p->pool, p) == 0)
+		net_packet_body_release(body);
 }
 
 void net_packet_retain(net_socket_t s, net_packet_t p)
 {
-	pool_retain(s->poolPackets, p);
+	pool_retain(p->pool, p);
 }
 
 void net_packet_free(net_socket_t s, net_packet_t p)
 {
-	pool_free(s->poolPackets, p);
+	net_packet_body_t body = p->body;
+	pool_free(p->pool, p);
+	net_packet_body_release(body);
 }
 
 #pragma mark -
@@ -201,51 +267,473 @@ void net_socket_set_receive_block(net_socket_t s, net_socket_receive_block_t rec
 	s->receiveBlock = receiveBlock;
 }
 
+void net_socket_set_receive_inline(net_socket_t s, bool isInline)
+{
+	s->isReceiveInline = isInline;
+}
+
+void net_socket_set_receive_batch_callback(net_socket_t s, void (*receiveBatchCallback)(void *))
+{
+	s->receiveBatchCallback = receiveBatchCallback;
+}
+
+#pragma mark -
+#pragma mark Demux
+
+static __thread volatile int * net_socket_demux_delivering = NULL; // In-flight counter of the entry whose receive block/callback runs on this thread
+static __thread net_socket_receive_block_t net_socket_demux_delivering_block = NULL; // Its receive block if removed while running, released once it returns
+
+// Publishes table (demuxLock held) and frees the previous one once no datagram is classified with it
+static void net_socket_demux_publish(net_socket_t s, net_socket_demux_table_t * table)
+{
+	net_socket_demux_table_t * previous = s->demuxTable;
+	
+	__sync_synchronize(); // Table is written before it's published
+	s->demuxTable = table;
+	__sync_synchronize(); // Published before demuxReaders is checked, net_socket_deliver does the opposite
+	
+	while(s->demuxReaders > 0) // Only the read source classifies, for the time of a few table lookups
+		sched_yield();
+	
+	free(previous);
+}
+
+static net_socket_demux_t net_socket_demux_add(net_socket_t s, uint8_t firstByteMin, uint8_t firstByteMax, net_socket_demux_match_t match, net_socket_demux_entry_t * entry)
+{
+	net_socket_demux_t demux = kNetSocketDemuxNone;
+	
+	pthread_mutex_lock(&s->demuxLock);
+	
+	net_socket_demux_table_t * table = (net_socket_demux_table_t *)malloc(sizeof(net_socket_demux_table_t));
+	if(table)
+	{
+		if(s->demuxTable)
+			memcpy(table, s->demuxTable, sizeof(net_socket_demux_table_t));
+		else
+			memset(table, 0, sizeof(net_socket_demux_table_t));
+		
+		for(unsigned int i=0; i<kNetSocketDemuxMaxProtocols; ++i)
+		{
+			if(!table->entries[i].isRegistered) // Lowest free entry, earlier registrations are matched first
+			{
+				table->entries[i] = *entry;
+				table->entries[i].match = match;
+				table->entries[i].isRegistered = true;
+				
+				for(unsigned int b=firstByteMin; b<=firstByteMax; ++b)
+					table->firstBytes[b] |= (1 << i);
+				
+				demux = i + 1;
+				break;
+			}
+		}
+		
+		if(demux != kNetSocketDemuxNone)
+			net_socket_demux_publish(s, table);
+		else
+			free(table); // Full
+	}
+	
+	pthread_mutex_unlock(&s->demuxLock);
+	
+	return demux;
+}
+
+net_socket_demux_t net_socket_demux_add_callback(net_socket_t s, uint8_t firstByteMin, uint8_t firstByteMax, net_socket_demux_match_t match, void * context, void (*receiveCallback)(void *, net_packet_t))
+{
+	net_socket_demux_entry_t entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.receiveCallback = (void (*)(void *, void *))receiveCallback;
+	entry.receiveCallbackContext = context;
+	
+	return net_socket_demux_add(s, firstByteMin, firstByteMax, match, &entry);
+}
+
+net_socket_demux_t net_socket_demux_add_block(net_socket_t s, uint8_t firstByteMin, uint8_t firstByteMax, net_socket_demux_match_t match, net_socket_receive_block_t receiveBlock)
+{
+	net_socket_demux_entry_t entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.receiveBlock = Block_copy(receiveBlock);
+	
+	net_socket_demux_t demux = net_socket_demux_add(s, firstByteMin, firstByteMax, match, &entry);
+	if(demux == kNetSocketDemuxNone)
+		Block_release(entry.receiveBlock);
+	
+	return demux;
+}
+
+// Publishes a copy of the table with entry i cleared, kept taken if isRemoved. False if entry i isn't registered or allocation fails
+static bool net_socket_demux_clear(net_socket_t s, unsigned int i, bool isRemoved, net_socket_receive_block_t * receiveBlock)
+{
+	bool isCleared = false;
+	
+	pthread_mutex_lock(&s->demuxLock);
+	
+	if(s->demuxTable && s->demuxTable->entries[i].isRegistered && s->demuxTable->entries[i].isRemoved != isRemoved)
+	{
+		net_socket_demux_table_t * table = (net_socket_demux_table_t *)malloc(sizeof(net_socket_demux_table_t));
+		if(table)
+		{
+			memcpy(table, s->demuxTable, sizeof(net_socket_demux_table_t));
+			
+			for(unsigned int b=0; b<256; ++b)
+				table->firstBytes[b] &= ~(1 << i);
+			
+			if(receiveBlock)
+				*receiveBlock = table->entries[i].receiveBlock;
+			memset(&table->entries[i], 0, sizeof(net_socket_demux_entry_t));
+			table->entries[i].isRegistered = isRemoved;
+			table->entries[i].isRemoved = isRemoved;
+			
+			net_socket_demux_publish(s, table);
+			isCleared = true;
+		}
+		else
+		{
+			mNetworkLog("Error allocating socket demux table");
+		}
+	}
+	
+	pthread_mutex_unlock(&s->demuxLock);
+	
+	return isCleared;
+}
+
+void net_socket_demux_remove(net_socket_t s, net_socket_demux_t demux)
+{
+	if(demux == kNetSocketDemuxNone || demux > kNetSocketDemuxMaxProtocols)
+		return;
+	
+	unsigned int i = demux - 1;
+	net_socket_receive_block_t receiveBlock = NULL;
+	
+	if(!net_socket_demux_clear(s, i, true, &receiveBlock)) // No datagram is classified to entry i from here on
+		return;
+	
+	// Wait for the packets already classified, without demuxLock: their receive block/callback may register or remove too
+	int delivering = (net_socket_demux_delivering == &s->demuxInFlight[i]) ? 1 : 0; // Removed from its own receive block/callback
+	while(s->demuxInFlight[i] > delivering)
+		usleep(kNetSocketDemuxRemoveWait);
+	
+	if(receiveBlock && delivering)
+		net_socket_demux_delivering_block = receiveBlock; // Still running
+	else if(receiveBlock)
+		Block_release(receiveBlock);
+	
+	while(!net_socket_demux_clear(s, i, false, NULL)) // Entry i can be taken again
+		usleep(kNetSocketDemuxRemoveWait);
+}
+
 #pragma mark -
 #pragma mark Send
 
+static bool net_socket_paced_push(net_socket_t s, net_packet_t packet)
+{
+	if(s->pacedCount == s->pacedCapacity)
+	{
+		unsigned int capacity = s->pacedCapacity > 0 ? s->pacedCapacity * 2 : kNetSocketPacedCapacity;
+		net_packet_t * pacedPackets = (net_packet_t *)realloc(s->pacedPackets, capacity * sizeof(net_packet_t));
+		if(!pacedPackets)
+			return false; // Sent right away instead
+		s->pacedPackets = pacedPackets;
+		s->pacedCapacity = capacity;
+	}
+	
+	// Sift up, earliest txtime on top
+	unsigned int i = s->pacedCount++;
+	while(i > 0 && s->pacedPackets[(i - 1) / 2]->txtime > packet->txtime)
+	{
+		s->pacedPackets[i] = s->pacedPackets[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	s->pacedPackets[i] = packet;
+	
+	return true;
+}
+
+static net_packet_t net_socket_paced_pop(net_socket_t s)
+{
+	net_packet_t top = s->pacedPackets[0];
+	net_packet_t last = s->pacedPackets[--s->pacedCount];
+	
+	// Sift down the last one from the top
+	unsigned int i = 0;
+	while(true)
+	{
+		unsigned int child = 2 * i + 1;
+		if(child >= s->pacedCount)
+			break;
+		if(child + 1 < s->pacedCount && s->pacedPackets[child + 1]->txtime < s->pacedPackets[child]->txtime)
+			++child;
+		if(s->pacedPackets[child]->txtime >= last->txtime)
+			break;
+		s->pacedPackets[i] = s->pacedPackets[child];
+		i = child;
+	}
+	if(s->pacedCount > 0)
+		s->pacedPackets[i] = last;
+	
+	return top;
+}
+
 void net_socket_send(net_socket_t s, net_packet_t packet)
+{
+	net_socket_send_at(s, packet, 0); // As soon as possible
+}
+
+void net_socket_send_at(net_socket_t s, net_packet_t packet, net_time_t txtime)
 {
 	packet->length = packet->bitstream.offset; // Set packet's length from bitstream current offset
+	packet->txtime = txtime;
 
 	if(packet->length > 0) // Don't queue up empty packets
 	{
-		pool_retain(s->poolPackets, packet); // Retain packet until sendto
+		net_packet_retain(s, packet); // Retain packet until sendto
 
 		dispatch_async(s->socketDispatchQueue, ^{
-		    queue_push(s->pendingPackets, packet); // Queue packet
+			if(txtime == 0 || s->isTxTime || !net_socket_paced_push(s, packet)) // Kernel paces SO_TXTIME packets
+			    queue_push(s->pendingPackets, packet); // Queue packet
 			net_socket_resume_write(s); // Resume. Will not work if already resumed... WEAK
 	    });
 	}
 }
 
+void net_socket_send_batch(net_socket_t s, net_packet_t * packets, unsigned int count)
+{
+	net_packet_t * batch = (net_packet_t *)malloc(count * sizeof(net_packet_t)); // Caller array may not outlive the call
+	if(!batch)
+		return;
+	
+	unsigned int batchCount = 0;
+	for(unsigned int i=0; i<count; ++i)
+	{
+		net_packet_t packet = packets[i];
+		packet->length = packet->bitstream.offset; // Set packet's length from bitstream current offset
+		packet->txtime = 0;
+		
+		if(packet->length > 0) // Don't queue up empty packets
+		{
+			net_packet_retain(s, packet); // Retain packet until sendto
+			batch[batchCount++] = packet;
+		}
+	}
+	
+	dispatch_async(s->socketDispatchQueue, ^{
+		for(unsigned int i=0; i<batchCount; ++i)
+			queue_push(s->pendingPackets, batch[i]); // Queue packets
+		free(batch);
+		if(batchCount > 0)
+			net_socket_resume_write(s); // One write event for the whole batch
+	});
+}
+
 void net_socket_local_addr(net_socket_t s, net_addr_t * addr)
 {
 	net_addr_local(addr);
 	addr->sin_port = s->sockaddr.sin_port;
 }
 
-#pragma mark -
-#pragma mark Socket Info
+size_t net_socket_packet_size(net_socket_t s)
+{
+	return s->packetSize;
+}
 
-void net_socket_copy_info(net_socket_t socket, net_socket_info_s * info)
+NetError net_socket_set_pmtu_probe(net_socket_t s)
 {
-	info->socket = socket;
-	info->receiveCallback = socket->receiveCallback;
-	info->receiveCallbackContext = socket->receiveCallbackContext;
-	info->receiveBlock = socket->receiveBlock;
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE) // Linux: DF bit set, kernel path MTU is ignored and datagrams are never fragmented locally
+	int discover = IP_PMTUDISC_PROBE;
+	if(setsockopt(s->fd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)) == -1)
+		return netErrorPosix(errno);
+	
+	return NetNoError;
+#elif defined(IP_DONTFRAG) // Darwin and BSD: DF bit only
+	int dontfrag = 1;
+	if(setsockopt(s->fd, IPPROTO_IP, IP_DONTFRAG, &dontfrag, sizeof(dontfrag)) == -1)
+		return netErrorPosix(errno);
+	
+	return NetNoError;
+#else
+	return NetOtherError; // Not supported
+#endif
 }
 
-void net_socket_set_info(net_socket_t socket, net_socket_info_s * info)
+NetError net_socket_set_txtime(net_socket_t s)
 {
-	socket->receiveCallback = info->receiveCallback;
-	socket->receiveCallbackContext = info->receiveCallbackContext;
-	socket->receiveBlock = info->receiveBlock;
+#if defined(SO_TXTIME) && defined(__linux__)
+	struct sock_txtime txtime;
+	txtime.clockid = CLOCK_MONOTONIC; // Same clock as net_time_now
+	txtime.flags = 0;
+	if(setsockopt(s->fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == -1)
+		return netErrorPosix(errno);
+	
+	s->isTxTime = 1;
+	return NetNoError;
+#else
+	return NetOtherError; // Not supported, user-space pacing
+#endif
 }
 
 #pragma mark -
 #pragma mark Internal
 
+void net_socket_read(net_socket_t s)
+{
+	net_packet_t * packets = s->receivePackets;
+	size_t lengths[kNetSocketReceiveBatch];
+	unsigned int count = 0, received = 0;
+	
+	for(; count<kNetSocketReceiveBatch; ++count) // Refill buffers handed over on previous read
+	{
+		if(packets[count] == NULL && (packets[count] = net_packet_alloc(s)) == NULL)
+			break;
+	}
+	
+#if defined(__linux__)
+	struct mmsghdr msgs[kNetSocketReceiveBatch];
+	struct iovec iovs[kNetSocketReceiveBatch];
+	memset(msgs, 0, count * sizeof(struct mmsghdr));
+	
+	for(unsigned int i=0; i<count; ++i)
+	{
+		iovs[i].iov_base = packets[i]->data;
+		iovs[i].iov_len = s->packetSize;
+		msgs[i].msg_hdr.msg_name = &packets[i]->addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(packets[i]->addr);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	
+	int result = count > 0 ? recvmmsg(s->fd, msgs, count, MSG_DONTWAIT, NULL) : 0; // Every queued datagram that fits the batch, single system call
+	if(result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		mNetworkLog("Error reading from socket");
+	
+	for(int i=0; i<result; ++i, ++received)
+		lengths[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? s->packetSize + 1 : msgs[i].msg_len;
+#else
+	for(; received<count; ++received)
+	{
+		socklen_t addr_len = sizeof(packets[received]->addr);
+		int read_flags = MSG_TRUNC; // Not standard, won't work in FreeBSD, Mac OS X and other unix systems
+		ssize_t read_bytes = recvfrom(s->fd, (uint8_t *)packets[received]->data, s->packetSize, read_flags, (struct sockaddr *)&packets[received]->addr, &addr_len);
+		
+		if(read_bytes < 0)
+		{
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				mNetworkLog("Error reading from socket");
+			break; // Nothing else queued
+		}
+		
+		lengths[received] = read_bytes;
+	}
+#endif
+	
+	net_time_t time = net_time_now();
+	
+	for(unsigned int i=0; i<received; ++i)
+	{
+		if(lengths[i] == 0) // Empty datagram, buffer is reused
+			continue;
+		
+		if(lengths[i] > s->packetSize) // ALWAYS CHECK: datagram was truncated
+		{
+			mNetworkLog("Error datagram doesn't fit packet size (%lu)", s->packetSize);
+			continue;
+		}
+		
+		net_packet_t packet = packets[i];
+		packets[i] = NULL; // Handed over, refilled on next read
+		
+		packet->length = lengths[i];
+		packet->bitstream.bound = lengths[i]; // Unpacking stops at datagram end
+		packet->time = time;
+		
+		net_socket_deliver(s, packet);
+	}
+	
+	if(received > 0 && s->isReceiveInline && s->receiveBatchCallback)
+		s->receiveBatchCallback(s->receiveCallbackContext);
+}
+
+static void net_socket_deliver_demux(volatile int * inFlight, net_socket_receive_block_t receiveBlock, net_socket_receive_callback_t receiveCallback, net_socket_receive_callback_context_t receiveCallbackContext, net_packet_t packet)
+{
+	volatile int * delivering = net_socket_demux_delivering; // Inline delivery may be nested in another one
+	net_socket_receive_block_t deliveringBlock = net_socket_demux_delivering_block;
+	net_socket_demux_delivering = inFlight;
+	net_socket_demux_delivering_block = NULL;
+	
+	if(receiveBlock)
+		receiveBlock(packet);
+	else
+		receiveCallback(receiveCallbackContext, packet);
+	
+	if(net_socket_demux_delivering_block) // Removed itself
+		Block_release(net_socket_demux_delivering_block);
+	net_socket_demux_delivering = delivering;
+	net_socket_demux_delivering_block = deliveringBlock;
+	__sync_sub_and_fetch(inFlight, 1); // Delivered, a waiting remove may return
+}
+
+void net_socket_deliver(net_socket_t s, net_packet_t packet)
+{
+	// Classify, registered protocols first
+	volatile int * inFlight = NULL;
+	net_socket_receive_block_t receiveBlock = s->receiveBlock;
+	net_socket_receive_callback_t receiveCallback = s->receiveCallback;
+	net_socket_receive_callback_context_t receiveCallbackContext = s->receiveCallbackContext;
+	
+	__sync_add_and_fetch(&s->demuxReaders, 1); // Before the table is loaded, net_socket_demux_publish does the opposite
+	net_socket_demux_table_t * table = s->demuxTable;
+	unsigned int candidates = table ? table->firstBytes[packet->data[0]] : 0;
+	while(candidates)
+	{
+		unsigned int i = __builtin_ctz(candidates);
+		net_socket_demux_entry_t * entry = &table->entries[i];
+		if(entry->match == NULL || entry->match(packet->data, packet->length))
+		{
+			receiveBlock = entry->receiveBlock; // Released by remove, which waits for inFlight
+			receiveCallback = entry->receiveCallback;
+			receiveCallbackContext = entry->receiveCallbackContext;
+			inFlight = &s->demuxInFlight[i];
+			__sync_add_and_fetch(inFlight, 1);
+			break;
+		}
+		candidates &= candidates - 1;
+	}
+	__sync_sub_and_fetch(&s->demuxReaders, 1); // Table is no longer used
+	
+	if(inFlight) // demux
+	{
+		if(s->isReceiveInline)
+			net_socket_deliver_demux(inFlight, receiveBlock, receiveCallback, receiveCallbackContext, packet);
+		else
+			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				net_socket_deliver_demux(inFlight, receiveBlock, receiveCallback, receiveCallbackContext, packet);
+			});
+	}
+	else if(receiveBlock) // block
+	{
+		if(s->isReceiveInline)
+			receiveBlock(packet);
+		else
+			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				receiveBlock(packet);
+			});
+	}
+	else if(receiveCallback) // alternative callback
+	{
+		if(s->isReceiveInline)
+			receiveCallback(receiveCallbackContext, packet);
+		else
+			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				receiveCallback(receiveCallbackContext, packet);
+			});
+	}
+	else
+	{
+		net_packet_free(s, packet); // Nobody to deliver to
+	}
+}
+
 NetError net_socket_set_nonblock(NetError * error, net_socket_t s)
 {
     int flags;
@@ -292,72 +780,70 @@ NetError net_socket_set_dispatch_sources(NetError * error, net_socket_t s)
 
  	// Install the read event handler
     dispatch_source_set_event_handler(s->readDispatchSource, ^{
-		// Allocate packet
-		net_packet_t packet = net_packet_alloc(s);
-		
-		if(packet)
-		{
-	        // Datagram source address length
-	        socklen_t addr_len = sizeof(packet->addr);
-
-	        // Read into data 
-			int read_flags = MSG_TRUNC; // Not standard, won't work in FreeBSD, Mac OS X and other unix systems
-	        ssize_t read_bytes = recvfrom(s->fd, (uint8_t *)packet->data, kNetPacketMaxLen, read_flags, (struct sockaddr *)&packet->addr, &addr_len);
-	        //mNetworkLog("recvfrom %lu", read_bytes);
-        
-	        if(read_bytes > 0) // Successfull
-	        {
-				if(read_bytes <= kNetPacketMaxLen) // ALWAYS CHECK: read_bytes will return the size of datagram received, even when truncated (MSG_TRUNC)
-				{
-					packet->length = read_bytes;
-
-					if(s->receiveBlock) // block
-					{
-						dispatch_async(globalQueue, ^{
-							s->receiveBlock(packet);
-						});
-					}
-					else if(s->receiveCallback) // alternative callback
-					{
-						dispatch_async(globalQueue, ^{
-	                        s->receiveCallback(s->receiveCallbackContext, packet);
-						});
-					}
-				}
-				else
-				{
-					mNetworkLog("Error read_bytes (%lu) doesn't fit kNetPacketMaxLen", read_bytes);
-					net_packet_free(s, packet); // Release packet
-				}
-	        }
-	        else if(read_bytes < 0) // Error
-	        {
-				mNetworkLog("Error reading from socket");
-				net_packet_free(s, packet); // Release packet
-	        }
-		}
+		net_socket_read(s);
     });
     
     // Install the write event handler
     dispatch_source_set_event_handler(s->writeDispatchSource, ^{
 		// Pending packet
         net_packet_t packet = NULL;	
-		// Loop over pendingPackets
+		// Loop over pendingPackets, not paced, kNetSocketSendBatch at a time
+		net_packet_t batch[kNetSocketSendBatch];
+		unsigned int count = 0;
         while ((packet = (net_packet_t)queue_pop(s->pendingPackets))) 
 		{	
-            ssize_t write_bytes = sendto(s->fd, packet->data, packet->length, 0, (struct sockaddr *)&packet->addr, sizeof(packet->addr));
-            
-            if(write_bytes < 0) // Error
-            {
-		        mNetworkLog("Error writing to socket");
-            }
-            
-			pool_release(s->poolPackets, packet); // Release, not free. Ownership belongs to outside scope
+			batch[count++] = packet;
+			if(count == kNetSocketSendBatch)
+			{
+				net_socket_write_batch(s, batch, count);
+				count = 0;
+			}
         }
+		if(count > 0)
+			net_socket_write_batch(s, batch, count);
+		
+		// Paced packets which are due, earliest txtime first
+		net_time_t now = net_time_now();
+		while (s->pacedCount > 0)
+		{
+			packet = s->pacedPackets[0];
+			if(packet->txtime > now + kNetSocketPacingSlack) // Not due yet
+			{
+				net_socket_schedule_write(s, packet->txtime - now);
+				break;
+			}
+			
+			net_socket_paced_pop(s);
+			
+			if(net_socket_write(s, packet) < 0) // Error
+			{
+				mNetworkLog("Error writing to socket");
+			}
+			
+			net_packet_release(s, packet);
+		}
 
 		net_socket_suspend_write(s); // Suspend until there's something more to send WEAK
     });
     
+    // Create pacing timer source and attach to socketDispatchQueue
+    s->pacingDispatchSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, s->socketDispatchQueue);
+    
+    // Failed to create pacing dispatch source
+    if(!s->pacingDispatchSource)
+    {
+      	netErrorSet(error, NetSockError);
+        return NetSockError;
+    }
+    
+    // Install the pacing event handler
+    dispatch_source_set_event_handler(s->pacingDispatchSource, ^{
+		net_socket_resume_write(s); // Next packet is due
+    });
+    
+    dispatch_source_set_timer(s->pacingDispatchSource, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0); // Armed by net_socket_schedule_write
+    dispatch_resume(s->pacingDispatchSource);
+    
     // Socket retain count by read and write dispatch sources
     // Socket's file descriptor socketIPv4 can be closed when socketIPv4RetainCount = 0
     __block int socketCloseRetainCount = 2;
@@ -404,4 +890,97 @@ void net_socket_resume_write(net_socket_t s)
 		s->isSending = 1;
 		dispatch_resume(s->writeDispatchSource); 
 	}
-}
\ No newline at end of file
+}
+
+void net_socket_schedule_write(net_socket_t s, net_time_t delay)
+{
+	dispatch_source_set_timer(s->pacingDispatchSource, dispatch_time(DISPATCH_TIME_NOW, delay), DISPATCH_TIME_FOREVER, kNetSocketPacingSlack);
+}
+
+#define kNetSocketControlLen CMSG_SPACE(sizeof(uint64_t)) // SCM_TXTIME
+
+// Fills msg for packet, iov holds 2 and control kNetSocketControlLen bytes
+static void net_socket_message(net_socket_t s, net_packet_t packet, struct msghdr * msg, struct iovec * iov, uint8_t * control)
+{
+	// Packet data, followed by shared body
+	iov[0].iov_base = packet->data;
+	iov[0].iov_len = packet->length;
+	if(packet->body)
+	{
+		iov[1].iov_base = packet->body->data;
+		iov[1].iov_len = packet->body->length;
+	}
+	
+	memset(msg, 0, sizeof(struct msghdr));
+	msg->msg_name = &packet->addr;
+	msg->msg_namelen = sizeof(packet->addr);
+	msg->msg_iov = iov;
+	msg->msg_iovlen = packet->body ? 2 : 1;
+	
+#if defined(SO_TXTIME) && defined(__linux__)
+	if(s->isTxTime && packet->txtime > 0) // Kernel pacing, txtime as control message
+	{
+		memset(control, 0, kNetSocketControlLen);
+		msg->msg_control = control;
+		msg->msg_controllen = kNetSocketControlLen;
+		
+		struct cmsghdr * cmsg = CMSG_FIRSTHDR(msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_TXTIME;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+		uint64_t txtime = packet->txtime;
+		memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+	}
+#endif
+}
+
+ssize_t net_socket_write(net_socket_t s, net_packet_t packet)
+{
+	bool isKernelPaced = s->isTxTime && packet->txtime > 0;
+	
+	if(packet->body == NULL && !isKernelPaced) // Single buffer
+		return sendto(s->fd, packet->data, packet->length, 0, (struct sockaddr *)&packet->addr, sizeof(packet->addr));
+	
+	struct iovec iov[2];
+	struct msghdr msg;
+	uint8_t control[kNetSocketControlLen];
+	net_socket_message(s, packet, &msg, iov, control);
+	
+	return sendmsg(s->fd, &msg, 0);
+}
+
+void net_socket_write_batch(net_socket_t s, net_packet_t * packets, unsigned int count)
+{
+#if defined(__linux__)
+	struct mmsghdr msgs[kNetSocketSendBatch];
+	struct iovec iovs[kNetSocketSendBatch][2];
+	uint8_t controls[kNetSocketSendBatch][kNetSocketControlLen];
+	
+	for(unsigned int i=0; i<count; ++i)
+	{
+		net_socket_message(s, packets[i], &msgs[i].msg_hdr, iovs[i], controls[i]);
+		msgs[i].msg_len = 0;
+	}
+	
+	unsigned int sent = 0;
+	while(sent < count)
+	{
+		int result = sendmmsg(s->fd, &msgs[sent], count - sent, 0);
+		if(result <= 0) // Error, first packet left is dropped as a single write would
+		{
+			mNetworkLog("Error writing to socket");
+			result = 1;
+		}
+		sent += result;
+	}
+#else
+	for(unsigned int i=0; i<count; ++i)
+	{
+		if(net_socket_write(s, packets[i]) < 0) // Error
+			mNetworkLog("Error writing to socket");
+	}
+#endif
+	
+	for(unsigned int i=0; i<count; ++i)
+		net_packet_release(s, packets[i]); // Release, not free. Ownership belongs to outside scope
+}
@@ -33,6 +33,7 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <string.h>
+#include <pthread.h>
 #include <Block.h> // Required for socket receive "callback" (read source events)
 
 #include "queue.h"
@@ -42,6 +43,10 @@
 #include "net_packet.h"
 
 #define kNetPacketPoolCapacity 64
+#define kNetSocketReceiveBatch 16 // Datagrams read per read source event (recvmmsg on Linux), buffers are kept by the socket
+#define kNetSocketSendBatch 16 // Queued datagrams written per system call (sendmmsg on Linux)
+#define kNetSocketPacingSlack (200 * kNetTimeMicrosecond) // Paced packets due within 200 us are sent right away
+#define kNetSocketPacedCapacity 64 // Initial paced packets heap capacity, doubles when full
 
 typedef void (^net_socket_receive_block_t)(net_packet_t);
 typedef void (*net_socket_receive_callback_t)(void *, void *);
@@ -51,48 +56,98 @@ struct StunStruct;
 
 typedef struct StunStruct * stun_t;
 
+/*!
+ * Demultiplexer
+ *
+ * Protocols sharing a socket (transaction, stream, STUN, ...) register the range of datagram first bytes they
+ * claim, plus an optional match function for a deeper check (e.g. STUN magic cookie). Each datagram is classified
+ * once on the read source: the first byte indexes a table with the candidate protocols, the first one that matches
+ * gets the packet. Datagrams no protocol claims go to the socket receive block/callback.
+ */
+
+#define kNetSocketDemuxMaxProtocols 8 // Protocols registered at once, one bit each in the first byte table
+#define kNetSocketDemuxNone 0 // Not registered
+#define kNetSocketDemuxRemoveWait 100 // Microseconds between checks while remove waits for packets being delivered
+
+typedef unsigned int net_socket_demux_t; // Registered protocol handle
+
+typedef bool (*net_socket_demux_match_t)(const uint8_t * data, size_t length); // Datagram starts with a claimed first byte, length >= 1
+
+typedef struct {
+	net_socket_demux_match_t match; // NULL accepts every datagram with a claimed first byte
+	net_socket_receive_callback_t receiveCallback;
+	net_socket_receive_callback_context_t receiveCallbackContext;
+	net_socket_receive_block_t receiveBlock; // Copied on register, released on remove
+	bool isRegistered;
+	bool isRemoved; // Still taken until the packets classified to it are delivered
+} net_socket_demux_entry_t;
+
+typedef struct {
+	uint8_t firstBytes[256]; // Datagram first byte -> bitmask of entries claiming it, lowest bit first
+	net_socket_demux_entry_t entries[kNetSocketDemuxMaxProtocols];
+} net_socket_demux_table_t; // Immutable once published, register/remove publish a new copy
+
 struct net_socket_s {
 	int fd;
 	net_addr_t sockaddr;
 	
 	dispatch_source_t readDispatchSource; // DISPATCH_SOURCE_TYPE_READ for socket file descriptor
     dispatch_source_t writeDispatchSource; // DISPATCH_SOURCE_TYPE_WRITE for socket file descriptor
+    dispatch_source_t pacingDispatchSource; // DISPATCH_SOURCE_TYPE_TIMER used to resume write when next packet is due (user-space pacing)
 	dispatch_queue_t socketDispatchQueue;
 	
 	int isSending;
+	int isTxTime; // SO_TXTIME enabled, packet txtime is handed to the kernel (fq qdisc paces)
 	
-	queue_t pendingPackets;
+	queue_t pendingPackets; // Sent as soon as possible, in order
+	net_packet_t * pacedPackets; // User-space pacing, min-heap by txtime (pacedCount of pacedCapacity)
+	unsigned int pacedCount;
+	unsigned int pacedCapacity;
 	pool_t poolPackets;
+	size_t packetSize; // Packet size class, capacity of every packet in poolPackets (<= kNetPacketMaxLen)
 	
 	net_socket_receive_callback_t receiveCallback;
 	net_socket_receive_callback_context_t receiveCallbackContext;
 	net_socket_receive_block_t receiveBlock;
+	bool isReceiveInline; // Receive block/callback runs on the read source, no dispatch per datagram
+	void (*receiveBatchCallback)(void *); // Called with receiveCallbackContext once a read batch is delivered
+	net_packet_t receivePackets[kNetSocketReceiveBatch]; // Read buffers, only used by the read source
+	
+	pthread_mutex_t demuxLock; // Serializes protocols registering/removing, datagrams are classified without it
+	net_socket_demux_table_t * volatile demuxTable; // Published table, NULL until the first registration
+	volatile int demuxReaders; // Datagrams being classified with the published table, the old one is freed once 0
+	volatile int demuxInFlight[kNetSocketDemuxMaxProtocols]; // Packets classified to each entry and not yet delivered
 };
 
 typedef struct net_socket_s * net_socket_t;
 
-net_socket_t net_socket_create(NetError * error, int domain, const char * host, const int port);
+net_socket_t net_socket_create(NetError * error, int domain, const char * host, const int port); // Uses kNetPacketDefaultLen packet size class
+net_socket_t net_socket_create_size(NetError * error, int domain, const char * host, const int port, size_t packetSize);
 void net_socket_destroy(net_socket_t s);
 
+size_t net_socket_packet_size(net_socket_t s); // Packet size class, max. datagram length that can be sent or received
+NetError net_socket_set_pmtu_probe(net_socket_t s); // Set DF bit and ignore kernel path MTU cache, required to probe path MTU from user-space
+NetError net_socket_set_txtime(net_socket_t s); // Hand packet txtime to the kernel (SO_TXTIME), only effective if egress interface uses fq qdisc
+
 net_packet_t net_packet_alloc(net_socket_t s); // Caller assumes ownership for allocated net_packet_t
+net_packet_t net_packet_alloc_pool(net_socket_t s, pool_t pool); // Same, allocated from a pool created with net_packet_pool_create
+pool_t net_packet_pool_create(net_socket_t s, size_t capacity); // Packet pool of socket's size class, e.g. one per thread. Destroy with pool_destroy once no packet is in flight
 void net_packet_free(net_socket_t s, net_packet_t p); // Should be used with CAUTION, will free net_packet_t
 void net_packet_retain(net_socket_t s, net_packet_t p); // Retain packet
 void net_packet_release(net_socket_t s, net_packet_t p); // Preferred way of releasing a net_packet_t when no longer needed
 
 void net_socket_set_receive_callback(net_socket_t s, void *, void (*receiveCallback)(void *, net_packet_t));
 void net_socket_set_receive_block(net_socket_t, net_socket_receive_block_t);
+void net_socket_set_receive_inline(net_socket_t, bool); // Receive blocks/callbacks (demux included) run on the socket read source, in datagram order. They must not block
+void net_socket_set_receive_batch_callback(net_socket_t, void (*receiveBatchCallback)(void *)); // Inline receive only, runs on the read source after the last datagram of each read batch, e.g. to send replies at once
+
+net_socket_demux_t net_socket_demux_add_callback(net_socket_t s, uint8_t firstByteMin, uint8_t firstByteMax, net_socket_demux_match_t match, void *, void (*receiveCallback)(void *, net_packet_t)); // kNetSocketDemuxNone if table is full
+net_socket_demux_t net_socket_demux_add_block(net_socket_t s, uint8_t firstByteMin, uint8_t firstByteMax, net_socket_demux_match_t match, net_socket_receive_block_t);
+void net_socket_demux_remove(net_socket_t s, net_socket_demux_t); // Does nothing for kNetSocketDemuxNone. Returns once packets already classified have been delivered (but the one being delivered, when called from its receive block/callback), its context can be freed then
 
 void net_socket_send(net_socket_t s, net_packet_t packet);
+void net_socket_send_at(net_socket_t s, net_packet_t packet, net_time_t txtime); // Paced, packet is sent at txtime (monotonic)
+void net_socket_send_batch(net_socket_t s, net_packet_t * packets, unsigned int count); // Queued at once and sent in a single write burst, caller keeps its references
 void net_socket_local_addr(net_socket_t s, net_addr_t * addr);
 
-typedef struct {
-	net_socket_t socket;
-	net_socket_receive_callback_t receiveCallback;
-	net_socket_receive_callback_context_t receiveCallbackContext;
-	net_socket_receive_block_t receiveBlock;
-} net_socket_info_s;
-
-void net_socket_copy_info(net_socket_t socket, net_socket_info_s * info); // Copies net_socket callback info to net_socket_info_s
-void net_socket_set_info(net_socket_t socket, net_socket_info_s * info); // Sets back net_socket_info_s callback info to net_socket
-
 #endif
\ No newline at end of file
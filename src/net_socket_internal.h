@@ -28,6 +28,12 @@ static NetError net_socket_set_dispatch_sources(NetError * error, net_socket_t s
 
 static void net_socket_suspend_write(net_socket_t s);
 static void net_socket_resume_write(net_socket_t s);
+static void net_socket_schedule_write(net_socket_t s, net_time_t delay); // Resume write after delay (user-space pacing)
+static ssize_t net_socket_write(net_socket_t s, net_packet_t packet);
+static void net_socket_write_batch(net_socket_t s, net_packet_t * packets, unsigned int count); // Up to kNetSocketSendBatch packets, single system call (sendmmsg on Linux)
+
+static void net_socket_read(net_socket_t s); // Read source event, up to kNetSocketReceiveBatch datagrams
+static void net_socket_deliver(net_socket_t s, net_packet_t packet); // Classify and hand over (demux, then socket receive block/callback)
 
 static void net_socket_destroy_async(net_socket_t s); // Asynchronous method called when both read+write dispatch sources cancel handlers are done
 
@@ -0,0 +1,45 @@
+/*
+ 
+ net_time.c
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#include "net_time.h"
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+net_time_t net_time_now(void)
+{
+#if defined(__APPLE__)
+	static mach_timebase_info_data_t timebase;
+	if(timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (net_time_t)ts.tv_sec * kNetTimeSecond + (net_time_t)ts.tv_nsec;
+#endif
+}
@@ -0,0 +1,45 @@
+/*
+ 
+ net_time.h
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#ifndef __universal_network_net_time_h__
+#define __universal_network_net_time_h__
+
+#include <stdint.h>
+
+/*!
+ * @typedef net_time_t
+ * @abstract Monotonic time in nanoseconds
+ * @discussion
+ * Origin is arbitrary (system boot on most platforms), only differences are meaningful
+ */
+typedef uint64_t net_time_t;
+
+#define kNetTimeSecond 1000000000ULL
+#define kNetTimeMillisecond 1000000ULL
+#define kNetTimeMicrosecond 1000ULL
+
+#define mNetTimeToSeconds(time) ((double)(time) / (double)kNetTimeSecond)
+#define mNetTimeFromSeconds(seconds) ((net_time_t)((seconds) * (double)kNetTimeSecond))
+
+net_time_t net_time_now(void);
+
+#endif
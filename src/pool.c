@@ -28,6 +28,8 @@ struct pool_s {
 	
 	pool_node_t freeList;
 	unsigned int allocCount;
+	
+	pthread_mutex_t lock; // Objects may be allocated and released from different threads
 };
 
 #define mAddressDoesNotBelongsToPool(Address, Pool) ((Address < Pool->memblock) || (Address >= Pool->membound))
@@ -83,6 +85,8 @@ pool_t pool_create(size_t sizeObject, size_t capacity)
 		p->membound = p->memblock + memsize; // End memory address bound (does not belong to pool)
 		
 		pool_weave_freelist(p); // Weave nodes in list
+		
+		pthread_mutex_init(&p->lock, NULL);
 	}
 
 	return p;
@@ -92,6 +96,7 @@ void pool_destroy(pool_t p)
 {
 	if(p)
 	{
+		pthread_mutex_destroy(&p->lock);
 		free(p->memblock);
 		free(p);
 	}
@@ -104,8 +109,13 @@ size_t pool_capacity(pool_t p)
 
 void * pool_alloc(pool_t p)
 {
+	pthread_mutex_lock(&p->lock);
+	
 	if(p->freeList == NULL)
+	{
+		pthread_mutex_unlock(&p->lock);
 		return NULL; // Pool is out of space
+	}
 	
 	pool_node_t allocNode = p->freeList; // Remove from free list
 	p->freeList = allocNode->next; // Update free list
@@ -114,6 +124,8 @@ void * pool_alloc(pool_t p)
 
 	++p->allocCount; // Increase alloc count
 	
+	pthread_mutex_unlock(&p->lock);
+	
 	return allocNode->object;
 }
 
@@ -129,7 +141,10 @@ void pool_retain(pool_t p, void * object)
 		return; // Object's memory address doesn't belong to pool
 		
 	pool_node_t retainNode = (pool_node_t)(addrObject + p->sizeObject); // Retrieve node
+	
+	pthread_mutex_lock(&p->lock);
 	++retainNode->retainCount; // Increase retain count
+	pthread_mutex_unlock(&p->lock);
 }
 
 void pool_free_node(pool_t p, pool_node_t node) // Internal
@@ -153,24 +168,32 @@ void pool_free(pool_t p, void * object)
 		return; // Object's memory address doesn't belong to pool
 		
 	pool_node_t freeNode = (pool_node_t)(addrObject + p->sizeObject); // Retrieve node
+	
+	pthread_mutex_lock(&p->lock);
 	pool_free_node(p, freeNode);
+	pthread_mutex_unlock(&p->lock);
 }
 
-void pool_release(pool_t p, void * object)
+unsigned int pool_release(pool_t p, void * object)
 {
 	if(p->allocCount == 0)
-		return; // Pool doesn't have any allocated nodes. Object doesn't belong to this pool...
+		return 0; // Pool doesn't have any allocated nodes. Object doesn't belong to this pool...
 
 	// Convert object's address for arithmetic manipulation
 	uint8_t * addrObject = (uint8_t *)object;
 	
 	if(mAddressDoesNotBelongsToPool(addrObject, p))
-		return; // Object's memory address doesn't belong to pool
+		return 0; // Object's memory address doesn't belong to pool
 		
 	pool_node_t releaseNode = (pool_node_t)(addrObject + p->sizeObject); // Retrieve node
 	
-	if((--releaseNode->retainCount) == 0) // Decrease retain count
+	pthread_mutex_lock(&p->lock);
+	unsigned int retainCount = --releaseNode->retainCount; // Decrease retain count
+	if(retainCount == 0)
 		pool_free_node(p, releaseNode); // Free if retain count reaches 0
+	pthread_mutex_unlock(&p->lock);
+	
+	return retainCount;
 }
 
 int debug_pool_free_count(pool_t p)
@@ -178,12 +201,14 @@ int debug_pool_free_count(pool_t p)
 	int freeCount = 0;
 	pool_node_t iter;
 	
+	pthread_mutex_lock(&p->lock);
 	iter = p->freeList; // free
 	while(iter != NULL) 
 	{
 		iter = iter->next;
 		++freeCount;
 	}
+	pthread_mutex_unlock(&p->lock);
 	
 	return freeCount;	
 }
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #define kPoolDefaultCapacity 32
 
@@ -26,7 +27,7 @@ void * pool_alloc(pool_t p);
 void pool_free(pool_t p, void * object);
 
 void pool_retain(pool_t p, void * object);
-void pool_release(pool_t p, void * object);
+unsigned int pool_release(pool_t p, void * object); // Remaining retain count, 0 once freed
 
 int debug_pool_free_count(pool_t p);
 int debug_pool_alloc_count(pool_t p);
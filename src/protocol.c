@@ -32,4 +32,19 @@ UnpackResult protocolUnpackHeader(bitstream_t * bitstream, ProtocolId protocolId
 		return UnpackInvalid;
 	
 	return UnpackValid;
-}
\ No newline at end of file
+}
+
+static inline bool protocolIsType(const uint8_t * data, size_t length, ProtocolType protocolType)
+{
+	return length >= kProtocolHeaderLength && data[0] == kProtocolDefaultId && data[1] == kProtocolDefaultVersion && data[2] == protocolType;
+}
+
+bool protocolIsTransaction(const uint8_t * data, size_t length)
+{
+	return protocolIsType(data, length, ProtocolTypeTransaction);
+}
+
+bool protocolIsStream(const uint8_t * data, size_t length)
+{
+	return protocolIsType(data, length, ProtocolTypeStream);
+}
@@ -74,4 +74,9 @@ typedef enum {
 void protocolPackHeader(bitstream_t * bitstream, ProtocolId, ProtocolVersion, ProtocolType);
 UnpackResult protocolUnpackHeader(bitstream_t * bitstream, ProtocolId, ProtocolVersion, ProtocolType);
 
+#define kProtocolHeaderLength 3 // Id, version and type
+
+bool protocolIsTransaction(const uint8_t * data, size_t length); // Socket demux match, registered for first byte kProtocolDefaultId
+bool protocolIsStream(const uint8_t * data, size_t length); // Same
+
 #endif
\ No newline at end of file
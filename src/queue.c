@@ -117,6 +117,14 @@ queue_object_t queue_pop(queue_t q)
 	return pop_queue_object;
 }
 
+queue_object_t queue_peek(queue_t q)
+{
+	if(q->head == NULL)
+		return NULL;
+	
+	return q->head->object;
+}
+
 int debug_queue_enqueued_count(queue_t q)
 {
 	int enqueued_count = 0;
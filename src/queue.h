@@ -23,6 +23,7 @@ bool queue_is_empty(queue_t q);
 
 void queue_push(queue_t q, queue_object_t o);
 queue_object_t queue_pop(queue_t q);
+queue_object_t queue_peek(queue_t q); // Head object, without removing it
 
 int debug_queue_enqueued_count(queue_t q);
 int debug_queue_reserved_count(queue_t q);
@@ -0,0 +1,188 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* sha1.c
+* universal-network-c
+*/
+
+#include "sha1.h"
+
+#define mSha1Rotate(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_compress(uint32_t state[5], const uint8_t block[kSha1BlockLength])
+{
+	uint32_t w[80];
+	
+	for(int t=0; t<16; ++t)
+		w[t] = ((uint32_t)block[4*t] << 24) | ((uint32_t)block[4*t+1] << 16) | ((uint32_t)block[4*t+2] << 8) | block[4*t+3];
+	for(int t=16; t<80; ++t)
+		w[t] = mSha1Rotate(w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16], 1);
+	
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	
+	for(int t=0; t<80; ++t)
+	{
+		uint32_t f, k;
+		if(t < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if(t < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if(t < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		
+		uint32_t temp = mSha1Rotate(a, 5) + f + e + k + w[t];
+		e = d;
+		d = c;
+		c = mSha1Rotate(b, 30);
+		b = a;
+		a = temp;
+	}
+	
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void sha1_init(sha1_t * sha1)
+{
+	sha1->state[0] = 0x67452301;
+	sha1->state[1] = 0xEFCDAB89;
+	sha1->state[2] = 0x98BADCFE;
+	sha1->state[3] = 0x10325476;
+	sha1->state[4] = 0xC3D2E1F0;
+	sha1->length = 0;
+	sha1->blockLength = 0;
+}
+
+void sha1_update(sha1_t * sha1, const uint8_t * data, size_t length)
+{
+	sha1->length += length;
+	
+	if(sha1->blockLength > 0) // Fill partial block first
+	{
+		size_t fill = kSha1BlockLength - sha1->blockLength;
+		if(fill > length)
+			fill = length;
+		
+		memcpy(&sha1->block[sha1->blockLength], data, fill);
+		sha1->blockLength += fill;
+		data += fill;
+		length -= fill;
+		
+		if(sha1->blockLength < kSha1BlockLength)
+			return;
+		
+		sha1_compress(sha1->state, sha1->block);
+		sha1->blockLength = 0;
+	}
+	
+	for(; length >= kSha1BlockLength; data += kSha1BlockLength, length -= kSha1BlockLength) // Whole blocks, no copy
+		sha1_compress(sha1->state, data);
+	
+	memcpy(sha1->block, data, length);
+	sha1->blockLength = length;
+}
+
+void sha1_final(sha1_t * sha1, uint8_t digest[kSha1DigestLength])
+{
+	uint64_t bits = sha1->length * 8;
+	
+	// Padding, 0x80 then zeroes up to the 64 bit length
+	sha1->block[sha1->blockLength++] = 0x80;
+	if(sha1->blockLength > kSha1BlockLength - 8)
+	{
+		memset(&sha1->block[sha1->blockLength], 0, kSha1BlockLength - sha1->blockLength);
+		sha1_compress(sha1->state, sha1->block);
+		sha1->blockLength = 0;
+	}
+	memset(&sha1->block[sha1->blockLength], 0, kSha1BlockLength - 8 - sha1->blockLength);
+	for(int i=0; i<8; ++i)
+		sha1->block[kSha1BlockLength - 1 - i] = (uint8_t)(bits >> (8 * i));
+	sha1_compress(sha1->state, sha1->block);
+	
+	for(int i=0; i<5; ++i)
+	{
+		digest[4*i] = (uint8_t)(sha1->state[i] >> 24);
+		digest[4*i+1] = (uint8_t)(sha1->state[i] >> 16);
+		digest[4*i+2] = (uint8_t)(sha1->state[i] >> 8);
+		digest[4*i+3] = (uint8_t)sha1->state[i];
+	}
+}
+
+void hmac_sha1_key_init(hmac_sha1_key_t * key, const uint8_t * data, size_t length)
+{
+	uint8_t block[kSha1BlockLength];
+	memset(block, 0, kSha1BlockLength);
+	
+	if(length > kSha1BlockLength)
+	{
+		sha1_t sha1;
+		sha1_init(&sha1);
+		sha1_update(&sha1, data, length);
+		sha1_final(&sha1, block);
+	}
+	else
+	{
+		memcpy(block, data, length);
+	}
+	
+	sha1_t sha1;
+	uint8_t pad[kSha1BlockLength];
+	
+	for(int i=0; i<kSha1BlockLength; ++i)
+		pad[i] = block[i] ^ 0x36;
+	sha1_init(&sha1);
+	sha1_compress(sha1.state, pad);
+	memcpy(key->inner, sha1.state, sizeof(key->inner));
+	
+	for(int i=0; i<kSha1BlockLength; ++i)
+		pad[i] = block[i] ^ 0x5c;
+	sha1_init(&sha1);
+	sha1_compress(sha1.state, pad);
+	memcpy(key->outer, sha1.state, sizeof(key->outer));
+}
+
+void hmac_sha1_init(const hmac_sha1_key_t * key, sha1_t * sha1)
+{
+	// Inner hash, resumed after the key block
+	memcpy(sha1->state, key->inner, sizeof(sha1->state));
+	sha1->length = kSha1BlockLength;
+	sha1->blockLength = 0;
+}
+
+void hmac_sha1_final(const hmac_sha1_key_t * key, sha1_t * sha1, uint8_t digest[kSha1DigestLength])
+{
+	sha1_final(sha1, digest);
+	
+	// Outer hash
+	memcpy(sha1->state, key->outer, sizeof(sha1->state));
+	sha1->length = kSha1BlockLength;
+	sha1->blockLength = 0;
+	sha1_update(sha1, digest, kSha1DigestLength);
+	sha1_final(sha1, digest);
+}
+
+void hmac_sha1(const hmac_sha1_key_t * key, const uint8_t * data, size_t length, uint8_t digest[kSha1DigestLength])
+{
+	sha1_t sha1;
+	hmac_sha1_init(key, &sha1);
+	sha1_update(&sha1, data, length);
+	hmac_sha1_final(key, &sha1, digest);
+}
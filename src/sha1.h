@@ -0,0 +1,51 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* sha1.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_sha1_h__
+#define __universal_network_sha1_h__
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*!
+ * @header
+ *
+ * SHA-1 (FIPS 180-4) and HMAC-SHA1 (RFC 2104), as used by STUN MESSAGE-INTEGRITY.
+ *
+ * hmac_sha1_key_t is the key schedule: the states after compressing the inner (key ^ ipad) and outer (key ^ opad)
+ * blocks. It is computed once per key, each message then costs the compressions of its own data plus one for the
+ * outer hash, instead of two more per message.
+ */
+
+#define kSha1DigestLength 20
+#define kSha1BlockLength 64
+
+typedef struct {
+	uint32_t state[5];
+	uint64_t length; // Bytes hashed
+	uint8_t block[kSha1BlockLength]; // Partial block
+	size_t blockLength;
+} sha1_t;
+
+void sha1_init(sha1_t *);
+void sha1_update(sha1_t *, const uint8_t * data, size_t length);
+void sha1_final(sha1_t *, uint8_t digest[kSha1DigestLength]);
+
+typedef struct {
+	uint32_t inner[5]; // State after key ^ ipad
+	uint32_t outer[5]; // State after key ^ opad
+} hmac_sha1_key_t;
+
+void hmac_sha1_key_init(hmac_sha1_key_t *, const uint8_t * key, size_t length); // Keys longer than a block are hashed first
+void hmac_sha1(const hmac_sha1_key_t *, const uint8_t * data, size_t length, uint8_t digest[kSha1DigestLength]);
+
+void hmac_sha1_init(const hmac_sha1_key_t *, sha1_t *); // Incremental, message data with sha1_update
+void hmac_sha1_final(const hmac_sha1_key_t *, sha1_t *, uint8_t digest[kSha1DigestLength]);
+
+#endif
@@ -9,22 +9,79 @@
 #include "stream.h"
 #include "stream_internal.h"
 
-#define kStreamListCapacity 5
+static int streamShardQueueKey; // Queue specific, shard of current queue
 
 #pragma mark -
 #pragma mark Setup
 
+static void streamShardSetup(StreamConfiguration * config, StreamShard * shard, unsigned int index)
+{
+	shard->config = config;
+	shard->index = index;
+	
+	// Dispatch queue, knows its shard
+	shard->streamDispatchQueue = dispatch_queue_create("com.laugga.streamDispatchQueue", NULL);
+	dispatch_queue_set_specific(shard->streamDispatchQueue, &streamShardQueueKey, shard, NULL);
+	
+	// Dispatch timer, suspended until the shard has at least one stream
+	shard->streamDispatchTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, shard->streamDispatchQueue);    
+    dispatch_source_set_timer(shard->streamDispatchTimer, dispatch_time(DISPATCH_TIME_NOW, 0), kStreamTimerUpdateInterval * NSEC_PER_SEC, kStreamTimerUpdateInterval * NSEC_PER_SEC);
+	dispatch_set_context(shard->streamDispatchTimer, shard);    
+	dispatch_source_set_event_handler_f(shard->streamDispatchTimer, &streamTimerCallback);
+	shard->active = false;
+	
+	// Dispatch timer (jitter buffer), disarmed until a snapshot is buffered
+	shard->jitterDispatchTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, shard->streamDispatchQueue);
+	dispatch_source_set_timer(shard->jitterDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+	dispatch_set_context(shard->jitterDispatchTimer, shard);
+	dispatch_source_set_event_handler_f(shard->jitterDispatchTimer, &streamJitterTimerCallback);
+	dispatch_resume(shard->jitterDispatchTimer);
+	shard->jitterTimerTime = 0;
+	shard->logAccumulator = 0.0f;
+	
+	// Stream table and update wheel, one tick per timer interval
+	shard->table = (Stream **)calloc(kStreamShardTableCapacity, sizeof(Stream *));
+	shard->tableMask = kStreamShardTableCapacity - 1;
+	shard->count = 0;
+	shard->dueStreams = (Stream **)calloc(kStreamShardTableCapacity, sizeof(Stream *));
+	shard->dueCount = 0;
+	shard->updateWheel = timer_wheel_create(mNetTimeFromSeconds(kStreamTimerUpdateInterval), kTimerWheelDefaultSlots, net_time_now());
+	
+	// Packet pool
+	shard->poolPackets = net_packet_pool_create(config->socket, kStreamShardPoolCapacity);
+	
+	// No channels by default, update data is a single object
+	streamChannelsClear(&shard->channels);
+}
+
 NetError streamSetup(StreamConfiguration * config, const unsigned int port, void * context, StreamUpdateCallback updateCallback, StreamReceiveCallback receiveCallback, StreamTimeoutCallback timeoutCallback, StreamSuspendCallback suspendCallback)
+{
+	return streamSetupShards(config, port, 1, context, updateCallback, receiveCallback, timeoutCallback, suspendCallback);
+}
+
+NetError streamSetupShards(StreamConfiguration * config, const unsigned int port, const unsigned int shardCount, void * context, StreamUpdateCallback updateCallback, StreamReceiveCallback receiveCallback, StreamTimeoutCallback timeoutCallback, StreamSuspendCallback suspendCallback)
 {	
+	if(shardCount == 0 || shardCount > kStreamShardMax) // Check shards
+	{
+		mNetworkLog("Error invalid stream shard count %u (NetError %d)", shardCount, NetInvalidError);
+		return NetInvalidError;
+	}
+	
 	// Socket
 	NetError socketError = NetNoError;
-	config->socket = net_socket_create(&socketError, AF_INET, "0.0.0.0", port); // "0.0.0.0" tistening on all network interfaces
+	config->socket = net_socket_create_size(&socketError, AF_INET, "0.0.0.0", port, kStreamMtuMax); // "0.0.0.0" tistening on all network interfaces
 	if(socketError) // Check error
 	{
 		mNetworkLog("Error creating socket (NetError %d)", socketError);
 		return socketError;
 	}
-	net_socket_set_receive_callback(config->socket, config, streamSocketReceiveCallback); // Set socket callback
+	if(net_socket_set_pmtu_probe(config->socket) != NetNoError) // Probes may be fragmented, path MTU will be overestimated
+		mNetworkLog("Warning path MTU probing not supported");
+#if kStreamPacingTxTime
+	if(net_socket_set_txtime(config->socket) != NetNoError) // Falls back to user-space pacing
+		mNetworkLog("Warning SO_TXTIME not supported");
+#endif
+	net_socket_demux_add_callback(config->socket, kProtocolDefaultId, kProtocolDefaultId, protocolIsStream, config, streamSocketReceiveCallback); // Stream datagrams, other protocols may share the socket
     
     // Address
     net_socket_local_addr(config->socket, &config->address);
@@ -41,74 +98,103 @@ NetError streamSetup(StreamConfiguration * config, const unsigned int port, void
 		return NetInvalidError;
 	}
 	
-	// Dispatch queue 
-	config->streamDispatchQueue = dispatch_queue_create("com.laugga.streamDispatchQueue", NULL);
-    
-	// Dispatch timer
-	config->streamDispatchTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, config->streamDispatchQueue);    
-    dispatch_source_set_timer(config->streamDispatchTimer, dispatch_time(DISPATCH_TIME_NOW, 0), kStreamTimerUpdateInterval * NSEC_PER_SEC, kStreamTimerUpdateInterval * NSEC_PER_SEC);
-	dispatch_set_context(config->streamDispatchTimer, config);    
-	dispatch_source_set_event_handler_f(config->streamDispatchTimer, &streamTimerCallback);
+	// FEC disabled by default
+	config->fecGroupSize = 0;
 	
-	// Start inactive by default
-	config->active = false;
+	// Jitter buffer disabled by default
+	config->jitterBuffer = false;
 	
-	// Streams list
-	config->streams = list_create(kStreamListCapacity); // Start with initial capacity of kStreamListCapacity
+	// Data is copied to/from StreamObject by default
+	config->updateViewCallback = NULL;
+	config->receiveViewCallback = NULL;
+	
+	// Shards, inactive until streams are added
+	config->streamCount = 0;
+	config->shardCount = shardCount;
+	config->shards = (StreamShard *)calloc(shardCount, sizeof(StreamShard));
+	for(unsigned int i=0; i<shardCount; ++i)
+		streamShardSetup(config, &config->shards[i], i);
 
 	return NetNoError;
 }
 
 void streamTeardown(StreamConfiguration * config)
 {
-	dispatch_release(config->streamDispatchQueue);
-	dispatch_source_cancel(config->streamDispatchTimer); // Atomic, guarantees the event handler will not fire again 				
-	if(config->active == false) 						 // after the source is resumed in case it is suspended
-		dispatch_resume(config->streamDispatchTimer);
-	dispatch_release(config->streamDispatchTimer);
-	list_destroy(config->streams);
-	net_socket_destroy(config->socket);
+	for(unsigned int i=0; i<config->shardCount; ++i)
+	{
+		StreamShard * shard = &config->shards[i];
+		dispatch_source_cancel(shard->streamDispatchTimer); // Atomic, guarantees the event handler will not fire again 				
+		if(shard->active == false) 						 	// after the source is resumed in case it is suspended
+			dispatch_resume(shard->streamDispatchTimer);
+		dispatch_release(shard->streamDispatchTimer);
+		dispatch_source_cancel(shard->jitterDispatchTimer);
+		dispatch_release(shard->jitterDispatchTimer);
+		dispatch_sync(shard->streamDispatchQueue, ^{ /* Wait for pending blocks */ });
+	}
+	
+	net_socket_destroy(config->socket); // Before shard pools, sent packets are released on socket queue
+	
+	for(unsigned int i=0; i<config->shardCount; ++i)
+	{
+		StreamShard * shard = &config->shards[i];
+		streamShardIterate(shard, ^(Stream * stream){
+			streamDestroy(&stream);
+		});
+		timer_wheel_destroy(shard->updateWheel);
+		free(shard->table);
+		free(shard->dueStreams);
+		pool_destroy(shard->poolPackets);
+		dispatch_release(shard->streamDispatchQueue);
+	}
+	
+	free(config->shards);
+	config->shards = NULL;
+	config->shardCount = 0;
 }
 
 #pragma mark -
 #pragma mark Pause/Resume
 
+static void streamShardSuspend(StreamShard * shard)
+{
+	if(shard->active == true)
+	{
+		dispatch_suspend(shard->streamDispatchTimer);
+		shard->active = false;
+	}
+}
+
+static void streamShardResume(StreamShard * shard)
+{
+	// Resume only if shard is not empty
+	if(shard->active == false && shard->count > 0)
+	{
+		shard->active = true;
+		dispatch_resume(shard->streamDispatchTimer);
+	}
+}
+
 void streamSuspend(StreamConfiguration * config)
 {
     mNetworkPrettyLog;
     
-	//dispatch_async(config->streamDispatchQueue, ^{
     // Always suspend
-    if(config->active == true)
-    {
-        dispatch_suspend(config->streamDispatchTimer);
-        config->active = false;
-        
-        // Remove all streams
-        //            list_iterate(config->streams, ^(list_object_t object){
-        //                Stream * stream = (Stream *)object;
-        //                list_remove(config->streams, stream);
-        //            });
-        
-        // callback
-        config->suspendCallback(config->context);
-    }
-	//});
+    bool wasActive = false;
+	for(unsigned int i=0; i<config->shardCount; ++i)
+	{
+		wasActive |= config->shards[i].active;
+		streamShardSuspend(&config->shards[i]);
+	}
+	
+	// callback
+	if(wasActive)
+		config->suspendCallback(config->context);
 }
 
 void streamResume(StreamConfiguration * config)
 {
-	//dispatch_async(config->streamDispatchQueue, ^{
-    if(config->active == false)
-    {
-        // Resume only if stream list is not empty
-        if(list_is_empty(config->streams) == false)
-        {
-            config->active = true;
-            dispatch_resume(config->streamDispatchTimer);
-        }
-    }
-	//});
+	for(unsigned int i=0; i<config->shardCount; ++i)
+		streamShardResume(&config->shards[i]);
 }
 
 #pragma mark -
@@ -122,29 +208,37 @@ void streamAdd(StreamConfiguration * config, const net_addr_t * streamRemoteAddr
     
     mNetworkLog("streamAdd %s:%d", inet_ntoa(streamAddress.sin_addr), ntohs(streamAddress.sin_port));
     
-    dispatch_async(config->streamDispatchQueue, ^{
+    StreamShard * shard = streamShardForAddress(config, &streamAddress);
+    
+    dispatch_async(shard->streamDispatchQueue, ^{
         
         // Find
-		Stream * stream = list_find(config->streams, ^(list_object_t object){
-			Stream * _stream = (Stream *)object;
-			return net_addr_is_equal(&_stream->address, &streamAddress);
-		});
+		Stream * stream = streamShardFind(shard, &streamAddress);
         
         // Create and add if doesn't exist yet
 		if(!stream)
 		{
             // Create
 			stream = streamCreate(&streamAddress);
+			if(!stream)
+				return;
+			stream->fec.groupSize = config->fecGroupSize;
             
-            // Add
-			list_add(config->streams, stream);
+            // Add, due on next tick
+			if(!streamShardInsert(shard, stream))
+			{
+				mNetworkLog("Error adding stream, shard %u is full", shard->index);
+				streamDestroy(&stream);
+				return;
+			}
+			__sync_add_and_fetch(&config->streamCount, 1);
             
             // Log...
-            mNetworkLog("Added remote stream %d to local %d", net_addr_get_port(&stream->address), net_addr_get_port(&config->address));
+            mNetworkLog("Added remote stream %d to local %d (shard %u)", net_addr_get_port(&stream->address), net_addr_get_port(&config->address), shard->index);
             net_addr_log(&stream->address);
             
-            // Resume timer when list has at least one
-            streamResume(config);
+            // Resume timer when shard has at least one
+            streamShardResume(shard);
 		}
     });
 }
@@ -155,25 +249,29 @@ void streamRemove(StreamConfiguration * config, const net_addr_t * streamRemoteA
     net_addr_t streamAddress;
     net_addr_copy(&streamAddress, streamRemoteAddress);
     
-	dispatch_async(config->streamDispatchQueue, ^{
+    StreamShard * shard = streamShardForAddress(config, &streamAddress);
+    
+	dispatch_async(shard->streamDispatchQueue, ^{
         
         // Find
-        Stream * stream = list_find(config->streams, ^(list_object_t object){
-			Stream * _stream = (Stream *)object;
-			return net_addr_is_equal(&_stream->address, &streamAddress);
-		});
+        Stream * stream = streamShardFind(shard, &streamAddress);
         
         // Remove if exists
         if(stream)
         {
-            mNetworkLog("Remove stream from list with address:");
+            mNetworkLog("Remove stream from shard %u with address:", shard->index);
             net_addr_log((net_addr_t*)&streamAddress);
             
-            list_remove(config->streams, stream);
+            streamShardRemove(shard, stream);
+            streamDestroy(&stream);
+            
+            // Suspend timer when shard is empty
+            if(shard->count == 0)
+                streamShardSuspend(shard);
             
-            // Suspend timer when list is empty
-            if(list_is_empty(config->streams))
-                streamSuspend(config);
+            // No streams left
+            if(__sync_sub_and_fetch(&config->streamCount, 1) == 0)
+            	config->suspendCallback(config->context);
         }
         else
         {
@@ -183,19 +281,278 @@ void streamRemove(StreamConfiguration * config, const net_addr_t * streamRemoteA
 	});
 }
 
+void streamSetFec(StreamConfiguration * config, unsigned int groupSize)
+{
+	if(groupSize > kStreamFecMaxGroupSize)
+		groupSize = kStreamFecMaxGroupSize;
+	
+	config->fecGroupSize = groupSize; // New streams
+	
+	for(unsigned int i=0; i<config->shardCount; ++i)
+	{
+		StreamShard * shard = &config->shards[i];
+		dispatch_async(shard->streamDispatchQueue, ^{
+			// Takes effect on the next FEC group of each stream
+			streamShardIterate(shard, ^(Stream * stream){
+				stream->fec.groupSize = groupSize;
+			});
+		});
+	}
+}
+
+void streamSetChannel(StreamConfiguration * config, unsigned int channel, unsigned int priority, unsigned int weight)
+{
+	if(channel >= kStreamChannelMax)
+		return;
+	
+	for(unsigned int i=0; i<config->shardCount; ++i)
+	{
+		StreamShard * shard = &config->shards[i];
+		dispatch_async(shard->streamDispatchQueue, ^{
+			streamChannelsSetup(&shard->channels, channel, priority, weight);
+		});
+	}
+}
+
+static void streamShardChannelsTrim(StreamShard * shard)
+{
+	// Drop messages every stream of the shard has sent
+	streamChannelsTrimBegin(&shard->channels);
+	streamShardIterate(shard, ^(Stream * stream){
+		streamChannelsTrimCursor(&shard->channels, &stream->channelCursor);
+	});
+	streamChannelsTrimEnd(&shard->channels);
+}
+
+static bool streamShardChannelsPush(StreamShard * shard, unsigned int channel, const uint8_t * data, unsigned int length)
+{
+	if(!streamChannelsHasRoom(&shard->channels, channel, length))
+		streamShardChannelsTrim(shard);
+	
+	return streamChannelsPush(&shard->channels, channel, data, length);
+}
+
+bool streamChannelSend(StreamConfiguration * config, unsigned int channel, const uint8_t * data, unsigned int length)
+{
+	StreamShard * shard = (StreamShard *)dispatch_get_specific(&streamShardQueueKey);
+	if(shard == NULL || shard->config != config)
+		return false; // Not called from a shard queue
+	
+	return streamShardChannelsPush(shard, channel, data, length);
+}
+
+typedef struct {
+	volatile int retainCount; // Shards still to queue it
+	unsigned int length;
+	uint8_t data[];
+} StreamChannelMessage;
+
+bool streamChannelBroadcast(StreamConfiguration * config, unsigned int channel, const uint8_t * data, unsigned int length)
+{
+	if(channel >= kStreamChannelMax || length > kStreamChannelMessageMaxLength)
+		return false;
+	
+	// Copied once, queued by each shard on its own queue
+	StreamChannelMessage * message = (StreamChannelMessage *)malloc(sizeof(StreamChannelMessage) + length);
+	if(message == NULL)
+		return false;
+	
+	message->retainCount = config->shardCount;
+	message->length = length;
+	memcpy(message->data, data, length);
+	
+	for(unsigned int i=0; i<config->shardCount; ++i)
+	{
+		StreamShard * shard = &config->shards[i];
+		dispatch_async(shard->streamDispatchQueue, ^{
+			streamShardChannelsPush(shard, channel, message->data, message->length); // Full queues count it as dropped
+			if(__sync_sub_and_fetch(&message->retainCount, 1) == 0)
+				free(message);
+		});
+	}
+	
+	return true;
+}
+
+void streamSetViewCallbacks(StreamConfiguration * config, StreamUpdateViewCallback updateViewCallback, StreamReceiveViewCallback receiveViewCallback)
+{
+	config->updateViewCallback = updateViewCallback; // Read on every update and packet
+	config->receiveViewCallback = receiveViewCallback;
+}
+
+void streamSetJitterBuffer(StreamConfiguration * config, bool enabled)
+{
+	config->jitterBuffer = enabled; // Read on every packet, buffered snapshots are still released when disabled
+}
+
 bool streamDoesExist(StreamConfiguration * config, const net_addr_t * streamRemoteAddress)
 {
-	Stream * stream = list_find(config->streams, ^(list_object_t object){
-		Stream * _stream = (Stream *)object;
-		return net_addr_is_equal(&_stream->address, streamRemoteAddress);
+	StreamShard * shard = streamShardForAddress(config, streamRemoteAddress);
+	__block bool exists = false;
+	
+	streamShardSync(shard, ^{
+		exists = (streamShardFind(shard, streamRemoteAddress) != NULL);
 	});
     
-	return (stream != NULL);
+	return exists;
+}
+
+bool streamRemoteToLocal(StreamConfiguration * config, const net_addr_t * streamRemoteAddress, net_time_t remoteTime, net_time_t * localTime)
+{
+	StreamShard * shard = streamShardForAddress(config, streamRemoteAddress);
+	__block bool synchronized = false;
+	__block net_time_t time = 0;
+	
+	streamShardSync(shard, ^{
+		Stream * stream = streamShardFind(shard, streamRemoteAddress);
+		if(stream && stream->clock.valid)
+		{
+			time = streamClockRemoteToLocal(&stream->clock, remoteTime, net_time_now());
+			synchronized = true;
+		}
+	});
+	
+	if(synchronized)
+		*localTime = time;
+	
+	return synchronized;
 }
 
 bool streamListIsEmpty(StreamConfiguration * config)
 {
-	return list_is_empty(config->streams);
+	return config->streamCount == 0;
+}
+
+#pragma mark -
+#pragma mark Shard
+
+StreamShard * streamShardForAddress(StreamConfiguration * config, const net_addr_t * address)
+{
+	return &config->shards[net_addr_hash(address) % config->shardCount];
+}
+
+void streamShardSync(StreamShard * shard, dispatch_block_t block)
+{
+	if(dispatch_get_specific(&streamShardQueueKey) == shard)
+		block(); // Already on the shard queue, from a callback
+	else
+		dispatch_sync(shard->streamDispatchQueue, block);
+}
+
+static unsigned int streamShardBucket(StreamShard * shard, unsigned int hash)
+{
+	return (hash / shard->config->shardCount) & shard->tableMask; // Bits not used to select the shard
+}
+
+Stream * streamShardFind(StreamShard * shard, const net_addr_t * address)
+{
+	unsigned int hash = net_addr_hash(address);
+	
+	Stream * stream = shard->table[streamShardBucket(shard, hash)];
+	while(stream && !(stream->hash == hash && net_addr_is_equal(&stream->address, address)))
+		stream = stream->next;
+	
+	return stream;
+}
+
+static void streamShardLink(StreamShard * shard, Stream * stream)
+{
+	Stream ** bucket = &shard->table[streamShardBucket(shard, stream->hash)];
+	
+	stream->previous = NULL;
+	stream->next = *bucket;
+	if(*bucket)
+		(*bucket)->previous = stream;
+	*bucket = stream;
+}
+
+static void streamShardGrow(StreamShard * shard)
+{
+	unsigned int capacity = (shard->tableMask + 1) * 2;
+	
+	Stream ** table = (Stream **)calloc(capacity, sizeof(Stream *));
+	Stream ** dueStreams = (Stream **)realloc(shard->dueStreams, capacity * sizeof(Stream *));
+	if(!table || !dueStreams)
+	{
+		free(table);
+		if(dueStreams)
+			shard->dueStreams = dueStreams;
+		return; // Keep current table, longer chains
+	}
+	shard->dueStreams = dueStreams;
+	
+	// Re-link every stream in new buckets
+	Stream ** oldTable = shard->table;
+	unsigned int oldCapacity = shard->tableMask + 1;
+	shard->table = table;
+	shard->tableMask = capacity - 1;
+	
+	for(unsigned int i=0; i<oldCapacity; ++i)
+	{
+		Stream * stream = oldTable[i];
+		while(stream)
+		{
+			Stream * next = stream->next;
+			streamShardLink(shard, stream);
+			stream = next;
+		}
+	}
+	
+	free(oldTable);
+}
+
+bool streamShardInsert(StreamShard * shard, Stream * stream)
+{
+	if(shard->count >= shard->tableMask + 1)
+		streamShardGrow(shard);
+	
+	if(shard->count >= shard->tableMask + 1)
+		return false; // Out of memory, due streams must fit
+	
+	stream->hash = net_addr_hash(&stream->address);
+	stream->shard = shard->index;
+	streamChannelsCursorClear(&shard->channels, &stream->channelCursor); // Messages queued from now on
+	streamShardLink(shard, stream);
+	++shard->count;
+	
+	// First update on next tick
+	net_time_t now = net_time_now();
+	stream->updateTime = now;
+	stream->updateDeadline = now;
+	timer_wheel_schedule(shard->updateWheel, &stream->updateEntry, now);
+	
+	return true;
+}
+
+void streamShardRemove(StreamShard * shard, Stream * stream)
+{
+	timer_wheel_cancel(shard->updateWheel, &stream->updateEntry);
+	
+	if(stream->previous)
+		stream->previous->next = stream->next;
+	else
+		shard->table[streamShardBucket(shard, stream->hash)] = stream->next;
+	
+	if(stream->next)
+		stream->next->previous = stream->previous;
+	
+	stream->next = NULL;
+	stream->previous = NULL;
+	--shard->count;
+}
+
+void streamShardIterate(StreamShard * shard, StreamShardIterateBlock block)
+{
+	for(unsigned int i=0; i<=shard->tableMask; ++i)
+	{
+		Stream * stream = shard->table[i];
+		while(stream)
+		{
+			Stream * next = stream->next; // Block may destroy stream
+			block(stream);
+			stream = next;
+		}
+	}
 }
 
 #pragma mark -
@@ -211,7 +568,11 @@ Stream * streamCreate(const net_addr_t * address)
 		stream->state = StreamWaiting; // Waiting state, until getting back from address
 		streamReliabilityClear(&stream ->reliability);
 		streamFlowClear(&stream ->flow);
+		streamMtuClear(&stream->mtu);
+		streamFecClear(&stream->fec, 0);
+		streamClockClear(&stream->clock);
 		net_addr_copy(&stream->address, address); // address
+		timer_wheel_entry_init(&stream->updateEntry, stream);
 	}
 	
 	return stream;
@@ -221,166 +582,452 @@ void streamDestroy(Stream ** stream)
 {
 	if(*stream)
 	{
+		free((*stream)->jitter);
 		free(*stream);
 		*stream = NULL;
 	}	
 }
 
-bool streamUpdate(StreamConfiguration * config, Stream * stream)
+void streamUpdate(StreamConfiguration * config, Stream * stream, net_time_t now)
 {
-	streamReliabilityUpdate(&stream->reliability, kStreamTimerUpdateInterval);
-	streamFlowUpdate(&stream->flow, stream->reliability.rtt, kStreamTimerUpdateInterval);
+	float elapsed = mNetTimeToSeconds(now - stream->updateTime);
+	stream->updateTime = now;
+	
+	streamReliabilityUpdate(&stream->reliability, now);
+	streamFlowUpdate(&stream->flow, stream->reliability.rtt, elapsed);
+	
+	StreamFlowSample flowSample;
+	flowSample.rtt = stream->reliability.rtt;
+	flowSample.rttMin = stream->reliability.rttMin;
+	flowSample.lossRatio = stream->reliability.lossRatio;
+	flowSample.sentRate = stream->reliability.sentBytesPerSecond;
+	flowSample.deliveryRate = stream->reliability.ackedBytesPerSecond;
+	flowSample.packetSize = stream->reliability.sentPackets > 0 ? (float)stream->reliability.sentBytes / stream->reliability.sentPackets : 0.0f;
+	streamFlowUpdateRate(&stream->flow, &flowSample, elapsed);
+	streamMtuUpdate(&stream->mtu, elapsed);
 	
-	stream->timeoutAccumulator += kStreamTimerUpdateInterval;
+	stream->timeoutAccumulator += elapsed;
 	
 	if(stream->timeoutAccumulator > kStreamTimeout)
 	{
 		streamTimeout(config, stream);
 	}
 	
-	stream->updateAccumulator += kStreamTimerUpdateInterval;
+	// Next update, keep deadlines evenly spaced so the update rate is continuous
+	net_time_t interval = mNetTimeFromSeconds(stream->flow.updateInterval);
+	stream->updateDeadline += interval;
+	if(stream->updateDeadline + interval < now) // Fell behind more than one update, don't burst
+		stream->updateDeadline = now + interval;
 	
-	if(stream->updateAccumulator >= stream->flow.updateInterval)
+	timer_wheel_schedule(config->shards[stream->shard].updateWheel, &stream->updateEntry, stream->updateDeadline);
+}
+
+net_packet_body_t streamPackBody(StreamObject * object)
+{
+	net_packet_body_t body = net_packet_body_create(kStreamProtocolDataOverheadLength + object->length);
+	if(body)
 	{
-		stream->updateAccumulator = 0.0f;
-		
-		return true; // needs update
+		bitstream_t bitstream = bitstream_create(body->data, body->capacity);
+		streamProtocolPackData(&bitstream, object);
+		body->length = bitstream.offset;
 	}
 	
-	return false;
+	return body;
 }
 
-void streamSend(StreamConfiguration * config, Stream * stream, StreamObject * object)
+void streamSend(StreamConfiguration * config, Stream * stream, StreamObject * object, net_packet_body_t body, net_time_t txtime)
 {
 	if(stream->state == StreamConnected || stream->state == StreamWaiting) 
 	{
         //mNetworkLog("Stream send to...");
-            
-		net_packet_t packet = net_packet_alloc(config->socket);
+        
+		StreamHeaderOptions options;
+		streamHeaderOptionsSetup(&options);
 		
-		if(packet)
+		// Data written in place, only copied if needed for FEC parity or probe padding
+		StreamObject bodyObject;
+		if(object == NULL)
 		{
-            mNetworkLog("streamObject has %d bytes", object->length);
-            
-			bitstream_t * bitstream = &packet->bitstream;
-	
-			// Pack Header
-			streamProtocolPackHeader(bitstream, stream->reliability.sequence, stream->reliability.ack, stream->reliability.ackBits);
+			streamObjectSetup(&bodyObject);
+			if(stream->fec.groupSize > 0 || stream->fec.sendIndex > 0 || streamMtuProbeSize(&stream->mtu) > 0)
+			{
+				bitstream_t bitstream = bitstream_create(body->data, body->length);
+				streamProtocolUnpackData(&bitstream, &bodyObject);
+			}
+			object = &bodyObject;
+		}
+		
+		// FEC
+		streamFecPackData(&stream->fec, &options, object);
+		
+		// Send data, may be a path MTU probe
+		streamSendPacket(config, stream, object, body, &options, streamMtuProbeSize(&stream->mtu), txtime);
+		
+		// Send parity, when FEC group is complete
+		StreamHeaderOptions parityOptions;
+		streamHeaderOptionsSetup(&parityOptions);
+		
+		StreamObject * parity = streamFecParity(&stream->fec, &parityOptions);
+		if(parity)
+			streamSendPacket(config, stream, parity, NULL, &parityOptions, 0, txtime);
+	}
+}
+
+void streamSendPacket(StreamConfiguration * config, Stream * stream, StreamObject * object, net_packet_body_t body, StreamHeaderOptions * options, size_t probeSize, net_time_t txtime)
+{
+	net_packet_t packet = net_packet_alloc_pool(config->socket, config->shards[stream->shard].poolPackets);
 	
-			// Pack Data
+	if(packet)
+	{
+        mNetworkLog("streamObject has %d bytes", object->length);
+        
+		bitstream_t * bitstream = &packet->bitstream;
+		
+		net_time_t now = txtime > 0 ? txtime : net_time_now(); // Expected departure
+		
+		// Timestamps and extended acks
+		streamReliabilityTimestamps(&stream->reliability, options, now);
+		streamReliabilityAckOptions(&stream->reliability, options);
+		
+		// Probes are padded, data can't be shared
+		if(probeSize > 0)
+			body = NULL;
+		
+		// Limit to path MTU, unless it's a probe
+		bitstream->bound = probeSize > 0 ? probeSize : stream->mtu.size;
+		if(body)
+			bitstream->bound -= body->length;
+
+		// Pack Header
+		streamProtocolPackHeader(bitstream, stream->reliability.sequence, stream->reliability.ack, stream->reliability.ackBits, options);
+
+		// Pack Data, or share it
+		if(body)
+			net_packet_set_body(packet, body);
+		else
 			streamProtocolPackData(bitstream, object);
-	
-			// Set packet stream remote addresss
-			net_packet_addr(packet, &stream->address);
-	        //mNetworkLog("Send from %d to %d", net_addr_get_port(&config->address), net_addr_get_port(&stream->address));
 		
-			// Send stream packet
-			net_socket_send(config->socket, packet);
-	
-			// Mark as sent
-			streamReliabilityPacketSent(&stream->reliability, packet->length);
-	
-			// Release packet
-			net_packet_release(config->socket, packet);
+		// Pad probe
+		if(probeSize > 0)
+		{
+			streamProtocolPackPadding(bitstream, probeSize);
+			streamMtuProbeSent(&stream->mtu, stream->reliability.sequence, probeSize);
 		}
+
+		// Set packet stream remote addresss
+		net_packet_addr(packet, &stream->address);
+        //mNetworkLog("Send from %d to %d", net_addr_get_port(&config->address), net_addr_get_port(&stream->address));
+	
+		// Send stream packet
+		net_socket_send_at(config->socket, packet, txtime);
+
+		// Mark as sent
+		streamReliabilityPacketSent(&stream->reliability, net_packet_len(packet), now);
+
+		// Release packet
+		net_packet_release(config->socket, packet);
 	}
 }
 
-void streamReceive(StreamConfiguration * config, Stream * stream, Sequence sequence, Ack ack, AckBitField ackBitField, StreamObject * object)
+static bool streamReceiveHeader(Stream * stream, Sequence sequence, Ack ack, AckBitField ackBitField, const StreamHeaderOptions * options, net_time_t time)
 {
     // Check ack is less than last sent packet sequence
-	if(ack <= stream->reliability.sequence)
-	{ 
-		// Reset timeout accumulator
-		stream->timeoutAccumulator = 0.0f;
+	if(ack > stream->reliability.sequence)
+		return false;
+	
+	// Reset timeout accumulator
+	stream->timeoutAccumulator = 0.0f;
+	
+	// Mark as received
+	streamReliabilityPacketReceived(&stream->reliability, sequence, ack, ackBitField, time);
+	streamReliabilityProcessAckOptions(&stream->reliability, ack, options, time);
+	streamReliabilityProcessTimestamps(&stream->reliability, options, time);
+	streamClockProcessTimestamps(&stream->clock, options, time);
+	streamMtuProcessAck(&stream->mtu, ack, ackBitField);
 	
-		// Mark as received
-		streamReliabilityPacketReceived(&stream->reliability, sequence, ack, ackBitField);
+	return true;
+}
+
+void streamReceiveView(StreamConfiguration * config, Stream * stream, Sequence sequence, Ack ack, AckBitField ackBitField, const StreamHeaderOptions * options, net_time_t time, StreamView * view)
+{
+	if(streamReceiveHeader(stream, sequence, ack, ackBitField, options, time))
+		config->receiveViewCallback(config->context, &stream->address, view);
+}
+
+void streamReceive(StreamConfiguration * config, Stream * stream, Sequence sequence, Ack ack, AckBitField ackBitField, const StreamHeaderOptions * options, net_time_t time, StreamObject * object)
+{
+	if(streamReceiveHeader(stream, sequence, ack, ackBitField, options, time))
+	{ 
+		// Forward object, unless it's parity or duplicate
+		if(streamFecReceive(&stream->fec, options, object))
+			streamForward(config, stream, sequence, options, time, object);
+		
+		// Forward lost object, if recovered (data packets in a FEC group have consecutive sequences)
+		StreamObject recoveredObject;
+		streamObjectSetup(&recoveredObject);
+		if(streamFecRecover(&stream->fec, &recoveredObject))
+		{
+			Sequence recoveredSequence = (sequence + kStreamReliabilityMaxSequence - options->fecIndex + stream->fec.receiveRecoveredIndex) % kStreamReliabilityMaxSequence;
+			streamForward(config, stream, recoveredSequence, options, time, &recoveredObject);
+		}
+	}
+}
+
+static void streamJitterSchedule(StreamShard * shard, net_time_t next, net_time_t now)
+{
+	if(next > 0 && (shard->jitterTimerTime == 0 || next < shard->jitterTimerTime)) // Only re-arm if earlier
+	{
+		shard->jitterTimerTime = next;
+		dispatch_source_set_timer(shard->jitterDispatchTimer, dispatch_time(DISPATCH_TIME_NOW, next - now), DISPATCH_TIME_FOREVER, kStreamJitterTimerLeeway);
+	}
+}
+
+void streamForward(StreamConfiguration * config, Stream * stream, Sequence sequence, const StreamHeaderOptions * options, net_time_t time, StreamObject * object)
+{
+	if(config->jitterBuffer && stream->jitter == NULL) // Allocated once used
+	{
+		stream->jitter = (StreamJitter *)malloc(sizeof(StreamJitter));
+		if(stream->jitter)
+			streamJitterClear(stream->jitter);
+	}
 	
-		// Forward object
+	if(config->jitterBuffer && stream->jitter)
+	{
+		if(streamJitterPush(stream->jitter, sequence, options, object, time))
+		{
+			net_time_t now = net_time_now();
+			streamJitterSchedule(&config->shards[stream->shard], streamJitterNextTime(stream->jitter, now), now);
+		}
+	}
+	else
+	{
+		streamDeliver(config, stream, object);
+	}
+}
+
+static void streamDeliverObject(StreamConfiguration * config, Stream * stream, StreamObject * object)
+{
+	if(config->receiveViewCallback) // View on object data
+	{
+		StreamView view;
+		view.tag = object->tag;
+		view.bitstream = bitstream_create(object->data, object->length);
+		config->receiveViewCallback(config->context, &stream->address, &view);
+	}
+	else
+	{
 		config->receiveCallback(config->context, &stream->address, object);
-        
+	}
+}
+
+void streamDeliver(StreamConfiguration * config, Stream * stream, StreamObject * object)
+{
+	if(object->tag == kStreamChannelTag) // One callback per channel message
+	{
+		StreamObject message;
+		streamObjectSetup(&message);
+		
+		unsigned int offset = 0;
+		while(streamChannelsUnpack(object, &offset, &message))
+			streamDeliverObject(config, stream, &message);
+	}
+	else
+	{
+		streamDeliverObject(config, stream, object);
 	}
 }
 
 void streamTimeout(StreamConfiguration * config, Stream * stream)
 {
-	dispatch_async(config->streamDispatchQueue, ^{
-		stream->state = StreamTimeout;
-        mNetworkLog("Stream timeout");
-        net_addr_log(&stream->address);
-		config->timeoutCallback(config->context, &stream->address); // forward
+	StreamShard * shard = &config->shards[stream->shard];
+	
+	net_addr_t streamAddress;
+	net_addr_copy(&streamAddress, &stream->address);
+	
+	dispatch_async(shard->streamDispatchQueue, ^{
+		Stream * _stream = streamShardFind(shard, &streamAddress); // May have been removed meanwhile
+		if(_stream)
+		{
+			_stream->state = StreamTimeout;
+	        mNetworkLog("Stream timeout");
+	        net_addr_log(&_stream->address);
+			config->timeoutCallback(config->context, &_stream->address); // forward
+		}
 	});
 }
 
 void streamLog(Stream * stream)
 {
-	mNetworkLog("\nrtt %.1fms, sent %d, acked %d, lost %d (%.1f%%), sent bandwidth = %.1fkbps, acked bandwidth = %.1fkbps, flow = %s\n", 
+	mNetworkLog("\nrtt %.2fms (min %.2fms, var %.2fms), sent %d, acked %d, lost %d (%.1f%%), sent bandwidth = %.1fkbps, acked bandwidth = %.1fkbps, loss = %.1f%%, flow = %s (%.1fHz, %.0fB), estimated bandwidth = %.1fkbps, mtu = %lu\n", 
 					stream->reliability.rtt * 1000.0f, 
+					stream->reliability.rttMin * 1000.0f, 
+					stream->reliability.rttVariance * 1000.0f, 
 					stream->reliability.totalSentPackets, 
 					stream->reliability.totalAckedPackets, 
 					stream->reliability.totalLostPackets, 
 					stream->reliability.totalSentPackets > 0.0f ? (float) stream->reliability.totalLostPackets / (float) stream->reliability.totalSentPackets * 100.0f : 0.0f, 
 					stream->reliability.sentBandwidth, 
 					stream->reliability.ackedBandwidth, 
-					stream->flow.mode == StreamFlowModeGood ? "good" : "bad");
+					stream->reliability.lossRatio * 100.0f, 
+					stream->flow.mode == StreamFlowModeGood ? "good" : "bad",
+					1.0f / stream->flow.updateInterval, 
+					stream->flow.packetBudget, 
+					stream->flow.bandwidth * 0.008f, 
+					stream->mtu.size);
 }
 
 #pragma mark -
 #pragma mark Timer Update
 
+static unsigned int streamDataCapacity(Stream * stream)
+{
+	size_t streamPacketLength = stream->mtu.size < stream->flow.packetBudget ? stream->mtu.size : (size_t)stream->flow.packetBudget; // Path MTU and congestion control
+	return mStreamObjectDataLength(streamPacketLength);
+}
+
 void streamTimerCallback(void * context)
 {
-	StreamConfiguration * config = (StreamConfiguration *)context;
-	if(!list_is_empty(config->streams))
+	StreamShard * shard = (StreamShard *)context;
+	StreamConfiguration * config = shard->config;
+	
+	net_time_t now = net_time_now();
+	net_time_t tick = mNetTimeFromSeconds(kStreamTimerUpdateInterval);
+	
+	// Streams due within half a tick, the timer is not aligned to wheel ticks
+	shard->dueCount = 0;
+	timer_wheel_advance(shard->updateWheel, now + tick / 2, ^(timer_wheel_entry_t * entry){
+		shard->dueStreams[shard->dueCount++] = (Stream *)entry->object;
+	});
+	
+	if(shard->dueCount > 0)
 	{	
-		// Flag indicates if all streams need to update data
-		// Baseline is the stream with lower update frequency
-		__block bool syncUpdate = true;
-	
-		// Update each stream		
-		list_iterate(config->streams, ^(list_object_t object){
-			Stream * stream = (Stream *)object;
-			bool streamShouldUpdate = streamUpdate(config, stream);
-			syncUpdate &= streamShouldUpdate; // all streams need to be true in order to update data		
-		});
+		// Update data must fit the stream with smaller path MTU or packet budget
+		unsigned int syncCapacity = kStreamObjectDataMaxLength;
+	
+		// Update each due stream
+		for(unsigned int i=0; i<shard->dueCount; ++i)
+		{
+			Stream * stream = shard->dueStreams[i];
+			streamUpdate(config, stream, now);
+			
+			unsigned int streamCapacity = streamDataCapacity(stream);
+			if(streamCapacity < syncCapacity)
+				syncCapacity = streamCapacity;
+		}
     
-		// Send data
-		if(syncUpdate)
+		StreamObject updateObject;
+        streamObjectSetup(&updateObject);
+        StreamObject * updateObjectPtr = &updateObject;
+        net_packet_body_t body = NULL;
+        
+		if(config->updateViewCallback && shard->channels.count == 0)
+		{
+			// Application writes update data in place, packed once and shared by each packet
+			body = net_packet_body_create(kStreamProtocolDataOverheadLength + syncCapacity);
+			if(body)
+			{
+				bitstream_t bitstream = bitstream_create(body->data, body->capacity);
+				StreamView updateView;
+				streamProtocolPackViewBegin(&bitstream, &updateView, syncCapacity);
+				config->updateViewCallback(config->context, &updateView);
+				streamProtocolPackViewEnd(&bitstream, &updateView);
+				body->length = bitstream.offset;
+				updateObjectPtr = NULL; // Only copied on demand
+			}
+		}
+		else
 		{
-            //mNetworkLog("Retrieve + Send %d", net_addr_get_port(&config->address));
-            
 			// Retrieve application update data
-			StreamObject updateObject;
-            streamObjectSetup(&updateObject);
-			config->updateCallback(config->context, &updateObject); // Use bitstream to pack data
-            mNetworkLog("streamObject has %d bytes", updateObject.length);
-            StreamObject * updateObjectPtr = &updateObject;
+	        updateObject.capacity = shard->channels.count > 0 ? 0 : syncCapacity; // Channels fill it instead
+	        if(config->updateViewCallback) // Zero capacity
+	        {
+	        	StreamView updateView;
+	        	updateView.tag = 0;
+	        	updateView.bitstream = bitstream_create(updateObject.data, 0);
+	        	config->updateViewCallback(config->context, &updateView);
+	        }
+	        else
+	        {
+				config->updateCallback(config->context, &updateObject); // Use bitstream to pack data
+			}
 			
-            //mNetworkLog("Got data %d", net_addr_get_port(&config->address));
-            
-			// Send data for each stream
-			list_iterate(config->streams, ^(list_object_t object){
-                //mNetworkLog("Iterate %d", net_addr_get_port(&config->address));
-				Stream * stream = (Stream *)object;
-				streamSend(config, stream, updateObjectPtr);
-			});
+	        mNetworkLog("streamObject has %d bytes", updateObject.length);
+			
+			// Pack data once, each packet only has its own header (channel messages are filled per stream)
+			if(shard->dueCount >= kStreamFanOutMin && shard->channels.count == 0)
+				body = streamPackBody(&updateObject);
 		}
-	
-		// Log status enabled in DEBUG only
-#if (DEBUG|TEST)
-		config->logAccumulator += kStreamTimerUpdateInterval;
-		if(config->logAccumulator > kStreamLogStatusInterval)
+		
+		// Pacing, avoids bursting one packet to every stream at the same instant
+		net_time_t txtimeInterval = shard->dueCount > 1 ? tick / shard->dueCount : 0;
+		
+		// Send data for each due stream
+		for(unsigned int i=0; i<shard->dueCount; ++i)
 		{
-			config->logAccumulator = 0.0f;
+			Stream * stream = shard->dueStreams[i];
+			net_time_t txtime = i > 0 ? now + i * txtimeInterval : 0;
 			
-			list_iterate(config->streams, ^(list_object_t object){
-				Stream * stream = (Stream *)object;
-				streamLog(stream);
-			});
+			if(shard->channels.count > 0)
+			{
+				// Fill from channels by priority, from where this stream left off
+				updateObject.capacity = streamDataCapacity(stream);
+				streamChannelsPack(&shard->channels, &stream->channelCursor, &updateObject);
+				streamSend(config, stream, &updateObject, NULL, txtime);
+			}
+			else
+			{
+				streamSend(config, stream, updateObjectPtr, body, txtime);
+			}
 		}
-#endif
+		
+		net_packet_body_release(body); // Retained by packets until written
 	}
+	
+	// Log status enabled in DEBUG only
+#if (DEBUG|TEST)
+	shard->logAccumulator += kStreamTimerUpdateInterval;
+	if(shard->logAccumulator > kStreamLogStatusInterval)
+	{
+		shard->logAccumulator = 0.0f;
+		
+		streamShardIterate(shard, ^(Stream * stream){
+			streamLog(stream);
+		});
+	}
+#endif
+}
+
+#pragma mark -
+#pragma mark Jitter Timer
+
+void streamJitterTimerCallback(void * context)
+{
+	StreamShard * shard = (StreamShard *)context;
+	StreamConfiguration * config = shard->config;
+	
+	__block net_time_t next = 0;
+	net_time_t now = net_time_now();
+	
+	shard->jitterTimerTime = 0; // Fired, disarmed
+	dispatch_source_set_timer(shard->jitterDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+	
+	// Release due snapshots of each stream, in order
+	streamShardIterate(shard, ^(Stream * stream){
+		if(stream->jitter == NULL)
+			return;
+		
+		StreamObject releaseObject;
+		streamObjectSetup(&releaseObject);
+		
+		while(streamJitterPop(stream->jitter, &releaseObject, now))
+			streamDeliver(config, stream, &releaseObject);
+		
+		net_time_t streamNext = streamJitterNextTime(stream->jitter, now);
+		if(streamNext > 0 && (next == 0 || streamNext < next))
+			next = streamNext;
+	});
+	
+	streamJitterSchedule(shard, next, now);
 }
 
 #pragma mark -
@@ -389,37 +1036,50 @@ void streamTimerCallback(void * context)
 void streamSocketReceiveCallback(void * context, net_packet_t packet)
 {	 
 	StreamConfiguration * config = (StreamConfiguration *)context;
-	dispatch_async(config->streamDispatchQueue, ^{
+	StreamShard * shard = streamShardForAddress(config, &packet->addr); // Owner shard
+	
+	dispatch_async(shard->streamDispatchQueue, ^{
         
 		bitstream_t * bitstream = &packet->bitstream;
 	
 		Sequence sequence;
 		Ack ack;
 		AckBitField ackBitField;
+		StreamHeaderOptions options;
 	
-		if(streamProtocolUnpackHeader(bitstream, &sequence, &ack, &ackBitField) == UnpackValid) // Only proceed if valid
+		if(streamProtocolUnpackHeader(bitstream, &sequence, &ack, &ackBitField, &options) == UnpackValid) // Only proceed if valid
 		{
-			Stream * stream = list_find(config->streams, ^(list_object_t object){
-				Stream * _stream = (Stream *)object;
-				return net_addr_is_equal(&_stream->address, &packet->addr);
-			});
+			Stream * stream = streamShardFind(shard, &packet->addr);
             
             if(stream == NULL)
             {
                 streamAdd(config, &packet->addr); // TODO improve...
             }
 			
-			if(stream)
+			// Read in place, unless it needs a copy (FEC, playout buffer or channel messages)
+			bool isView = false;
+			if(stream && config->receiveViewCallback && !(options.flags & StreamHeaderFlagFec) && !config->jitterBuffer)
+			{
+				size_t dataOffset = bitstream->offset;
+				StreamView receiveView;
+				if(streamProtocolUnpackView(bitstream, &receiveView) == UnpackValid && receiveView.tag != kStreamChannelTag)
+				{
+					streamReceiveView(config, stream, sequence, ack, ackBitField, &options, packet->time, &receiveView); // set received
+					isView = true;
+				}
+				bitstream->offset = dataOffset;
+			}
+			
+			if(stream && !isView)
 			{
 				StreamObject receiveObject;
                 streamObjectSetup(&receiveObject);
-				streamProtocolUnpackData(bitstream, &receiveObject); // unpack	
-                
-				streamReceive(config, stream, sequence, ack, ackBitField, &receiveObject); // set received
+				if(streamProtocolUnpackData(bitstream, &receiveObject) == UnpackValid) // unpack, invalid data drops the packet
+					streamReceive(config, stream, sequence, ack, ackBitField, &options, packet->time, &receiveObject); // set received
 			}
 		}
 			
 		net_packet_release(config->socket, packet); // release packet
 	});
 
-}
\ No newline at end of file
+}
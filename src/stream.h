@@ -10,6 +10,7 @@
 #define __universal_network_stream_h__
 
 #include "stream_protocol.h"
+#include "stream_channel.h"
 
 #include "net.h"
 #include "bitstream.h"
@@ -25,12 +26,25 @@
  *
  * The stream works on a dedicated socket, using UDP. The stream also adds reliability and 
  * flow control on top of UDP.
+ *
+ * Streams are partitioned by remote address hash across shards. Each shard has its own serial
+ * dispatch queue, update timer, stream table and packet pool, so streams of a single socket are
+ * serviced on up to as many cores as shards. Callbacks are called on the queue of the shard
+ * owning the stream, concurrently if there's more than one shard. The update callback is called
+ * once per update tick of a shard, for the streams of that shard which are due. Channel messages
+ * are queued per shard and sent by each of its streams when due.
  */
 
+#define kStreamShardMax 64
+
 typedef void (*StreamUpdateCallback)(void *, StreamObject *); // Update - Send data
 typedef void (*StreamReceiveCallback)(void *, net_addr_t *, StreamObject *); // Receive data
 typedef void (*StreamTimeoutCallback)(void *, net_addr_t *); // Timeout
 typedef void (*StreamSuspendCallback)(void *); // Suspend
+typedef void (*StreamUpdateViewCallback)(void *, StreamView *); // Update - Write data in place
+typedef void (*StreamReceiveViewCallback)(void *, net_addr_t *, StreamView *); // Receive data - Read data in place
+
+struct StreamShardStruct;
 
 /*!
  * @typedef StreamConfiguration
@@ -40,29 +54,40 @@ typedef struct {
 	net_socket_t socket; // Associated socket
     net_addr_t address; // Local socket address 
 	
-	dispatch_queue_t streamDispatchQueue; // Dispatch queue used to synchronize access to streams
-    dispatch_source_t streamDispatchTimer; // Dispatch timer used to update connected streams with data
-    float logAccumulator; // Time accumulator before next status log (Debug only)
-	bool active; // Suspend/Resume with change active state
+	struct StreamShardStruct * shards; // Streams partitioned by address hash, each shard is serviced by its own queue and timer
+	unsigned int shardCount;
+	volatile int streamCount; // Streams in all shards
+	unsigned int fecGroupSize; // FEC data packets per parity packet, 0 disables FEC (default)
+	bool jitterBuffer; // Received data is buffered and released in order, on a steady clock. Disabled by default
 	
 	StreamReceiveCallback receiveCallback; // Receive data callback (called on incoming data)
 	StreamUpdateCallback updateCallback; // Update data callback (called by local update timer)
 	StreamTimeoutCallback timeoutCallback; // Stream connected timeout callback (called when a stream becomes irresponsive)
     StreamSuspendCallback suspendCallback; // Stream suspend callback (called when there are no streams left and update timer is suspended)
+	StreamUpdateViewCallback updateViewCallback; // Used instead of updateCallback if set, writes directly into the packet body
+	StreamReceiveViewCallback receiveViewCallback; // Used instead of receiveCallback if set, reads directly from the received packet
 	void * context; // Context callback object
-	
-	list_t streams; // List of active streams
 } StreamConfiguration;
 
 NetError streamSetup(StreamConfiguration *, const unsigned int, void *, StreamUpdateCallback, StreamReceiveCallback, StreamTimeoutCallback, StreamSuspendCallback); // StreamUpdateCallback is mandatory
-void streamTeardown(StreamConfiguration *);
+NetError streamSetupShards(StreamConfiguration *, const unsigned int, const unsigned int, void *, StreamUpdateCallback, StreamReceiveCallback, StreamTimeoutCallback, StreamSuspendCallback); // Same, with up to kStreamShardMax shards (streamSetup has one)
+void streamTeardown(StreamConfiguration *); // Waits for shard queues, not to be called from callbacks
 
 void streamSuspend(StreamConfiguration *);
 void streamResume(StreamConfiguration *);
 
 void streamAdd(StreamConfiguration *, const net_addr_t *);
 void streamRemove(StreamConfiguration *, const net_addr_t *);
-bool streamDoesExist(StreamConfiguration *, const net_addr_t *);
+bool streamDoesExist(StreamConfiguration *, const net_addr_t *); // Waits for the owning shard queue, from callbacks only for streams of the same shard
+
+void streamSetFec(StreamConfiguration *, unsigned int); // Send a parity packet every N updates (up to 16), a single loss in each group is recovered. 0 disables
+void streamSetChannel(StreamConfiguration *, unsigned int, unsigned int, unsigned int); // Channel (up to 8), priority (0 is highest) and weight. Update callback gets a zero capacity object once set
+bool streamChannelSend(StreamConfiguration *, unsigned int, const uint8_t *, unsigned int); // Queues a message to the streams of the calling shard, false if full. Same queue as callbacks, received messages have the channel as tag
+bool streamChannelBroadcast(StreamConfiguration *, unsigned int, const uint8_t *, unsigned int); // Queues a message to every stream, on each shard queue. Any queue, false if invalid (full shard queues drop it)
+void streamSetViewCallbacks(StreamConfiguration *, StreamUpdateViewCallback, StreamReceiveViewCallback); // Zero-copy alternative to update/receive callbacks, NULL restores them. FEC, probes and jitter buffer still copy
+void streamSetJitterBuffer(StreamConfiguration *, bool); // Receive callback gets ordered snapshots, evenly spaced by adapting a playout delay to jitter
+
+bool streamRemoteToLocal(StreamConfiguration *, const net_addr_t *, net_time_t, net_time_t *); // Remote peer monotonic time (net_time_now) to local, false if not synchronized yet. Waits as streamDoesExist
 
 bool streamListIsEmpty(StreamConfiguration *);
 
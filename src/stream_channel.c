@@ -0,0 +1,289 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_channel.c
+* universal-network-c
+*/
+
+#include "stream_channel.h"
+
+static void streamChannelQueueWrite(StreamChannel * channel, const uint8_t * data, unsigned int length)
+{
+    unsigned int back = channel->back % kStreamChannelQueueCapacity;
+    unsigned int first = kStreamChannelQueueCapacity - back < length ? kStreamChannelQueueCapacity - back : length;
+    
+    memcpy(&channel->queue[back], data, first);
+    memcpy(channel->queue, data + first, length - first); // Wrap around
+    
+    channel->back += length;
+}
+
+static void streamChannelQueueRead(StreamChannel * channel, uint32_t position, uint8_t * data, unsigned int length)
+{
+    unsigned int front = position % kStreamChannelQueueCapacity;
+    unsigned int first = kStreamChannelQueueCapacity - front < length ? kStreamChannelQueueCapacity - front : length;
+    
+    memcpy(data, &channel->queue[front], first);
+    memcpy(data + first, channel->queue, length - first); // Wrap around
+}
+
+static unsigned int streamChannelQueuePeek(StreamChannel * channel, uint32_t position)
+{
+    return (channel->queue[position % kStreamChannelQueueCapacity] << 8) | channel->queue[(position + 1) % kStreamChannelQueueCapacity]; // Message length
+}
+
+static inline unsigned int streamChannelPriority(StreamChannel * channel, StreamChannelCursor * cursor)
+{
+    unsigned int promotion = cursor->age / kStreamChannelAging;
+    return channel->priority > promotion ? channel->priority - promotion : 0;
+}
+
+void streamChannelsClear(StreamChannelsRef ref)
+{
+    assert(ref != NULL);
+    
+    for(int i=0; i<kStreamChannelMax; ++i)
+    {
+        StreamChannel * channel = &ref->channels[i];
+        
+        channel->enabled = false;
+        channel->priority = 0;
+        channel->weight = 1;
+        channel->front = 0;
+        channel->back = 0;
+        channel->trim = 0;
+        channel->totalSent = 0;
+        channel->totalDropped = 0;
+    }
+    
+    ref->count = 0;
+}
+
+void streamChannelsSetup(StreamChannelsRef ref, unsigned int index, unsigned int priority, unsigned int weight)
+{
+    assert(ref != NULL);
+    assert(index < kStreamChannelMax);
+    
+    StreamChannel * channel = &ref->channels[index];
+    
+    if(!channel->enabled)
+        ref->count += 1;
+    
+    channel->enabled = true;
+    channel->priority = priority;
+    channel->weight = weight > 0 ? weight : 1;
+}
+
+bool streamChannelsHasRoom(StreamChannelsRef ref, unsigned int index, unsigned int length)
+{
+    assert(ref != NULL);
+    
+    return index >= kStreamChannelMax || ref->channels[index].back - ref->channels[index].front + 2 + length <= kStreamChannelQueueCapacity;
+}
+
+bool streamChannelsPush(StreamChannelsRef ref, unsigned int index, const uint8_t * data, unsigned int length)
+{
+    assert(ref != NULL);
+    
+    if(index >= kStreamChannelMax || !ref->channels[index].enabled || length > kStreamChannelMessageMaxLength)
+        return false;
+    
+    StreamChannel * channel = &ref->channels[index];
+    
+    if(!streamChannelsHasRoom(ref, index, length))
+    {
+        channel->totalDropped += 1; // Full
+        return false;
+    }
+    
+    uint8_t header[2] = { (uint8_t)(length >> 8), (uint8_t)length };
+    streamChannelQueueWrite(channel, header, 2);
+    streamChannelQueueWrite(channel, data, length);
+    
+    return true;
+}
+
+void streamChannelsCursorClear(StreamChannelsRef ref, StreamChannelsCursor * cursor)
+{
+    assert(ref != NULL);
+    
+    for(int i=0; i<kStreamChannelMax; ++i)
+    {
+        cursor->channels[i].position = ref->channels[i].back;
+        cursor->channels[i].deficit = 0;
+        cursor->channels[i].age = 0;
+    }
+    
+    cursor->next = 0;
+}
+
+bool streamChannelsCursorIsPending(StreamChannelsRef ref, const StreamChannelsCursor * cursor)
+{
+    for(int i=0; i<kStreamChannelMax; ++i)
+    {
+        if(ref->channels[i].enabled && cursor->channels[i].position != ref->channels[i].back)
+            return true;
+    }
+    
+    return false;
+}
+
+void streamChannelsPack(StreamChannelsRef ref, StreamChannelsCursor * cursor, StreamObject * object)
+{
+    assert(ref != NULL);
+    
+    bitstream_t bitstream = bitstream_create(object->data, object->capacity);
+    
+    int last = -1; // Last channel that sent
+    bool blocked[kStreamChannelMax]; // Empty or head message doesn't fit
+    bool sent[kStreamChannelMax];
+    
+    for(int i=0; i<kStreamChannelMax; ++i)
+    {
+        blocked[i] = !ref->channels[i].enabled || cursor->channels[i].position == ref->channels[i].back;
+        sent[i] = false;
+    }
+    
+    while(true)
+    {
+        // Highest priority level left, including promotions
+        unsigned int level = UINT32_MAX;
+        
+        for(int i=0; i<kStreamChannelMax; ++i)
+        {
+            if(!blocked[i] && streamChannelPriority(&ref->channels[i], &cursor->channels[i]) < level)
+                level = streamChannelPriority(&ref->channels[i], &cursor->channels[i]);
+        }
+        
+        if(level == UINT32_MAX)
+            break; // Nothing fits anymore
+        
+        // Deficit round robin among channels in level, until all are empty or blocked
+        bool active = true;
+        
+        while(active)
+        {
+            active = false;
+            
+            for(int k=0; k<kStreamChannelMax; ++k)
+            {
+                int i = (cursor->next + k) % kStreamChannelMax;
+                StreamChannel * channel = &ref->channels[i];
+                StreamChannelCursor * channelCursor = &cursor->channels[i];
+                
+                if(blocked[i] || streamChannelPriority(channel, channelCursor) != level)
+                    continue;
+                
+                unsigned int peek = streamChannelQueuePeek(channel, channelCursor->position);
+                if(bitstream.offset + bitstream_varint_length(mStreamChannelHeader(i, peek)) + peek > bitstream.bound)
+                {
+                    blocked[i] = true; // Doesn't fit, stays queued without quantum
+                    continue;
+                }
+                
+                channelCursor->deficit += channel->weight * kStreamChannelQuantum;
+                
+                while(channelCursor->position != channel->back)
+                {
+                    unsigned int length = streamChannelQueuePeek(channel, channelCursor->position);
+                    
+                    if(bitstream.offset + bitstream_varint_length(mStreamChannelHeader(i, length)) + length > bitstream.bound)
+                    {
+                        blocked[i] = true; // Doesn't fit, stays queued
+                        break;
+                    }
+                    
+                    if(length > channelCursor->deficit)
+                        break; // Next round
+                    
+                    bitstream_write_varint(&bitstream, mStreamChannelHeader(i, length));
+                    streamChannelQueueRead(channel, channelCursor->position + 2, &bitstream.data[bitstream.offset], length);
+                    bitstream_skip_bytes(&bitstream, length);
+                    
+                    channelCursor->position += 2 + length;
+                    channelCursor->deficit -= length;
+                    channel->totalSent += 1;
+                    sent[i] = true;
+                    last = i;
+                }
+                
+                if(channelCursor->position == channel->back)
+                {
+                    blocked[i] = true;
+                    channelCursor->deficit = 0; // Not backlogged
+                }
+                else if(channelCursor->deficit > kStreamObjectDataMaxLength)
+                {
+                    channelCursor->deficit = kStreamObjectDataMaxLength; // Blocked by capacity, don't accumulate indefinitely
+                }
+                
+                active |= !blocked[i];
+            }
+        }
+    }
+    
+    if(last >= 0)
+        cursor->next = (last + 1) % kStreamChannelMax;
+    
+    // Aging
+    for(int i=0; i<kStreamChannelMax; ++i)
+    {
+        StreamChannelCursor * channelCursor = &cursor->channels[i];
+        channelCursor->age = (channelCursor->position != ref->channels[i].back && !sent[i]) ? channelCursor->age + 1 : 0;
+    }
+    
+    object->tag = kStreamChannelTag;
+    object->length = bitstream.offset;
+}
+
+void streamChannelsTrimBegin(StreamChannelsRef ref)
+{
+    for(int i=0; i<kStreamChannelMax; ++i)
+        ref->channels[i].trim = ref->channels[i].back; // Everything, unless a cursor still needs it
+}
+
+void streamChannelsTrimCursor(StreamChannelsRef ref, const StreamChannelsCursor * cursor)
+{
+    for(int i=0; i<kStreamChannelMax; ++i)
+    {
+        StreamChannel * channel = &ref->channels[i];
+        uint32_t position = cursor->channels[i].position;
+        
+        if(position - channel->front < channel->trim - channel->front) // Distances from front, positions wrap around
+            channel->trim = position;
+    }
+}
+
+void streamChannelsTrimEnd(StreamChannelsRef ref)
+{
+    for(int i=0; i<kStreamChannelMax; ++i)
+        ref->channels[i].front = ref->channels[i].trim;
+}
+
+bool streamChannelsUnpack(const StreamObject * object, unsigned int * offset, StreamObject * message)
+{
+    if(object->tag != kStreamChannelTag || *offset >= object->length)
+        return false;
+    
+    bitstream_t bitstream = bitstream_create((uint8_t *)object->data, object->length);
+    bitstream_skip_bytes(&bitstream, *offset);
+    
+    uint64_t header;
+    if(!bitstream_read_varint(&bitstream, &header))
+        return false; // Truncated
+    
+    unsigned int channel = (unsigned int)(header & (kStreamChannelMax - 1));
+    uint64_t length = header >> 3;
+    
+    if(bitstream.offset + length > object->length || length > message->capacity)
+        return false; // Truncated
+    
+    message->tag = channel;
+    message->length = length;
+    memcpy(message->data, &bitstream.data[bitstream.offset], length);
+    
+    *offset = bitstream.offset + length;
+    
+    return true;
+}
@@ -0,0 +1,95 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_channel.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_stream_channel_h__
+#define __universal_network_stream_channel_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream_protocol.h"
+
+/*!
+ * @header
+ *
+ * Logical channels multiplexed in the stream object body, each one a queue of messages.
+ *
+ * Every update the body is filled up to its capacity (path MTU and congestion budget) from the channel
+ * with the highest priority (0) first. Channels with the same priority share the budget according to their
+ * weight (deficit round robin). Messages are never split, a message that doesn't fit stays queued and
+ * smaller ones from other channels may fill the rest. A channel with queued messages that sends nothing in
+ * kStreamChannelAging updates is promoted one priority level, so lower priorities are never starved.
+ *
+ * Queues are shared by every stream of a shard, each stream reads them through its own cursor (position,
+ * deficit and age per channel), so every stream sends every message whenever it is due. Messages are kept
+ * until every cursor is past them, they are trimmed when a queue runs out of room.
+ *
+ * Body format: Header (varint, Length << 3 | Channel), Data (Length Bytes), repeated. Tag is kStreamChannelTag.
+ * Messages under 16 Bytes have a 1 Byte header, 2 Bytes up to 2047 Bytes.
+ */
+
+#define kStreamChannelMax 8 // Channels per stream configuration
+#define kStreamChannelQueueCapacity 4096 // Bytes queued per channel, including 2 Bytes length per message
+#define kStreamChannelQuantum 64 // Bytes per unit of weight, per round
+#define kStreamChannelAging 8 // Updates without sending before promoting one priority level
+#define kStreamChannelOverheadLength 3 // Channel and Length, at most
+#define mStreamChannelHeader(channel, length) (((uint64_t)(length) << 3) | (channel)) // Channel in the 3 lowest bits
+#define kStreamChannelMessageMaxLength (kStreamObjectDataMaxLength-kStreamChannelOverheadLength)
+#define kStreamChannelTag 0x5543484e4c535632ULL // "UCHNLSV2", body contains channel messages
+
+typedef struct {
+    bool enabled;
+    unsigned int priority;      // 0 is the highest
+    unsigned int weight;        // Share of the budget among channels with the same priority
+    
+    uint8_t queue[kStreamChannelQueueCapacity]; // Ring buffer, 2 Bytes length followed by data
+    uint32_t front;             // Position of the oldest byte kept, positions only grow (index is position % capacity)
+    uint32_t back;              // Position after the newest byte
+    uint32_t trim;              // New front, while trimming
+    
+    unsigned int totalSent;     // Total messages sent, to any stream
+    unsigned int totalDropped;  // Total messages not queued (full)
+} StreamChannel;
+
+typedef struct {
+    StreamChannel channels[kStreamChannelMax];
+    unsigned int count;         // Enabled channels
+} StreamChannels;
+
+typedef StreamChannels * StreamChannelsRef;
+
+typedef struct {
+    uint32_t position;          // Next message to send
+    unsigned int deficit;       // Bytes this channel may still send in current round
+    unsigned int age;           // Consecutive updates with queued messages but nothing sent
+} StreamChannelCursor;
+
+typedef struct {
+    StreamChannelCursor channels[kStreamChannelMax];
+    unsigned int next;          // Round robin starts at the channel after the last one that sent
+} StreamChannelsCursor;
+
+void streamChannelsClear(StreamChannelsRef);
+void streamChannelsSetup(StreamChannelsRef, unsigned int, unsigned int, unsigned int); // Channel, priority and weight (>= 1)
+
+bool streamChannelsHasRoom(StreamChannelsRef, unsigned int, unsigned int); // Channel and message length, false if it must be trimmed first
+bool streamChannelsPush(StreamChannelsRef, unsigned int, const uint8_t *, unsigned int); // Returns false if channel is disabled, full or message is too long
+
+void streamChannelsCursorClear(StreamChannelsRef, StreamChannelsCursor *); // Starts after the last queued message
+bool streamChannelsCursorIsPending(StreamChannelsRef, const StreamChannelsCursor *); // Messages left to send
+void streamChannelsPack(StreamChannelsRef, StreamChannelsCursor *, StreamObject *); // Fills object up to its capacity, from the cursor on
+
+void streamChannelsTrimBegin(StreamChannelsRef); // Drops messages every cursor has sent, called with each cursor in between
+void streamChannelsTrimCursor(StreamChannelsRef, const StreamChannelsCursor *);
+void streamChannelsTrimEnd(StreamChannelsRef);
+
+bool streamChannelsUnpack(const StreamObject *, unsigned int *, StreamObject *); // Next message at offset (starts at 0) with tag set to its channel, false if none left
+
+#endif
@@ -0,0 +1,190 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_clock.c
+* universal-network-c
+*/
+
+#include "stream_clock.h"
+
+static inline unsigned int streamClockMicroseconds(net_time_t time)
+{
+    return (unsigned int)(time / kNetTimeMicrosecond); // Wraps around, same as header timestamps
+}
+
+static inline unsigned int streamClockOffsetAt(StreamClockRef ref, unsigned int offset, net_time_t offsetTime, net_time_t now)
+{
+    return offset + (int)(ref->drift * (float)(int64_t)(now - offsetTime) / kNetTimeMicrosecond); // Drift corrected
+}
+
+void streamClockClear(StreamClockRef ref)
+{
+    assert(ref != NULL);
+    
+    memset(ref->samples, 0, sizeof(ref->samples));
+    ref->sampleCount = 0;
+    
+    ref->valid = false;
+    ref->offset = 0;
+    ref->offsetTime = 0;
+    ref->rtt = 0.0f;
+    
+    ref->drift = 0.0f;
+    memset(&ref->driftSample, 0, sizeof(ref->driftSample));
+    ref->driftIntervalTime = 0;
+    ref->driftOffset = 0;
+    memset(ref->driftHistory, 0, sizeof(ref->driftHistory));
+    memset(ref->driftTime, 0, sizeof(ref->driftTime));
+    ref->driftCount = 0;
+    ref->fitValid = false;
+    ref->fitOffset = 0.0f;
+    ref->fitTime = 0;
+}
+
+static void streamClockDriftSample(StreamClockRef ref, const StreamClockSample * sample, net_time_t now)
+{
+    if(ref->sampleCount == 1) // First interval
+    {
+        ref->driftSample = *sample;
+        ref->driftIntervalTime = now;
+        return;
+    }
+    
+    if(sample->rtt < ref->driftSample.rtt)
+        ref->driftSample = *sample;
+    
+    if(now - ref->driftIntervalTime < kStreamClockDriftInterval)
+        return;
+    
+    // Interval complete, add its smallest rtt sample to history
+    if(ref->driftCount == 0)
+        ref->driftOffset = ref->driftSample.offset;
+    
+    unsigned int index = ref->driftCount % kStreamClockDriftSamples;
+    ref->driftHistory[index] = (float)(int)(ref->driftSample.offset - ref->driftOffset);
+    ref->driftTime[index] = ref->driftSample.time;
+    ref->driftCount += 1;
+    
+    ref->driftSample = *sample; // Next interval
+    ref->driftIntervalTime = now;
+    
+    unsigned int count = ref->driftCount < kStreamClockDriftSamples ? ref->driftCount : kStreamClockDriftSamples;
+    
+    if(count < 3)
+        return;
+    
+    // Least-squares slope, times relative to the newest sample
+    float meanTime = 0.0f, meanOffset = 0.0f;
+    
+    for(unsigned int i=0; i<count; ++i)
+    {
+        meanTime += -mNetTimeToSeconds(now - ref->driftTime[i]);
+        meanOffset += ref->driftHistory[i];
+    }
+    
+    meanTime /= count;
+    meanOffset /= count;
+    
+    float covariance = 0.0f, variance = 0.0f;
+    
+    for(unsigned int i=0; i<count; ++i)
+    {
+        float time = -mNetTimeToSeconds(now - ref->driftTime[i]) - meanTime;
+        covariance += time * (ref->driftHistory[i] - meanOffset);
+        variance += time * time;
+    }
+    
+    if(variance > 0.0f)
+    {
+        float drift = covariance / variance * 1e-6f; // Microseconds per second
+        
+        if(fabsf(drift) <= kStreamClockMaxDrift)
+        {
+            ref->drift = drift;
+            ref->fitValid = true;
+            ref->fitOffset = meanOffset - drift * 1e6f * meanTime; // At now
+            ref->fitTime = now;
+        }
+        else // Clock was stepped, start over
+        {
+            ref->drift = 0.0f;
+            ref->driftCount = 0;
+            ref->fitValid = false;
+        }
+    }
+}
+
+void streamClockProcessTimestamps(StreamClockRef ref, const StreamHeaderOptions * options, net_time_t now)
+{
+    assert(ref != NULL);
+    
+    if((options->flags & (StreamHeaderFlagTimestamp | StreamHeaderFlagEcho)) != (StreamHeaderFlagTimestamp | StreamHeaderFlagEcho))
+        return;
+    
+    unsigned int t1 = options->echoTimestamp; // Local send
+    unsigned int t3 = options->timestamp; // Remote send
+    unsigned int t4 = streamClockMicroseconds(now); // Local receive
+    
+    int rtt = (int)(t4 - t1 - options->echoDelay); // Wrap around safe
+    
+    if(rtt < 0)
+        rtt = 0; // Rounding to microseconds
+    
+    if(rtt > kStreamReliabilityMaxRtt * 1000000) // Discard invalid or stale echoes
+        return;
+    
+    unsigned int remoteReceive = t3 - t1 - options->echoDelay; // T2 - T1
+    unsigned int remoteSend = t3 - t4; // T3 - T4
+    
+    StreamClockSample * sample = &ref->samples[ref->sampleCount % kStreamClockSamples];
+    sample->offset = remoteSend + (int)(remoteReceive - remoteSend) / 2; // Average, wrap around safe
+    sample->rtt = rtt / 1000000.0f;
+    sample->time = now;
+    ref->sampleCount += 1;
+    
+    // Clock filter, smallest rtt
+    unsigned int count = ref->sampleCount < kStreamClockSamples ? ref->sampleCount : kStreamClockSamples;
+    StreamClockSample * best = &ref->samples[0];
+    
+    for(unsigned int i=1; i<count; ++i)
+    {
+        if(ref->samples[i].rtt < best->rtt)
+            best = &ref->samples[i];
+    }
+    
+    streamClockDriftSample(ref, sample, now);
+    
+    ref->valid = true;
+    ref->offset = streamClockOffsetAt(ref, best->offset, best->time, now);
+    ref->offsetTime = now;
+    ref->rtt = best->rtt;
+    
+    if(ref->fitValid)
+    {
+        unsigned int fit = ref->driftOffset + (int)(ref->fitOffset + ref->drift * 1e6f * mNetTimeToSeconds(now - ref->fitTime));
+        
+        if(abs((int)(fit - ref->offset)) <= (int)(best->rtt * 500000.0f)) // Within half the rtt of the filtered sample
+        {
+            ref->offset = fit;
+        }
+        else // Clock was stepped, start over
+        {
+            ref->drift = 0.0f;
+            ref->driftCount = 0;
+            ref->fitValid = false;
+        }
+    }
+}
+
+net_time_t streamClockRemoteToLocal(StreamClockRef ref, net_time_t remoteTime, net_time_t now)
+{
+    assert(ref != NULL);
+    assert(ref->valid);
+    
+    unsigned int offset = streamClockOffsetAt(ref, ref->offset, ref->offsetTime, now);
+    unsigned int local = streamClockMicroseconds(remoteTime) - offset;
+    int delta = (int)(local - streamClockMicroseconds(now)); // Relative to now, wrap around safe
+    
+    return (net_time_t)((int64_t)now + (int64_t)delta * kNetTimeMicrosecond);
+}
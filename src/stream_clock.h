@@ -0,0 +1,77 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_clock.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_stream_clock_h__
+#define __universal_network_stream_clock_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream_reliability.h"
+
+/*!
+ * @header
+ *
+ * Remote clock synchronization for a single stream (NTP-style, no dedicated probes).
+ *
+ * Every header with a timestamp and an echo is a sample: T1 local send (Echo Timestamp), T2 remote receive,
+ * T3 remote send (Timestamp), T4 local receive, where T3 - T2 is the Echo Delay.
+ * Offset = ((T2 - T1) + (T3 - T4)) / 2 and Rtt = (T4 - T1) - (T3 - T2).
+ *
+ * Only the sample with the smallest rtt of the last kStreamClockSamples is used (clock filter), since its 
+ * offset has the smallest error (half the rtt asymmetry). Drift is the least-squares slope of the smallest 
+ * rtt sample of each kStreamClockDriftInterval, so conversions stay accurate between samples. Once there is
+ * a fit, it is used as offset (averages the asymmetry of many samples) as long as it is within the error
+ * bound of the filtered sample, otherwise the remote clock was stepped and the history is discarded.
+ *
+ * Times are wrapped microseconds (same as header timestamps), conversions are valid within ~35 minutes of now.
+ */
+
+#define kStreamClockSamples 8 // Clock filter, ~0.5 sec. at max. update rate
+#define kStreamClockDriftSamples 32 // Drift history, ~30 sec.
+#define kStreamClockDriftInterval kNetTimeSecond // 1 sec. between drift samples
+#define kStreamClockMaxDrift 0.001f // 1000 ppm, larger estimates are discarded
+
+typedef struct {
+    unsigned int offset;        // Remote minus local clock, in microseconds (wraps around)
+    float rtt;                  // Round trip time in seconds
+    net_time_t time;            // Local time when sampled
+} StreamClockSample;
+
+typedef struct {
+    StreamClockSample samples[kStreamClockSamples]; // Ring buffer
+    unsigned int sampleCount;   // Total samples
+    
+    bool valid;                 // Synchronized, at least one sample
+    unsigned int offset;        // Filtered offset at offsetTime, in microseconds (wraps around)
+    net_time_t offsetTime;      // Local time of filtered offset
+    float rtt;                  // Rtt of filtered offset sample, error is at most rtt/2
+    
+    float drift;                // Remote clock drift relative to local, seconds per second
+    StreamClockSample driftSample; // Smallest rtt sample in current drift interval
+    net_time_t driftIntervalTime; // Local time when current drift interval started
+    unsigned int driftOffset;   // Reference offset for drift history
+    float driftHistory[kStreamClockDriftSamples]; // Offset minus driftOffset, in microseconds
+    net_time_t driftTime[kStreamClockDriftSamples]; // Local time of each drift sample
+    unsigned int driftCount;    // Total drift samples
+    bool fitValid;              // Drift history has a least-squares fit
+    float fitOffset;            // Fit offset at fitTime minus driftOffset, in microseconds
+    net_time_t fitTime;         // Local time of fitOffset
+} StreamClock;
+
+typedef StreamClock * StreamClockRef;
+
+void streamClockClear(StreamClockRef);
+
+void streamClockProcessTimestamps(StreamClockRef, const StreamHeaderOptions *, net_time_t); // Header timestamps received, changes offset and drift
+
+net_time_t streamClockRemoteToLocal(StreamClockRef, net_time_t, net_time_t); // Remote monotonic time to local, relative to local now (must be synchronized)
+
+#endif
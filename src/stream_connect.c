@@ -0,0 +1,448 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_connect.c
+* universal-network-c
+*/
+
+#include "stream_connect.h"
+#include "stun_utils.h"
+#include "universal_network_c.h"
+
+#pragma mark -
+#pragma mark Checks
+
+static StreamConnectPair * streamConnectFindPair(StreamConnectRef ref, const net_addr_t * addr)
+{
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        if(net_addr_is_equal(&ref->pairs[i].addr, addr))
+            return &ref->pairs[i];
+    }
+
+    return NULL;
+}
+
+static StreamConnectPair * streamConnectNextPair(StreamConnectRef ref)
+{
+    StreamConnectPair * next = NULL;
+
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        StreamConnectPair * pair = &ref->pairs[i];
+        if(pair->state != StreamCheckWaiting)
+            continue;
+
+        if(next == NULL || (pair->isTriggered && !next->isTriggered) || (pair->isTriggered == next->isTriggered && pair->priority > next->priority))
+            next = pair;
+    }
+
+    return next;
+}
+
+static void streamConnectSendCheck(StreamConnectRef ref, StreamConnectPair * pair, net_time_t now, bool isRetransmission)
+{
+    if(!isRetransmission)
+    {
+        stunGenerateTransactionId(&pair->transactionId);
+        pair->transmissions = 0;
+    }
+
+    uint8_t data[kStreamConnectMessageMaxLen];
+    bitstream_t bitstream = bitstream_create(data, kStreamConnectMessageMaxLen);
+    stunProtocolPackBindingCheck(&bitstream, pair->transactionId, pair == ref->nominated);
+    stunProtocolPackFingerprint(&bitstream);
+    ref->sendCallback(ref->context, &pair->addr, data, bitstream.offset);
+
+    pair->state = StreamCheckInProgress;
+    pair->isTriggered = false;
+    pair->sentTime = now;
+    pair->deadline = now + (mNetTimeFromSeconds(kStreamConnectRto) << pair->transmissions); // Exponential backoff
+    ++pair->transmissions;
+}
+
+static void streamConnectSucceed(StreamConnectRef ref, const net_addr_t * addr, net_time_t rtt)
+{
+    net_addr_copy(&ref->selectedAddr, addr);
+    ref->selectedRtt = rtt;
+    ref->state = StreamConnectSucceeded;
+}
+
+static void streamConnectNominate(StreamConnectRef ref, net_time_t now)
+{
+    StreamConnectPair * best = NULL;
+
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        StreamConnectPair * pair = &ref->pairs[i];
+        if(pair->state == StreamCheckSucceeded && (best == NULL || pair->rtt < best->rtt))
+            best = pair;
+    }
+
+    if(best)
+    {
+        ref->state = StreamConnectNominating;
+        ref->nominated = best;
+        streamConnectSendCheck(ref, best, now, false); // Same check, with USE-CANDIDATE
+    }
+}
+
+void streamConnectClear(StreamConnectRef ref, bool isControlling, const StunResults * results, void * context, StreamConnectSendCallback sendCallback)
+{
+    assert(ref != NULL);
+
+    memset(ref, 0, sizeof(StreamConnect));
+
+    ref->state = StreamConnectChecking;
+    ref->isControlling = isControlling;
+
+    if(results && results->didBindingTestSuccess)
+    {
+        ref->isLocalDirect = results->isMappingDirect;
+        net_addr_copy(&ref->localMappedAddr, &results->mappedAddr);
+    }
+
+    ref->context = context;
+    ref->sendCallback = sendCallback;
+}
+
+bool streamConnectAddCandidate(StreamConnectRef ref, const net_addr_t * addr, StreamCandidateType type)
+{
+    assert(ref != NULL);
+
+    if(addr->sin_port == 0 || streamConnectFindPair(ref, addr))
+        return true; // Unknown or already a candidate
+
+    if(ref->pairCount == kStreamConnectCandidatesMax)
+        return false;
+
+    StreamConnectPair * pair = &ref->pairs[ref->pairCount++];
+    memset(pair, 0, sizeof(StreamConnectPair));
+    net_addr_copy(&pair->addr, addr);
+    pair->type = type;
+    pair->state = StreamCheckWaiting;
+
+    return true;
+}
+
+void streamConnectStart(StreamConnectRef ref, net_time_t now)
+{
+    assert(ref != NULL);
+
+    // Same NAT if the peer's mapped host is ours, host candidates are reachable (no hairpinning needed)
+    bool isSameNat = false;
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        if(ref->pairs[i].type == StreamCandidateReflexive && ref->localMappedAddr.sin_addr.s_addr != 0 && ref->pairs[i].addr.sin_addr.s_addr == ref->localMappedAddr.sin_addr.s_addr)
+            isSameNat = true;
+    }
+
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        StreamConnectPair * pair = &ref->pairs[i];
+        if(pair->type == StreamCandidateHost)
+            pair->priority = (ref->isLocalDirect || isSameNat) ? 3 : 1;
+        else
+            pair->priority = 2;
+    }
+
+    ref->startTime = now;
+    ref->nextCheckTime = now;
+    ref->state = ref->pairCount > 0 ? StreamConnectChecking : StreamConnectFailed;
+}
+
+net_time_t streamConnectUpdate(StreamConnectRef ref, net_time_t now)
+{
+    assert(ref != NULL);
+
+    if(ref->state == StreamConnectSucceeded || ref->state == StreamConnectFailed)
+        return 0;
+
+    net_time_t timeout = ref->startTime + mNetTimeFromSeconds(kStreamConnectTimeout);
+    if(now >= timeout)
+    {
+        ref->state = StreamConnectFailed;
+        return 0;
+    }
+
+    // Retransmissions
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        StreamConnectPair * pair = &ref->pairs[i];
+        if(pair->state == StreamCheckInProgress && now >= pair->deadline)
+        {
+            if(pair->transmissions > kStreamConnectRetries)
+            {
+                pair->state = StreamCheckFailed;
+                if(pair == ref->nominated) // Path went away while nominating
+                {
+                    ref->state = StreamConnectFailed;
+                    return 0;
+                }
+            }
+            else
+            {
+                streamConnectSendCheck(ref, pair, now, true);
+            }
+        }
+    }
+
+    // New check, paced
+    if(ref->state == StreamConnectChecking && now >= ref->nextCheckTime)
+    {
+        StreamConnectPair * pair = streamConnectNextPair(ref);
+        if(pair)
+        {
+            streamConnectSendCheck(ref, pair, now, false);
+            ref->nextCheckTime = now + mNetTimeFromSeconds(kStreamConnectPacing);
+        }
+    }
+
+    bool isPending = false;
+    bool hasSucceeded = false;
+    net_time_t next = timeout;
+
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        StreamConnectPair * pair = &ref->pairs[i];
+        if(pair->state == StreamCheckInProgress)
+        {
+            isPending = true;
+            if(pair->deadline < next)
+                next = pair->deadline;
+        }
+        else if(pair->state == StreamCheckWaiting)
+        {
+            isPending = true;
+            if(ref->nextCheckTime < next)
+                next = ref->nextCheckTime;
+        }
+        else if(pair->state == StreamCheckSucceeded)
+        {
+            hasSucceeded = true;
+        }
+    }
+
+    if(ref->isControlling && ref->state == StreamConnectChecking)
+    {
+        if(hasSucceeded && (now >= ref->selectTime || !isPending)) // Lower RTT pairs had their chance
+        {
+            streamConnectNominate(ref, now);
+            if(ref->nominated->deadline < next)
+                next = ref->nominated->deadline;
+        }
+        else if(hasSucceeded)
+        {
+            if(ref->selectTime < next)
+                next = ref->selectTime;
+        }
+        else if(!isPending) // Every pair failed
+        {
+            ref->state = StreamConnectFailed;
+            return 0;
+        }
+    }
+
+    return next; // Controlled peer waits for the nomination until timeout
+}
+
+bool streamConnectReceive(StreamConnectRef ref, const net_addr_t * addr, bitstream_t * bitstream, net_time_t now)
+{
+    assert(ref != NULL);
+
+    StunTransactionId transactionId;
+    bitstream_t requestBitstream = *bitstream;
+    StunBindingRequest bindingRequest;
+
+    int result = stunProtocolUnpackBindingRequest(&requestBitstream, &transactionId, &bindingRequest);
+    if(result == kStunValid) // Check from the peer
+    {
+        // Answer, tells the peer its address as seen from here
+        uint8_t data[kStreamConnectMessageMaxLen];
+        bitstream_t responseBitstream = bitstream_create(data, kStreamConnectMessageMaxLen);
+        stunProtocolPackBindingCheckResponse(&responseBitstream, transactionId, addr);
+        stunProtocolPackFingerprint(&responseBitstream);
+        ref->sendCallback(ref->context, addr, data, responseBitstream.offset);
+
+        if(ref->state != StreamConnectChecking && ref->state != StreamConnectNominating)
+            return true;
+
+        // Peer reflexive if unknown, triggered check if not confirmed yet
+        StreamConnectPair * pair = streamConnectFindPair(ref, addr);
+        if(!pair && streamConnectAddCandidate(ref, addr, StreamCandidatePeerReflexive))
+            pair = streamConnectFindPair(ref, addr);
+
+        if(pair && (pair->state == StreamCheckWaiting || pair->state == StreamCheckFailed))
+        {
+            pair->state = StreamCheckWaiting;
+            pair->isTriggered = true;
+            ref->nextCheckTime = now;
+        }
+
+        if(bindingRequest.hasUseCandidate && !ref->isControlling) // Controlled, the nominated path is where it came from
+            streamConnectSucceed(ref, addr, pair && pair->state == StreamCheckSucceeded ? pair->rtt : 0);
+
+        return true;
+    }
+
+    if(result != kStunUnexpected)
+        return false;
+
+    StunBindingResponse bindingResponse;
+    memset(&bindingResponse, 0, sizeof(StunBindingResponse));
+
+    if(stunProtocolUnpackBindingResponse(bitstream, &transactionId, &bindingResponse) != kStunValid)
+        return false;
+
+    for(unsigned int i=0; i<ref->pairCount; ++i)
+    {
+        StreamConnectPair * pair = &ref->pairs[i];
+        if(pair->state != StreamCheckInProgress || !stunIsEqualTransactionId(&pair->transactionId, &transactionId))
+            continue;
+
+        if(!net_addr_is_equal(&pair->addr, addr)) // Not symmetric, the path back is different
+            break;
+
+        pair->state = StreamCheckSucceeded;
+        pair->rtt = now - pair->sentTime;
+
+        if(pair == ref->nominated)
+            streamConnectSucceed(ref, addr, pair->rtt);
+        else if(ref->selectTime == 0)
+            ref->selectTime = now + 2 * pair->rtt; // Wait for pairs with a lower RTT
+
+        break;
+    }
+
+    return true;
+}
+
+#pragma mark -
+#pragma mark Stream socket
+
+struct StreamConnectSessionStruct {
+    StreamConnect checks;
+    StreamConfiguration * config;
+    net_socket_demux_t demux;
+    dispatch_queue_t connectDispatchQueue;
+    dispatch_source_t connectDispatchTimer; // One-shot, armed at the next check deadline
+    bool didComplete; // Callback was called
+    StreamConnectCallback callback;
+    void * context;
+};
+
+static void streamConnectSessionSend(void * context, const net_addr_t * addr, const uint8_t * data, size_t length)
+{
+    stream_connect_t session = (stream_connect_t)context;
+    net_socket_t socket = session->config->socket;
+
+    net_packet_t packet = net_packet_alloc(socket);
+    if(packet)
+    {
+        net_addr_copy(&packet->addr, addr);
+        bitstream_write_raw(&packet->bitstream, data, length);
+        net_socket_send(socket, packet);
+        net_packet_release(socket, packet);
+    }
+}
+
+static void streamConnectSessionUpdate(stream_connect_t session, net_time_t now)
+{
+    net_time_t next = streamConnectUpdate(&session->checks, now);
+
+    if(next > 0)
+        dispatch_source_set_timer(session->connectDispatchTimer, dispatch_time(DISPATCH_TIME_NOW, next > now ? next - now : 0), DISPATCH_TIME_FOREVER, kStreamConnectTimerLeeway);
+    else
+        dispatch_source_set_timer(session->connectDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+
+    if(!session->didComplete && (session->checks.state == StreamConnectSucceeded || session->checks.state == StreamConnectFailed))
+    {
+        session->didComplete = true;
+
+        if(session->checks.state == StreamConnectSucceeded)
+        {
+            mNetworkLog("Connectivity check selected %s:%u (rtt %.2fms)", inet_ntoa(session->checks.selectedAddr.sin_addr), ntohs(session->checks.selectedAddr.sin_port), mNetTimeToSeconds(session->checks.selectedRtt) * 1000.0);
+            streamAdd(session->config, &session->checks.selectedAddr);
+            session->callback(session->context, &session->checks.selectedAddr);
+        }
+        else
+        {
+            session->callback(session->context, NULL);
+        }
+    }
+}
+
+static void streamConnectTimerCallback(void * context)
+{
+    stream_connect_t session = (stream_connect_t)context;
+    streamConnectSessionUpdate(session, net_time_now());
+}
+
+stream_connect_t streamConnectCreate(StreamConfiguration * config, bool isControlling, const StunResults * results, const net_addr_t * remoteLocalAddr, const net_addr_t * remoteMappedAddr, void * context, StreamConnectCallback callback)
+{
+    if(!config || !callback)
+        return NULL;
+
+    stream_connect_t session = calloc(1, sizeof(struct StreamConnectSessionStruct));
+    if(!session)
+        return NULL;
+
+    session->config = config;
+    session->callback = callback;
+    session->context = context;
+
+    streamConnectClear(&session->checks, isControlling, results, session, streamConnectSessionSend);
+    if(remoteLocalAddr)
+        streamConnectAddCandidate(&session->checks, remoteLocalAddr, StreamCandidateHost);
+    if(remoteMappedAddr)
+        streamConnectAddCandidate(&session->checks, remoteMappedAddr, StreamCandidateReflexive);
+
+    // Dispatch queue and timer
+    session->connectDispatchQueue = dispatch_queue_create("com.laugga.connectDispatchQueue", NULL);
+    session->connectDispatchTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, session->connectDispatchQueue);
+    dispatch_source_set_timer(session->connectDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+    dispatch_set_context(session->connectDispatchTimer, session);
+    dispatch_source_set_event_handler_f(session->connectDispatchTimer, &streamConnectTimerCallback);
+    dispatch_resume(session->connectDispatchTimer);
+
+    // STUN datagrams of the stream socket, stream datagrams keep going to the stream
+    session->demux = net_socket_demux_add_block(config->socket, 0x00, kStunProtocolFirstByteMax, stunProtocolHasValidFingerprint, ^(net_packet_t packet) {
+        dispatch_async(session->connectDispatchQueue, ^{
+            net_time_t now = net_time_now();
+            if(streamConnectReceive(&session->checks, &packet->addr, &packet->bitstream, now))
+                streamConnectSessionUpdate(session, now);
+            net_packet_release(config->socket, packet);
+        });
+    });
+
+    if(session->demux == kNetSocketDemuxNone)
+    {
+        mNetworkLog("Error stream socket demux table is full");
+        streamConnectDestroy(session);
+        return NULL;
+    }
+
+    dispatch_async(session->connectDispatchQueue, ^{
+        net_time_t now = net_time_now();
+        streamConnectStart(&session->checks, now);
+        streamConnectSessionUpdate(session, now);
+    });
+
+    return session;
+}
+
+void streamConnectDestroy(stream_connect_t session)
+{
+    if(session)
+    {
+        net_socket_demux_remove(session->config->socket, session->demux); // Returns once deliveries in flight have dispatched to connect queue
+
+        dispatch_source_cancel(session->connectDispatchTimer); // Handler will not fire again
+        dispatch_sync(session->connectDispatchQueue, ^{ /* Wait for pending blocks */ });
+        dispatch_release(session->connectDispatchTimer);
+        dispatch_release(session->connectDispatchQueue);
+
+        free(session);
+    }
+}
@@ -0,0 +1,135 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_connect.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_stream_connect_h__
+#define __universal_network_stream_connect_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream.h"
+#include "stun_protocol.h"
+#include "stun_tests.h"
+
+/*!
+ * @header
+ *
+ * Connectivity checks between two peers before a stream is added (ICE-lite style, RFC 8445 without gathering).
+ *
+ * Both peers know each other's local and mapped address (TransactionObjectConnect). Each sends STUN binding
+ * requests from the stream socket to every remote candidate, paced by kStreamConnectPacing, and answers the
+ * requests it receives. Outgoing checks open the local NAT towards the peer, so checks of both peers meet
+ * through address restricted NATs. A request from an address that is not a candidate (e.g. the peer is behind
+ * a NAT with address dependent mapping) adds it as a peer reflexive candidate, checked right away.
+ *
+ * Check order comes from the local NAT classification: host candidates first when there is no NAT or both
+ * peers share the mapped host (same NAT), mapped candidates first otherwise.
+ *
+ * The controlling peer (connect requester) waits for other pairs up to two RTTs after the first one succeeds,
+ * then nominates the lowest RTT pair with USE-CANDIDATE. The controlled peer selects the address the
+ * nomination came from, so both peers select the same path. A pair fails after kStreamConnectRetries
+ * retransmissions, checks give up after kStreamConnectTimeout.
+ *
+ * Checks and responses end with FINGERPRINT, the stream socket only hands STUN datagrams with a valid one to the
+ * checks, so corrupted or foreign datagrams are dropped before parsing.
+ *
+ * StreamConnect holds the check state only, datagrams are sent through a callback and time is passed in.
+ * stream_connect_t runs it on the stream socket and adds the selected address with streamAdd.
+ */
+
+#define kStreamConnectCandidatesMax 8 // Remote candidates, peer reflexive included
+#define kStreamConnectPacing 0.02 // 20 ms between new checks
+#define kStreamConnectRto 0.1 // 100 ms, doubled on each retransmission
+#define kStreamConnectRetries 4 // Retransmissions before a pair fails (1.5 s)
+#define kStreamConnectTimeout 5.0 // 5 s, overall
+#define kStreamConnectMessageMaxLen (kStunHeaderLen + 12 + kStunFingerprintLen) // Check response, XOR-MAPPED-ADDRESS and FINGERPRINT
+#define kStreamConnectTimerLeeway (1 * NSEC_PER_MSEC)
+
+typedef enum {
+    StreamCandidateHost,            // Remote local address
+    StreamCandidateReflexive,       // Remote mapped address
+    StreamCandidatePeerReflexive    // Learned from an incoming check
+} StreamCandidateType;
+
+typedef enum {
+    StreamCheckWaiting,
+    StreamCheckInProgress,
+    StreamCheckSucceeded,
+    StreamCheckFailed
+} StreamCheckState;
+
+typedef struct {
+    net_addr_t addr;                // Remote candidate, the local one is always the stream socket
+    StreamCandidateType type;
+    unsigned int priority;          // Higher is checked first
+    bool isTriggered;               // Checked before any other waiting pair
+    StreamCheckState state;
+    StunTransactionId transactionId;
+    unsigned int transmissions;
+    net_time_t sentTime;            // Last transmission
+    net_time_t deadline;            // Next retransmission
+    net_time_t rtt;                 // Valid once succeeded
+} StreamConnectPair;
+
+typedef enum {
+    StreamConnectChecking,
+    StreamConnectNominating,        // Controlling, USE-CANDIDATE sent on the selected pair
+    StreamConnectSucceeded,
+    StreamConnectFailed
+} StreamConnectState;
+
+typedef void (*StreamConnectSendCallback)(void *, const net_addr_t *, const uint8_t *, size_t); // Datagram to send from the stream socket
+
+typedef struct {
+    StreamConnectState state;
+    bool isControlling;
+    bool isLocalDirect;             // No local NAT
+    net_addr_t localMappedAddr;     // Zero if unknown
+
+    StreamConnectPair pairs[kStreamConnectCandidatesMax];
+    unsigned int pairCount;
+    StreamConnectPair * nominated;  // Selected pair, once nominating
+
+    net_time_t startTime;
+    net_time_t nextCheckTime;       // Pacing
+    net_time_t selectTime;          // Controlling, nominate by then (0 until a pair succeeds)
+
+    net_addr_t selectedAddr;        // Valid once succeeded
+    net_time_t selectedRtt;
+
+    StreamConnectSendCallback sendCallback;
+    void * context;
+} StreamConnect;
+
+typedef StreamConnect * StreamConnectRef;
+
+void streamConnectClear(StreamConnectRef, bool isControlling, const StunResults *, void *, StreamConnectSendCallback); // NULL results if the local NAT was not classified
+bool streamConnectAddCandidate(StreamConnectRef, const net_addr_t *, StreamCandidateType); // Before start, false if full. Duplicates are ignored
+
+void streamConnectStart(StreamConnectRef, net_time_t);
+net_time_t streamConnectUpdate(StreamConnectRef, net_time_t); // Sends due checks, returns the next deadline (0 once done)
+bool streamConnectReceive(StreamConnectRef, const net_addr_t *, bitstream_t *, net_time_t); // STUN datagram, false if not a check or check response. Checks are answered even once done
+
+/*!
+ * @typedef stream_connect_t
+ * @abstract Connectivity checks on the stream socket, the selected address is added with streamAdd
+ * @discussion
+ * STUN datagrams of the stream socket are demultiplexed to the checks until destroyed, one peer at a time.
+ * The callback is called once, on the checks queue, after streamAdd.
+ */
+
+typedef void (*StreamConnectCallback)(void *, const net_addr_t *); // Selected remote address, NULL if no pair works
+
+typedef struct StreamConnectSessionStruct * stream_connect_t;
+
+stream_connect_t streamConnectCreate(StreamConfiguration *, bool isControlling, const StunResults *, const net_addr_t * remoteLocalAddr, const net_addr_t * remoteMappedAddr, void *, StreamConnectCallback);
+void streamConnectDestroy(stream_connect_t); // Stops answering checks, not to be called from the callback
+
+#endif
@@ -0,0 +1,173 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_fec.c
+* universal-network-c
+*/
+
+#include "stream_fec.h"
+#include "stream_reliability.h"
+
+static void streamFecParityClear(StreamFecParity * parity)
+{
+    memset(parity->object.data, 0, parity->object.length); // Only the used part
+    parity->object.length = 0;
+    parity->object.capacity = kStreamObjectDataMaxLength;
+    parity->object.tag = 0;
+    parity->length = 0;
+}
+
+static void streamFecParityAdd(StreamFecParity * parity, uint64_t tag, unsigned int length, const uint8_t * data, unsigned int dataLength)
+{
+    parity->object.tag ^= tag;
+    parity->length ^= length;
+    
+    for(unsigned int i=0; i<dataLength; ++i)
+        parity->object.data[i] ^= data[i];
+    
+    if(dataLength > parity->object.length)
+        parity->object.length = dataLength; // Zero padded
+}
+
+void streamFecClear(StreamFecRef ref, unsigned int groupSize)
+{
+    assert(ref != NULL);
+    assert(groupSize <= kStreamFecMaxGroupSize);
+    
+    ref->groupSize = groupSize;
+    
+    ref->sendGroup = 0;
+    ref->sendCount = 0;
+    ref->sendIndex = 0;
+    ref->sendParity.object.length = kStreamObjectDataMaxLength;
+    streamFecParityClear(&ref->sendParity);
+    
+    ref->receiveValid = false;
+    ref->receiveGroup = 0;
+    ref->receiveCount = 0;
+    ref->receiveBits = 0;
+    ref->receiveParityValid = false;
+    ref->receiveRecoveredIndex = 0;
+    ref->receiveParity.object.length = kStreamObjectDataMaxLength;
+    streamFecParityClear(&ref->receiveParity);
+}
+
+void streamFecPackData(StreamFecRef ref, StreamHeaderOptions * options, const StreamObject * object)
+{
+    assert(ref != NULL);
+    
+    if(ref->sendIndex == 0) // New group
+    {
+        if(ref->groupSize == 0)
+            return; // Disabled
+        
+        ref->sendCount = ref->groupSize;
+        streamFecParityClear(&ref->sendParity);
+    }
+    
+    options->flags |= StreamHeaderFlagFec;
+    options->fecGroup = ref->sendGroup;
+    options->fecIndex = ref->sendIndex;
+    options->fecCount = ref->sendCount;
+    
+    streamFecParityAdd(&ref->sendParity, object->tag, object->length, object->data, object->length);
+    
+    ref->sendIndex += 1;
+}
+
+StreamObject * streamFecParity(StreamFecRef ref, StreamHeaderOptions * options)
+{
+    assert(ref != NULL);
+    
+    if(ref->sendIndex == 0 || ref->sendIndex < ref->sendCount)
+        return NULL; // Group not complete
+    
+    options->flags |= StreamHeaderFlagFec | StreamHeaderFlagParity;
+    options->fecGroup = ref->sendGroup;
+    options->fecIndex = ref->sendCount;
+    options->fecCount = ref->sendCount;
+    options->fecLength = ref->sendParity.length;
+    
+    ref->sendIndex = 0; // Next group
+    increase(&ref->sendGroup, kStreamFecMaxGroup);
+    
+    return &ref->sendParity.object;
+}
+
+bool streamFecReceive(StreamFecRef ref, const StreamHeaderOptions * options, const StreamObject * object)
+{
+    assert(ref != NULL);
+    
+    if((options->flags & StreamHeaderFlagFec) == 0)
+        return true; // Not protected
+    
+    bool parity = (options->flags & StreamHeaderFlagParity) != 0;
+    
+    if(options->fecCount == 0 || options->fecCount > kStreamFecMaxGroupSize || options->fecIndex > options->fecCount || (parity != (options->fecIndex == options->fecCount)))
+        return false; // Invalid
+    
+    if(!ref->receiveValid || (options->fecGroup != ref->receiveGroup && isSequenceMoreRecent(options->fecGroup, ref->receiveGroup, kStreamFecMaxGroup)))
+    {
+        // New group, discard previous one
+        ref->receiveValid = true;
+        ref->receiveGroup = options->fecGroup;
+        ref->receiveCount = options->fecCount;
+        ref->receiveBits = 0;
+        ref->receiveParityValid = false;
+        streamFecParityClear(&ref->receiveParity);
+    }
+    else if(options->fecGroup != ref->receiveGroup || options->fecCount != ref->receiveCount)
+    {
+        return !parity; // Older group, too late to recover
+    }
+    
+    if(parity)
+    {
+        if(ref->receiveParityValid)
+            return false; // Duplicate
+        
+        ref->receiveParityValid = true;
+        streamFecParityAdd(&ref->receiveParity, object->tag, options->fecLength, object->data, object->length);
+        
+        return false; // Never forwarded
+    }
+    
+    unsigned int bit = 1 << options->fecIndex;
+    
+    if(ref->receiveBits & bit)
+        return false; // Duplicate or already recovered
+    
+    ref->receiveBits |= bit;
+    streamFecParityAdd(&ref->receiveParity, object->tag, object->length, object->data, object->length);
+    
+    return true;
+}
+
+bool streamFecRecover(StreamFecRef ref, StreamObject * object)
+{
+    assert(ref != NULL);
+    
+    if(!ref->receiveValid || !ref->receiveParityValid)
+        return false;
+    
+    unsigned int allBits = (1 << ref->receiveCount) - 1;
+    unsigned int missingBits = allBits & ~ref->receiveBits;
+    
+    if(missingBits == 0 || (missingBits & (missingBits - 1)) != 0)
+        return false; // Nothing or more than one missing
+    
+    unsigned int length = ref->receiveParity.length;
+    
+    if(length > ref->receiveParity.object.length || length > object->capacity)
+        return false; // Corrupted
+    
+    ref->receiveBits |= missingBits; // Recovered
+    ref->receiveRecoveredIndex = __builtin_ctz(missingBits);
+    
+    object->tag = ref->receiveParity.object.tag;
+    object->length = length;
+    memcpy(object->data, ref->receiveParity.object.data, length);
+    
+    return true;
+}
@@ -0,0 +1,70 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_fec.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_stream_fec_h__
+#define __universal_network_stream_fec_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream_protocol.h"
+
+/*!
+ * @header
+ *
+ * Forward error correction (XOR parity) for a single stream.
+ *
+ * Sender: every groupSize data packets, a parity packet is sent with the XOR of every body in the group
+ * (tag, length and data zero padded to the longest one).
+ *
+ * Receiver: XOR of every body received in the group (data and parity) is accumulated, so when the parity 
+ * and all but one data packet have been received, the accumulator is the missing body. Only one loss per 
+ * group can be recovered. Memory is a single StreamObject per direction, regardless of groupSize.
+ */
+
+#define kStreamFecMaxGroupSize 16 // Max. data packets per group
+#define kStreamFecDefaultGroupSize 4 // 25% bandwidth overhead
+#define kStreamFecMaxGroup 0xFFFF // 16 bits
+
+typedef struct {
+    StreamObject object;        // XOR of bodies, object->length is the longest length
+    unsigned int length;        // XOR of body lengths
+} StreamFecParity;
+
+typedef struct {
+    unsigned int groupSize;     // Data packets per group for new send groups, 0 disables FEC
+    
+    // Send
+    unsigned int sendGroup;     // Current send group
+    unsigned int sendCount;     // Data packets in current send group
+    unsigned int sendIndex;     // Next index in current send group
+    StreamFecParity sendParity;
+    
+    // Receive
+    bool receiveValid;          // Any FEC packet received
+    unsigned int receiveGroup;  // Current receive group
+    unsigned int receiveCount;  // Data packets in current receive group
+    unsigned int receiveBits;   // Bit field of received (or recovered) data indexes in current receive group
+    bool receiveParityValid;    // Parity received for current receive group
+    StreamFecParity receiveParity; // XOR of everything received in current receive group
+    unsigned int receiveRecoveredIndex; // Index of the last recovered data packet, sequence is relative to the group
+} StreamFec;
+
+typedef StreamFec * StreamFecRef;
+
+void streamFecClear(StreamFecRef, unsigned int);
+
+void streamFecPackData(StreamFecRef, StreamHeaderOptions *, const StreamObject *); // Sets FEC header options for a data packet
+StreamObject * streamFecParity(StreamFecRef, StreamHeaderOptions *); // Returns parity object (and sets options) when group is complete, NULL otherwise
+
+bool streamFecReceive(StreamFecRef, const StreamHeaderOptions *, const StreamObject *); // Returns true if object should be forwarded (not parity or duplicate)
+bool streamFecRecover(StreamFecRef, StreamObject *); // Returns true if a missing object could be recovered
+
+#endif
@@ -8,13 +8,30 @@
 
 #include "stream_flow.h"
 
+static void streamFlowUpdateInterval(StreamFlowRef ref)
+{
+    float maxRate = ref->mode == StreamFlowModeGood ? kStreamFlowModeGoodRate : kStreamFlowModeBadRate;
+    
+    // Prefer update rate over packet size, until max. rate
+    float rate = ref->sendRate / fmaxf(ref->packetSize, 1.0f);
+    rate = fminf(fmaxf(rate, kStreamFlowModeBadRate), maxRate);
+    
+    ref->updateInterval = 1.0f/rate;
+    ref->packetBudget = fminf(fmaxf(ref->sendRate / rate, kStreamFlowMinPacketBudget), kStreamFlowMaxPacketBudget);
+}
+
 void streamFlowClear(StreamFlowRef ref)
 { 
     ref->mode = StreamFlowModeBad;
-    ref->updateInterval = 1.0f/kStreamFlowModeBadRate;
+    ref->sendRate = kStreamFlowMinSendRate;
+    ref->bandwidth = 0.0f;
+    ref->decreaseAccumulator = 0.0f;
+    ref->packetSize = kStreamFlowMinPacketBudget;
     ref->penalty = 4.0f;
     ref->goodConditions = 0.0f;
     ref->penaltyReductionAccumulator = 0.0f;
+    
+    streamFlowUpdateInterval(ref);
 }
 
 void streamFlowUpdate(StreamFlowRef ref, float rtt, float deltaTime)
@@ -24,7 +41,7 @@ void streamFlowUpdate(StreamFlowRef ref, float rtt, float deltaTime)
         if (rtt > kStreamFlowRttThreshold)
         {
             ref->mode = StreamFlowModeBad;
-            ref->updateInterval = 1.0f/kStreamFlowModeBadRate;
+            streamFlowUpdateInterval(ref);
             
             if(ref->goodConditions < 10.0f && ref->penalty < 60.0f)
             {
@@ -67,7 +84,41 @@ void streamFlowUpdate(StreamFlowRef ref, float rtt, float deltaTime)
             ref->penaltyReductionAccumulator = 0.0f;
             
             ref->mode = StreamFlowModeGood;
-            ref->updateInterval = 1.0f/kStreamFlowModeGoodRate;
+            streamFlowUpdateInterval(ref);
         }
     }
+}
+
+void streamFlowUpdateRate(StreamFlowRef ref, const StreamFlowSample * sample, float deltaTime)
+{
+    // Bandwidth estimate, max. delivery rate slowly decaying
+    if(sample->deliveryRate > ref->bandwidth)
+        ref->bandwidth = sample->deliveryRate;
+    else
+        ref->bandwidth -= (ref->bandwidth - sample->deliveryRate) * fminf(kStreamFlowBandwidthDecay * deltaTime, 1.0f);
+    
+    if(sample->packetSize > 0.0f)
+        ref->packetSize = sample->packetSize;
+    
+    ref->decreaseAccumulator += deltaTime;
+    
+    bool congested = sample->lossRatio > kStreamFlowLossThreshold || (sample->rtt - sample->rttMin) > kStreamFlowQueueDelayThreshold;
+    
+    if(congested)
+    {
+        if(ref->decreaseAccumulator > kStreamFlowDecreaseInterval) // Once per loss detection window
+        {
+            ref->sendRate *= kStreamFlowRateDecrease;
+            ref->decreaseAccumulator = 0.0f;
+        }
+    }
+    else if(sample->sentRate >= ref->sendRate * kStreamFlowAppLimited) // Only probe for more if send rate is being used
+    {
+        ref->sendRate += kStreamFlowRateIncrease * deltaTime;
+        ref->sendRate = fminf(ref->sendRate, fmaxf(ref->bandwidth * kStreamFlowBandwidthGain, kStreamFlowMinSendRate));
+    }
+    
+    ref->sendRate = fminf(fmaxf(ref->sendRate, kStreamFlowMinSendRate), kStreamFlowMaxSendRate);
+    
+    streamFlowUpdateInterval(ref);
 }
\ No newline at end of file
@@ -21,15 +21,48 @@
 
 #define kStreamFlowRttThreshold 0.25f // 250 ms
 
+#define kStreamFlowMinPacketBudget 256.0f // Bytes per packet, always allowed
+#define kStreamFlowMaxPacketBudget 1472.0f // Bytes per packet, further limited by path MTU
+#define kStreamFlowMinSendRate (kStreamFlowModeBadRate * kStreamFlowMinPacketBudget) // Bytes per sec.
+#define kStreamFlowMaxSendRate (kStreamFlowMaxRate * kStreamFlowMaxPacketBudget) // Bytes per sec.
+
+#define kStreamFlowRateIncrease 1024.0f // Additive increase, bytes per sec. every second
+#define kStreamFlowRateDecrease 0.7f // Multiplicative decrease
+#define kStreamFlowDecreaseInterval 1.0f // Min. time in seconds between decreases, loss is only detected after 1 sec.
+#define kStreamFlowAppLimited 0.8f // Send rate is not increased if sent rate is below 80% of it
+#define kStreamFlowBandwidthGain 1.5f // Send rate may exceed bandwidth estimate by 50%, to probe for more
+#define kStreamFlowBandwidthDecay 0.1f // Bandwidth estimate decay per second, when delivery rate is lower
+#define kStreamFlowLossThreshold 0.02f // 2% loss
+#define kStreamFlowQueueDelayThreshold 0.1f // 100 ms above min. rtt
+
 typedef enum {
     StreamFlowModeGood,
     StreamFlowModeBad
 } StreamFlowMode;
 
+/*!
+ * @typedef StreamFlowSample
+ * @abstract Reliability measurements used for congestion control
+ */
+typedef struct {
+    float rtt;                          // Smoothed rtt in seconds
+    float rttMin;                       // Min. rtt in seconds
+    float lossRatio;                    // Lost packets ratio [0,1]
+    float sentRate;                     // Sent bytes per sec.
+    float deliveryRate;                 // Acked bytes per sec.
+    float packetSize;                   // Average sent packet size in bytes
+} StreamFlowSample;
+
 typedef struct {    
-    StreamFlowMode mode;               // Flow Control Mode, affects update frequency
+    StreamFlowMode mode;               // Flow Control Mode, caps update frequency
+    
+    float sendRate;                     // Target bytes per sec. (AIMD), split into update rate and packet budget
+    float bandwidth;                    // Estimated available bandwidth in bytes per sec. (max. delivery rate, decaying)
+    float decreaseAccumulator;          // Time in seconds since last multiplicative decrease
+    float packetSize;                   // Average packet size in bytes
     
     float updateInterval;               // Time in seconds between send update
+    float packetBudget;                 // Max. packet size in bytes for each send update
     float goodConditions;               // Time in seconds of consecutive good rtt
     float penalty;                      // Time in seconds of consecutive good rtt before returning from bad to good flow mode
     float penaltyReductionAccumulator;  // Accumulated time in seconds of consecutive good rtt, used to reduce penalty
@@ -39,6 +72,7 @@ typedef StreamFlow * StreamFlowRef;
 
 void streamFlowClear(StreamFlowRef ref);
 
-void streamFlowUpdate(StreamFlowRef ref, float rtt, float deltaTime);
+void streamFlowUpdate(StreamFlowRef ref, float rtt, float deltaTime); // Flow mode
+void streamFlowUpdateRate(StreamFlowRef ref, const StreamFlowSample * sample, float deltaTime); // Congestion control, bandwidth estimation
 
 #endif
\ No newline at end of file
@@ -13,10 +13,17 @@
 #include "universal_network_c.h"
 #include "hashtable.h"
 #include "bitstream.h"
+#include "pool.h"
+#include "timer_wheel.h"
 
 #include "stream_protocol.h"
 #include "stream_reliability.h"
 #include "stream_flow.h"
+#include "stream_mtu.h"
+#include "stream_fec.h"
+#include "stream_jitter.h"
+#include "stream_clock.h"
+#include "stream_channel.h"
 
 /*!
  * @header
@@ -30,8 +37,14 @@
 #define kStreamTimeout 5.0 // 5 secs.
 #define kStreamTimerUpdateInterval (1.0f/kStreamFlowMaxRate)
 #define kStreamLogStatusInterval 5.0 // 5 secs.
+#define kStreamJitterTimerLeeway (1 * NSEC_PER_MSEC) // Playout timer leeway
+#define kStreamPacingTxTime 0 // Pace with SO_TXTIME, enable only if egress interface uses fq qdisc (user-space pacing otherwise)
+#define kStreamShardTableCapacity 64 // Initial stream table buckets, doubles when streams outnumber buckets
+#define kStreamShardPoolCapacity 1024 // Packets in flight per shard (sent, not written to socket yet)
+#define kStreamFanOutMin 2 // Due streams sharing update data packed once, sent as a shared packet body
 
-void streamTimerCallback(void *);
+void streamTimerCallback(void *); // Context is StreamShard
+void streamJitterTimerCallback(void *); // Context is StreamShard
 void streamSocketReceiveCallback(void *, net_packet_t);
 
 /*!
@@ -56,19 +69,72 @@ typedef struct StreamStruct {
 	StreamState state; 				// State
 	StreamReliability reliability;  // Reliability
     StreamFlow flow;				// Flow control
+    StreamMtu mtu;					// Path MTU discovery
+    StreamFec fec;					// Forward error correction
+    StreamJitter * jitter;			// Playout buffer, allocated once used
+    StreamClock clock;				// Remote clock offset and drift
+    StreamChannelsCursor channelCursor; // Next channel messages of the shard queues to send
 	net_addr_t address; 			// Remote side address
+	unsigned int hash;				// Address hash, selects shard and table bucket
+	unsigned int shard;				// Owner shard index
 	float timeoutAccumulator;		// Time accumulator before timeout
-    float updateAccumulator;		// Time accumulator before next update
-   	struct StreamStruct * next;
+	net_time_t updateTime;			// Last update
+	net_time_t updateDeadline;		// Next update, scheduled in shard update wheel
+	timer_wheel_entry_t updateEntry;
+   	struct StreamStruct * next;		// Table bucket chain
 	struct StreamStruct * previous;
 } Stream;
 
+/*!
+ * @typedef StreamShard
+ * @abstract Streams owned by a single serial queue: stream table, update wheel, timers and packet pool
+ * @discussion
+ * Each stream is scheduled in the update wheel at its own flow control rate. On every timer tick
+ * the due streams are updated and sent the same update data, paced over the tick.
+ * Nothing in a shard is accessed from other queues, lookups from other queues go through streamShardSync.
+ */
+typedef struct StreamShardStruct {
+	StreamConfiguration * config;
+	unsigned int index;
+	
+	dispatch_queue_t streamDispatchQueue; // Dispatch queue used to synchronize access to shard streams
+    dispatch_source_t streamDispatchTimer; // Dispatch timer used to update due streams with data
+    dispatch_source_t jitterDispatchTimer; // Dispatch timer used to release buffered snapshots, armed to the earliest playout time
+    net_time_t jitterTimerTime; // Time jitterDispatchTimer is armed to, 0 if disarmed
+    float logAccumulator; // Time accumulator before next status log (Debug only)
+	bool active; // Suspend/Resume with change active state
+	
+	Stream ** table; // Buckets, chained with Stream next/previous
+	unsigned int tableMask; // Buckets - 1
+	unsigned int count; // Streams in table
+	timer_wheel_t updateWheel; // Per stream update deadlines
+	Stream ** dueStreams; // Due on current tick, as many as buckets
+	unsigned int dueCount;
+	
+	pool_t poolPackets; // Sent packets
+	StreamChannels channels; // Update data is filled from channel queues by priority, if any channel is set
+} StreamShard;
+
+typedef void (^StreamShardIterateBlock)(Stream *);
+
+StreamShard * streamShardForAddress(StreamConfiguration *, const net_addr_t *);
+void streamShardSync(StreamShard *, dispatch_block_t); // Runs block on the shard queue and waits, in place if already on it
+Stream * streamShardFind(StreamShard *, const net_addr_t *);
+bool streamShardInsert(StreamShard *, Stream *); // False if table can't grow
+void streamShardRemove(StreamShard *, Stream *);
+void streamShardIterate(StreamShard *, StreamShardIterateBlock);
+
 Stream * streamCreate(const net_addr_t *);
 void streamDestroy(Stream **);
 
-bool streamUpdate(StreamConfiguration *, Stream *); // Returns true if it's time to update data
-void streamSend(StreamConfiguration *, Stream *, StreamObject *);
-void streamReceive(StreamConfiguration *, Stream *, Sequence, Ack, AckBitField, StreamObject *);
+void streamUpdate(StreamConfiguration *, Stream *, net_time_t); // Reliability, flow control and timeout since last update, schedules next update
+net_packet_body_t streamPackBody(StreamObject *); // Packed data, to be shared by many packets
+void streamSend(StreamConfiguration *, Stream *, StreamObject *, net_packet_body_t, net_time_t); // Sent at txtime (pacing), 0 is immediate. Body is the packed object or NULL
+void streamSendPacket(StreamConfiguration *, Stream *, StreamObject *, net_packet_body_t, StreamHeaderOptions *, size_t, net_time_t); // Single packet, padded to probe size if > 0 (body is not used then)
+void streamReceive(StreamConfiguration *, Stream *, Sequence, Ack, AckBitField, const StreamHeaderOptions *, net_time_t, StreamObject *);
+void streamReceiveView(StreamConfiguration *, Stream *, Sequence, Ack, AckBitField, const StreamHeaderOptions *, net_time_t, StreamView *); // Delivered in place, no FEC nor jitter buffer
+void streamForward(StreamConfiguration *, Stream *, Sequence, const StreamHeaderOptions *, net_time_t, StreamObject *); // To receive callback, through the playout buffer if enabled
+void streamDeliver(StreamConfiguration *, Stream *, StreamObject *); // To receive (or receive view) callback, one per message if it contains channels
 void streamTimeout(StreamConfiguration *, Stream *);
 void streamLog(Stream *);
 
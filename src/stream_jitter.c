@@ -0,0 +1,197 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_jitter.c
+* universal-network-c
+*/
+
+#include "stream_jitter.h"
+
+static inline unsigned int streamJitterMicroseconds(net_time_t time)
+{
+    return (unsigned int)(time / kNetTimeMicrosecond); // Wraps around, same as header timestamps
+}
+
+static void streamJitterCopy(StreamObject * dest, const StreamObject * src)
+{
+    assert(src->length <= dest->capacity);
+    
+    dest->tag = src->tag;
+    dest->length = src->length;
+    memcpy(dest->data, src->data, src->length); // Only the used part
+}
+
+static int streamJitterOldest(StreamJitterRef ref)
+{
+    int oldest = -1;
+    
+    for(int i=0; i<kStreamJitterCapacity; ++i)
+    {
+        if(ref->snapshots[i].valid && (oldest < 0 || isSequenceMoreRecent(ref->snapshots[oldest].sequence, ref->snapshots[i].sequence, kStreamReliabilityMaxSequence)))
+            oldest = i;
+    }
+    
+    return oldest;
+}
+
+void streamJitterClear(StreamJitterRef ref)
+{
+    assert(ref != NULL);
+    
+    for(int i=0; i<kStreamJitterCapacity; ++i)
+    {
+        ref->snapshots[i].valid = false;
+        streamObjectSetup(&ref->snapshots[i].object);
+    }
+    
+    ref->count = 0;
+    
+    ref->releasedValid = false;
+    ref->releasedSequence = 0;
+    
+    ref->transitValid = false;
+    ref->transit = 0;
+    ref->transitBase = 0;
+    ref->transitBaseTime = 0;
+    
+    ref->jitter = 0.0f;
+    ref->delay = kStreamJitterMinDelay;
+    
+    ref->totalReleased = 0;
+    ref->totalDropped = 0;
+}
+
+bool streamJitterPush(StreamJitterRef ref, Sequence sequence, const StreamHeaderOptions * options, const StreamObject * object, net_time_t now)
+{
+    assert(ref != NULL);
+    
+    if(ref->releasedValid && !isSequenceMoreRecent(sequence, ref->releasedSequence, kStreamReliabilityMaxSequence))
+    {
+        ref->totalDropped += 1; // Stale, a more recent snapshot was already released
+        return false;
+    }
+    
+    for(int i=0; i<kStreamJitterCapacity; ++i)
+    {
+        if(ref->snapshots[i].valid && ref->snapshots[i].sequence == sequence)
+        {
+            ref->totalDropped += 1; // Duplicate
+            return false;
+        }
+    }
+    
+    unsigned int nowMicroseconds = streamJitterMicroseconds(now);
+    unsigned int timestamp = (options->flags & StreamHeaderFlagTimestamp) ? options->timestamp : nowMicroseconds; // Without timestamps, playout is relative to arrival
+    unsigned int transit = nowMicroseconds - timestamp; // Includes clock offset, only differences are meaningful
+    
+    // Interarrival jitter
+    if(ref->transitValid)
+    {
+        float difference = (int)(transit - ref->transit) * 1e-6f;
+        ref->jitter += (fabsf(difference) - ref->jitter) * kStreamJitterGain; // Low-pass filtered
+    }
+    
+    ref->transit = transit;
+    
+    // Smallest transit, playout reference
+    if(!ref->transitValid || (int)(transit - ref->transitBase) < 0 || now - ref->transitBaseTime > kStreamJitterBaseWindow)
+    {
+        ref->transitBase = transit;
+        ref->transitBaseTime = now;
+    }
+    
+    ref->transitValid = true;
+    
+    // Playout delay, covers jitter and this arrival
+    float late = (transit - ref->transitBase) * 1e-6f;
+    float target = kStreamJitterMinDelay + kStreamJitterDelayFactor * ref->jitter;
+    
+    if(late > target)
+        target = late;
+    
+    if(target > kStreamJitterMaxDelay)
+        target = kStreamJitterMaxDelay;
+    
+    if(target > ref->delay)
+        ref->delay = target; // Increase immediately, avoids more late snapshots
+    else
+        ref->delay += (target - ref->delay) * kStreamJitterDelayDecay; // Decrease slowly
+    
+    // Store
+    int index = 0;
+    
+    if(ref->count == kStreamJitterCapacity)
+    {
+        index = streamJitterOldest(ref); // Full, discard oldest
+        ref->count -= 1;
+        ref->totalDropped += 1;
+    }
+    else
+    {
+        while(ref->snapshots[index].valid)
+            ++index;
+    }
+    
+    StreamJitterSnapshot * snapshot = &ref->snapshots[index];
+    snapshot->valid = true;
+    snapshot->sequence = sequence;
+    snapshot->timestamp = timestamp;
+    streamJitterCopy(&snapshot->object, object);
+    
+    ref->count += 1;
+    
+    return true;
+}
+
+net_time_t streamJitterNextTime(StreamJitterRef ref, net_time_t now)
+{
+    assert(ref != NULL);
+    
+    if(ref->count == 0)
+        return 0;
+    
+    unsigned int nowMicroseconds = streamJitterMicroseconds(now);
+    unsigned int delay = (unsigned int)(ref->delay * 1e6f);
+    int next = 0;
+    bool nextValid = false;
+    
+    for(int i=0; i<kStreamJitterCapacity; ++i)
+    {
+        if(ref->snapshots[i].valid)
+        {
+            int remaining = (int)(ref->snapshots[i].timestamp + ref->transitBase + delay - nowMicroseconds); // Playout time relative to now
+            
+            if(!nextValid || remaining < next)
+            {
+                next = remaining;
+                nextValid = true;
+            }
+        }
+    }
+    
+    return next > 0 ? now + next * kNetTimeMicrosecond : now;
+}
+
+bool streamJitterPop(StreamJitterRef ref, StreamObject * object, net_time_t now)
+{
+    assert(ref != NULL);
+    
+    net_time_t next = streamJitterNextTime(ref, now);
+    
+    if(next == 0 || next > now) // Empty or nothing due yet
+        return false;
+    
+    int index = streamJitterOldest(ref); // Any due snapshot releases the ones before it, keeps order
+    
+    StreamJitterSnapshot * snapshot = &ref->snapshots[index];
+    streamJitterCopy(object, &snapshot->object);
+    snapshot->valid = false;
+    
+    ref->count -= 1;
+    ref->releasedValid = true;
+    ref->releasedSequence = snapshot->sequence;
+    ref->totalReleased += 1;
+    
+    return true;
+}
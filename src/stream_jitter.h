@@ -0,0 +1,75 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_jitter.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_stream_jitter_h__
+#define __universal_network_stream_jitter_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream_reliability.h"
+
+/*!
+ * @header
+ *
+ * Receiver jitter buffer (playout buffer) for a single stream.
+ *
+ * Snapshots are buffered and released in sequence order, each one at the time it was sent on the remote 
+ * side (header timestamp) plus the smallest transit time seen (kStreamJitterBaseWindow) plus a playout delay.
+ * Snapshots older than the last released one are stale and dropped.
+ *
+ * The playout delay follows the interarrival jitter (RFC 3550) and the worst late arrival, it goes up
+ * immediately and decays slowly, so the application gets evenly spaced and ordered snapshots to interpolate.
+ */
+
+#define kStreamJitterCapacity 16 // Buffered snapshots, ~1 sec. at max. update rate
+#define kStreamJitterGain (1.0f/16.0f) // Low-pass filter gain for jitter (RFC 3550)
+#define kStreamJitterDelayFactor 3.0f // Playout delay covers 3 times the jitter
+#define kStreamJitterDelayDecay 0.02f // Low-pass filter gain when playout delay decreases, per snapshot
+#define kStreamJitterMinDelay (0.01f) // 10 ms
+#define kStreamJitterMaxDelay (0.5f) // 500 ms
+#define kStreamJitterBaseWindow (10 * kNetTimeSecond) // Smallest transit expires after 10 seconds, path may have changed
+
+typedef struct {
+    bool valid;
+    Sequence sequence;          // Remote sequence
+    unsigned int timestamp;     // Remote timestamp, in microseconds
+    StreamObject object;
+} StreamJitterSnapshot;
+
+typedef struct {
+    StreamJitterSnapshot snapshots[kStreamJitterCapacity]; // Unordered, released by sequence
+    unsigned int count;         // Valid snapshots
+    
+    bool releasedValid;         // Any snapshot released
+    Sequence releasedSequence;  // Last released sequence, older ones are stale
+    
+    bool transitValid;          // Any transit sample
+    unsigned int transit;       // Last transit (local arrival - remote timestamp), in microseconds (wraps around)
+    unsigned int transitBase;   // Smallest transit within kStreamJitterBaseWindow
+    net_time_t transitBaseTime; // Time when transitBase was sampled
+    
+    float jitter;               // Interarrival jitter in seconds
+    float delay;                // Playout delay in seconds, added to transitBase
+    
+    unsigned int totalReleased; // Total snapshots released
+    unsigned int totalDropped;  // Total snapshots dropped (stale, duplicate or overflow)
+} StreamJitter;
+
+typedef StreamJitter * StreamJitterRef;
+
+void streamJitterClear(StreamJitterRef);
+
+bool streamJitterPush(StreamJitterRef, Sequence, const StreamHeaderOptions *, const StreamObject *, net_time_t); // Returns false if snapshot was dropped
+bool streamJitterPop(StreamJitterRef, StreamObject *, net_time_t); // Returns true and the next snapshot in sequence, if it is time to release it
+
+net_time_t streamJitterNextTime(StreamJitterRef, net_time_t); // Time when the next snapshot is released, 0 if empty
+
+#endif
@@ -0,0 +1,107 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_mtu.c
+* universal-network-c
+*/
+
+#include "stream_mtu.h"
+
+static size_t streamMtuNextProbeSize(StreamMtuRef ref)
+{
+    return ref->size + (ref->probeHigh - ref->size) / 2; // Binary search
+}
+
+void streamMtuClear(StreamMtuRef ref)
+{
+    assert(ref != NULL);
+    
+    ref->state = StreamMtuSearching;
+    
+    ref->size = kStreamMtuMin;
+    ref->probeHigh = kStreamMtuMax + 1;
+    
+    ref->probeSize = 0;
+    ref->probeSequence = 0;
+    ref->probeLosses = 0;
+    ref->probeAccumulator = 0.0f;
+    ref->settledAccumulator = 0.0f;
+}
+
+void streamMtuUpdate(StreamMtuRef ref, float deltaTime)
+{
+    assert(ref != NULL);
+    
+    ref->probeAccumulator += deltaTime;
+    
+    if(ref->probeSize > 0) // Probe in-flight
+    {
+        if(ref->probeAccumulator > kStreamMtuProbeTimeout) // Lost
+        {
+            if(++ref->probeLosses > kStreamMtuProbeRetries)
+            {
+                ref->probeHigh = ref->probeSize; // Too big
+                ref->probeLosses = 0;
+            }
+            
+            ref->probeSize = 0;
+        }
+    }
+    
+    if(ref->state == StreamMtuSearching)
+    {
+        if(ref->probeSize == 0 && ref->probeHigh - ref->size <= kStreamMtuProbeResolution)
+        {
+            ref->state = StreamMtuSettled;
+            ref->settledAccumulator = 0.0f;
+        }
+    }
+    else if(ref->state == StreamMtuSettled)
+    {
+        ref->settledAccumulator += deltaTime;
+        
+        if(ref->settledAccumulator > kStreamMtuRaiseInterval && ref->size < kStreamMtuMax) // Path may have changed
+        {
+            ref->state = StreamMtuSearching;
+            ref->probeHigh = kStreamMtuMax + 1;
+            ref->probeLosses = 0;
+        }
+    }
+}
+
+size_t streamMtuProbeSize(StreamMtuRef ref)
+{
+    assert(ref != NULL);
+    
+    if(ref->state != StreamMtuSearching || ref->probeSize > 0 || ref->probeAccumulator < kStreamMtuProbeInterval)
+        return 0;
+    
+    return streamMtuNextProbeSize(ref);
+}
+
+void streamMtuProbeSent(StreamMtuRef ref, Sequence sequence, size_t size)
+{
+    assert(ref != NULL);
+    
+    ref->probeSize = size;
+    ref->probeSequence = sequence;
+    ref->probeAccumulator = 0.0f;
+}
+
+void streamMtuProcessAck(StreamMtuRef ref, Ack ack, AckBitField ackBits)
+{
+    assert(ref != NULL);
+    
+    if(ref->probeSize == 0)
+        return;
+    
+    unsigned int count = (ack + kStreamReliabilityMaxSequence - ref->probeSequence) % kStreamReliabilityMaxSequence; // Wrap around case
+    
+    if(count < sizeof(AckBitField)*8 && ((ackBits >> count) & 1)) // Probe was received on the remote side
+    {
+        ref->size = ref->probeSize; // Confirmed
+        ref->probeSize = 0;
+        ref->probeLosses = 0;
+    }
+}
@@ -0,0 +1,66 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* stream_mtu.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_stream_mtu_h__
+#define __universal_network_stream_mtu_h__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream_reliability.h"
+
+/*!
+ * @header
+ *
+ * Path MTU discovery for a single stream (packetization layer path MTU discovery, RFC 4821).
+ *
+ * Regular packets never exceed the confirmed size. Every kStreamMtuProbeInterval one regular packet is
+ * padded up to the probe size, a binary search between the largest acked and the smallest lost probe size.
+ * The socket must have the DF bit set (see net_socket_set_pmtu_probe) so oversized probes are dropped
+ * instead of fragmented. The search settles once the window is narrower than kStreamMtuProbeResolution.
+ */
+
+#define kStreamMtuMin 256 // Initial size, always safe (previous fixed packet size)
+#define kStreamMtuMax kNetPacketMaxLen
+#define kStreamMtuProbeResolution 16 // Settle when search window is smaller than 16 bytes
+#define kStreamMtuProbeInterval 0.25f // 250 ms between probes
+#define kStreamMtuProbeTimeout kStreamReliabilityMaxRtt // Probe is lost if not acked within max. rtt
+#define kStreamMtuProbeRetries 2 // Retry 2 times before considering probe size too big
+#define kStreamMtuRaiseInterval 600.0f // 10 min. after settling, search again for a bigger size
+
+typedef enum {
+    StreamMtuSearching,
+    StreamMtuSettled
+} StreamMtuState;
+
+typedef struct {
+    StreamMtuState state;
+
+    size_t size;                // Largest confirmed size (packet length), used for regular packets
+    size_t probeHigh;           // Smallest size known to be too big (search upper bound, exclusive)
+
+    size_t probeSize;           // Size of the in-flight probe, 0 if none
+    Sequence probeSequence;     // Sequence of the in-flight probe
+    unsigned int probeLosses;   // Consecutive losses at probeSize
+    float probeAccumulator;     // Time in seconds since last probe was sent
+    float settledAccumulator;   // Time in seconds since search settled
+} StreamMtu;
+
+typedef StreamMtu * StreamMtuRef;
+
+void streamMtuClear(StreamMtuRef);
+
+void streamMtuUpdate(StreamMtuRef, float);
+size_t streamMtuProbeSize(StreamMtuRef); // Returns the size to pad the next packet to, 0 if next packet is not a probe
+
+void streamMtuProbeSent(StreamMtuRef, Sequence, size_t);
+void streamMtuProcessAck(StreamMtuRef, Ack, AckBitField);
+
+#endif
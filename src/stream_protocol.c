@@ -11,29 +11,153 @@
 #pragma mark -
 #pragma mark Header
 
-void streamProtocolPackHeader(bitstream_t * bitstream, Sequence sequence, Ack ack, AckBitField ackBitField)
+void streamHeaderOptionsSetup(StreamHeaderOptions * options)
 {
+	memset(options, 0, sizeof(StreamHeaderOptions));
+}
+
+size_t streamProtocolHeaderOptionsLength(unsigned int flags, unsigned int sackCount)
+{
+	size_t length = 13; // Sequence, Ack, Ack Bit Field and Flags
+	
+	if(flags & StreamHeaderFlagTimestamp) length += 4;
+	if(flags & StreamHeaderFlagEcho) length += 8;
+	if(flags & StreamHeaderFlagFec) length += 4;
+	if(flags & StreamHeaderFlagParity) length += 2;
+	if(flags & StreamHeaderFlagAckExtended) length += 4;
+	if(flags & StreamHeaderFlagSack) length += 1 + 2 * sackCount;
+	
+	return length;
+}
+
+void streamProtocolPackHeader(bitstream_t * bitstream, Sequence sequence, Ack ack, AckBitField ackBitField, const StreamHeaderOptions * options)
+{
+	unsigned int flags = options ? options->flags : 0;
+	unsigned int sackCount = (flags & StreamHeaderFlagSack) ? (options->sackCount < kStreamProtocolMaxSackBlocks ? options->sackCount : kStreamProtocolMaxSackBlocks) : 0;
+	
 	// Pack protocol header
 	protocolPackHeader(bitstream, kProtocolDefaultId, kProtocolDefaultVersion, ProtocolTypeStream);
 	
+	// Single bounds check for the whole header
+	bitstream_writer_t writer;
+	if(!bitstream_reserve(bitstream, &writer, streamProtocolHeaderOptionsLength(flags, sackCount)))
+		return;
+	
 	// Pack stream protocol header
-	bitstream_write_uint32(bitstream, sequence);
-	bitstream_write_uint32(bitstream, ack);
-	bitstream_write_uint32(bitstream, ackBitField);
+	bitstream_writer_uint32(&writer, sequence);
+	bitstream_writer_uint32(&writer, ack);
+	bitstream_writer_uint32(&writer, (unsigned int)(ackBitField & 0xFFFFFFFF));
+	bitstream_writer_uint8(&writer, flags);
+	
+	// Pack optional fields
+	if(flags & StreamHeaderFlagTimestamp)
+		bitstream_writer_uint32(&writer, options->timestamp);
+	
+	if(flags & StreamHeaderFlagEcho)
+	{
+		bitstream_writer_uint32(&writer, options->echoTimestamp);
+		bitstream_writer_uint32(&writer, options->echoDelay);
+	}
+	
+	if(flags & StreamHeaderFlagFec)
+	{
+		bitstream_writer_uint16(&writer, options->fecGroup);
+		bitstream_writer_uint8(&writer, options->fecIndex);
+		bitstream_writer_uint8(&writer, options->fecCount);
+	}
+	
+	if(flags & StreamHeaderFlagParity)
+		bitstream_writer_uint16(&writer, options->fecLength);
+	
+	if(flags & StreamHeaderFlagAckExtended)
+		bitstream_writer_uint32(&writer, (unsigned int)(ackBitField >> 32));
+	
+	if(flags & StreamHeaderFlagSack)
+	{
+		bitstream_writer_uint8(&writer, sackCount);
+		
+		for(unsigned int i=0; i<sackCount; ++i)
+		{
+			bitstream_writer_uint8(&writer, options->sack[i].offset);
+			bitstream_writer_uint8(&writer, options->sack[i].length);
+		}
+	}
+	
+	bitstream_commit(bitstream, &writer);
 }
 
-UnpackResult streamProtocolUnpackHeader(bitstream_t * bitstream, Sequence * sequence, Ack * ack, AckBitField * ackBitField)
+UnpackResult streamProtocolUnpackHeader(bitstream_t * bitstream, Sequence * sequence, Ack * ack, AckBitField * ackBitField, StreamHeaderOptions * options)
 {
 	// Unpack protocol header
 	if(protocolUnpackHeader(bitstream, kProtocolDefaultId, kProtocolDefaultVersion, ProtocolTypeStream) != UnpackValid)
 		return UnpackInvalid;
 	
-	// Unpack stream protocol header	
-	bitstream_read_uint32(bitstream, sequence);
-	bitstream_read_uint32(bitstream, ack);
-	bitstream_read_uint32(bitstream, ackBitField);
+	unsigned int ackBitFieldLow, ackBitFieldHigh = 0;
+	
+	// Unpack stream protocol header, one bounds check for fixed fields and one for optional fields
+	streamHeaderOptionsSetup(options);
+	
+	bitstream_reader_t reader;
+	if(!bitstream_require(bitstream, &reader, streamProtocolHeaderOptionsLength(0, 0)))
+		return UnpackInvalid; // Truncated
+	
+	bitstream_reader_uint32(&reader, sequence);
+	bitstream_reader_uint32(&reader, ack);
+	bitstream_reader_uint32(&reader, &ackBitFieldLow);
+	bitstream_reader_uint8(&reader, &options->flags);
+	bitstream_consume(bitstream, &reader);
+	
+	size_t optionsLength = streamProtocolHeaderOptionsLength(options->flags & ~StreamHeaderFlagSack, 0) - streamProtocolHeaderOptionsLength(0, 0);
+	if(!bitstream_require(bitstream, &reader, optionsLength))
+		return UnpackInvalid;
+	
+	// Unpack optional fields
+	if(options->flags & StreamHeaderFlagTimestamp)
+		bitstream_reader_uint32(&reader, &options->timestamp);
+	
+	if(options->flags & StreamHeaderFlagEcho)
+	{
+		bitstream_reader_uint32(&reader, &options->echoTimestamp);
+		bitstream_reader_uint32(&reader, &options->echoDelay);
+	}
+	
+	if(options->flags & StreamHeaderFlagFec)
+	{
+		bitstream_reader_uint16(&reader, &options->fecGroup);
+		bitstream_reader_uint8(&reader, &options->fecIndex);
+		bitstream_reader_uint8(&reader, &options->fecCount);
+	}
+	
+	if(options->flags & StreamHeaderFlagParity)
+		bitstream_reader_uint16(&reader, &options->fecLength);
+	
+	if(options->flags & StreamHeaderFlagAckExtended)
+		bitstream_reader_uint32(&reader, &ackBitFieldHigh);
+	
+	bitstream_consume(bitstream, &reader);
+	
+	*ackBitField = ((AckBitField)ackBitFieldHigh << 32) | ackBitFieldLow;
+	
+	if(options->flags & StreamHeaderFlagSack)
+	{
+		bitstream_read_uint8(bitstream, &options->sackCount);
+		
+		if(options->sackCount > kStreamProtocolMaxSackBlocks)
+			return UnpackInvalid;
+		
+		if(!bitstream_require(bitstream, &reader, 2 * options->sackCount))
+			return UnpackInvalid;
+		
+		for(unsigned int i=0; i<options->sackCount; ++i)
+		{
+			bitstream_reader_uint8(&reader, &options->sack[i].offset);
+			bitstream_reader_uint8(&reader, &options->sack[i].length);
+		}
+		
+		bitstream_consume(bitstream, &reader);
+	}
 
-	return UnpackValid;
+	return bitstream_error(bitstream) ? UnpackInvalid : UnpackValid;
 }
 
 #pragma mark -
@@ -42,12 +166,13 @@ UnpackResult streamProtocolUnpackHeader(bitstream_t * bitstream, Sequence * sequ
 void streamObjectSetup(StreamObject * object)
 {
   object->length = 0;
+  object->capacity = kStreamObjectDataMaxLength;
   object->tag = 0;
 }
 
 void streamObjectCopyData(StreamObject * object, uint8_t * data, unsigned int length)
 {
-  if((object->length + length) <= kStreamObjectDataMaxLength)
+  if((object->length + length) <= object->capacity)
   {
     memcpy(object->data+object->length, data, length);
     object->length += length; 
@@ -58,7 +183,7 @@ void streamProtocolPackData(bitstream_t * bitstream, StreamObject * object)
 {
   bitstream_write_uint64(bitstream, object->tag); // tag (use bitstream)
 	bitstream_write_uint16(bitstream, object->length); // length (use bitstream)
-	bitstream_write_bytes(bitstream, object->data, object->length); // data
+	bitstream_write_raw(bitstream, object->data, object->length); // data, as is (same bytes as a view)
 }
 
 UnpackResult streamProtocolUnpackData(bitstream_t * bitstream, StreamObject * object)
@@ -67,10 +192,75 @@ UnpackResult streamProtocolUnpackData(bitstream_t * bitstream, StreamObject * ob
 	
   bitstream_read_uint64(bitstream, &object->tag); // length (use bitstream)
   bitstream_read_uint16(bitstream, &object->length); // length (use bitstream)
-	bitstream_read_bytes(bitstream, object->data, object->length); // data
+  
+  if(object->length > kStreamObjectDataMaxLength) // Doesn't fit data, packet is larger than any valid one
+  {
+    object->length = 0;
+    return UnpackInvalid;
+  }
+  
+	bitstream_read_raw(bitstream, object->data, object->length); // data, as is (same bytes as a view)
     
   mNetworkLog("streamProtocolUnpackData %llu => %d", object->tag, object->length);
+  
+  if(bitstream_error(bitstream)) // Truncated
+  {
+    object->length = 0;
+    unpackResult = UnpackInvalid;
+  }
     
   return unpackResult;
 }
 
+#pragma mark -
+#pragma mark View
+
+void streamProtocolPackViewBegin(bitstream_t * bitstream, StreamView * view, size_t capacity)
+{
+	size_t dataOffset = bitstream->offset + kStreamProtocolDataOverheadLength; // tag and length are packed on end
+	size_t available = dataOffset < bitstream->bound ? bitstream->bound - dataOffset : 0;
+	
+	view->tag = 0;
+	view->bitstream = bitstream_create(bitstream->data + (dataOffset < bitstream->bound ? dataOffset : bitstream->bound), capacity < available ? capacity : available);
+}
+
+void streamProtocolPackViewEnd(bitstream_t * bitstream, StreamView * view)
+{
+	if(bitstream->offset + kStreamProtocolDataOverheadLength > bitstream->bound)
+		return; // No room for tag and length
+	
+	bitstream_write_uint64(bitstream, view->tag); // tag
+	bitstream_write_uint16(bitstream, view->bitstream.offset); // length
+	bitstream->offset += view->bitstream.offset; // data, already in place
+}
+
+UnpackResult streamProtocolUnpackView(bitstream_t * bitstream, StreamView * view)
+{
+	unsigned int length;
+	
+	if(bitstream->offset + kStreamProtocolDataOverheadLength > bitstream->bound)
+		return UnpackInvalid;
+	
+	bitstream_read_uint64(bitstream, &view->tag); // tag
+	bitstream_read_uint16(bitstream, &length); // length
+	
+	if(length > bitstream->bound - bitstream->offset)
+		return UnpackInvalid; // Truncated
+	
+	view->bitstream = bitstream_create(bitstream->data + bitstream->offset, length); // data, in place
+	bitstream->offset += length;
+	
+	return UnpackValid;
+}
+
+#pragma mark -
+#pragma mark Padding
+
+void streamProtocolPackPadding(bitstream_t * bitstream, size_t length)
+{
+	if(length > bitstream->offset && length <= bitstream->bound)
+	{
+		memset(&bitstream->data[bitstream->offset], 0, length - bitstream->offset); // zeroes
+		bitstream_skip_bytes(bitstream, length - bitstream->offset);
+	}
+}
@@ -28,7 +28,21 @@
  * | Sequence Nr.                | Ack Nr.                     | 4+4 Bytes
  * +--------------+--------------+--------------+--------------+ 
  * | Ack Bit Field 		           |                               4 Bytes
- * +-----------------------------------------------------------+
+ * +--------------+--------------+--------------+--------------+
+ * | Flags |                                                     1 Byte
+ * +--------------+--------------+--------------+--------------+
+ * | Timestamp (optional)        |                               4 Bytes
+ * +--------------+--------------+--------------+--------------+
+ * | Echo Timestamp (optional)   | Echo Delay (optional)       | 4+4 Bytes
+ * +--------------+--------------+--------------+--------------+
+ * | FEC Group (optional)        | Index | Count |                 2+1+1 Bytes
+ * +--------------+--------------+--------------+--------------+
+ * | FEC Length (optional)       |                                 2 Bytes
+ * +--------------+--------------+--------------+--------------+
+ * | Ack Bit Field Ext. (optional) |                             4 Bytes
+ * +--------------+--------------+--------------+--------------+
+ * | SACK Count | Offset | Length | ...  (optional)              1+(1+1)*Count Bytes
+ * +--------------+--------------+--------------+--------------+
  * | Tag                                                       | 8 Bytes
  * +--------------+--------------+--------------+--------------+
  * | Body (length)|                                              2 Bytes
@@ -37,10 +51,32 @@
  * | ...                                                       | 
  * +--------------+--------------+--------------+--------------+
  *
+ * Flags: Indicate which optional header fields are present
+ *
+ * Timestamps: Sender monotonic clock in microseconds (wraps around every ~71 minutes).
+ * Echo Timestamp is the last timestamp received from the remote side and Echo Delay 
+ * the time it was held before being echoed, so that RTT = now - Echo Timestamp - Echo Delay
+ *
+ * FEC: Packets are grouped, after Count data packets a parity packet (Index = Count) is sent with the
+ * XOR of every body (Tag, Length and zero padded Data) in the group, so a single lost packet can be recovered
+ *
+ * Extended Ack: Upper 32 bits of a 64-bit Ack Bit Field. Sending it advertises support,
+ * SACK blocks are only sent once the remote side has advertised it as well. Each SACK block
+ * acknowledges Length sequences ending Offset sequences before Ack (Offset >= 64), so acks 
+ * older than the bit field are still reported
+ *
  * Data: Application specific, length must conform to packet's max. size 
+ *
+ * Padding: Probe packets (path MTU discovery) are padded with zeroes after the body, 
+ * which is ignored when unpacking
  */
 
-#define kStreamObjectDataMaxLength (kProtocolMaxLength-22)
+#define kStreamProtocolOverheadLength 54 // Sequence, Ack, Ack Bit Field, Flags, Timestamps, FEC, Extended Ack, SACK, Tag and Body length
+#define kStreamProtocolMaxSackBlocks 4 // SACK blocks per header
+#define kStreamProtocolSackWindow 256 // SACK blocks only cover sequences within Ack-255 (8-bit Offset)
+#define kStreamObjectDataMaxLength (kProtocolMaxLength-kStreamProtocolOverheadLength)
+#define kStreamProtocolDataOverheadLength 10 // Tag and Body length, packed before data
+#define mStreamObjectDataLength(packetLength) ((packetLength)-(kNetPacketMaxLen-kProtocolMaxLength)-kStreamProtocolOverheadLength) // Max. body data length for a given packet length
 
 /*!
  * @typedef SequenceNr
@@ -58,10 +94,46 @@ typedef unsigned int Ack;
  * @typedef SequenceNr
  * @abstract Last acked sequence bit field received
  */
-typedef unsigned int AckBitField; 
+typedef uint64_t AckBitField; // 64 bits, upper half is only sent with StreamHeaderFlagAckExtended
 
-void streamProtocolPackHeader(bitstream_t * bitstream, Sequence, Ack, AckBitField);
-UnpackResult streamProtocolUnpackHeader(bitstream_t * bitstream, Sequence *, Ack *, AckBitField *);
+/*!
+ * @typedef StreamHeaderFlags
+ * @abstract Optional header fields present
+ */
+typedef enum {
+    StreamHeaderFlagTimestamp = 0x01,  // Timestamp
+    StreamHeaderFlagEcho = 0x02,       // Echo Timestamp and Echo Delay
+    StreamHeaderFlagFec = 0x04,        // FEC Group, Index and Count
+    StreamHeaderFlagParity = 0x08,     // FEC Length, body is the parity of the group (not application data)
+    StreamHeaderFlagAckExtended = 0x10, // Upper 32 bits of Ack Bit Field
+    StreamHeaderFlagSack = 0x20        // SACK blocks
+} StreamHeaderFlags;
+
+/*!
+ * @typedef StreamHeaderOptions
+ * @abstract Optional header fields, only the ones set in flags are packed
+ */
+typedef struct {
+    unsigned int flags;             // StreamHeaderFlags
+    unsigned int timestamp;         // Local time when packet was sent, in microseconds
+    unsigned int echoTimestamp;     // Last remote timestamp received, in microseconds
+    unsigned int echoDelay;         // Time elapsed since echoTimestamp was received, in microseconds
+    unsigned int fecGroup;          // FEC group number (16 bits)
+    unsigned int fecIndex;          // Index in FEC group, parity is fecCount
+    unsigned int fecCount;          // Number of data packets in FEC group
+    unsigned int fecLength;         // Parity only, XOR of group body lengths
+    unsigned int sackCount;         // Number of SACK blocks
+    struct {
+        unsigned int offset;        // Distance between Ack and the most recent sequence in block
+        unsigned int length;        // Number of sequences in block
+    } sack[kStreamProtocolMaxSackBlocks];
+} StreamHeaderOptions;
+
+void streamHeaderOptionsSetup(StreamHeaderOptions *);
+
+size_t streamProtocolHeaderOptionsLength(unsigned int flags, unsigned int sackCount); // Stream header length after protocol header, for the given flags
+void streamProtocolPackHeader(bitstream_t * bitstream, Sequence, Ack, AckBitField, const StreamHeaderOptions *); // StreamHeaderOptions is optional (NULL)
+UnpackResult streamProtocolUnpackHeader(bitstream_t * bitstream, Sequence *, Ack *, AckBitField *, StreamHeaderOptions *);
 
 /*!
  * @typedef StreamObject
@@ -71,6 +143,7 @@ UnpackResult streamProtocolUnpackHeader(bitstream_t * bitstream, Sequence *, Ack
 typedef struct {
 	uint8_t data[kStreamObjectDataMaxLength];
     unsigned int length;
+    unsigned int capacity; // Max. length for data, set by the stream according to path MTU (<= kStreamObjectDataMaxLength)
     uint64_t tag;
 } StreamObject;
 
@@ -80,4 +153,23 @@ void streamObjectCopyData(StreamObject *, uint8_t *, unsigned int);
 void streamProtocolPackData(bitstream_t * bitstream, StreamObject *);
 UnpackResult streamProtocolUnpackData(bitstream_t * bitstream, StreamObject *);
 
+/*!
+ * @typedef StreamView
+ * @abstract Data written or read in place, inside a packet buffer (no StreamObject copies)
+ * @discussion
+ * The bitstream starts at the first data byte. When updating, it is bound by the data capacity
+ * and data length is the bitstream offset. When receiving, it is bound by the data length, it
+ * must not be written to and is only valid until the callback returns.
+ */
+typedef struct {
+    bitstream_t bitstream;
+    uint64_t tag;
+} StreamView;
+
+void streamProtocolPackViewBegin(bitstream_t * bitstream, StreamView *, size_t); // View at data, up to capacity bytes. Tag and length are packed on end
+void streamProtocolPackViewEnd(bitstream_t * bitstream, StreamView *); // Bitstream moves past data written to view
+UnpackResult streamProtocolUnpackView(bitstream_t * bitstream, StreamView *);
+
+void streamProtocolPackPadding(bitstream_t * bitstream, size_t length); // Pad with zeroes up to length bytes
+
 #endif
\ No newline at end of file
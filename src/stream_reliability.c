@@ -19,12 +19,16 @@ void streamReliabilityClear(StreamReliabilityRef ref)
     ref->sequence = 0;
     ref->ack = 0;
     ref->ackBits = 0;
+    memset(ref->sackBits, 0, sizeof(ref->sackBits));
+    ref->ackExtended = true;
+    ref->remoteAckExtended = false;
     
     ref->totalSentPackets = 0;
     ref->totalReceivedPackets = 0;
     ref->totalAckedPackets = 0;
     ref->totalLostPackets = 0;
     
+    ref->sentPackets = 0;
     ref->sentBytes = 0;
     ref->sentBytesPerSecond = 0;
     ref->ackedPackets = 0;
@@ -34,25 +38,102 @@ void streamReliabilityClear(StreamReliabilityRef ref)
     
     ref->sentBandwidth = 0;
     ref->ackedBandwidth = 0;
+    ref->lossRatio = 0.0f;
     
     ref->rtt = 0.0f;
+    ref->rttVariance = 0.0f;
+    ref->rttMin = 0.0f;
+    ref->rttMinTime = 0;
+    ref->rttSamples = 0;
+    
+    ref->remoteTimestampValid = false;
+    ref->remoteTimestamp = 0;
+    ref->remoteTimestampTime = 0;
+    ref->echoValid = false;
 }
 
-void streamReliabilityPacketSent(StreamReliabilityRef ref, size_t size)
+static void streamReliabilityRttSample(StreamReliabilityRef ref, float rtt, net_time_t now)
 {
-    assert(ref != NULL);
+    if(ref->rttSamples == 0)
+    {
+        ref->rtt = rtt;
+        ref->rttVariance = rtt * 0.5f;
+    }
+    else
+    {
+        ref->rttVariance += (fabsf(rtt - ref->rtt) - ref->rttVariance) * kStreamReliabilityRttVarianceGain; // Low-pass filtered
+        ref->rtt += (rtt - ref->rtt) * kStreamReliabilityRttGain; // Low-pass filtered
+    }
     
-    unsigned int pivotBack = ref->back;
-    unsigned int pivotAcked = ref->frontAcked;
+    if(ref->rttSamples == 0 || rtt <= ref->rttMin || now - ref->rttMinTime > kStreamReliabilityRttMinWindow)
+    {
+        ref->rttMin = rtt;
+        ref->rttMinTime = now;
+    }
     
-    if(pivotBack != pivotAcked)
-        assert(pivotBack != pivotAcked);
+    ref->rttSamples += 1;
+}
+
+static inline bool streamReliabilityIsAckedList(StreamReliabilityRef ref, unsigned int index)
+{
+    unsigned int distance = (index + kStreamReliabilityBufferCapacity - ref->frontAcked) % kStreamReliabilityBufferCapacity;
+    unsigned int length = (ref->frontSent + kStreamReliabilityBufferCapacity - ref->frontAcked) % kStreamReliabilityBufferCapacity;
+    
+    return distance < length;
+}
+
+static inline bool streamReliabilityIsValid(StreamReliabilityRef ref, unsigned int index)
+{
+    unsigned int distance = (index + kStreamReliabilityBufferCapacity - ref->frontAcked) % kStreamReliabilityBufferCapacity;
+    unsigned int length = (ref->back + kStreamReliabilityBufferCapacity - ref->frontAcked) % kStreamReliabilityBufferCapacity;
+    
+    return distance < length;
+}
+
+static void streamReliabilityPopSent(StreamReliabilityRef ref)
+{
+    StreamPacketMetadataRef packet = &ref->packets[ref->frontSent];
+    
+    ref->sentPackets -= 1; // Remove from sent count
+    ref->sentBytes -= packet->size;
+    
+    if(packet->acked)
+    {
+        ref->ackedPackets += 1; // Move to acked count
+        ref->ackedBytes += packet->size;
+    }
+    else
+    {
+        ++ref->totalLostPackets; // Consider it is lost if kStreamReliabilityMaxRtt elapsed without ack
+    }
+    
+    ref->lossRatio += ((packet->acked ? 0.0f : 1.0f) - ref->lossRatio) * kStreamReliabilityLossGain; // Low-pass filtered
+    
+    increase(&ref->frontSent, kStreamReliabilityBufferCapacity); // Move sent head to next
+}
+
+static void streamReliabilityPopAcked(StreamReliabilityRef ref)
+{
+    StreamPacketMetadataRef packet = &ref->packets[ref->frontAcked];
+    
+    if(packet->acked)
+    {
+        ref->ackedPackets -= 1; // Remove from acked count
+        ref->ackedBytes -= packet->size;
+    }
+    
+    increase(&ref->frontAcked, kStreamReliabilityBufferCapacity); // Move acked head to next
+}
+
+void streamReliabilityPacketSent(StreamReliabilityRef ref, size_t size, net_time_t now)
+{
+    assert(ref != NULL);
     
     StreamPacketMetadata metadata;
     
     metadata.acked = 0;
     metadata.sequence = ref->sequence;
-    metadata.time = 0.0f;
+    metadata.sendTime = now;
     metadata.size = size;
     
     ref->packets[ref->back] = metadata;
@@ -61,28 +142,68 @@ void streamReliabilityPacketSent(StreamReliabilityRef ref, size_t size)
     increase(&ref->sequence, kStreamReliabilityMaxSequence);
 
     ref->totalSentPackets += 1;
+    ref->sentPackets += 1;
     ref->sentBytes += size;
     
-    if(ref->back == ref->frontAcked)
-        increase(&ref->frontAcked, kStreamReliabilityBufferCapacity); // Overwrite, discard acked packets
-    
-    if(ref->back == ref->frontSent)
-        increase(&ref->frontSent, kStreamReliabilityBufferCapacity); // Overwrite, discard sent packets 
+    if(ref->back == ref->frontAcked) // Overwrite, discard oldest packet
+    {
+        if(ref->frontAcked == ref->frontSent)
+            streamReliabilityPopSent(ref); // Discard sent packet, move to acked list first
+        
+        streamReliabilityPopAcked(ref); // Discard acked packet
+    }
     
     assert(ref->frontSent != ref->back);
     assert(ref->frontAcked != ref->back);
 }
 
-void streamReliabilityPacketReceived(StreamReliabilityRef ref, Sequence sequence, Ack ack, AckBitField ackBits)
+void streamReliabilityPacketReceived(StreamReliabilityRef ref, Sequence sequence, Ack ack, AckBitField ackBits, net_time_t now)
 {
     assert(ref != NULL);
     
     streamReliabilityProcessSequence(ref, sequence);
-    streamReliabilityProcessAck(ref, ack, ackBits);
+    streamReliabilityProcessAck(ref, ack, ackBits, now);
     
     ref->totalReceivedPackets += 1;
 }
 
+static void streamReliabilityShiftAckBits(StreamReliabilityRef ref, unsigned int shifts)
+{
+    uint64_t words[1+kStreamReliabilitySackWords]; // ackBits followed by sackBits, shifted as a single bit field
+    const unsigned int count = 1+kStreamReliabilitySackWords;
+    unsigned int wordShifts = shifts / 64, bitShifts = shifts % 64;
+    
+    words[0] = ref->ackBits;
+    memcpy(&words[1], ref->sackBits, sizeof(ref->sackBits));
+    
+    for(int i=count-1; i>=0; --i) // Most significant word first, only reads less significant words
+    {
+        uint64_t value = 0;
+        
+        if(i >= (int)wordShifts)
+        {
+            value = words[i-wordShifts] << bitShifts;
+            
+            if(bitShifts > 0 && i > (int)wordShifts)
+                value |= words[i-wordShifts-1] >> (64-bitShifts); // Carry from less significant word
+        }
+        
+        words[i] = value;
+    }
+    
+    ref->ackBits = words[0];
+    memcpy(ref->sackBits, &words[1], sizeof(ref->sackBits));
+}
+
+static inline bool streamReliabilityAckBit(StreamReliabilityRef ref, unsigned int offset)
+{
+    if(offset < 64)
+        return (ref->ackBits >> offset) & 1;
+    
+    offset -= 64;
+    return (ref->sackBits[offset/64] >> (offset%64)) & 1;
+}
+
 void streamReliabilityProcessSequence(StreamReliabilityRef ref, Sequence sequence)
 {
     assert(ref != NULL);
@@ -91,15 +212,8 @@ void streamReliabilityProcessSequence(StreamReliabilityRef ref, Sequence sequenc
     {
         unsigned int shifts = (sequence > ref->ack) ? (sequence-ref->ack) : (sequence-ref->ack+kStreamReliabilityMaxSequence+1); // Non and wrap-around cases
         
-        if(shifts < sizeof(unsigned int)*8)
-        {
-            ref->ackBits <<= shifts; // Shift bit field
-            ref->ackBits |= 1; // Set LSB bit
-        }
-        else 
-        {
-            ref->ackBits = 0; // Shift was > 31 bits, zero bit field
-        }		
+        streamReliabilityShiftAckBits(ref, shifts); // Shift bit field, zeroed if shift exceeds kStreamProtocolSackWindow
+        ref->ackBits |= 1; // Set LSB bit
         
         ref->ack = sequence; // Update ack
     }
@@ -107,108 +221,200 @@ void streamReliabilityProcessSequence(StreamReliabilityRef ref, Sequence sequenc
     {
         unsigned int shifts = (ref->ack >= sequence) ? (ref->ack-sequence) : (ref->ack-sequence+kStreamReliabilityMaxSequence+1); // Non and wrap-around cases
         
-        if(shifts < sizeof(unsigned int)*8)
+        if(shifts < 64)
         {
-            ref->ackBits |= (1 << shifts);  // Not more recent, set bit that is |sequence - ack| bits to left
+            ref->ackBits |= ((AckBitField)1 << shifts);  // Not more recent, set bit that is |sequence - ack| bits to left
+        }
+        else if(shifts < kStreamProtocolSackWindow)
+        {
+            shifts -= 64;
+            ref->sackBits[shifts/64] |= ((uint64_t)1 << (shifts%64)); // Older than ackBits, reported in SACK blocks
         }
     }
-    
-    ref->ackBits &= 0xFFFFFFFF; // Make sure only 4 LSB Bytes are filled in	
 }
 
-void streamReliabilityProcessAck(StreamReliabilityRef ref, Ack ack, AckBitField ackBits)
-{	
-    assert(ref != NULL);
-   
+static bool streamReliabilityAckPivot(StreamReliabilityRef ref, Ack ack, int * pivot)
+{
     if(ref->frontSent == ref->back) // Assume it is empty
-        return;
+        return false;
     
-    int pivot, count; // Pivot and Count (delta between current sequence and received ack)
+    int count; // Count (delta between current sequence and received ack)
     
-    pivot = ref->back; // Start at pivot = back, move back to ack pack and check last 32 sent against ackBits and acked flag
-
     if(ref->sequence > ack)
         count = ref->sequence-ack;
     else
         count = ref->sequence-ack+kStreamReliabilityMaxSequence+1; // Wrap around case
     
-    if(count < kStreamReliabilityBufferCapacity) // Only check if count doesn't exceed buffer's capacity
+    if(count >= kStreamReliabilityBufferCapacity) // Only check if count doesn't exceed buffer's capacity
+        return false;
+    
+    *pivot = ref->back; // Start at pivot = back, move back to ack packet
+    decrease(pivot, count, kStreamReliabilityBufferCapacity); 
+    
+    assert(*pivot >= 0 && *pivot < kStreamReliabilityBufferCapacity);
+    
+    return streamReliabilityIsValid(ref, *pivot);
+}
+
+static void streamReliabilityAckPacket(StreamReliabilityRef ref, int pivot, unsigned int distance, net_time_t now)
+{
+    unsigned int age = (pivot + kStreamReliabilityBufferCapacity - ref->frontAcked) % kStreamReliabilityBufferCapacity;
+    
+    if(distance > age) // Older than any packet in buffer
+        return;
+    
+    int index = pivot;
+    decrease(&index, distance, kStreamReliabilityBufferCapacity);
+    
+    if(!ref->packets[index].acked) // First time acked
     {
-        decrease(&pivot, count, kStreamReliabilityBufferCapacity); // Move pivot back
+        ref->packets[index].acked = true;
         
-        assert(pivot >= 0 && pivot < kStreamReliabilityBufferCapacity);
+        ref->totalAckedPackets += 1;
         
-        for(int p=0; p<31; ++p) // Check 32 bits in ackBits field
+        if(streamReliabilityIsAckedList(ref, index)) // Late ack, already moved to acked list
         {
-            if(!ref->packets[pivot].acked && (ackBits & 1)) // First time acked
-            {
-                ref->packets[pivot].acked = true;
-                
-                ref->totalAckedPackets += 1;
-                ref->rtt += (ref->packets[pivot].time - ref->rtt) * 0.1f; // Low-pass filtered
-            }
-            
-            ackBits >>= 1; // Move left
-            decrease(&pivot, 1, kStreamReliabilityBufferCapacity); // Advance to previous
+            ref->ackedPackets += 1;
+            ref->ackedBytes += ref->packets[index].size;
         }
+        
+        if(!ref->echoValid) // Includes time the ack was held on the remote side, only used if timestamps aren't echoed
+            streamReliabilityRttSample(ref, mNetTimeToSeconds(now - ref->packets[index].sendTime), now);
+    }
+}
+
+void streamReliabilityProcessAck(StreamReliabilityRef ref, Ack ack, AckBitField ackBits, net_time_t now)
+{	
+    assert(ref != NULL);
+    
+    int pivot;
+    
+    if(!streamReliabilityAckPivot(ref, ack, &pivot))
+        return;
+    
+    for(unsigned int p=0; ackBits != 0; ++p, ackBits >>= 1) // Check all 64 bits in ackBits field, stop at last set bit
+    {
+        if(ackBits & 1)
+            streamReliabilityAckPacket(ref, pivot, p, now);
     }
 }
 
-void streamReliabilityUpdate(StreamReliabilityRef ref, float deltaTime)
+void streamReliabilityAckOptions(StreamReliabilityRef ref, StreamHeaderOptions * options)
 {
     assert(ref != NULL);
     
-    if(ref->frontSent == ref->back) // Assume it is empty
+    if(!ref->ackExtended)
         return;
+    
+    options->flags |= StreamHeaderFlagAckExtended;
+    
+    if(!ref->remoteAckExtended) // Only send SACK blocks once negotiated
+        return;
+    
+    options->sackCount = 0;
+    
+    for(unsigned int offset=64; offset < kStreamProtocolSackWindow && options->sackCount < kStreamProtocolMaxSackBlocks; ) // Most recent blocks first
+    {
+        if((offset % 64) == 0 && ref->sackBits[(offset-64)/64] == 0) // Skip empty words
+        {
+            offset += 64;
+        }
+        else if(streamReliabilityAckBit(ref, offset))
+        {
+            unsigned int start = offset;
+            
+            while(offset < kStreamProtocolSackWindow && streamReliabilityAckBit(ref, offset))
+                ++offset;
+            
+            options->sack[options->sackCount].offset = start;
+            options->sack[options->sackCount].length = offset-start;
+            options->sackCount += 1;
+        }
+        else
+        {
+            ++offset;
+        }
+    }
+    
+    if(options->sackCount > 0)
+        options->flags |= StreamHeaderFlagSack;
+}
 
-    // Update time
-    for(unsigned int i=0; i<kStreamReliabilityBufferCapacity; ++i)
-        ref->packets[i].time += deltaTime;
+void streamReliabilityProcessAckOptions(StreamReliabilityRef ref, Ack ack, const StreamHeaderOptions * options, net_time_t now)
+{
+    assert(ref != NULL);
     
-    // RTT epsilon
-    const float epsilon = 0.0001f;
+    if(options->flags & StreamHeaderFlagAckExtended)
+        ref->remoteAckExtended = true; // Remote side supports extended acks
     
-    // Sent Front    
-    while(ref->frontSent != ref->back && ref->packets[ref->frontSent].time > (kStreamReliabilityMaxRtt + epsilon))
+    int pivot;
+    
+    if(!(options->flags & StreamHeaderFlagSack) || !streamReliabilityAckPivot(ref, ack, &pivot))
+        return;
+    
+    for(unsigned int i=0; i<options->sackCount; ++i)
     {
-        ref->sentBytes -= ref->packets[ref->frontSent].size; // Remove from sent count
-        
-        if(ref->packets[ref->frontSent].acked == false)
-            ++ref->totalLostPackets; // Consider it is lost if kStreamReliabilityMaxRtt+epsilon elapsed without ack
-        
-        increase(&ref->frontSent, kStreamReliabilityBufferCapacity); // Move sent head to next
+        for(unsigned int p=0; p<options->sack[i].length; ++p)
+            streamReliabilityAckPacket(ref, pivot, options->sack[i].offset + p, now);
     }
+}
+
+void streamReliabilityTimestamps(StreamReliabilityRef ref, StreamHeaderOptions * options, net_time_t now)
+{
+    assert(ref != NULL);
     
-    // Acked Front
-    unsigned int c = 0;
-    while(ref->frontAcked != ref->back && ref->packets[ref->frontAcked].time > (kStreamReliabilityMaxRtt * 2.0f - epsilon))
+    options->flags |= StreamHeaderFlagTimestamp;
+    options->timestamp = (unsigned int)(now / kNetTimeMicrosecond);
+    
+    if(ref->remoteTimestampValid)
     {
-        ++c;
-        increase(&ref->frontAcked, kStreamReliabilityBufferCapacity); // Move acked head to next
+        options->flags |= StreamHeaderFlagEcho;
+        options->echoTimestamp = ref->remoteTimestamp;
+        options->echoDelay = (unsigned int)((now - ref->remoteTimestampTime) / kNetTimeMicrosecond);
     }
+}
+
+void streamReliabilityProcessTimestamps(StreamReliabilityRef ref, const StreamHeaderOptions * options, net_time_t now)
+{
+    assert(ref != NULL);
     
-    // Clear acked packets/bytes (to be recalculated)
-    ref->ackedPackets = 0;
-    ref->ackedBytes = 0;
+    if(options->flags & StreamHeaderFlagTimestamp)
+    {
+        if(!ref->remoteTimestampValid || (int)(options->timestamp - ref->remoteTimestamp) > 0) // Ignore reordered packets
+        {
+            ref->remoteTimestampValid = true;
+            ref->remoteTimestamp = options->timestamp;
+            ref->remoteTimestampTime = now;
+        }
+    }
     
-    if(ref->frontAcked != ref->back) // Proceed in case there are acked packets
+    if(options->flags & StreamHeaderFlagEcho)
     {
-        unsigned int pivot = ref->frontAcked;
+        unsigned int timestamp = (unsigned int)(now / kNetTimeMicrosecond);
+        int rtt = (int)(timestamp - options->echoTimestamp - options->echoDelay); // Wrap around safe
+        
+        if(rtt < 0)
+            rtt = 0; // Rounding to microseconds
         
-        while(pivot != ref->back)
+        if(rtt <= kStreamReliabilityMaxRtt * 1000000) // Discard invalid or stale echoes
         {
-            if(ref->packets[pivot].acked)
-            {
-                if(ref->packets[pivot].time >= kStreamReliabilityMaxRtt) // For stats. count only acked packets after kStreamReliabilityMaxRtt has elapsed
-                {
-                    ref->ackedPackets += 1;
-                    ref->ackedBytes += ref->packets[pivot].size;
-                }	
-            }
-            
-            increase(&pivot, kStreamReliabilityBufferCapacity);
+            ref->echoValid = true;
+            streamReliabilityRttSample(ref, rtt / 1000000.0f, now);
         }
     }
+}
+
+void streamReliabilityUpdate(StreamReliabilityRef ref, net_time_t now)
+{
+    assert(ref != NULL);
+    
+    // Sent Front, oldest first so only expired packets are visited
+    while(ref->frontSent != ref->back && now - ref->packets[ref->frontSent].sendTime > kStreamReliabilityMaxRttTime)
+        streamReliabilityPopSent(ref);
+    
+    // Acked Front
+    while(ref->frontAcked != ref->frontSent && now - ref->packets[ref->frontAcked].sendTime >= 2 * kStreamReliabilityMaxRttTime)
+        streamReliabilityPopAcked(ref);
     
     // Stats
     ref->sentBytesPerSecond = ref->sentBytes / kStreamReliabilityMaxRtt;
@@ -216,4 +422,4 @@ void streamReliabilityUpdate(StreamReliabilityRef ref, float deltaTime)
     ref->ackedBytesPerSecond = ref->ackedBytes / kStreamReliabilityMaxRtt;
     ref->sentBandwidth = ref->sentBytesPerSecond * 0.008f; // ( 8 / 1000.0f );
     ref->ackedBandwidth = ref->ackedBytesPerSecond * 0.008f; // ( 8 / 1000.0f );
-}
+}
\ No newline at end of file
@@ -18,14 +18,22 @@
 #include "stream_protocol.h"
 
 #define kStreamReliabilityMaxRtt 1.0
+#define kStreamReliabilityMaxRttTime ((net_time_t)(kStreamReliabilityMaxRtt * kNetTimeSecond))
+#define kStreamReliabilityRttGain 0.1f          // Low-pass filter gain for rtt
+#define kStreamReliabilityRttVarianceGain 0.25f // Low-pass filter gain for rttVariance
+#define kStreamReliabilityLossGain 0.05f        // Low-pass filter gain for lossRatio, per expired packet
+#define kStreamReliabilityRttMinWindow (10 * kNetTimeSecond) // rttMin expires after 10 seconds, path may have changed
 #define kStreamReliabilityMaxSequence 0xFFFF // 16 bits
 
-#define kStreamReliabilityBufferCapacity ((int)(2.35f * kStreamReliabilityMaxRtt * kStreamFlowMaxRate + 0.5))
+#define kStreamReliabilitySackWords ((kStreamProtocolSackWindow - 64) / 64) // Received history older than ackBits
+
+#define kStreamReliabilityRateCapacity ((int)(2.35f * kStreamReliabilityMaxRtt * kStreamFlowMaxRate + 0.5))
+#define kStreamReliabilityBufferCapacity (kStreamReliabilityRateCapacity > kStreamProtocolSackWindow ? kStreamReliabilityRateCapacity : kStreamProtocolSackWindow) // At least the SACK window, so that every reported ack can be matched
 
 typedef struct 
 {
     unsigned int sequence;  // Packet sequence number
-    float time;             // Time offset since packet was sent or received (depending on context)
+    net_time_t sendTime;    // Monotonic time when packet was sent
     size_t size;            // Packet total size in bytes (header and payload)
     bool acked;             // Confirms if packets has been received on the remote side
     
@@ -37,30 +45,44 @@ typedef struct
 {    
     StreamPacketMetadata packets[kStreamReliabilityBufferCapacity]; // Ring buffer, used to store all sent packets metadata
     
-    unsigned int frontSent;             // Oldest index in buffer that is in "sent list"
-    unsigned int frontAcked;            // Oldest index in buffer that is in "acked list"
+    unsigned int frontSent;             // Oldest index in buffer that is in "sent list", packets sent within kStreamReliabilityMaxRtt
+    unsigned int frontAcked;            // Oldest index in buffer that is in "acked list", packets sent between kStreamReliabilityMaxRtt and 2*kStreamReliabilityMaxRtt
     unsigned int back;                  // Next available index
     
     Sequence sequence;              // Current local sequence, increased every streamReliabilityPacketSent
     Ack ack;                   		// Last remote sequence received
     AckBitField ackBits;            // Last remote sequence bit field received
+    uint64_t sackBits[kStreamReliabilitySackWords]; // Remote sequences received older than ackBits, bit n is ack-64-n
+    bool ackExtended;                   // Send extended ack bit field, advertises SACK support (default)
+    bool remoteAckExtended;             // Remote side sends extended ack bit field, send SACK blocks
     
     unsigned int totalSentPackets;      // Total sent packets recorded
     unsigned int totalReceivedPackets;  // Total received packets recorded
     unsigned int totalAckedPackets;     // Total acked packets recorded
     unsigned int totalLostPackets;      // Total lost packets recorded
 
-    unsigned int sentBytes;
+    unsigned int sentPackets;           // Sent packets in "sent list", maintained incrementally
+    unsigned int sentBytes;             // Sent bytes in "sent list", maintained incrementally
     unsigned int sentBytesPerSecond;    // Sent bytes, used for sentBandwidth
-    unsigned int ackedPackets;
+    unsigned int ackedPackets;          // Acked packets in "acked list", maintained incrementally
     unsigned int ackedPacketsPerSecond; // Acked packets 
-    unsigned int ackedBytes;
+    unsigned int ackedBytes;            // Acked bytes in "acked list", maintained incrementally
     unsigned int ackedBytesPerSecond;   // Acked bytes, used for ackedBandwidth
 
     float sentBandwidth;				// Approximate sent bandwidth over the last second in kbps
     float ackedBandwidth;				// Approximate acked bandwidth over the last second in kbps
+    float lossRatio;					// Ratio of lost packets [0,1], low-pass filtered as packets expire
    
-    float rtt;							// Estimated round trip time based on acked packets
+    float rtt;							// Estimated round trip time based on acked packets or echoed timestamps
+    float rttVariance;					// Mean deviation of rtt samples
+    float rttMin;						// Minimum rtt sample within kStreamReliabilityRttMinWindow
+    net_time_t rttMinTime;				// Time when rttMin was sampled
+    unsigned int rttSamples;			// Total rtt samples
+    
+    bool remoteTimestampValid;			// Remote side sends timestamps, echo them back
+    unsigned int remoteTimestamp;		// Most recent remote timestamp received
+    net_time_t remoteTimestampTime;		// Time when remoteTimestamp was received
+    bool echoValid;						// Remote side echoes timestamps, use them for rtt instead of acks
     
 } StreamReliability;
 
@@ -68,13 +90,19 @@ typedef StreamReliability * StreamReliabilityRef;
 
 void streamReliabilityClear(StreamReliabilityRef);
 
-void streamReliabilityPacketSent(StreamReliabilityRef, size_t);
-void streamReliabilityPacketReceived(StreamReliabilityRef, Sequence, Ack, AckBitField);
+void streamReliabilityPacketSent(StreamReliabilityRef, size_t, net_time_t);
+void streamReliabilityPacketReceived(StreamReliabilityRef, Sequence, Ack, AckBitField, net_time_t);
 
 void streamReliabilityProcessSequence(StreamReliabilityRef, Sequence); // Remote sequence, changes ack and ackBits
-void streamReliabilityProcessAck(StreamReliabilityRef, Ack, AckBitField); // Local sequence, changes ackedPackets
+void streamReliabilityProcessAck(StreamReliabilityRef, Ack, AckBitField, net_time_t); // Local sequence, changes ackedPackets
+
+void streamReliabilityAckOptions(StreamReliabilityRef, StreamHeaderOptions *); // Header extended ack and SACK blocks to send
+void streamReliabilityProcessAckOptions(StreamReliabilityRef, Ack, const StreamHeaderOptions *, net_time_t); // Header SACK blocks received, changes ackedPackets
+
+void streamReliabilityTimestamps(StreamReliabilityRef, StreamHeaderOptions *, net_time_t); // Header timestamps to send, local timestamp and echo
+void streamReliabilityProcessTimestamps(StreamReliabilityRef, const StreamHeaderOptions *, net_time_t); // Header timestamps received, changes rtt
 
-void streamReliabilityUpdate(StreamReliabilityRef, float);
+void streamReliabilityUpdate(StreamReliabilityRef, net_time_t); // Expires packets sent more than kStreamReliabilityMaxRtt ago, O(expired packets)
 
 static inline void increase(unsigned int * value, unsigned max)
 {
@@ -24,9 +24,11 @@
 #include "stun_internal.h"
 #include "universal_network_c.h"
 
+#include <time.h>
+
 stun_t stunCreate(net_socket_t socket, const char * serverHostname, StunDidResolve stunDidResolve, StunDidFailResolve stunDidFailResolve)
 {
-	stun_t stun = malloc(sizeof(struct StunStruct)); // Alloc
+	stun_t stun = calloc(1, sizeof(struct StunStruct)); // Alloc, tests not started yet are zeroed (no demux registration)
 	
 	if(stun)
 	{		
@@ -37,7 +39,7 @@ stun_t stunCreate(net_socket_t socket, const char * serverHostname, StunDidResol
 		
 		// Test configuration
 		stun->config.testDidComplete = Block_copy(^(StunTest * test) {
-			stunRunNextTest(stun, test);
+			stunDidCompleteTest(stun, test);
 		});
 		
 		// Transmission configuration
@@ -48,13 +50,14 @@ stun_t stunCreate(net_socket_t socket, const char * serverHostname, StunDidResol
 		memset(&stun->results, 0, sizeof(StunResults));
 		
 		// Associate socket
-		stun->config.socket_info.socket = socket;
+		stun->config.socket = socket;
 		
 		// Create queue
 		stun->config.stunDispatchQueue = dispatch_queue_create("com.laugga.stunDispatchQueue", NULL);
         
         // Store server hostname
         strncpy(stun->config.primaryServerHostname, serverHostname, 64);
+        stun->config.primaryServerPort = kStunServerDefaultPort;
 	}
 	
 	return stun;
@@ -64,6 +67,10 @@ void stunDestroy(stun_t stun)
 {
 	if(stun)
 	{
+		// Stop receiving, then wait for the datagrams already dispatched to stun queue
+		net_socket_demux_remove(stun->config.socket, stun->config.demux);
+		dispatch_sync(stun->config.stunDispatchQueue, ^{ /* Wait for pending blocks */ });
+		
 		// Release any pending tests
 		if(!stun->bindingTest1.isCompleted) stunTestRelease(&stun->bindingTest1, &stun->config);
 		if(!stun->behaviorTest1.isCompleted) stunTestRelease(&stun->behaviorTest1, &stun->config);
@@ -82,18 +89,109 @@ void stunDestroy(stun_t stun)
 		
 		if(stun->stunDidFailResolve)
 			Block_release(stun->stunDidFailResolve); // Release did fail resolve block
+		
+		free(stun->cachePath);
 	
 		free(stun); // Release self
 		stun = NULL; // Nil pointer
 	}
 }
 
+void stunSetCache(stun_t c, const char * path, uint64_t ttl)
+{
+	free(c->cachePath);
+	c->cachePath = path ? strdup(path) : NULL;
+	c->cacheTtl = ttl;
+}
+
+void stunSetServerPort(stun_t c, unsigned short port)
+{
+	c->config.primaryServerPort = port;
+}
+
+static bool stunStartBinding(stun_t c, StunResults * results)
+{
+	// Receive STUN datagrams for every test, on stun queue
+	c->config.demux = net_socket_demux_add_block(c->config.socket, 0x00, kStunProtocolFirstByteMax, stunProtocolIsMessage, ^(net_packet_t packet) {
+		dispatch_async(c->config.stunDispatchQueue, ^{
+			stunReceive(c, packet);
+		});
+	});
+	
+	if(c->config.demux == kNetSocketDemuxNone)
+	{
+		mNetworkLog("Error socket demux is full");
+		return false;
+	}
+	
+	// Run first test: basic binding
+	c->isBehaviorDone = false;
+	c->isFilteringDone = false;
+	stunTestStartBasicBinding(&c->bindingTest1, &c->config, results);
+	
+	return true;
+}
+
+static bool stunLoadCache(stun_t c)
+{
+	if(c->cachePath == NULL || net_addr_local(&c->cacheLocalAddr) != NetNoError)
+		return false;
+	
+	StunCacheEntry entry;
+	if(!stunCacheLoad(c->cachePath, &c->cacheLocalAddr, c->config.primaryServerHostname, (uint64_t)time(NULL), c->cacheTtl, &entry) || !entry.results.didBindingTestSuccess)
+		return false;
+	
+	c->results = entry.results;
+	net_addr_copy(&c->config.primaryServerAddr, &entry.serverAddr); // No DNS resolution
+	
+	net_socket_local_addr(c->config.socket, &c->results.localAddr); // Same interface, this socket's port
+	if(c->results.isMappingDirect)
+		net_addr_copy(&c->results.mappedAddr, &c->results.localAddr);
+	
+	return true;
+}
+
+static void stunStoreCache(stun_t c)
+{
+	if(c->cachePath == NULL || !c->results.didBindingTestSuccess)
+		return;
+	
+	StunCacheEntry entry;
+	memset(&entry, 0, sizeof(StunCacheEntry));
+	net_addr_copy(&entry.localAddr, &c->cacheLocalAddr);
+	strncpy(entry.serverHostname, c->config.primaryServerHostname, kStunCacheServerHostnameMaxLen - 1);
+	net_addr_copy(&entry.serverAddr, &c->config.primaryServerAddr);
+	entry.time = (uint64_t)time(NULL);
+	entry.results = c->results;
+	
+	NetError netError = stunCacheStore(c->cachePath, &entry);
+	if(netError)
+		netErrorLog(netError);
+}
+
 void stunResolve(stun_t c)
 {
 	dispatch_async(c->config.stunDispatchQueue, ^{ 
         
+        // Cached results, revalidated in background
+        if(stunLoadCache(c))
+        {
+            mNetworkLog("Using cached STUN results");
+            
+            c->didResolve = true;
+            c->stunDidResolve(c); // notify
+            
+            memset(&c->revalidationResults, 0, sizeof(StunResults));
+            c->isRevalidating = stunStartBinding(c, &c->revalidationResults);
+            return;
+        }
+        
+        // Key for storing results (cache misses if local interface changes)
+        if(c->cachePath)
+            net_addr_local(&c->cacheLocalAddr);
+        
         // Server address resolution
-		NetError netError = net_addr_resolve(&c->config.primaryServerAddr, c->config.primaryServerHostname, kStunServerDefaultPort);
+		NetError netError = net_addr_resolve(&c->config.primaryServerAddr, c->config.primaryServerHostname, c->config.primaryServerPort);
 		
         // Won't proceed if resolve fails
         if(netError)
@@ -104,41 +202,206 @@ void stunResolve(stun_t c)
             
             c->stunDidFailResolve(c); // notify
 		}
-        else // no error
+        else if(!stunStartBinding(c, &c->results))
         {
-            // Copy socket callback and block callback pointers
-            net_socket_copy_info(c->config.socket_info.socket, &c->config.socket_info);
-            
-            // Run first test: basic binding
-            stunTestStartBasicBinding(&c->bindingTest1, &c->config, &c->results);
+            c->stunDidFailResolve(c); // notify
         }
 	});
 }
 
-void stunRunNextTest(stun_t c, StunTest * previousTest)
+void stunReceive(stun_t c, net_packet_t packet)
+{
+	StunTransactionId transactionId; // Unpack response
+	StunBindingResponse bindingResponse;
+	
+	if(stunProtocolUnpackBindingResponse(&packet->bitstream, &transactionId, &bindingResponse) == kStunValid)
+	{
+		StunTest * tests[] = {&c->bindingTest1, &c->behaviorTest1, &c->behaviorTest2, &c->filteringTest1, &c->filteringTest2};
+		
+		for(int i=0; i<sizeof(tests)/sizeof(tests[0]); ++i)
+		{
+			if(stunTestIsResponse(tests[i], &transactionId))
+			{
+				stunTestReceive(tests[i], &c->config, packet, &bindingResponse);
+				break;
+			}
+		}
+	}
+	
+	net_packet_release(c->config.socket, packet); // Release response packet
+}
+
+static void stunMergeBehavior(stun_t c)
+{
+	StunResults * results = &c->results;
+	StunTest * test1 = &c->behaviorTest1; // otherServerPrimaryPortAddr
+	StunTest * test2 = &c->behaviorTest2; // otherServerAddr
+	
+	if(test1->isCompleted && !test1->didRespond) // Can't classify without test 1
+	{
+		c->isBehaviorDone = true;
+	}
+	else if(test1->didRespond && net_addr_is_equal(&results->mappedOtherServerPrimaryPortAddr, &results->mappedAddr)) // Same mapping from other address, test 2 not needed
+	{
+		results->natBehavior = EndpointIndependentMapping;
+		results->didBehaviorTestSuccess = true;
+		c->isBehaviorDone = true;
+	}
+	else if(test1->didRespond && test2->isCompleted)
+	{
+		if(test2->didRespond)
+		{
+			if(net_addr_is_equal(&results->mappedOtherServerAddr, &results->mappedOtherServerPrimaryPortAddr)) // Same mapping from other port
+				results->natBehavior = AddressDependentMapping;
+			else
+				results->natBehavior = AddressAndPortDependentMapping;
+			
+			results->didBehaviorTestSuccess = true;
+		}
+		c->isBehaviorDone = true;
+	}
+	
+	if(c->isBehaviorDone)
+	{
+		stunTestCancel(test1, &c->config);
+		stunTestCancel(test2, &c->config);
+	}
+}
+
+static void stunMergeFiltering(stun_t c)
+{
+	StunResults * results = &c->results;
+	StunTest * test1 = &c->filteringTest1; // Change host and port
+	StunTest * test2 = &c->filteringTest2; // Change port
+	
+	if(test1->didRespond) // Response from other host, test 2 not needed
+	{
+		results->natFiltering = EndpointIndependentFiltering;
+		results->didFilteringTestSuccess = true;
+		c->isFilteringDone = true;
+	}
+	else if(test1->isCompleted && test2->isCompleted)
+	{
+		results->natFiltering = test2->didRespond ? AddressDependentFiltering : AddressAndPortDependentFiltering;
+		results->didFilteringTestSuccess = true;
+		c->isFilteringDone = true;
+	}
+	
+	if(c->isFilteringDone)
+	{
+		stunTestCancel(test1, &c->config);
+		stunTestCancel(test2, &c->config);
+	}
+}
+
+static bool stunRevalidate(stun_t c, bool * didChange) // True if cached results still hold, otherwise binding results replace them
+{
+	StunResults * results = &c->results;
+	StunResults * revalidation = &c->revalidationResults;
+	
+	c->isRevalidating = false;
+	*didChange = false;
+	
+	if(!revalidation->didBindingTestSuccess) // Server unreachable, keep cached results
+		return true;
+	
+	if(revalidation->isMappingDirect == results->isMappingDirect
+		&& revalidation->mappedAddr.sin_addr.s_addr == results->mappedAddr.sin_addr.s_addr
+		&& revalidation->hasOtherServerAddress == results->hasOtherServerAddress
+		&& (!revalidation->hasOtherServerAddress || net_addr_is_equal(&revalidation->otherServerAddr, &results->otherServerAddr)))
+	{
+		*didChange = !net_addr_is_equal(&revalidation->mappedAddr, &results->mappedAddr); // Port only, same classification
+		net_addr_copy(&results->localAddr, &revalidation->localAddr);
+		net_addr_copy(&results->mappedAddr, &revalidation->mappedAddr);
+		return true;
+	}
+	
+	mNetworkLog("Cached STUN results changed, classifying");
+	*results = *revalidation; // Behavior and filtering unknown
+	return false;
+}
+
+static void stunFinish(stun_t c)
+{
+	net_socket_demux_remove(c->config.socket, c->config.demux); // Stop receiving
+	c->config.demux = kNetSocketDemuxNone;
+	
+	stunStoreCache(c);
+	
+	if(c->results.didBindingTestSuccess)
+	{
+		// Notify
+		c->didResolve = true;
+		c->stunDidResolve(c);	
+	}
+	else
+	{
+		c->stunDidFailResolve(c); // If fails basic binding test, no point going further
+	}
+}
+
+void stunDidCompleteTest(stun_t c, StunTest * completedTest)
 {
 	dispatch_async(c->config.stunDispatchQueue, ^{ 
-		if(previousTest == &c->bindingTest1) // Run test: behavior 1
-			stunTestStartBehavior1(&c->behaviorTest1, &c->config, &c->results);
-		else if(previousTest == &c->behaviorTest1) // Run test: behavior 2
-			stunTestStartBehavior2(&c->behaviorTest2, &c->config, &c->results);
-		else if(previousTest == &c->behaviorTest2) // Run test: filtering 1
-			stunTestStartFiltering1(&c->filteringTest1, &c->config, &c->results);
-		else if(previousTest == &c->filteringTest1) // Run test: filtering 2
-			stunTestStartFiltering2(&c->filteringTest2, &c->config, &c->results);
-		else if(c->results.didBindingTestSuccess) // Finish
+		StunResults * results = &c->results;
+		
+		if(completedTest == &c->bindingTest1 && c->isRevalidating)
 		{
-			// Copy back socket callback and block callback pointers
-			net_socket_set_info(c->config.socket_info.socket, &c->config.socket_info);
+			bool didChange;
+			if(stunRevalidate(c, &didChange))
+			{
+				net_socket_demux_remove(c->config.socket, c->config.demux); // Stop receiving
+				c->config.demux = kNetSocketDemuxNone;
+				
+				if(c->revalidationResults.didBindingTestSuccess)
+					stunStoreCache(c); // Refresh time
+				if(didChange)
+					c->stunDidResolve(c); // notify, new mapped address
+				return;
+			}
+		}
 		
-			// Notify
-			c->didResolve = true;
-			c->stunDidResolve(c);	
+		if(completedTest == &c->bindingTest1)
+		{
+			if(!results->didBindingTestSuccess) // Nothing else to test
+			{
+				c->isBehaviorDone = true;
+				c->isFilteringDone = true;
+			}
+			else if(results->isMappingDirect) // No NAT
+			{
+				results->natBehavior = DirectMapping;
+				results->didBehaviorTestSuccess = true;
+				results->natFiltering = EndpointIndependentFiltering;
+				results->didFilteringTestSuccess = true;
+				c->isBehaviorDone = true;
+				c->isFilteringDone = true;
+			}
+			else if(results->hasOtherServerAddress == false) // Can't classify without OTHER-ADDRESS
+			{
+				c->isBehaviorDone = true;
+				c->isFilteringDone = true;
+			}
+			else // Independent tests, concurrently
+			{
+				stunTestStartBehavior1(&c->behaviorTest1, &c->config, results);
+				stunTestStartBehavior2(&c->behaviorTest2, &c->config, results);
+				stunTestStartFiltering1(&c->filteringTest1, &c->config, results);
+				stunTestStartFiltering2(&c->filteringTest2, &c->config, results);
+			}
 		}
-		else
+		else if(completedTest == &c->behaviorTest1 || completedTest == &c->behaviorTest2)
 		{
-			c->stunDidFailResolve(c); // If fails basic binding test, no point going further
+			if(!c->isBehaviorDone)
+				stunMergeBehavior(c);
 		}
+		else if(!c->isFilteringDone)
+		{
+			stunMergeFiltering(c);
+		}
+		
+		if(c->isBehaviorDone && c->isFilteringDone && c->config.demux != kNetSocketDemuxNone) // Finish once
+			stunFinish(c);
 	});
 }
 
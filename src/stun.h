@@ -24,6 +24,7 @@
 #define __universal_network_stun_h__
 
 #include "stun_tests.h"
+#include "stun_cache.h"
 
 #define kStunServerDefaultPort 3478
 
@@ -38,12 +39,29 @@
  * The Stun object can be used only in associated mode.
  * Associated: the stun object uses a previously created and valid net_socket
  * 
- * If an incoming packet is not STUN-valid, it is forwarded to socket's original callback
+ * STUN datagrams are demultiplexed on the socket while tests run, other datagrams keep going to their protocol
+ *
+ * Once the binding test returns an OTHER-ADDRESS, behavior and filtering tests run concurrently, each with its own
+ * transaction id. Results are merged as tests complete and tests still running are cancelled as soon as the
+ * classification is known (RFC 5780 sections 4.3 and 4.4).
+ *
+ * With a cache set, results stored for the local interface and server are reused right away: stunDidResolve is
+ * called without any request, then a single binding request revalidates them in the background. If the mapped
+ * address changed, results are updated (re-classified if the mapping host or OTHER-ADDRESS changed) and
+ * stunDidResolve is called again.
  *
  * Warning: StunTest will release any memory once it did complete. DO NOT attempt to access it out of the resolve sequence.
  */
 struct StunStruct {
 	bool didResolve; // True if resolved already for socket in config
+	bool isBehaviorDone; // NAT behavior classified, or can't be
+	bool isFilteringDone; // NAT filtering classified, or can't be
+	
+	char * cachePath; // NULL if no cache
+	uint64_t cacheTtl; // Seconds
+	bool isRevalidating; // Results were loaded from cache, binding test is checking them
+	net_addr_t cacheLocalAddr; // Cache key, local interface
+	StunResults revalidationResults; // Binding test results while revalidating
 	void (^stunDidResolve)(struct StunStruct *); // Did resolve block 
 	void (^stunDidFailResolve)(struct StunStruct *); // Did fail block
 	
@@ -63,6 +81,8 @@ typedef void (^StunDidFailResolve)(stun_t);
 stun_t stunCreate(net_socket_t, const char *, StunDidResolve, StunDidFailResolve);
 void stunDestroy(stun_t ); // shouldn't be called from any of its blocks or callbacks
 
+void stunSetCache(stun_t, const char * path, uint64_t ttl); // Call before stunResolve, NULL path disables cache
+void stunSetServerPort(stun_t, unsigned short port); // Call before stunResolve, default is kStunServerDefaultPort
 void stunResolve(stun_t);
 void stunLog(stun_t );
 
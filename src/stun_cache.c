@@ -0,0 +1,231 @@
+/*
+ 
+ stun_cache.c
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#include "stun_cache.h"
+#include "universal_network_c.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#define kStunCacheMagic 0x55535443 // "USTC"
+#define kStunCacheVersion 0x01
+#define kStunCacheHeaderLen 6
+#define kStunCacheEntryMaxLen (4 + 1 + kStunCacheServerHostnameMaxLen + 6 + 8 + 3 + 7 * 6)
+#define kStunCacheMaxLen (kStunCacheHeaderLen + kStunCacheMaxEntries * kStunCacheEntryMaxLen)
+
+#pragma mark -
+#pragma mark Pack/Unpack
+
+static void stunCachePackAddr(bitstream_t * bitstream, const net_addr_t * addr)
+{
+	bitstream_write_uint32(bitstream, addr->sin_addr.s_addr); // As stored, network order
+	bitstream_write_uint16(bitstream, addr->sin_port);
+}
+
+static void stunCacheUnpackAddr(bitstream_t * bitstream, net_addr_t * addr)
+{
+	unsigned int host = 0, port = 0;
+	bitstream_read_uint32(bitstream, &host);
+	bitstream_read_uint16(bitstream, &port);
+	net_addr_set(addr, host, port, false);
+}
+
+static void stunCachePackEntry(bitstream_t * bitstream, const StunCacheEntry * entry)
+{
+	const StunResults * results = &entry->results;
+	
+	bitstream_write_uint32(bitstream, entry->localAddr.sin_addr.s_addr);
+	bitstream_write_str(bitstream, entry->serverHostname);
+	stunCachePackAddr(bitstream, &entry->serverAddr);
+	bitstream_write_uint64(bitstream, entry->time);
+	
+	unsigned int flags = (results->didBindingTestSuccess << 0) | (results->isMappingDirect << 1) | (results->hasOtherServerAddress << 2) | (results->didBehaviorTestSuccess << 3) | (results->didFilteringTestSuccess << 4);
+	bitstream_write_uint8(bitstream, flags);
+	bitstream_write_uint8(bitstream, results->natBehavior);
+	bitstream_write_uint8(bitstream, results->natFiltering);
+	
+	stunCachePackAddr(bitstream, &results->localAddr);
+	stunCachePackAddr(bitstream, &results->mappedAddr);
+	stunCachePackAddr(bitstream, &results->otherServerPrimaryHostAddr);
+	stunCachePackAddr(bitstream, &results->otherServerPrimaryPortAddr);
+	stunCachePackAddr(bitstream, &results->otherServerAddr);
+	stunCachePackAddr(bitstream, &results->mappedOtherServerPrimaryPortAddr);
+	stunCachePackAddr(bitstream, &results->mappedOtherServerAddr);
+}
+
+static bool stunCacheUnpackEntry(bitstream_t * bitstream, StunCacheEntry * entry)
+{
+	StunResults * results = &entry->results;
+	memset(entry, 0, sizeof(StunCacheEntry));
+	
+	unsigned int host = 0;
+	bitstream_read_uint32(bitstream, &host);
+	net_addr_set(&entry->localAddr, host, 0, false);
+	bitstream_read_str(bitstream, entry->serverHostname, kStunCacheServerHostnameMaxLen);
+	stunCacheUnpackAddr(bitstream, &entry->serverAddr);
+	bitstream_read_uint64(bitstream, &entry->time);
+	
+	unsigned int flags = 0, natBehavior = 0, natFiltering = 0;
+	bitstream_read_uint8(bitstream, &flags);
+	bitstream_read_uint8(bitstream, &natBehavior);
+	bitstream_read_uint8(bitstream, &natFiltering);
+	results->didBindingTestSuccess = (flags >> 0) & 1;
+	results->isMappingDirect = (flags >> 1) & 1;
+	results->hasOtherServerAddress = (flags >> 2) & 1;
+	results->didBehaviorTestSuccess = (flags >> 3) & 1;
+	results->didFilteringTestSuccess = (flags >> 4) & 1;
+	results->natBehavior = natBehavior <= AddressAndPortDependentMapping ? natBehavior : UnknownBehavior;
+	results->natFiltering = natFiltering <= AddressAndPortDependentFiltering ? natFiltering : UnknownFiltering;
+	
+	stunCacheUnpackAddr(bitstream, &results->localAddr);
+	stunCacheUnpackAddr(bitstream, &results->mappedAddr);
+	stunCacheUnpackAddr(bitstream, &results->otherServerPrimaryHostAddr);
+	stunCacheUnpackAddr(bitstream, &results->otherServerPrimaryPortAddr);
+	stunCacheUnpackAddr(bitstream, &results->otherServerAddr);
+	stunCacheUnpackAddr(bitstream, &results->mappedOtherServerPrimaryPortAddr);
+	stunCacheUnpackAddr(bitstream, &results->mappedOtherServerAddr);
+	
+	return !bitstream_error(bitstream);
+}
+
+#pragma mark -
+#pragma mark File
+
+static unsigned int stunCacheRead(const char * path, StunCacheEntry * entries) // Returns number of entries, 0 if missing or invalid
+{
+	FILE * file = fopen(path, "rb");
+	if(!file)
+		return 0;
+	
+	uint8_t data[kStunCacheMaxLen];
+	size_t length = fread(data, 1, sizeof(data), file);
+	fclose(file);
+	
+	bitstream_t bitstream = bitstream_create(data, length);
+	
+	unsigned int magic = 0, version = 0, count = 0;
+	bitstream_read_uint32(&bitstream, &magic);
+	bitstream_read_uint8(&bitstream, &version);
+	bitstream_read_uint8(&bitstream, &count);
+	if(bitstream_error(&bitstream) || magic != kStunCacheMagic || version != kStunCacheVersion || count > kStunCacheMaxEntries)
+		return 0;
+	
+	for(unsigned int i=0; i<count; ++i)
+		if(!stunCacheUnpackEntry(&bitstream, &entries[i]))
+			return 0; // Truncated, start over
+	
+	return count;
+}
+
+static bool stunCacheIsKey(const StunCacheEntry * entry, const net_addr_t * localAddr, const char * serverHostname)
+{
+	return entry->localAddr.sin_addr.s_addr == localAddr->sin_addr.s_addr && strncmp(entry->serverHostname, serverHostname, kStunCacheServerHostnameMaxLen) == 0;
+}
+
+bool stunCacheLoad(const char * path, const net_addr_t * localAddr, const char * serverHostname, uint64_t now, uint64_t ttl, StunCacheEntry * entry)
+{
+	StunCacheEntry entries[kStunCacheMaxEntries];
+	unsigned int count = stunCacheRead(path, entries);
+	
+	for(unsigned int i=0; i<count; ++i)
+	{
+		if(stunCacheIsKey(&entries[i], localAddr, serverHostname))
+		{
+			if(entries[i].time > now || now - entries[i].time >= ttl) // Expired, or clock went back
+				return false;
+			
+			*entry = entries[i];
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+NetError stunCacheStore(const char * path, const StunCacheEntry * entry)
+{
+	StunCacheEntry entries[kStunCacheMaxEntries];
+	unsigned int count = stunCacheRead(path, entries);
+	
+	// Replace same key, otherwise append or replace oldest
+	unsigned int index = count;
+	for(unsigned int i=0; i<count; ++i)
+	{
+		if(stunCacheIsKey(&entries[i], &entry->localAddr, entry->serverHostname))
+		{
+			index = i;
+			break;
+		}
+	}
+	
+	if(index == kStunCacheMaxEntries)
+	{
+		index = 0;
+		for(unsigned int i=1; i<count; ++i)
+			if(entries[i].time < entries[index].time)
+				index = i;
+	}
+	
+	entries[index] = *entry;
+	if(index == count)
+		++count;
+	
+	// Pack
+	uint8_t data[kStunCacheMaxLen];
+	bitstream_t bitstream = bitstream_create(data, sizeof(data));
+	bitstream_write_uint32(&bitstream, kStunCacheMagic);
+	bitstream_write_uint8(&bitstream, kStunCacheVersion);
+	bitstream_write_uint8(&bitstream, count);
+	for(unsigned int i=0; i<count; ++i)
+		stunCachePackEntry(&bitstream, &entries[i]);
+	
+	if(bitstream_error(&bitstream))
+		return NetInvalidError;
+	
+	// Write and rename, atomic replace
+	char tmpPath[PATH_MAX];
+	int tmpPathLength = snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+	if(tmpPathLength < 0 || (size_t)tmpPathLength >= sizeof(tmpPath))
+		return NetInvalidError;
+	
+	FILE * file = fopen(tmpPath, "wb");
+	if(!file)
+		return netErrorPosix(errno);
+	
+	size_t written = fwrite(data, 1, bitstream.offset, file);
+	if(fclose(file) != 0 || written != bitstream.offset)
+	{
+		remove(tmpPath);
+		return NetOtherError;
+	}
+	
+	if(rename(tmpPath, path) != 0)
+	{
+		NetError netError = netErrorPosix(errno);
+		remove(tmpPath);
+		return netError;
+	}
+	
+	return NetNoError;
+}
@@ -0,0 +1,58 @@
+/*
+ 
+ stun_cache.h
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#ifndef __universal_network_stun_cache_h__
+#define __universal_network_stun_cache_h__
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "net.h"
+#include "stun_tests.h"
+
+/*!
+ * @header
+ *
+ * On-disk cache of NAT classification results, keyed by local interface address (host) and STUN server hostname.
+ * Entries older than the TTL are ignored. The file holds up to kStunCacheMaxEntries entries, the oldest one is
+ * replaced when full. Stores write a temporary file and rename it, so readers never see a partial file.
+ *
+ * Format (big-endian): magic (4 Bytes), version (1 Byte), count (1 Byte), count x entry
+ * Entry: local host (4), server hostname (string), server address (6), time (8), results
+ */
+
+#define kStunCacheMaxEntries 16
+#define kStunCacheDefaultTtl (24 * 60 * 60) // 24 hours, in seconds
+#define kStunCacheServerHostnameMaxLen 64 // Same as StunConfig primaryServerHostname
+
+typedef struct {
+	net_addr_t localAddr; // Local interface, port is ignored
+	char serverHostname[kStunCacheServerHostnameMaxLen];
+	net_addr_t serverAddr; // Resolved server address, no DNS resolution needed on reuse
+	uint64_t time; // Seconds since epoch, when stored
+	StunResults results;
+} StunCacheEntry;
+
+bool stunCacheLoad(const char * path, const net_addr_t * localAddr, const char * serverHostname, uint64_t now, uint64_t ttl, StunCacheEntry * entry); // False if missing, expired or unreadable
+NetError stunCacheStore(const char * path, const StunCacheEntry * entry); // Inserts or replaces entry with same key
+
+#endif
@@ -23,6 +23,7 @@
 #ifndef __universal_network_stun_internal_h__
 #define __universal_network_stun_internal_h__
 
-void stunRunNextTest(stun_t , StunTest * );
+void stunDidCompleteTest(stun_t , StunTest * ); // Merges test results, starts the next tests or finishes
+void stunReceive(stun_t , net_packet_t ); // STUN datagram, dispatched to the test waiting for its transaction id
 
 #endif
\ No newline at end of file
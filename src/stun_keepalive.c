@@ -0,0 +1,235 @@
+/*
+ 
+ stun_keepalive.c
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#include "stun_keepalive.h"
+#include "universal_network_c.h"
+
+static double stunKeepaliveRandom(stun_keepalive_t keepalive)
+{
+	return (double)rand_r(&keepalive->seed) / ((double)RAND_MAX + 1.0); // [0, 1)
+}
+
+static void stunKeepaliveTransactionId(stun_keepalive_t keepalive, StunTransactionId * transactionId)
+{
+	for(int b=0; b<kStunTransactionIdLen; ++b)
+		transactionId->id[b] = (uint8_t)(rand_r(&keepalive->seed) >> 8); // Indications are never matched to a response
+}
+
+static void stunKeepaliveSchedule(stun_keepalive_t keepalive, StunKeepaliveBinding * binding, net_time_t deadline)
+{
+	binding->deadline = deadline;
+	timer_wheel_schedule(keepalive->wheel, &binding->entry, deadline);
+}
+
+static void stunKeepaliveArm(stun_keepalive_t keepalive, net_time_t now)
+{
+	net_time_t next = timer_wheel_next(keepalive->wheel);
+	
+	if(next == 0) // No bindings
+	{
+		if(keepalive->timerTime != 0)
+		{
+			keepalive->timerTime = 0;
+			dispatch_source_set_timer(keepalive->keepaliveDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+		}
+	}
+	else if(keepalive->timerTime == 0 || next < keepalive->timerTime) // Only re-arm if earlier
+	{
+		keepalive->timerTime = next;
+		dispatch_source_set_timer(keepalive->keepaliveDispatchTimer, dispatch_time(DISPATCH_TIME_NOW, next > now ? next - now : 0), DISPATCH_TIME_FOREVER, kStunKeepaliveTimerLeeway);
+	}
+}
+
+static void stunKeepaliveTimerCallback(void * context)
+{
+	stun_keepalive_t keepalive = (stun_keepalive_t)context;
+	net_time_t now = net_time_now();
+	net_time_t tick = mNetTimeFromSeconds(kStunKeepaliveTick);
+	
+	keepalive->timerTime = 0; // Fired, disarmed
+	dispatch_source_set_timer(keepalive->keepaliveDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+	
+	// Pack every due keepalive, sent in one burst
+	net_packet_t packets[kStunKeepaliveBatchMax];
+	net_packet_t * batch = packets;
+	__block unsigned int count = 0;
+	__block unsigned int overflow = 0;
+	
+	timer_wheel_advance(keepalive->wheel, now, ^(timer_wheel_entry_t * entry){
+		StunKeepaliveBinding * binding = (StunKeepaliveBinding *)entry->object;
+		
+		net_packet_t packet = count < kStunKeepaliveBatchMax ? net_packet_alloc_pool(keepalive->socket, keepalive->poolPackets) : NULL;
+		if(!packet) // Burst is full or pool is exhausted, a burst's worth per next tick, jittered within the tick
+		{
+			net_time_t delay = tick * (1 + overflow++ / kStunKeepaliveBatchMax) + (net_time_t)(stunKeepaliveRandom(keepalive) * tick);
+			stunKeepaliveSchedule(keepalive, binding, now + delay);
+			return;
+		}
+		
+		StunTransactionId transactionId;
+		stunKeepaliveTransactionId(keepalive, &transactionId);
+		stunProtocolPackBindingIndication(&packet->bitstream, transactionId);
+		net_addr_copy(&packet->addr, &binding->addr);
+		batch[count++] = packet;
+		
+		++binding->sentCount;
+		stunKeepaliveSchedule(keepalive, binding, now + stunKeepaliveInterval(binding->lifetime, stunKeepaliveRandom(keepalive)));
+	});
+	
+	if(count > 0)
+	{
+		net_socket_send_batch(keepalive->socket, packets, count);
+		for(unsigned int i=0; i<count; ++i)
+			net_packet_release(keepalive->socket, packets[i]);
+		
+		keepalive->sentCount += count;
+	}
+	
+	stunKeepaliveArm(keepalive, now);
+}
+
+stun_keepalive_t stunKeepaliveCreate(net_socket_t socket)
+{
+	if(!socket)
+		return NULL;
+	
+	stun_keepalive_t keepalive = calloc(1, sizeof(struct StunKeepaliveStruct));
+	if(keepalive)
+	{
+		keepalive->socket = socket;
+		keepalive->seed = (unsigned int)net_time_now() ^ (unsigned int)(uintptr_t)keepalive;
+		keepalive->wheel = timer_wheel_create(mNetTimeFromSeconds(kStunKeepaliveTick), kStunKeepaliveWheelSlots, net_time_now());
+		keepalive->poolPackets = net_packet_pool_create(socket, kStunKeepalivePoolCapacity);
+		if(!keepalive->wheel || !keepalive->poolPackets)
+		{
+			if(keepalive->wheel)
+				timer_wheel_destroy(keepalive->wheel);
+			if(keepalive->poolPackets)
+				pool_destroy(keepalive->poolPackets);
+			free(keepalive);
+			return NULL;
+		}
+		
+		// Dispatch queue and timer, disarmed until a binding is added
+		keepalive->keepaliveDispatchQueue = dispatch_queue_create("com.laugga.keepaliveDispatchQueue", NULL);
+		keepalive->keepaliveDispatchTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, keepalive->keepaliveDispatchQueue);
+		dispatch_source_set_timer(keepalive->keepaliveDispatchTimer, DISPATCH_TIME_FOREVER, 0, 0);
+		dispatch_set_context(keepalive->keepaliveDispatchTimer, keepalive);
+		dispatch_source_set_event_handler_f(keepalive->keepaliveDispatchTimer, &stunKeepaliveTimerCallback);
+		dispatch_resume(keepalive->keepaliveDispatchTimer);
+		keepalive->timerTime = 0;
+	}
+	
+	return keepalive;
+}
+
+void stunKeepaliveDestroy(stun_keepalive_t keepalive)
+{
+	if(keepalive)
+	{
+		dispatch_source_cancel(keepalive->keepaliveDispatchTimer); // Handler will not fire again
+		dispatch_sync(keepalive->keepaliveDispatchQueue, ^{ /* Wait for pending blocks */ });
+		dispatch_release(keepalive->keepaliveDispatchTimer);
+		dispatch_release(keepalive->keepaliveDispatchQueue);
+		
+		timer_wheel_destroy(keepalive->wheel); // Bindings belong to the caller
+		
+		// Keepalives sent are released on socket queue once written
+		net_time_t start = net_time_now();
+		while(debug_pool_alloc_count(keepalive->poolPackets) > 0 && net_time_now() - start < kStunKeepaliveDestroyTimeout)
+			usleep(kStunKeepaliveDestroyWait / kNetTimeMicrosecond);
+		
+		if(debug_pool_alloc_count(keepalive->poolPackets) == 0)
+			pool_destroy(keepalive->poolPackets);
+		else
+			mNetworkLog("Error keepalives still in flight, leaking their pool");
+		
+		free(keepalive);
+	}
+}
+
+void stunKeepaliveBindingInit(StunKeepaliveBinding * binding, const net_addr_t * addr, double lifetime)
+{
+	net_addr_copy(&binding->addr, addr);
+	binding->lifetime = lifetime > 0.0 ? (lifetime < kStunKeepaliveMinLifetime ? kStunKeepaliveMinLifetime : lifetime) : kStunKeepaliveDefaultLifetime;
+	binding->deadline = 0;
+	binding->sentCount = 0;
+	timer_wheel_entry_init(&binding->entry, binding);
+}
+
+void stunKeepaliveAdd(stun_keepalive_t keepalive, StunKeepaliveBinding * binding)
+{
+	dispatch_sync(keepalive->keepaliveDispatchQueue, ^{
+		net_time_t now = net_time_now();
+		stunKeepaliveSchedule(keepalive, binding, now + stunKeepaliveInterval(binding->lifetime, stunKeepaliveRandom(keepalive)));
+		stunKeepaliveArm(keepalive, now);
+	});
+}
+
+void stunKeepaliveRemove(stun_keepalive_t keepalive, StunKeepaliveBinding * binding)
+{
+	dispatch_sync(keepalive->keepaliveDispatchQueue, ^{
+		timer_wheel_cancel(keepalive->wheel, &binding->entry); // Timer disarms itself if it was the last one
+	});
+}
+
+void stunKeepaliveSetLifetime(stun_keepalive_t keepalive, StunKeepaliveBinding * binding, double lifetime)
+{
+	dispatch_sync(keepalive->keepaliveDispatchQueue, ^{
+		binding->lifetime = lifetime < kStunKeepaliveMinLifetime ? kStunKeepaliveMinLifetime : lifetime;
+		
+		net_time_t now = net_time_now();
+		net_time_t deadline = now + stunKeepaliveInterval(binding->lifetime, stunKeepaliveRandom(keepalive));
+		if(binding->entry.scheduled && deadline < binding->deadline)
+		{
+			stunKeepaliveSchedule(keepalive, binding, deadline);
+			stunKeepaliveArm(keepalive, now);
+		}
+	});
+}
+
+void stunKeepaliveDidExpire(stun_keepalive_t keepalive, StunKeepaliveBinding * binding)
+{
+	dispatch_sync(keepalive->keepaliveDispatchQueue, ^{
+		binding->lifetime *= 0.5; // Lost before the next keepalive, interval was too long
+		if(binding->lifetime < kStunKeepaliveMinLifetime)
+			binding->lifetime = kStunKeepaliveMinLifetime;
+		
+		net_time_t now = net_time_now();
+		stunKeepaliveSchedule(keepalive, binding, now); // New mapping, refreshed on next tick
+		stunKeepaliveArm(keepalive, now);
+	});
+}
+
+net_time_t stunKeepaliveInterval(double lifetime, double random)
+{
+	return mNetTimeFromSeconds(lifetime * kStunKeepaliveLifetimeRatio * (1.0 - kStunKeepaliveJitter * random));
+}
+
+unsigned int stunKeepaliveCount(stun_keepalive_t keepalive)
+{
+	__block unsigned int count = 0;
+	dispatch_sync(keepalive->keepaliveDispatchQueue, ^{
+		count = timer_wheel_count(keepalive->wheel);
+	});
+	return count;
+}
@@ -0,0 +1,96 @@
+/*
+ 
+ stun_keepalive.h
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#ifndef __universal_network_stun_keepalive_h__
+#define __universal_network_stun_keepalive_h__
+
+#include "net.h"
+#include "timer_wheel.h"
+#include "stun_protocol.h"
+
+#include <dispatch/dispatch.h>
+
+/*!
+ * @typedef stun_keepalive_t
+ *
+ * @abstract Keeps NAT bindings of a socket alive with STUN binding indications
+ * @discussion
+ * Each binding (STUN server or peer address) gets a binding indication every lifetime * kStunKeepaliveLifetimeRatio
+ * seconds, minus a random jitter of up to kStunKeepaliveJitter so bindings added at once spread out. Deadlines are
+ * kept in a timer wheel and a single one-shot timer is armed at the earliest one: keepalives due on the same tick
+ * are sent in one burst (net_socket_send_batch), from a packet pool of their own. At most kStunKeepaliveBatchMax
+ * go per tick; the others are spread over the next ticks, one burst's worth per tick plus a random jitter of up to
+ * a tick, so they don't all land on the same tick again.
+ *
+ * The lifetime is the observed binding lifetime, e.g. learned by the application when a mapped address changed.
+ * stunKeepaliveDidExpire halves it, for when a binding was lost between keepalives.
+ *
+ * Bindings are owned by the caller (no allocation per binding) and MUST be removed before they are freed.
+ * Binding calls are synchronous on the keepalive queue, they must not be called from that queue.
+ */
+
+#define kStunKeepaliveDefaultLifetime 30.0 // Seconds, shortest UDP binding timeout commonly seen
+#define kStunKeepaliveMinLifetime 2.0 // Seconds, lower bound for stunKeepaliveDidExpire
+#define kStunKeepaliveLifetimeRatio 0.5 // Keepalive interval, two chances per lifetime
+#define kStunKeepaliveJitter 0.2 // Interval reduced by up to 20%
+#define kStunKeepaliveTick 0.02 // Seconds, wheel resolution
+#define kStunKeepaliveTimerLeeway (5 * NSEC_PER_MSEC)
+#define kStunKeepaliveWheelSlots 1024 // One revolution covers the default interval
+#define kStunKeepalivePoolCapacity 512 // Keepalive packets, own pool so bursts don't drain the socket packet pool
+#define kStunKeepaliveBatchMax (kStunKeepalivePoolCapacity / 2) // Keepalives per tick (12,800/s), half of the pool is left while a burst is written
+#define kStunKeepaliveDestroyWait (10 * kNetTimeMillisecond) // Polled while keepalives sent are still being written
+#define kStunKeepaliveDestroyTimeout (1 * kNetTimeSecond) // Pool is leaked if they aren't by then (socket destroyed first)
+
+typedef struct {
+	net_addr_t addr; // Keepalive destination
+	double lifetime; // Observed binding lifetime, seconds
+	net_time_t deadline; // Next keepalive
+	unsigned int sentCount;
+	timer_wheel_entry_t entry;
+} StunKeepaliveBinding;
+
+typedef struct StunKeepaliveStruct * stun_keepalive_t;
+
+struct StunKeepaliveStruct {
+	net_socket_t socket; // Keepalives are sent from the socket holding the bindings
+	dispatch_queue_t keepaliveDispatchQueue;
+	dispatch_source_t keepaliveDispatchTimer; // One-shot, armed at the earliest deadline
+	net_time_t timerTime; // Armed deadline, 0 if disarmed
+	timer_wheel_t wheel; // Binding deadlines
+	pool_t poolPackets; // Keepalive packets, kStunKeepalivePoolCapacity
+	unsigned int seed; // Jitter and transaction ids, not cryptographic
+	uint64_t sentCount; // Keepalives sent
+};
+
+stun_keepalive_t stunKeepaliveCreate(net_socket_t);
+void stunKeepaliveDestroy(stun_keepalive_t); // Bindings still added are dropped, not freed
+
+void stunKeepaliveBindingInit(StunKeepaliveBinding *, const net_addr_t * addr, double lifetime); // 0 lifetime is kStunKeepaliveDefaultLifetime
+void stunKeepaliveAdd(stun_keepalive_t, StunKeepaliveBinding *); // First keepalive after one jittered interval
+void stunKeepaliveRemove(stun_keepalive_t, StunKeepaliveBinding *);
+void stunKeepaliveSetLifetime(stun_keepalive_t, StunKeepaliveBinding *, double lifetime); // Re-scheduled if the new interval ends earlier
+void stunKeepaliveDidExpire(stun_keepalive_t, StunKeepaliveBinding *); // Binding was lost, halves lifetime and sends a keepalive right away
+
+net_time_t stunKeepaliveInterval(double lifetime, double random); // Jittered interval, random in [0, 1)
+unsigned int stunKeepaliveCount(stun_keepalive_t);
+
+#endif
@@ -77,6 +77,15 @@ int stunProtocolUnpackHeader(bitstream_t * bitstream, StunMsgType * msgType, Stu
 	return kStunValid;
 }
 
+bool stunProtocolIsMessage(const uint8_t * data, size_t length)
+{
+	if(length < kStunHeaderLen || (data[0] & 0xc0) != 0 || (length & 0x3) != 0) // Header, 2 bit zeroes and 32-bit aligned attributes
+		return false;
+	
+	uint32_t magic_cookie = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
+	return mStunProtocolIsValidMagicCookie(magic_cookie);
+}
+
 void stunProtocolPackAttributeChangeAddr(bitstream_t * bitstream, bool doChangeHost, bool doChangePort)
 {
 	uint32_t changeData = 0;
@@ -92,6 +101,24 @@ void stunProtocolPackAttributeChangeAddr(bitstream_t * bitstream, bool doChangeH
 	bitstream_write_uint32(bitstream, changeData);
 }
 
+void stunProtocolPackAttributeAddr(bitstream_t * bitstream, StunAttributeType attributeType, const net_addr_t * addr)
+{
+	bitstream_write_uint16(bitstream, attributeType);
+	bitstream_write_uint16(bitstream, 0x0008); // IPv4
+	bitstream_write_uint16(bitstream, StunAddrFamilyIPv4); // Reserved zero byte + family
+	bitstream_write_uint16(bitstream, ntohs(addr->sin_port));
+	bitstream_write_uint32(bitstream, ntohl(addr->sin_addr.s_addr));
+}
+
+void stunProtocolPackAttributeXorAddr(bitstream_t * bitstream, const net_addr_t * addr)
+{
+	bitstream_write_uint16(bitstream, StunAttributeXorMappedAddress);
+	bitstream_write_uint16(bitstream, 0x0008); // IPv4
+	bitstream_write_uint16(bitstream, StunAddrFamilyIPv4); // Reserved zero byte + family
+	bitstream_write_uint16(bitstream, ntohs(addr->sin_port) ^ ((kStunProtocolMagicCookie >> 16) & 0xFFFF)); // XOR-Port
+	bitstream_write_uint32(bitstream, ntohl(addr->sin_addr.s_addr) ^ kStunProtocolMagicCookie); // XOR-Address
+}
+
 int stunProtocolUnpackAttributeAddr(bitstream_t * bitstream, net_addr_t * addr)
 {
 	StunAddrFamilyType addrFamily;
@@ -236,6 +263,23 @@ void stunProtocolPackBindingChangeRequest(bitstream_t * bitstream, StunTransacti
 	stunProtocolPackAttributeChangeAddr(bitstream, doChangeHost, doChangePort);
 }
 
+void stunProtocolPackBindingIndication(bitstream_t * bitstream, StunTransactionId transactionId)
+{
+	// Pack header (empty body)
+	stunProtocolPackHeader(bitstream, StunMsgTypeBinding, StunMsgClassIndication, transactionId, 0);
+}
+
+void stunProtocolPackBindingCheck(bitstream_t * bitstream, StunTransactionId transactionId, bool useCandidate)
+{
+	// Pack header (USE-CANDIDATE attribute has no value)
+	stunProtocolPackHeader(bitstream, StunMsgTypeBinding, StunMsgClassRequest, transactionId, useCandidate ? 4 : 0);
+	if(useCandidate)
+	{
+		bitstream_write_uint16(bitstream, StunAttributeUseCandidate);
+		bitstream_write_uint16(bitstream, 0x0000);
+	}
+}
+
 int stunProtocolUnpackBindingResponse(bitstream_t * bitstream, StunTransactionId * transactionId, StunBindingResponse * bindingResponse)
 {
 	StunMsgType msgType;
@@ -263,3 +307,164 @@ int stunProtocolUnpackBindingResponse(bitstream_t * bitstream, StunTransactionId
 		
 	return kStunValid;
 }
+
+int stunProtocolUnpackBindingRequest(bitstream_t * bitstream, StunTransactionId * transactionId, StunBindingRequest * bindingRequest)
+{
+	StunMsgType msgType;
+	StunMsgClass msgClass;
+	unsigned int bodyLength;
+	
+	memset(bindingRequest, 0, sizeof(StunBindingRequest));
+	
+	// Unpack header
+	if(stunProtocolUnpackHeader(bitstream, &msgType, &msgClass, transactionId, &bodyLength) == kStunInvalid || bitstream_error(bitstream))
+		return kStunInvalid;
+	
+	// Check message type and class
+	if(msgType != StunMsgTypeBinding || msgClass != StunMsgClassRequest)
+		return kStunUnexpected;
+	
+	// Loop over all Type-Length-Value attributes, only CHANGE-REQUEST and USE-CANDIDATE are handled (a truncated body sets bitstream error)
+	int remainingBytes = bodyLength;
+	while(remainingBytes >= 4)
+	{
+		unsigned int attributeType, attributeLength;
+		bitstream_read_uint16(bitstream, &attributeType);
+		bitstream_read_uint16(bitstream, &attributeLength);
+		
+		unsigned int paddedLength = (attributeLength + 3) & ~3; // Values are padded to 32 bits
+		
+		if(attributeType == StunAttributeUseCandidate)
+		{
+			bindingRequest->hasUseCandidate = true;
+			bitstream_skip_bytes(bitstream, paddedLength);
+		}
+		else if(attributeType == StunAttributeChangeRequest && attributeLength == 4)
+		{
+			unsigned int changeData = 0;
+			bitstream_read_uint32(bitstream, &changeData);
+			bindingRequest->hasChangeRequest = true;
+			bindingRequest->doChangeHost = (changeData & 0x04) != 0;
+			bindingRequest->doChangePort = (changeData & 0x02) != 0;
+		}
+		else
+		{
+			bitstream_skip_bytes(bitstream, paddedLength);
+		}
+		
+		remainingBytes = remainingBytes - paddedLength - 4; // Type (2B) Length (2B) Value (padded)
+	}
+	
+	return bitstream_error(bitstream) ? kStunInvalid : kStunValid;
+}
+
+void stunProtocolPackBindingResponse(bitstream_t * bitstream, StunTransactionId transactionId, const net_addr_t * mappedAddr, const net_addr_t * otherAddr, const net_addr_t * originAddr)
+{
+	stunProtocolPackHeader(bitstream, StunMsgTypeBinding, StunMsgClassSuccessResponse, transactionId, kStunBindingResponseLen - kStunHeaderLen);
+	stunProtocolPackAttributeXorAddr(bitstream, mappedAddr);
+	stunProtocolPackAttributeAddr(bitstream, StunAttributeMappedAddress, mappedAddr); // RFC 3489 clients
+	stunProtocolPackAttributeAddr(bitstream, StunAttributeOtherAddress, otherAddr);
+	stunProtocolPackAttributeAddr(bitstream, StunAttributeOriginServer, originAddr); // RESPONSE-ORIGIN
+}
+
+void stunProtocolPackBindingCheckResponse(bitstream_t * bitstream, StunTransactionId transactionId, const net_addr_t * mappedAddr)
+{
+	stunProtocolPackHeader(bitstream, StunMsgTypeBinding, StunMsgClassSuccessResponse, transactionId, 12); // XOR-MAPPED-ADDRESS has 12 bytes
+	stunProtocolPackAttributeXorAddr(bitstream, mappedAddr);
+}
+
+static void stunProtocolUpdateLength(uint8_t * data, size_t length) // Header length, attributes only
+{
+	data[2] = (uint8_t)(length >> 8);
+	data[3] = (uint8_t)length;
+}
+
+void stunProtocolPackMessageIntegrity(bitstream_t * bitstream, const hmac_sha1_key_t * key)
+{
+	if(bitstream_error(bitstream) || bitstream->offset < kStunHeaderLen)
+		return;
+	
+	uint8_t digest[kSha1DigestLength];
+	stunProtocolUpdateLength(bitstream->data, bitstream->offset - kStunHeaderLen + kStunMessageIntegrityLen);
+	hmac_sha1(key, bitstream->data, bitstream->offset, digest);
+	
+	bitstream_write_uint16(bitstream, StunAttributeMessageIntegrity);
+	bitstream_write_uint16(bitstream, kSha1DigestLength);
+	bitstream_write_raw(bitstream, digest, kSha1DigestLength);
+}
+
+void stunProtocolPackFingerprint(bitstream_t * bitstream)
+{
+	if(bitstream_error(bitstream) || bitstream->offset < kStunHeaderLen)
+		return;
+	
+	stunProtocolUpdateLength(bitstream->data, bitstream->offset - kStunHeaderLen + kStunFingerprintLen);
+	uint32_t fingerprint = crc32_compute(bitstream->data, bitstream->offset) ^ kStunFingerprintXor;
+	
+	bitstream_write_uint16(bitstream, StunAttributeFingerprint);
+	bitstream_write_uint16(bitstream, 0x0004);
+	bitstream_write_uint32(bitstream, fingerprint);
+}
+
+bool stunProtocolHasValidFingerprint(const uint8_t * data, size_t length)
+{
+	if(!stunProtocolIsMessage(data, length) || length < kStunHeaderLen + kStunFingerprintLen)
+		return false;
+	
+	size_t bodyLength = ((size_t)data[2] << 8) | data[3];
+	if(bodyLength != length - kStunHeaderLen) // Datagram is exactly one message
+		return false;
+	
+	// Last attribute, type (2B) length (2B) and CRC-32 (4B)
+	const uint8_t * attribute = &data[length - kStunFingerprintLen];
+	if(attribute[0] != (StunAttributeFingerprint >> 8) || attribute[1] != (StunAttributeFingerprint & 0xff) || attribute[2] != 0 || attribute[3] != 4)
+		return false;
+	
+	uint32_t fingerprint = ((uint32_t)attribute[4] << 24) | ((uint32_t)attribute[5] << 16) | ((uint32_t)attribute[6] << 8) | attribute[7];
+	return fingerprint == (crc32_compute(data, length - kStunFingerprintLen) ^ kStunFingerprintXor);
+}
+
+bool stunProtocolHasValidMessageIntegrity(const uint8_t * data, size_t length, const hmac_sha1_key_t * key)
+{
+	if(!stunProtocolIsMessage(data, length))
+		return false;
+	
+	size_t end = kStunHeaderLen + (((size_t)data[2] << 8) | data[3]);
+	if(end > length)
+		return false;
+	
+	// Find MESSAGE-INTEGRITY, attributes after it (FINGERPRINT) are not covered
+	size_t offset = kStunHeaderLen;
+	while(offset + 4 <= end)
+	{
+		unsigned int attributeType = ((unsigned int)data[offset] << 8) | data[offset+1];
+		unsigned int attributeLength = ((unsigned int)data[offset+2] << 8) | data[offset+3];
+		
+		if(attributeType == StunAttributeMessageIntegrity)
+		{
+			if(attributeLength != kSha1DigestLength || offset + kStunMessageIntegrityLen > end)
+				return false;
+			
+			// Hashed with the header length ending at MESSAGE-INTEGRITY
+			uint8_t header[kStunHeaderLen];
+			memcpy(header, data, kStunHeaderLen);
+			stunProtocolUpdateLength(header, offset - kStunHeaderLen + kStunMessageIntegrityLen);
+			
+			sha1_t sha1;
+			uint8_t digest[kSha1DigestLength];
+			hmac_sha1_init(key, &sha1);
+			sha1_update(&sha1, header, kStunHeaderLen);
+			sha1_update(&sha1, &data[kStunHeaderLen], offset - kStunHeaderLen);
+			hmac_sha1_final(key, &sha1, digest);
+			
+			uint8_t difference = 0; // Constant time
+			for(int i=0; i<kSha1DigestLength; ++i)
+				difference |= digest[i] ^ data[offset + 4 + i];
+			return difference == 0;
+		}
+		
+		offset += 4 + ((attributeLength + 3) & ~3); // Type (2B) Length (2B) Value (padded)
+	}
+	
+	return false;
+}
@@ -25,6 +25,8 @@
 
 #include "bitstream.h"
 #include "net_packet.h"
+#include "crc32.h"
+#include "sha1.h"
 
 typedef enum {
     StunMsgClassRequest = 0x00,
@@ -46,7 +48,10 @@ typedef enum {
 	StunAttributeOtherAddress = 0x802c, // Equivalent to StunAttributeAlternateServer
 	StunAttributeOriginServer = 0x802b,
 	StunAttributeErrorCode = 0x0009,
-	StunAttributeChangeRequest = 0x0003 // Typically sent inside the request body (legacy)
+	StunAttributeChangeRequest = 0x0003, // Typically sent inside the request body (legacy)
+	StunAttributeUseCandidate = 0x0025, // Connectivity check nomination (RFC 8445), no value
+	StunAttributeMessageIntegrity = 0x0008, // HMAC-SHA1 of the message up to this attribute
+	StunAttributeFingerprint = 0x8028 // CRC-32 of the message up to this attribute, last attribute
 } StunAttributeType;
 
 #define StunAddrFamilyIPv4 0x01
@@ -77,6 +82,10 @@ typedef struct {
 void stunProtocolPackHeader(bitstream_t * bitstream, StunMsgType, StunMsgClass, StunTransactionId, unsigned int);
 int stunProtocolUnpackHeader(bitstream_t * bitstream, StunMsgType *, StunMsgClass *, StunTransactionId *, unsigned int *);
 
+#define kStunProtocolFirstByteMax 0x3f // Two leading zero bits, STUN datagrams start with 0x00-0x3f
+
+bool stunProtocolIsMessage(const uint8_t * data, size_t length); // Socket demux match for first bytes 0x00-kStunProtocolFirstByteMax, checks length and magic cookie
+
 typedef struct {
 	bool hasResponseOrigin; // RESPONSE-ORIGIN
 	net_addr_t responseOriginAddr; 
@@ -90,14 +99,48 @@ typedef struct {
 	int errorCodeValue;
 } StunBindingResponse;
 
+typedef struct {
+	bool hasChangeRequest; // CHANGE-REQUEST
+	bool doChangeHost;
+	bool doChangePort;
+	bool hasUseCandidate; // USE-CANDIDATE
+} StunBindingRequest;
+
+#define kStunBindingResponseLen (kStunHeaderLen + 4 * 12) // XOR-MAPPED-ADDRESS, MAPPED-ADDRESS, OTHER-ADDRESS and RESPONSE-ORIGIN (IPv4)
+
 void stunProtocolPackAttributeChangeAddr(bitstream_t *, bool doChangeHost, bool doChangePort);
+void stunProtocolPackAttributeAddr(bitstream_t *, StunAttributeType, const net_addr_t *);
+void stunProtocolPackAttributeXorAddr(bitstream_t *, const net_addr_t *);
 int stunProtocolUnpackAttributeAddr(bitstream_t *, net_addr_t *);
 int stunProtocolUnpackAttributeXorAddr(bitstream_t *, net_addr_t *);
 int stunProtocolUnpackAttributeError(bitstream_t *, int *);
 int stunProtocolUnpackBindingResponseBody(bitstream_t *, unsigned int length, StunBindingResponse *);
 
+/*
+ * MESSAGE-INTEGRITY and FINGERPRINT are appended to a message packed from the first byte of the bitstream, in this
+ * order and after every other attribute. Both update the header length before hashing, as RFC 5389 requires.
+ * The key is the short-term credential password (no SASLprep), its ipad/opad schedule is computed once per peer.
+ *
+ * Checking the FINGERPRINT is cheaper than parsing the attributes, it tells STUN apart from other protocols on
+ * the same socket (demux match) and drops corrupted datagrams early.
+ */
+#define kStunFingerprintXor 0x5354554e // "STUN"
+#define kStunFingerprintLen 8 // Attribute, CRC-32
+#define kStunMessageIntegrityLen 24 // Attribute, HMAC-SHA1
+
+void stunProtocolPackMessageIntegrity(bitstream_t *, const hmac_sha1_key_t *);
+void stunProtocolPackFingerprint(bitstream_t *);
+bool stunProtocolHasValidFingerprint(const uint8_t * data, size_t length); // Socket demux match, as stunProtocolIsMessage and FINGERPRINT is the last attribute and matches
+bool stunProtocolHasValidMessageIntegrity(const uint8_t * data, size_t length, const hmac_sha1_key_t *); // False if missing
+
 void stunProtocolPackBindingRequest(bitstream_t *, StunTransactionId);
 void stunProtocolPackBindingChangeRequest(bitstream_t *, StunTransactionId, bool doChangeHost, bool doChangePort);
+void stunProtocolPackBindingIndication(bitstream_t *, StunTransactionId); // Keepalive, no response expected
+void stunProtocolPackBindingCheck(bitstream_t *, StunTransactionId, bool useCandidate); // Connectivity check, USE-CANDIDATE nominates the pair
 int stunProtocolUnpackBindingResponse(bitstream_t *, StunTransactionId *, StunBindingResponse *);
 
+int stunProtocolUnpackBindingRequest(bitstream_t *, StunTransactionId *, StunBindingRequest *); // Server side
+void stunProtocolPackBindingResponse(bitstream_t *, StunTransactionId, const net_addr_t * mappedAddr, const net_addr_t * otherAddr, const net_addr_t * originAddr); // Server side, kStunBindingResponseLen
+void stunProtocolPackBindingCheckResponse(bitstream_t *, StunTransactionId, const net_addr_t * mappedAddr); // Connectivity check answer, XOR-MAPPED-ADDRESS only
+
 #endif
\ No newline at end of file
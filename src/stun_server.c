@@ -0,0 +1,143 @@
+/*
+ 
+ stun_server.c
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#include "stun_server.h"
+#include "universal_network_c.h"
+
+#define mStunServerIndex(isOtherHost, isOtherPort) (((isOtherHost) ? 2 : 0) | ((isOtherPort) ? 1 : 0))
+
+static void stunServerReceiveCallback(void * context, net_packet_t packet)
+{
+	StunServerSocket * serverSocket = (StunServerSocket *)context;
+	stun_server_t server = serverSocket->server;
+	net_socket_t socket = server->sockets[serverSocket->index];
+	
+	StunTransactionId transactionId;
+	StunBindingRequest bindingRequest;
+	
+	if(stunProtocolUnpackBindingRequest(&packet->bitstream, &transactionId, &bindingRequest) == kStunValid)
+	{
+		unsigned int responseIndex = serverSocket->index ^ mStunServerIndex(bindingRequest.doChangeHost, bindingRequest.doChangePort);
+		
+		// Response in place, back to the request source address
+		net_packet_init(packet, packet->capacity);
+		stunProtocolPackBindingResponse(&packet->bitstream, transactionId, &packet->addr, &server->addrs[serverSocket->index ^ mStunServerIndex(true, true)], &server->addrs[responseIndex]); // OTHER-ADDRESS, other host and port than the one receiving
+		serverSocket->responses[responseIndex][serverSocket->responseCount[responseIndex]++] = packet; // Sent at batch end, at most kNetSocketReceiveBatch
+		
+		__sync_add_and_fetch(&server->requestCount, 1);
+		return;
+	}
+	
+	net_packet_release(socket, packet);
+}
+
+static void stunServerReceiveBatchCallback(void * context)
+{
+	StunServerSocket * serverSocket = (StunServerSocket *)context;
+	stun_server_t server = serverSocket->server;
+	
+	for(unsigned int index=0; index<kStunServerSocketCount; ++index)
+	{
+		unsigned int count = serverSocket->responseCount[index];
+		if(count == 0)
+			continue;
+		
+		net_socket_send_batch(server->sockets[index], serverSocket->responses[index], count);
+		
+		for(unsigned int i=0; i<count; ++i)
+			net_packet_release(server->sockets[index], serverSocket->responses[index][i]); // Send batch keeps its own reference
+		serverSocket->responseCount[index] = 0;
+	}
+}
+
+stun_server_t stunServerCreate(NetError * error, const char * primaryHost, const char * otherHost, const int primaryPort, const int otherPort)
+{
+	if(!primaryHost || !otherHost || (primaryPort != 0 && primaryPort == otherPort))
+	{
+		netErrorSet(error, NetInvalidError);
+		return NULL;
+	}
+	
+	stun_server_t server = calloc(1, sizeof(struct StunServerStruct));
+	if(!server)
+	{
+		netErrorSet(error, NetOtherError);
+		return NULL;
+	}
+	
+	// Primary host sockets first, other host binds the same ports (ports picked by the system if 0)
+	int ports[2] = {primaryPort, otherPort};
+	for(unsigned int index=0; index<kStunServerSocketCount; ++index)
+	{
+		bool isOtherHost = (index & 2) != 0;
+		bool isOtherPort = (index & 1) != 0;
+		
+		int port = isOtherHost ? ntohs(server->addrs[mStunServerIndex(false, isOtherPort)].sin_port) : ports[isOtherPort];
+		server->sockets[index] = net_socket_create(error, AF_INET, isOtherHost ? otherHost : primaryHost, port);
+		if(!server->sockets[index])
+		{
+			stunServerDestroy(server);
+			return NULL;
+		}
+		
+		net_addr_copy(&server->addrs[index], &server->sockets[index]->sockaddr);
+		if(server->addrs[index].sin_addr.s_addr == htonl(INADDR_ANY)) // Responses must carry a reachable address
+		{
+			stunServerDestroy(server);
+			netErrorSet(error, NetInvalidError);
+			return NULL;
+		}
+		
+		server->contexts[index].server = server;
+		server->contexts[index].index = index;
+		net_socket_set_receive_inline(server->sockets[index], true); // Answered on the read source, no dispatch per request
+		net_socket_set_receive_callback(server->sockets[index], &server->contexts[index], stunServerReceiveCallback);
+		net_socket_set_receive_batch_callback(server->sockets[index], stunServerReceiveBatchCallback);
+	}
+	
+	mNetworkLog("STUN server %s:%u, other address %s:%u", primaryHost, ntohs(server->addrs[0].sin_port), otherHost, ntohs(server->addrs[3].sin_port));
+	
+	*error = NetNoError;
+	return server;
+}
+
+void stunServerDestroy(stun_server_t server)
+{
+	if(server)
+	{
+		for(unsigned int index=0; index<kStunServerSocketCount; ++index)
+			if(server->sockets[index])
+				net_socket_destroy(server->sockets[index]);
+		
+		free(server);
+	}
+}
+
+void stunServerAddr(stun_server_t server, bool isOtherHost, bool isOtherPort, net_addr_t * addr)
+{
+	net_addr_copy(addr, &server->addrs[mStunServerIndex(isOtherHost, isOtherPort)]);
+}
+
+uint64_t stunServerRequestCount(stun_server_t server)
+{
+	return server->requestCount;
+}
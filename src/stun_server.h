@@ -0,0 +1,69 @@
+/*
+ 
+ stun_server.h
+ universal-network-c
+ 
+ Copyright (cc) 2012 Luis Laugga.
+ Some rights reserved, all wrongs deserved.
+ 
+ Licensed under a Creative Commons Attribution-ShareAlike 3.0 License;
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://creativecommons.org/licenses/by-sa/3.0/
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" basis,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ 
+*/
+
+#ifndef __universal_network_stun_server_h__
+#define __universal_network_stun_server_h__
+
+#include "net.h"
+#include "stun_protocol.h"
+
+/*!
+ * @typedef stun_server_t
+ *
+ * @abstract STUN binding server (RFC 5389), with the RFC 5780 attributes used for NAT classification
+ * @discussion
+ * The server listens on two local addresses (primary, other) and two ports (primary, other), one socket each.
+ * Binding requests are answered with XOR-MAPPED-ADDRESS, MAPPED-ADDRESS, OTHER-ADDRESS (other host:other port)
+ * and RESPONSE-ORIGIN. CHANGE-REQUEST is honoured by answering from the socket with the other host and/or port.
+ *
+ * Requests are answered on the socket read source, in batches (see kNetSocketReceiveBatch), the request packet
+ * is re-used for the response. The responses of a read batch are sent together, one net_socket_send_batch per
+ * responding socket. Anything that is not a binding request is dropped.
+ *
+ * On loopback any 127.x.y.z address can be used as other host, e.g. 127.0.0.1 and 127.0.0.2.
+ */
+
+#define kStunServerSocketCount 4
+
+typedef struct StunServerStruct * stun_server_t;
+
+typedef struct {
+	stun_server_t server;
+	unsigned int index; // Bit 1: other host, bit 0: other port
+	net_packet_t responses[kStunServerSocketCount][kNetSocketReceiveBatch]; // Responses of the current read batch, by responding socket
+	unsigned int responseCount[kStunServerSocketCount];
+} StunServerSocket;
+
+struct StunServerStruct {
+	net_socket_t sockets[kStunServerSocketCount];
+	net_addr_t addrs[kStunServerSocketCount]; // Bound address of each socket
+	StunServerSocket contexts[kStunServerSocketCount]; // Receive callback context of each socket
+	volatile uint64_t requestCount; // Answered binding requests
+};
+
+stun_server_t stunServerCreate(NetError * error, const char * primaryHost, const char * otherHost, const int primaryPort, const int otherPort); // Port 0 picks free ports
+void stunServerDestroy(stun_server_t);
+
+void stunServerAddr(stun_server_t, bool isOtherHost, bool isOtherPort, net_addr_t *);
+uint64_t stunServerRequestCount(stun_server_t);
+
+#endif
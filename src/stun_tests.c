@@ -24,6 +24,11 @@
 #include "stun_utils.h"
 #include "universal_network_c.h"
 
+/*
+ * Tests only send their request and record the response. Which tests run, and the NAT classification derived
+ * from their outcome, is decided by the stun object as each test completes (see stun.c)
+ */
+
 void stunTestStartBasicBinding(StunTest * test, StunConfig * config, StunResults * results)
 {	
 	mNetworkLog("Testing: Binding");
@@ -35,56 +40,34 @@ void stunTestStartBasicBinding(StunTest * test, StunConfig * config, StunResults
 	stunTestSetup(test, config, &config->primaryServerAddr);
 	
 	// Retrieve local address
-	net_socket_local_addr(config->socket_info.socket, &results->localAddr);
+	net_socket_local_addr(config->socket, &results->localAddr);
 	
 	// Build STUN request
 	stunProtocolPackBindingRequest(&test->packet->bitstream, test->transactionId); // Binding request
 	
 	// Set STUN response block (simplifies access to config and results)
-	test->receiveBlock = Block_copy(^(net_packet_t packet) {
-		dispatch_async(config->stunDispatchQueue, ^{ 
-			if(test->isCompleted == false) // If test has not been completed
-			{
-				StunTransactionId transactionId; // Unpack response
-				StunBindingResponse bindingResponse;
-			
-				if(stunProtocolUnpackBindingResponse(&packet->bitstream, &transactionId, &bindingResponse) == kStunValid)
-				{
-					stunTestDestroyTimeout(test, config); // Stop timeout
-				
-					if(stunIsEqualTransactionId(&test->transactionId, &transactionId))
-					{
-						if(bindingResponse.hasMappedAddress)
-							net_addr_copy(&results->mappedAddr, &bindingResponse.mappedAddressAddr);
-						if(bindingResponse.hasXorMappedAddress)
-							net_addr_copy(&results->mappedAddr, &bindingResponse.xorMappedAddressAddr);
-						if(bindingResponse.hasAlternateServer)
-						{
-							results->hasOtherServerAddress = true;
-							net_addr_copy(&results->otherServerAddr, &bindingResponse.alternateServerAddr);
-							net_addr_set(&results->otherServerPrimaryHostAddr, config->primaryServerAddr.sin_addr.s_addr, results->otherServerAddr.sin_port, false);
-							net_addr_set(&results->otherServerPrimaryPortAddr, results->otherServerAddr.sin_addr.s_addr, config->primaryServerAddr.sin_port, false);
-						}
-					
-						if(net_addr_is_equal(&results->mappedAddr, &results->localAddr))
-							results->isMappingDirect = true;
-						
-						results->didBindingTestSuccess = true; // Set binding test results
-						stunTestSetComplete(test, config);
-					}
-				}
-				else
-				{
-					stunTestForward(test, config, packet); // Forward if not valid stun (might belong to other protocol running on same socket)
-				}
-			}
-
-			net_packet_release(config->socket_info.socket, packet); // Release response packet
-		});
+	test->responseBlock = Block_copy(^(net_packet_t packet, StunBindingResponse * bindingResponse) {
+		if(bindingResponse->hasMappedAddress)
+			net_addr_copy(&results->mappedAddr, &bindingResponse->mappedAddressAddr);
+		if(bindingResponse->hasXorMappedAddress)
+			net_addr_copy(&results->mappedAddr, &bindingResponse->xorMappedAddressAddr);
+		if(bindingResponse->hasAlternateServer)
+		{
+			results->hasOtherServerAddress = true;
+			net_addr_copy(&results->otherServerAddr, &bindingResponse->alternateServerAddr);
+			net_addr_set(&results->otherServerPrimaryHostAddr, config->primaryServerAddr.sin_addr.s_addr, results->otherServerAddr.sin_port, false);
+			net_addr_set(&results->otherServerPrimaryPortAddr, results->otherServerAddr.sin_addr.s_addr, config->primaryServerAddr.sin_port, false);
+		}
+	
+		if(net_addr_is_equal(&results->mappedAddr, &results->localAddr))
+			results->isMappingDirect = true;
+		
+		results->didBindingTestSuccess = true; // Set binding test results
+		test->didRespond = true;
 	});
 	
 	// Send STUN request
-	stunTestSend(test, config, &results->didBindingTestSuccess);
+	stunTestSend(test, config);
 }
 
 void stunTestStartBehavior1(StunTest * test, StunConfig * config, StunResults * results)
@@ -94,70 +77,22 @@ void stunTestStartBehavior1(StunTest * test, StunConfig * config, StunResults *
 	// Reset
 	memset(test, 0, sizeof(StunTest));
 	
-	// Not need to run if it is direct
-	if(results->didBindingTestSuccess && results->isMappingDirect)
-	{
-		results->natBehavior = DirectMapping;
-		results->didBehaviorTestSuccess = true;
-		stunTestSetComplete(test, config);
-	}	
-	// Set complete but fail if no alternate server address
-	else if(results->hasOtherServerAddress == false)
-	{
-		results->didBehaviorTestSuccess = false;
-		stunTestSetComplete(test, config);
-	}
-	else
-	{
-		// Send STUN request to otherServerPrimaryPortAddr
-		// Test setup
-		stunTestSetup(test, config, &results->otherServerPrimaryPortAddr);
-
-		// Build STUN request
-		stunProtocolPackBindingRequest(&test->packet->bitstream, test->transactionId); // Binding request
+	// Send STUN request to otherServerPrimaryPortAddr
+	stunTestSetup(test, config, &results->otherServerPrimaryPortAddr);
+	stunProtocolPackBindingRequest(&test->packet->bitstream, test->transactionId); // Binding request
+	
+	// Set STUN response block (simplifies access to config and results)
+	test->responseBlock = Block_copy(^(net_packet_t packet, StunBindingResponse * bindingResponse) {
+		if(bindingResponse->hasMappedAddress)
+			net_addr_copy(&results->mappedOtherServerPrimaryPortAddr, &bindingResponse->mappedAddressAddr);
+		if(bindingResponse->hasXorMappedAddress)
+			net_addr_copy(&results->mappedOtherServerPrimaryPortAddr, &bindingResponse->xorMappedAddressAddr);
 		
-		// Set STUN response block (simplifies access to config and results)
-		test->receiveBlock = Block_copy(^(net_packet_t packet) {
-			dispatch_async(config->stunDispatchQueue, ^{ 
-				if(test->isCompleted == false) // If test has not been completed
-				{
-					StunTransactionId transactionId; // Unpack response
-					StunBindingResponse bindingResponse;
-					if(stunProtocolUnpackBindingResponse(&packet->bitstream, &transactionId, &bindingResponse) == kStunValid)
-					{
-						stunTestDestroyTimeout(test, config); // Stop timeout
-					
-						if(stunIsEqualTransactionId(&test->transactionId, &transactionId))
-						{
-							if(bindingResponse.hasMappedAddress)
-								net_addr_copy(&results->mappedOtherServerPrimaryPortAddr, &bindingResponse.mappedAddressAddr);
-							if(bindingResponse.hasXorMappedAddress)
-								net_addr_copy(&results->mappedOtherServerPrimaryPortAddr, &bindingResponse.xorMappedAddressAddr);
-						
-							if(bindingResponse.hasMappedAddress || bindingResponse.hasXorMappedAddress)
-					        	if (net_addr_is_equal(&results->mappedOtherServerPrimaryPortAddr, &results->mappedAddr)) // mappedAddr = mappedAddr with otherAddr:primaryPort
-					        	{
-									results->didBehaviorTestSuccess = true;
-					            	results->natBehavior = EndpointIndependentMapping;
-					        	}
-						
-							 // Set behavior test 1 results
-							stunTestSetComplete(test, config);
-						}
-					}
-					else
-					{
-						stunTestForward(test, config, packet); // Forward if not valid stun (might belong to other protocol running on same socket)
-					}
-				}
-
-				net_packet_release(config->socket_info.socket, packet); // Release response packet
-			});
-		});
+		test->didRespond = bindingResponse->hasMappedAddress || bindingResponse->hasXorMappedAddress;
+	});
 
-		// Send STUN request
-		stunTestSend(test, config, &results->didBindingTestSuccess);
-	}
+	// Send STUN request
+	stunTestSend(test, config);
 }
 
 void stunTestStartBehavior2(StunTest * test, StunConfig * config, StunResults * results)
@@ -167,72 +102,22 @@ void stunTestStartBehavior2(StunTest * test, StunConfig * config, StunResults *
 	// Reset
 	memset(test, 0, sizeof(StunTest));
 	
-	// Not need to run if behavior was found
-	if(results->didBehaviorTestSuccess)
-	{
-		stunTestSetComplete(test, config);
-	}	
-	// Behavior test 1 error
-	else if(net_addr_is_valid(&results->mappedOtherServerPrimaryPortAddr) == false)
-	{
-		results->didBehaviorTestSuccess = false;
-		stunTestSetComplete(test, config);
-	}
-	else
-	{
-		// Send STUN request to otherServerAddr
-		// Test setup
-		stunTestSetup(test, config, &results->otherServerAddr);
-
-		// Build STUN request
-		stunProtocolPackBindingRequest(&test->packet->bitstream, test->transactionId); // Binding request
+	// Send STUN request to otherServerAddr
+	stunTestSetup(test, config, &results->otherServerAddr);
+	stunProtocolPackBindingRequest(&test->packet->bitstream, test->transactionId); // Binding request
+	
+	// Set STUN response block (simplifies access to config and results)
+	test->responseBlock = Block_copy(^(net_packet_t packet, StunBindingResponse * bindingResponse) {
+		if(bindingResponse->hasMappedAddress)
+			net_addr_copy(&results->mappedOtherServerAddr, &bindingResponse->mappedAddressAddr);
+		if(bindingResponse->hasXorMappedAddress)
+			net_addr_copy(&results->mappedOtherServerAddr, &bindingResponse->xorMappedAddressAddr);
 		
-		// Set STUN response block (simplifies access to config and results)
-		test->receiveBlock = Block_copy(^(net_packet_t packet) {
-			dispatch_async(config->stunDispatchQueue, ^{ 
-				if(test->isCompleted == false) // If test has not been completed
-				{
-					StunTransactionId transactionId; // Unpack response
-					StunBindingResponse bindingResponse;
-
-					if(stunProtocolUnpackBindingResponse(&packet->bitstream, &transactionId, &bindingResponse) == kStunValid)
-					{
-						stunTestDestroyTimeout(test, config); // Stop timeout
-					
-						if(stunIsEqualTransactionId(&test->transactionId, &transactionId))
-						{
-							if(bindingResponse.hasMappedAddress)
-								net_addr_copy(&results->mappedOtherServerAddr, &bindingResponse.mappedAddressAddr);
-							if(bindingResponse.hasXorMappedAddress)
-								net_addr_copy(&results->mappedOtherServerAddr, &bindingResponse.xorMappedAddressAddr);
-						
-							if(bindingResponse.hasMappedAddress || bindingResponse.hasXorMappedAddress)
-							{
-					        	if (net_addr_is_equal(&results->mappedOtherServerAddr, &results->mappedAddr)) // mappedAddr = mappedAddr with otherAddr:otherPort	
-					            	results->natBehavior = AddressDependentMapping;
-					        	else
-									results->natBehavior = AddressAndPortDependentMapping;
-								
-								results->didBehaviorTestSuccess = true;	
-							}
-						
-							 // Set behavior test 1 results
-							stunTestSetComplete(test, config);
-						}
-					}
-					else
-					{
-						stunTestForward(test, config, packet); // Forward if not valid stun (might belong to other protocol running on same socket)
-					}
-				}
-
-				net_packet_release(config->socket_info.socket, packet); // Release response packet
-			});
-		});
+		test->didRespond = bindingResponse->hasMappedAddress || bindingResponse->hasXorMappedAddress;
+	});
 
-		// Send STUN request
-		stunTestSend(test, config, &results->didBindingTestSuccess);
-	}
+	// Send STUN request
+	stunTestSend(test, config);
 }
 
 void stunTestStartFiltering1(StunTest * test, StunConfig * config, StunResults * results)
@@ -242,66 +127,17 @@ void stunTestStartFiltering1(StunTest * test, StunConfig * config, StunResults *
 	// Reset
 	memset(test, 0, sizeof(StunTest));
 	
-	// Not need to run if it is direct
-	if(results->didBindingTestSuccess && results->isMappingDirect)
-	{
-		results->natFiltering = EndpointIndependentFiltering;
-		results->didFilteringTestSuccess = true;
-		stunTestSetComplete(test, config);
-	}	
-	// Set complete but fail if no alternate server address
-	else if(results->hasOtherServerAddress == false)
-	{
-		results->didFilteringTestSuccess = false;
-		stunTestSetComplete(test, config);
-	}
-	else
-	{
-		// Test setup
-		stunTestSetup(test, config, &config->primaryServerAddr); // Primary server address
-
-		// Build STUN binding-change-request
-		bool doChangeHost = true;
-		bool doChangePort = true;
-		stunProtocolPackBindingChangeRequest(&test->packet->bitstream, test->transactionId, doChangeHost, doChangePort); // Bind request with change host+port
-		
-		// Set STUN response block (simplifies access to config and results)
-		test->receiveBlock = Block_copy(^(net_packet_t packet) {
-			dispatch_async(config->stunDispatchQueue, ^{ 
-				if(test->isCompleted == false) // If test has not been completed
-				{
-					StunTransactionId transactionId; // Unpack response
-					StunBindingResponse bindingResponse;
-					if(stunProtocolUnpackBindingResponse(&packet->bitstream, &transactionId, &bindingResponse) == kStunValid)
-					{
-						stunTestDestroyTimeout(test, config); // Stop timeout
-					
-						if(stunIsEqualTransactionId(&test->transactionId, &transactionId))
-						{
-							// if we got a response back from the other IP and Port, then we have independent filtering
-							if (net_addr_is_equal(&results->otherServerAddr, &packet->addr))
-					        	{
-									results->didFilteringTestSuccess = true;
-					            	results->natFiltering = EndpointIndependentFiltering;
-					        	}
-						
-	                     	 // Set behavior test 1 results
-							stunTestSetComplete(test, config);
-						}
-					}
-					else
-					{
-						stunTestForward(test, config, packet); // Forward if not valid stun (might belong to other protocol running on same socket)
-					}
-				}
-
-				net_packet_release(config->socket_info.socket, packet); // Release response packet
-			});
-		});
+	// Send STUN binding-change-request to primary server address
+	stunTestSetup(test, config, &config->primaryServerAddr);
+	stunProtocolPackBindingChangeRequest(&test->packet->bitstream, test->transactionId, true, true); // Bind request with change host+port
+	
+	// Set STUN response block (simplifies access to config and results)
+	test->responseBlock = Block_copy(^(net_packet_t packet, StunBindingResponse * bindingResponse) {
+		test->didRespond = net_addr_is_equal(&results->otherServerAddr, &packet->addr); // Response got through from the other IP and port
+	});
 
-		// Send STUN request
-		stunTestSend(test, config, &results->didFilteringTestSuccess);
-	}
+	// Send STUN request
+	stunTestSend(test, config);
 }
 
 void stunTestStartFiltering2(StunTest * test, StunConfig * config, StunResults * results)
@@ -311,64 +147,17 @@ void stunTestStartFiltering2(StunTest * test, StunConfig * config, StunResults *
 	// Reset
 	memset(test, 0, sizeof(StunTest));
 	
-	// Not need to run if filtering was found
-	if(results->didFilteringTestSuccess)
-	{
-		stunTestSetComplete(test, config);
-	}
-	// Set complete but fail if no alternate server address
-	else if(results->hasOtherServerAddress == false)
-	{
-		results->didFilteringTestSuccess = false;
-		stunTestSetComplete(test, config);
-	}
-	else
-	{
-		// Test setup
-		stunTestSetup(test, config, &config->primaryServerAddr); // Primary server address
-
-		// Build STUN binding-change-request
-		bool doChangeHost = false;
-		bool doChangePort = true;
-		stunProtocolPackBindingChangeRequest(&test->packet->bitstream, test->transactionId, doChangeHost, doChangePort); // Bind request with change host+port
-		
-		// Set STUN response block (simplifies access to config and results)
-		test->receiveBlock = Block_copy(^(net_packet_t packet) {
-			dispatch_async(config->stunDispatchQueue, ^{ 
-				if(test->isCompleted == false) // If test has not been completed
-				{
-					StunTransactionId transactionId; // Unpack response
-					StunBindingResponse bindingResponse;
-					if(stunProtocolUnpackBindingResponse(&packet->bitstream, &transactionId, &bindingResponse) == kStunValid)
-					{
-						stunTestDestroyTimeout(test, config); // Stop timeout
-					
-						if(stunIsEqualTransactionId(&test->transactionId, &transactionId))
-						{
-							// if we got a response back from the other Port, then we have independent filtering
-							if (net_addr_is_equal(&results->otherServerAddr, &packet->addr))
-					        	{
-									results->didFilteringTestSuccess = true;
-					            	results->natFiltering = AddressDependentFiltering;
-					        	}
-						
-							 // Set behavior test 1 results
-							stunTestSetComplete(test, config);
-						}
-					}
-					else
-					{
-						stunTestForward(test, config, packet); // Forward if not valid stun (might belong to other protocol running on same socket)
-					}
-				}
-
-				net_packet_release(config->socket_info.socket, packet); // Release response packet
-			});
-		});
+	// Send STUN binding-change-request to primary server address
+	stunTestSetup(test, config, &config->primaryServerAddr);
+	stunProtocolPackBindingChangeRequest(&test->packet->bitstream, test->transactionId, false, true); // Bind request with change port
+	
+	// Set STUN response block (simplifies access to config and results)
+	test->responseBlock = Block_copy(^(net_packet_t packet, StunBindingResponse * bindingResponse) {
+		test->didRespond = net_addr_is_equal(&results->otherServerPrimaryHostAddr, &packet->addr); // Response got through from the other port
+	});
 
-		// Send STUN request
-		stunTestSend(test, config, &results->didFilteringTestSuccess);
-	}
+	// Send STUN request
+	stunTestSend(test, config);
 }
 
 void stunTestSetup(StunTest * test, StunConfig * config, net_addr_t * destAddr)
@@ -376,30 +165,44 @@ void stunTestSetup(StunTest * test, StunConfig * config, net_addr_t * destAddr)
 	mNetworkPrettyLog;
 	
 	// Packet setup
-	test->packet = net_packet_alloc(config->socket_info.socket); // Stun test owns packet. Responsible for releasing it.
+	test->packet = net_packet_alloc(config->socket); // Stun test owns packet. Responsible for releasing it.
 	net_packet_addr(test->packet, destAddr); // Set STUN server address
 	
 	// STUN setup
 	stunGenerateTransactionId(&test->transactionId); // Generate random trans. id
 }
 
-void stunTestSend(StunTest * test, StunConfig * config, bool * testSuccessCheck)
+void stunTestSend(StunTest * test, StunConfig * config)
 {
 	// Define timeout block (simplifies access to config and results)
 	test->timeoutBlock = Block_copy(^(void) {
       	dispatch_async(config->stunDispatchQueue, ^{ 
-			stunTestRetryOrFail(test, config, testSuccessCheck); // If fails will set *testSuccessCheck = false
+			stunTestRetryOrFail(test, config); // If fails will complete without response
 		});
 	});
 	
-	// Socket set receive block
-	net_socket_set_receive_block(config->socket_info.socket, test->receiveBlock);
+	// Responses are matched by transaction id (see stunTestIsResponse)
+	test->isRunning = true;
 	
 	// Set timeout
 	timeout_create_block(&test->timeout, test->timeoutBlock, config->rto);
 	
 	// Socket send packet
-	net_socket_send(config->socket_info.socket, test->packet);
+	net_socket_send(config->socket, test->packet);
+}
+
+bool stunTestIsResponse(StunTest * test, StunTransactionId * transactionId)
+{
+	return test->isRunning && !test->isCompleted && stunIsEqualTransactionId(&test->transactionId, transactionId);
+}
+
+void stunTestReceive(StunTest * test, StunConfig * config, net_packet_t packet, StunBindingResponse * bindingResponse)
+{
+	mNetworkPrettyLog;
+	
+	stunTestDestroyTimeout(test, config); // Stop timeout
+	test->responseBlock(packet, bindingResponse); // Set test results
+	stunTestSetComplete(test, config);
 }
 
 void stunTestDestroyTimeout(StunTest * test, StunConfig * config)
@@ -423,7 +226,18 @@ void stunTestSetComplete(StunTest * test, StunConfig * config)
 	config->testDidComplete(test); // Notify
 }
 
-void stunTestRetryOrFail(StunTest * test, StunConfig * config, bool * testSuccessCheck)
+void stunTestCancel(StunTest * test, StunConfig * config)
+{
+	if(test->isRunning && !test->isCompleted)
+	{
+		mNetworkPrettyLog;
+		
+		stunTestRelease(test, config); // No longer needed, outcome is already known
+		test->isCompleted = true; // Without notification
+	}
+}
+
+void stunTestRetryOrFail(StunTest * test, StunConfig * config)
 {
 	mNetworkPrettyLog;
 	
@@ -435,13 +249,13 @@ void stunTestRetryOrFail(StunTest * test, StunConfig * config, bool * testSucces
 			test->retries++; // Update retries
             long timeoutRto = config->rto * (3ull * (long)test->retries); // Calculate new rto
 			timeout_create_block(&test->timeout, test->timeoutBlock, timeoutRto); // Set timeout
-			net_socket_send(config->socket_info.socket, test->packet); // Retransmit
+			net_socket_send(config->socket, test->packet); // Retransmit
             
             mNetworkLog("Retry nr: %u Timeout: %ld", test->retries, timeoutRto);
 		}
 		else // Fail
 		{	
-			*testSuccessCheck = false; // Set test result to failed
+			test->didRespond = false; // Complete without response
 			stunTestSetComplete(test, config);
 		}
 	}
@@ -452,33 +266,17 @@ void stunTestRelease(StunTest * test, StunConfig * config)
 	mNetworkPrettyLog;
 	
 	stunTestDestroyTimeout(test, config); // Destroy timeout (re-release)
+	test->isRunning = false;
 
-	if(test->receiveBlock)
-		Block_release(test->receiveBlock); // Release receive block
+	if(test->responseBlock)
+		Block_release(test->responseBlock); // Release response block
+	test->responseBlock = NULL;
 	
 	if(test->timeoutBlock)
 		Block_release(test->timeoutBlock); // Release timeout block
+	test->timeoutBlock = NULL;
 	
 	if(test->packet)
-		net_packet_release(config->socket_info.socket, test->packet); // Release request packet
+		net_packet_release(config->socket, test->packet); // Release request packet
+	test->packet = NULL;
 }
-
-void stunTestForward(StunTest * test, StunConfig * config, net_packet_t packet)
-{
-	mNetworkPrettyLog;
-	
-	// 1. Reset bitstream
-	bitstream_reset(&packet->bitstream);
-	
-	// 2. Forward using config's socket_info
-	net_socket_info_s socket_info = config->socket_info;	
-	
-	if(socket_info.receiveBlock) // block
-	{
-		socket_info.receiveBlock(packet);
-	}
-	else if(socket_info.receiveCallback) // alternative callback
-	{
-		socket_info.receiveCallback(socket_info.receiveCallbackContext, packet);
-	}
-}
\ No newline at end of file
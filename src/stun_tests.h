@@ -64,11 +64,15 @@ typedef struct {
     StunNatFiltering natFiltering;
 } StunResults;
 
+typedef void (^StunTestResponseBlock)(net_packet_t, StunBindingResponse *); // Valid response for the test transaction id, on stun queue
+
 typedef struct {
+	bool isRunning; // Request sent, waiting for the response or timeout
 	bool isCompleted;
+	bool didRespond; // Completed with the expected response, otherwise timed out
 	StunTransactionId transactionId; // The transaction ID is a 96-bit identifier, used to uniquely identify STUN transactions
 	net_packet_t packet;
-	net_socket_receive_block_t receiveBlock; // receiveBlock needs to be released (Block_Copy on start)
+	StunTestResponseBlock responseBlock; // responseBlock needs to be released (Block_Copy on start)
 	unsigned int retries; // Nr. of retransmissions
 	timeout_t timeout;
 	timeout_block_t timeoutBlock; // timeoutBlock needs to be released (Block_Copy on start)
@@ -80,27 +84,30 @@ typedef struct {
 	long rto;     // Retransmission timeout in milliseconds
 	unsigned int maxRetries; // Max. number of retransmissions after first request
 	
-	net_socket_info_s socket_info;
+	net_socket_t socket; // Shared socket, STUN datagrams are demultiplexed
+	net_socket_demux_t demux; // Registered while resolving, responses of every running test
 	dispatch_queue_t stunDispatchQueue;
 	
     char primaryServerHostname[64]; // WEAK 64 bytes is enough?
+	unsigned short primaryServerPort; // kStunServerDefaultPort unless set
 	net_addr_t primaryServerAddr;
 	StunTestDidComplete testDidComplete; // Block is called whenever some test finishes
 } StunConfig;
 
 void stunTestStartBasicBinding(StunTest * t, StunConfig * config, StunResults * results);
-void stunTestStartBehavior1(StunTest * t, StunConfig * config, StunResults * results);
-void stunTestStartBehavior2(StunTest * t, StunConfig * config, StunResults * results);
-void stunTestStartFiltering1(StunTest * t, StunConfig * config, StunResults * results);
-void stunTestStartFiltering2(StunTest * t, StunConfig * config, StunResults * results);
+void stunTestStartBehavior1(StunTest * t, StunConfig * config, StunResults * results); // Requires OTHER-ADDRESS from binding
+void stunTestStartBehavior2(StunTest * t, StunConfig * config, StunResults * results); // Same
+void stunTestStartFiltering1(StunTest * t, StunConfig * config, StunResults * results); // Same
+void stunTestStartFiltering2(StunTest * t, StunConfig * config, StunResults * results); // Same
 
 void stunTestSetup(StunTest * test, StunConfig * config, net_addr_t * destAddr);
-void stunTestSend(StunTest * test, StunConfig * config, bool * testSuccessCheck);
+void stunTestSend(StunTest * test, StunConfig * config);
+bool stunTestIsResponse(StunTest * test, StunTransactionId * transactionId); // Running and waiting for transactionId
+void stunTestReceive(StunTest * test, StunConfig * config, net_packet_t packet, StunBindingResponse * bindingResponse); // Sets results and completes
 void stunTestDestroyTimeout(StunTest * test, StunConfig * config);
 void stunTestSetComplete(StunTest * test, StunConfig * config);
-void stunTestRetryOrFail(StunTest * test, StunConfig * config, bool * testSuccessCheck);
+void stunTestCancel(StunTest * test, StunConfig * config); // Completes a running test without notification
+void stunTestRetryOrFail(StunTest * test, StunConfig * config);
 void stunTestRelease(StunTest * test, StunConfig * config);
 
-void stunTestForward(StunTest * test, StunConfig * config, net_packet_t packet); // Forward packet to socket's original callback in case it is STUN invalid
-
 #endif
\ No newline at end of file
@@ -0,0 +1,189 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* timer_wheel.c
+* universal-network-c
+*/
+
+#include "timer_wheel.h"
+
+struct timer_wheel_s {
+	uint64_t resolution; // Tick duration
+	uint64_t tick; // Next tick to expire, all previous ticks were already expired
+	unsigned int mask; // Slots - 1
+	unsigned int count; // Scheduled entries
+	timer_wheel_entry_t ** slots;
+};
+
+static void timer_wheel_unlink(timer_wheel_t w, timer_wheel_entry_t * entry)
+{
+	if(entry->previous)
+		entry->previous->next = entry->next;
+	else
+		w->slots[entry->tick & w->mask] = entry->next; // Head of slot
+
+	if(entry->next)
+		entry->next->previous = entry->previous;
+
+	entry->next = NULL;
+	entry->previous = NULL;
+	entry->scheduled = false;
+
+	--w->count;
+}
+
+timer_wheel_t timer_wheel_create(uint64_t resolution, unsigned int slots, uint64_t now)
+{
+	if(resolution == 0)
+		return NULL;
+
+	unsigned int size = 1;
+	while(size < slots) // Round up to power of 2
+		size <<= 1;
+
+	timer_wheel_t w = (timer_wheel_t)malloc(sizeof(struct timer_wheel_s));
+	if(w)
+	{
+		w->resolution = resolution;
+		w->tick = now / resolution;
+		w->mask = size - 1;
+		w->count = 0;
+		w->slots = (timer_wheel_entry_t **)calloc(size, sizeof(timer_wheel_entry_t *));
+
+		if(!w->slots)
+		{
+			free(w);
+			return NULL;
+		}
+	}
+
+	return w;
+}
+
+void timer_wheel_destroy(timer_wheel_t w)
+{
+	if(w)
+	{
+		free(w->slots); // Entries belong to the caller
+		free(w);
+	}
+}
+
+void timer_wheel_entry_init(timer_wheel_entry_t * entry, void * object)
+{
+	entry->next = NULL;
+	entry->previous = NULL;
+	entry->tick = 0;
+	entry->object = object;
+	entry->scheduled = false;
+}
+
+void timer_wheel_schedule(timer_wheel_t w, timer_wheel_entry_t * entry, uint64_t deadline)
+{
+	if(entry->scheduled)
+		timer_wheel_unlink(w, entry);
+
+	uint64_t tick = (deadline + w->resolution - 1) / w->resolution; // Never before deadline
+	if(tick < w->tick)
+		tick = w->tick; // Past deadline, next advance
+
+	timer_wheel_entry_t ** slot = &w->slots[tick & w->mask];
+
+	entry->tick = tick;
+	entry->previous = NULL;
+	entry->next = *slot;
+	if(*slot)
+		(*slot)->previous = entry;
+	*slot = entry;
+	entry->scheduled = true;
+
+	++w->count;
+}
+
+void timer_wheel_cancel(timer_wheel_t w, timer_wheel_entry_t * entry)
+{
+	if(entry->scheduled)
+		timer_wheel_unlink(w, entry);
+}
+
+unsigned int timer_wheel_advance(timer_wheel_t w, uint64_t now, timer_wheel_expire_block_t block)
+{
+	uint64_t target = now / w->resolution;
+	if(target < w->tick || w->count == 0)
+	{
+		if(target >= w->tick)
+			w->tick = target + 1; // Nothing to expire
+		return 0;
+	}
+
+	// Visit each slot at most once, entries beyond target stay for a later revolution
+	uint64_t span = target - w->tick + 1;
+	if(span > (uint64_t)w->mask + 1)
+		span = (uint64_t)w->mask + 1;
+
+	timer_wheel_entry_t * expired = NULL; // In tick order
+	timer_wheel_entry_t * expiredTail = NULL;
+
+	for(uint64_t i=0; i<span; ++i)
+	{
+		timer_wheel_entry_t * entry = w->slots[(w->tick + i) & w->mask];
+		while(entry)
+		{
+			timer_wheel_entry_t * next = entry->next;
+			if(entry->tick <= target)
+			{
+				timer_wheel_unlink(w, entry);
+				if(expiredTail)
+					expiredTail->next = entry;
+				else
+					expired = entry;
+				expiredTail = entry;
+			}
+			entry = next;
+		}
+	}
+
+	w->tick = target + 1; // Re-scheduled entries from the block go ahead
+
+	// Expire, the block may re-schedule the entry
+	unsigned int count = 0;
+	while(expired)
+	{
+		timer_wheel_entry_t * entry = expired;
+		expired = entry->next;
+		entry->next = NULL;
+
+		block(entry);
+		++count;
+	}
+
+	return count;
+}
+
+uint64_t timer_wheel_next(timer_wheel_t w)
+{
+	if(w->count == 0)
+		return 0;
+
+	uint64_t earliest = UINT64_MAX;
+
+	for(uint64_t i=0; i<=w->mask; ++i)
+	{
+		timer_wheel_entry_t * entry = w->slots[(w->tick + i) & w->mask];
+		for(; entry; entry = entry->next)
+		{
+			if(entry->tick == w->tick + i)
+				return entry->tick * w->resolution; // Within this revolution
+			if(entry->tick < earliest)
+				earliest = entry->tick;
+		}
+	}
+
+	return earliest * w->resolution;
+}
+
+unsigned int timer_wheel_count(timer_wheel_t w)
+{
+	return w->count;
+}
@@ -0,0 +1,59 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* timer_wheel.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_timer_wheel_h__
+#define __universal_network_timer_wheel_h__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/*!
+ * @header
+ *
+ * timer_wheel_t is a hashed timing wheel, used to keep a large number of deadlines
+ * with O(1) schedule/cancel and a cost per advance proportional to the expired entries.
+ *
+ * Time is any monotonic unsigned 64 bit unit (e.g. net_time_t), quantized in ticks of
+ * the resolution set on creation. Each slot holds a doubly linked list of the entries
+ * expiring on ticks that map to it, entries further than one revolution stay in their
+ * slot until their own tick is reached. An entry never expires before its deadline,
+ * it may expire up to one tick later.
+ *
+ * Entries are intrusive, the caller embeds timer_wheel_entry_t in its own objects and
+ * sets the object pointer. NO memory is allocated when scheduling.
+ */
+
+#define kTimerWheelDefaultSlots 64
+
+typedef struct timer_wheel_entry_s {
+	struct timer_wheel_entry_s * next;
+	struct timer_wheel_entry_s * previous;
+	uint64_t tick; // Expiry tick
+	void * object; // Owner object, set by the caller
+	bool scheduled;
+} timer_wheel_entry_t;
+
+typedef struct timer_wheel_s * timer_wheel_t;
+
+timer_wheel_t timer_wheel_create(uint64_t resolution, unsigned int slots, uint64_t now); // Slots are rounded up to a power of 2
+void timer_wheel_destroy(timer_wheel_t);
+
+void timer_wheel_entry_init(timer_wheel_entry_t *, void *); // Entry with owner object, not scheduled
+
+void timer_wheel_schedule(timer_wheel_t, timer_wheel_entry_t *, uint64_t deadline); // Re-schedules if already scheduled, past deadlines expire on next advance
+void timer_wheel_cancel(timer_wheel_t, timer_wheel_entry_t *); // Does nothing if not scheduled
+
+typedef void (^timer_wheel_expire_block_t)(timer_wheel_entry_t *); // Entry is no longer scheduled, may be re-scheduled from the block (other entries must not)
+unsigned int timer_wheel_advance(timer_wheel_t, uint64_t now, timer_wheel_expire_block_t); // Expires due entries, returns count
+
+uint64_t timer_wheel_next(timer_wheel_t); // Start of the earliest tick with entries (lower bound of next deadline), 0 if empty
+unsigned int timer_wheel_count(timer_wheel_t);
+
+#endif
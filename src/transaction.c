@@ -25,7 +25,7 @@ NetError transactionSetup(TransactionConfiguration * config, const int port, voi
 	// Socket
 	NetError netError;
 	static const char * localhost = "0.0.0.0"; // Listening on all network interfaces
-	config->socket = net_socket_create(&netError, AF_INET, localhost, port);
+	config->socket = net_socket_create_size(&netError, AF_INET, localhost, port, kTransactionPacketLen);
 	
 	// Check error
 	if(netError)
@@ -34,7 +34,7 @@ NetError transactionSetup(TransactionConfiguration * config, const int port, voi
 		return netError;
 	}
 	
-	net_socket_set_receive_callback(config->socket, config, transactionSocketReceiveCallback); // Set socket callback
+	net_socket_demux_add_callback(config->socket, kProtocolDefaultId, kProtocolDefaultId, protocolIsTransaction, config, transactionSocketReceiveCallback); // Transaction datagrams, other protocols may share the socket
 	
 	config->receiveCallback = receiveCallback;
 	config->errorCallback = errorCallback;
@@ -159,7 +159,14 @@ void transactionRequest(TransactionConfiguration * config, net_addr_t * addr, Tr
 		transactionProtocolPackHeader(bitstream, transaction->id, TransactionTypeRequest);
 	
 		// Pack request
-		transactionProtocolPackRequest(bitstream, object);
+		if(!transactionProtocolPackRequest(bitstream, object))
+		{
+			mNetworkLog("Error transaction request type %d doesn't fit a %zu bytes packet", object->type, (size_t)kTransactionPacketLen);
+			transactionFree(config, transaction);
+			if(config->errorCallback)
+				config->errorCallback(config->context, addr);
+			return;
+		}
 	
 		dispatch_async(config->transactionsDispatchQueue, ^{
 			// Insert transaction in the hash table
@@ -7,6 +7,7 @@
 */
 
 #include "transaction_protocol.h"
+#include "transaction_schema.h"
 
 #pragma mark -
 #pragma mark Header
@@ -52,41 +53,24 @@ UnpackResult transactionProtocolUnpackResponse(bitstream_t * bitstream, Transact
 #pragma mark -
 #pragma mark Request
 
-void transactionProtocolPackRequest(bitstream_t * bitstream, TransactionObject * transactionObject)
+typedef void (*TransactionPackFunction)(bitstream_t *, TransactionObject *);
+typedef UnpackResult (*TransactionUnpackFunction)(bitstream_t *, TransactionObject *);
+
+typedef struct {
+	TransactionPackFunction pack;
+	TransactionUnpackFunction unpack;
+} TransactionSchemaEntry;
+
+static const TransactionSchemaEntry transactionProtocolSchema[256]; // Indexed by TransactionRequestType, see Schema
+
+bool transactionProtocolPackRequest(bitstream_t * bitstream, TransactionObject * transactionObject)
 {
 	bitstream_write_uint8(bitstream, transactionObject->type); // Request type
 	
-	switch(transactionObject->type) {
-		case TransactionUserCreate: // user create
-			transactionProtocolPackObjectUserCreate(bitstream, (TransactionObjectUserCreate *)transactionObject);
-			break;
-		case TransactionResourceCreate: // resource create 
-			transactionProtocolPackObjectResourceCreate(bitstream, (TransactionObjectResourceCreate *)transactionObject);
-			break;
-		case TransactionOnline: // online 
-			transactionProtocolPackObjectOnline(bitstream, (TransactionObjectOnline *)transactionObject);
-			break;
-		case TransactionOffline: // offline 
-			transactionProtocolPackObjectOffline(bitstream, (TransactionObjectOffline *)transactionObject);
-			break;
-		case TransactionPeerList: // peerlist 
-			transactionProtocolPackObjectPeerList(bitstream, (TransactionObjectPeerList *)transactionObject);
-			break;
-		case TransactionConnect: // connect 
-			transactionProtocolPackObjectConnect(bitstream, (TransactionObjectConnect *)transactionObject);
-			break;
-		case TransactionConnectAccept: // connect accept 
-			transactionProtocolPackObjectConnectAccept(bitstream, (TransactionObjectConnectAccept *)transactionObject);
-			break;
-        case TransactionConnectRefuse: // connect refuse 
-			transactionProtocolPackObjectConnectRefuse(bitstream, (TransactionObjectConnectRefuse *)transactionObject);
-			break;
-		case TransactionDisconnect: // disconnect
-			transactionProtocolPackObjectDisconnect(bitstream, (TransactionObjectDisconnect *)transactionObject);
-			break;
-		default: // empty
-		break;
-	}
+	if((unsigned int)transactionObject->type < 256 && transactionProtocolSchema[transactionObject->type].pack) // Otherwise empty
+		transactionProtocolSchema[transactionObject->type].pack(bitstream, transactionObject);
+	
+	return bitstream_error(bitstream) == 0; // Object reserve failed, body would be empty
 }
 
 UnpackResult transactionProtocolUnpackRequest(bitstream_t * bitstream, TransactionObject * transactionObject)
@@ -95,41 +79,17 @@ UnpackResult transactionProtocolUnpackRequest(bitstream_t * bitstream, Transacti
 	
 	bitstream_read_uint8(bitstream, &transactionObject->type); // Request type
 	
-	switch(transactionObject->type) {
-		case TransactionUserCreate: // user create 
-			unpackResult = transactionProtocolUnpackObjectUserCreate(bitstream, (TransactionObjectUserCreate *)transactionObject);
-			break;
-		case TransactionResourceCreate: // resource create 
-			unpackResult = transactionProtocolUnpackObjectResourceCreate(bitstream, (TransactionObjectResourceCreate *)transactionObject);
-			break;
-		case TransactionOnline: // online 
-			unpackResult = transactionProtocolUnpackObjectOnline(bitstream, (TransactionObjectOnline *)transactionObject);
-			break;
-		case TransactionOffline: // offline 
-			unpackResult = transactionProtocolUnpackObjectOffline(bitstream, (TransactionObjectOffline *)transactionObject);
-			break;
-		case TransactionPeerList: // peerlist 
-			unpackResult = transactionProtocolUnpackObjectPeerList(bitstream, (TransactionObjectPeerList *)transactionObject);
-			break;
-		case TransactionConnect: // connect 
-			unpackResult = transactionProtocolUnpackObjectConnect(bitstream, (TransactionObjectConnect *)transactionObject);
-			break;
-		case TransactionConnectAccept: // connect accept
-			unpackResult = transactionProtocolUnpackObjectConnectAccept(bitstream, (TransactionObjectConnectAccept *)transactionObject);
-			break;
-        case TransactionConnectRefuse: // connect refuse
-			unpackResult = transactionProtocolUnpackObjectConnectRefuse(bitstream, (TransactionObjectConnectRefuse *)transactionObject);
-			break;
-		case TransactionDisconnect: // disconnect
-			unpackResult = transactionProtocolUnpackObjectDisconnect(bitstream, (TransactionObjectDisconnect *)transactionObject);
-			break;
-		case TransactionEmpty: // test purposes only
-			unpackResult = UnpackValid;
-			break;
-		default:
-			unpackResult = UnpackUnexpected;
-			break;
-	}
+	const TransactionSchemaEntry * entry = &transactionProtocolSchema[transactionObject->type & 0xFF];
+	
+	if(entry->unpack)
+		unpackResult = entry->unpack(bitstream, transactionObject);
+	else if(transactionObject->type == TransactionEmpty) // test purposes only
+		unpackResult = UnpackValid;
+	else
+		unpackResult = UnpackUnexpected;
+	
+	if(unpackResult == UnpackValid && bitstream_error(bitstream)) // A field didn't fit, truncated request
+		unpackResult = UnpackInvalid;
 	
 	return unpackResult;
 }
@@ -249,201 +209,197 @@ UnpackResult transactionProtocolUnpackAttributeCount(bitstream_t * bitstream, un
 }
 
 #pragma mark -
-#pragma mark User
+#pragma mark Schema
 
-void transactionProtocolPackObjectUserCreate(bitstream_t * bitstream, TransactionObjectUserCreate * objectUserCreate)
+/*
+ * Field kinds, see transaction_schema.h
+ * Length: exact packed length (constant for fixed kinds), Min: shortest valid length, Write: unchecked (reserved), Read: checked
+ */
+#define kTransactionAttributeHeaderLength 2 // type and length
+#define mTransactionStringLength(string, capacity) strnlen(string, (capacity)-1) // Fits the receiver, including null terminating char
+
+#define mTransactionFieldLengthUInt64(object, member, argument) 8
+#define mTransactionFieldLengthString(object, member, argument) (kTransactionAttributeHeaderLength + 1 + mTransactionStringLength((object)->member, argument))
+#define mTransactionFieldLengthAddress(object, member, argument) (kTransactionAttributeHeaderLength + 6)
+#define mTransactionFieldLengthSeconds(object, member, argument) (kTransactionAttributeHeaderLength + kTransactionAttributeLengthSeconds)
+#define mTransactionFieldLengthBlob(object, member, argument) (1 + (object)->argument)
+#define mTransactionFieldLengthPeers(object, member, argument) transactionProtocolLengthPeers((object)->member, (object)->argument)
+
+#define kTransactionFieldMinUInt64 8
+#define kTransactionFieldMinString (kTransactionAttributeHeaderLength + 1)
+#define kTransactionFieldMinAddress (kTransactionAttributeHeaderLength + 6)
+#define kTransactionFieldMinSeconds (kTransactionAttributeHeaderLength + kTransactionAttributeLengthSeconds)
+#define kTransactionFieldMinBlob 1
+#define kTransactionFieldMinPeers (kTransactionAttributeHeaderLength + kTransactionAttributeLengthCount)
+
+#define mTransactionFieldWriteUInt64(writer, object, member, argument) bitstream_writer_uint64(writer, (object)->member)
+#define mTransactionFieldWriteString(writer, object, member, argument) transactionProtocolWriteString(writer, (object)->member, mTransactionStringLength((object)->member, argument))
+#define mTransactionFieldWriteAddress(writer, object, member, argument) transactionProtocolWriteAddress(writer, &(object)->member)
+#define mTransactionFieldWriteSeconds(writer, object, member, argument) transactionProtocolWriteSeconds(writer, (object)->member)
+#define mTransactionFieldWriteBlob(writer, object, member, argument) transactionProtocolWriteBlob(writer, (object)->member, (object)->argument)
+#define mTransactionFieldWritePeers(writer, object, member, argument) transactionProtocolWritePeers(writer, (object)->member, (object)->argument)
+
+#define mTransactionFieldReadUInt64(bitstream, object, member, argument) (bitstream_read_uint64(bitstream, &(object)->member), UnpackValid)
+#define mTransactionFieldReadString(bitstream, object, member, argument) transactionProtocolUnpackAttributeString(bitstream, (object)->member, argument)
+#define mTransactionFieldReadAddress(bitstream, object, member, argument) transactionProtocolUnpackAttributeAddress(bitstream, &(object)->member)
+#define mTransactionFieldReadSeconds(bitstream, object, member, argument) transactionProtocolUnpackAttributeSeconds(bitstream, &(object)->member)
+#define mTransactionFieldReadBlob(bitstream, object, member, argument) transactionProtocolReadBlob(bitstream, (object)->member, sizeof((object)->member), &(object)->argument)
+#define mTransactionFieldReadPeers(bitstream, object, member, argument) transactionProtocolReadPeers(bitstream, (object)->member, sizeof((object)->member) / sizeof((object)->member[0]), &(object)->argument)
+
+// Expansions of a schema field F(kind, member, argument)
+#define TRANSACTION_FIELD_LENGTH(kind, member, argument) + mTransactionFieldLength##kind(object, member, argument)
+#define TRANSACTION_FIELD_MIN(kind, member, argument) + kTransactionFieldMin##kind
+#define TRANSACTION_FIELD_WRITE(kind, member, argument) mTransactionFieldWrite##kind(writer, object, member, argument);
+#define TRANSACTION_FIELD_READ(kind, member, argument) if(mTransactionFieldRead##kind(bitstream, object, member, argument) != UnpackValid) unpackResult = UnpackInvalid;
+
+static void transactionProtocolWriteString(bitstream_writer_t * writer, const char * string, size_t length)
 {
-	bitstream_write_uint64(bitstream, objectUserCreate->uid); // huid_t
-	transactionProtocolPackAttributeString(bitstream, objectUserCreate->name); // name
-	transactionProtocolPackAttributeString(bitstream, objectUserCreate->email); // email
+	bitstream_writer_uint8(writer, TransactionAttributeTypeString); // string attribute type
+	bitstream_writer_uint8(writer, 2 + length); // string attribute length
+	bitstream_writer_uint8(writer, length); // string length
+	bitstream_writer_bytes(writer, (const uint8_t *)string, length); // string bytes
 }
 
-UnpackResult transactionProtocolUnpackObjectUserCreate(bitstream_t * bitstream, TransactionObjectUserCreate * objectUserCreate)
-{	
-	UnpackResult unpackResult = UnpackValid;
-	
-	bitstream_read_uint64(bitstream, &objectUserCreate->uid); // huid_t
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectUserCreate->name, kUniversalUserNameMaxLength); // name
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectUserCreate->email, kUniversalUserEmailMaxLength); // name
-	
-	return unpackResult;
-}
-
-#pragma mark -
-#pragma mark Resource
-
-void transactionProtocolPackObjectResourceCreate(bitstream_t * bitstream, TransactionObjectResourceCreate * resourceObject)
+static void transactionProtocolWriteAddress(bitstream_writer_t * writer, net_addr_t * address)
 {
-	bitstream_write_uint64(bitstream, resourceObject->rid); // huid_t
-	bitstream_write_uint64(bitstream, resourceObject->uid); // huid_t
-	bitstream_write_uint8(bitstream, resourceObject->length); // data length
-	bitstream_write_bytes(bitstream, resourceObject->data, resourceObject->length); // data bytes
+	bitstream_writer_uint8(writer, TransactionAttributeTypeAddress); // Address attribute type
+	bitstream_writer_uint8(writer, kTransactionAttributeLengthAddress); // Address attribute length = fixed
+	bitstream_writer_uint16_endian(writer, address->sin_port); // Address port
+	bitstream_writer_uint32_endian(writer, address->sin_addr.s_addr); // Address host
 }
 
-UnpackResult transactionProtocolUnpackObjectResourceCreate(bitstream_t * bitstream, TransactionObjectResourceCreate * resourceObject)
+static void transactionProtocolWriteSeconds(bitstream_writer_t * writer, time_t seconds)
 {
-	UnpackResult unpackResult = UnpackValid;
-	
-	bitstream_read_uint64(bitstream, &resourceObject->rid); // huid_t
-	bitstream_read_uint64(bitstream, &resourceObject->uid); // huid_t
-	bitstream_read_uint8(bitstream, &resourceObject->length); // data length
-	int read_length = bitstream_read_bytes(bitstream, resourceObject->data, resourceObject->length); // data bytes
-	
-	if(read_length != resourceObject->length)
-		unpackResult = UnpackInvalid;
-	
-	return unpackResult;
+	bitstream_writer_uint8(writer, TransactionAttributeTypeSeconds); // Expire time attribute type
+	bitstream_writer_uint8(writer, kTransactionAttributeLengthSeconds); // Expire time attribute length = 4 Bytes
+	bitstream_writer_uint32(writer, seconds);
 }
 
-#pragma mark -
-#pragma mark Online
-
-void transactionProtocolPackObjectOnline(bitstream_t * bitstream, TransactionObjectOnline * objectOnline)
-{
-	bitstream_write_uint64(bitstream, objectOnline->uid); // huid_t
-	transactionProtocolPackAttributeAddress(bitstream, &objectOnline->localAddress); // local address
-	transactionProtocolPackAttributeAddress(bitstream, &objectOnline->mappedAddress); // mapped address	
-	transactionProtocolPackAttributeSeconds(bitstream, objectOnline->expireSeconds); // expire Seconds
-}
-
-UnpackResult transactionProtocolUnpackObjectOnline(bitstream_t * bitstream, TransactionObjectOnline * objectOnline)
-{	
-	UnpackResult unpackResult = UnpackValid;
-	
-	bitstream_read_uint64(bitstream, &objectOnline->uid); // huid_t
-	//unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectOnline->peerId, kUniversalPeerIdMaxLength); // id 
-	unpackResult = transactionProtocolUnpackAttributeAddress(bitstream, &objectOnline->localAddress); // local address
-	unpackResult = transactionProtocolUnpackAttributeAddress(bitstream, &objectOnline->mappedAddress); // mapped address	
-	unpackResult = transactionProtocolUnpackAttributeSeconds(bitstream, &objectOnline->expireSeconds); // expire Seconds
-
-	return unpackResult;
-}
-
-#pragma mark -
-#pragma mark Offline
-
-void transactionProtocolPackObjectOffline(bitstream_t * bitstream, TransactionObjectOffline * objectOffline)
+static void transactionProtocolWriteBlob(bitstream_writer_t * writer, const uint8_t * data, unsigned int length)
 {
-	transactionProtocolPackAttributeString(bitstream, objectOffline->peerId); // id 
+	bitstream_writer_uint8(writer, length); // data length
+	bitstream_writer_bytes(writer, data, length); // data bytes
 }
 
-UnpackResult transactionProtocolUnpackObjectOffline(bitstream_t * bitstream, TransactionObjectOffline * objectOffline)
+static UnpackResult transactionProtocolReadBlob(bitstream_t * bitstream, uint8_t * data, size_t capacity, unsigned int * length)
 {
-	UnpackResult unpackResult = UnpackValid;
+	bitstream_read_uint8(bitstream, length); // data length
 	
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectOffline->peerId, kUniversalPeerIdMaxLength); // id 
-
-	return unpackResult;
-}
-
-#pragma mark -
-#pragma mark PeerList
-
-void transactionProtocolInitializeObjectPeerList(TransactionObjectPeerList * objectPeerList)
-{
-	objectPeerList->count = 0;
-}
-
-void transactionProtocolAddPeerToObjectPeerList(TransactionObjectPeerList * objectPeerList, TransactionObjectPeer * objectPeer)
-{
-	memcpy(&objectPeerList->list[objectPeerList->count], objectPeer, sizeof(TransactionObjectPeer));
-	++objectPeerList->count;
-}
-
-void transactionProtocolPackObjectPeerList(bitstream_t * bitstream, TransactionObjectPeerList * objectPeerList)
-{
-	transactionProtocolPackAttributeCount(bitstream, objectPeerList->count); // count 	
-	for(int i=0; i<objectPeerList->count; ++i)
+	if(*length > capacity || bitstream_read_bytes(bitstream, data, *length) != (int)*length) // Bounded by capacity
 	{
-		transactionProtocolPackAttributeString(bitstream, objectPeerList->list[i].peerId); // id 
-		transactionProtocolPackAttributeAddress(bitstream, &objectPeerList->list[i].localAddress); // local address
-		transactionProtocolPackAttributeAddress(bitstream, &objectPeerList->list[i].mappedAddress); // mapped address	
+		*length = 0;
+		return UnpackInvalid;
 	}
+	
+	return UnpackValid;
 }
 
-UnpackResult transactionProtocolUnpackObjectPeerList(bitstream_t * bitstream, TransactionObjectPeerList * objectPeerList)
+// Peer, one entry of Peers
+static size_t transactionProtocolLengthPeer(TransactionObjectPeer * object)
 {
-	UnpackResult unpackResult = UnpackValid;
-	
-	unpackResult = transactionProtocolUnpackAttributeCount(bitstream, &objectPeerList->count); // count 
-	for(int i=0; i<objectPeerList->count; ++i)
-	{
-		unpackResult = transactionProtocolUnpackAttributeString(bitstream, objectPeerList->list[i].peerId, kUniversalPeerIdMaxLength); // id 
-		unpackResult = transactionProtocolUnpackAttributeAddress(bitstream, &objectPeerList->list[i].localAddress); // local address
-		unpackResult = transactionProtocolUnpackAttributeAddress(bitstream, &objectPeerList->list[i].mappedAddress); // mapped address	
-	}
-	
-	return unpackResult;
+	return 0 TRANSACTION_SCHEMA_PEER(TRANSACTION_FIELD_LENGTH);
 }
 
-#pragma mark -
-#pragma mark Connect
-
-void transactionProtocolPackObjectConnect(bitstream_t * bitstream, TransactionObjectConnect * objectConnect)
+static void transactionProtocolWritePeer(bitstream_writer_t * writer, TransactionObjectPeer * object)
 {
-	transactionProtocolPackAttributeString(bitstream, objectConnect->peerId); // id 
-    transactionProtocolPackAttributeAddress(bitstream, &objectConnect->streamAddress); // stream address
+	TRANSACTION_SCHEMA_PEER(TRANSACTION_FIELD_WRITE)
 }
 
-UnpackResult transactionProtocolUnpackObjectConnect(bitstream_t * bitstream, TransactionObjectConnect * objectConnect)
+static UnpackResult transactionProtocolReadPeer(bitstream_t * bitstream, TransactionObjectPeer * object)
 {
 	UnpackResult unpackResult = UnpackValid;
-	
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectConnect->peerId, kUniversalPeerIdMaxLength); // id 
- 	unpackResult = transactionProtocolUnpackAttributeAddress(bitstream, &objectConnect->streamAddress); // stream address
-	
+	TRANSACTION_SCHEMA_PEER(TRANSACTION_FIELD_READ)
 	return unpackResult;
 }
 
-#pragma mark -
-#pragma mark ConnectAccept
-
-void transactionProtocolPackObjectConnectAccept(bitstream_t * bitstream, TransactionObjectConnectAccept * objectConnectAccept)
+static size_t transactionProtocolLengthPeers(TransactionObjectPeer * list, unsigned int count)
 {
-	transactionProtocolPackAttributeString(bitstream, objectConnectAccept->peerId); // id 
-    transactionProtocolPackAttributeAddress(bitstream, &objectConnectAccept->streamAddress); // stream address
+	size_t length = kTransactionAttributeHeaderLength + kTransactionAttributeLengthCount;
+	for(unsigned int i=0; i<count; ++i)
+		length += transactionProtocolLengthPeer(&list[i]);
+	return length;
 }
 
-UnpackResult transactionProtocolUnpackObjectConnectAccept(bitstream_t * bitstream, TransactionObjectConnectAccept * objectConnectAccept)
+static void transactionProtocolWritePeers(bitstream_writer_t * writer, TransactionObjectPeer * list, unsigned int count)
 {
-	UnpackResult unpackResult = UnpackValid;
+	bitstream_writer_uint8(writer, TransactionAttributeTypeCount); // Count attribute type
+	bitstream_writer_uint8(writer, kTransactionAttributeLengthCount); // Count attribute length = 2 Bytes
+	bitstream_writer_uint16(writer, count);
 	
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectConnectAccept->peerId, kUniversalPeerIdMaxLength); // id 
-    unpackResult = transactionProtocolUnpackAttributeAddress(bitstream, &objectConnectAccept->streamAddress); // stream address
-
-	return unpackResult;
-}
-
-#pragma mark -
-#pragma mark ConnectRefuse
-
-void transactionProtocolPackObjectConnectRefuse(bitstream_t * bitstream, TransactionObjectConnectRefuse * objectConnectRefuse)
-{
-	transactionProtocolPackAttributeString(bitstream, objectConnectRefuse->peerId); // id 
+	for(unsigned int i=0; i<count; ++i)
+		transactionProtocolWritePeer(writer, &list[i]);
 }
 
-UnpackResult transactionProtocolUnpackObjectConnectRefuse(bitstream_t * bitstream, TransactionObjectConnectRefuse * objectConnectRefuse)
+static UnpackResult transactionProtocolReadPeers(bitstream_t * bitstream, TransactionObjectPeer * list, unsigned int capacity, unsigned int * count)
 {
+	if(transactionProtocolUnpackAttributeCount(bitstream, count) != UnpackValid || *count > capacity)
+	{
+		*count = 0;
+		return UnpackInvalid;
+	}
+	
 	UnpackResult unpackResult = UnpackValid;
+	for(unsigned int i=0; i<*count; ++i)
+	{
+		if(transactionProtocolReadPeer(bitstream, &list[i]) != UnpackValid)
+			unpackResult = UnpackInvalid;
+	}
 	
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectConnectRefuse->peerId, kUniversalPeerIdMaxLength); // id 
-    
 	return unpackResult;
 }
 
+/*
+ * Per object: public pack/unpack and table entries
+ * Pack does a single bounds check for the whole object, unpack rejects anything shorter than the schema minimum up front
+ */
+#define TRANSACTION_OBJECT_FUNCTIONS(requestType, name, schema) \
+void transactionProtocolPackObject##name(bitstream_t * bitstream, TransactionObject##name * object) \
+{ \
+	bitstream_writer_t reserved, * writer = &reserved; \
+	if(!bitstream_reserve(bitstream, writer, 0 schema(TRANSACTION_FIELD_LENGTH))) \
+		return; \
+	schema(TRANSACTION_FIELD_WRITE) \
+	bitstream_commit(bitstream, writer); \
+} \
+\
+UnpackResult transactionProtocolUnpackObject##name(bitstream_t * bitstream, TransactionObject##name * object) \
+{ \
+	bitstream_reader_t minimum; /* Only checked, fields are read from bitstream */ \
+	if(!bitstream_require(bitstream, &minimum, 0 schema(TRANSACTION_FIELD_MIN))) \
+		return UnpackInvalid; \
+	UnpackResult unpackResult = UnpackValid; \
+	schema(TRANSACTION_FIELD_READ) \
+	return unpackResult; \
+} \
+\
+static void transactionProtocolPackEntry##name(bitstream_t * bitstream, TransactionObject * object) \
+{ \
+	transactionProtocolPackObject##name(bitstream, (TransactionObject##name *)object); \
+} \
+\
+static UnpackResult transactionProtocolUnpackEntry##name(bitstream_t * bitstream, TransactionObject * object) \
+{ \
+	return transactionProtocolUnpackObject##name(bitstream, (TransactionObject##name *)object); \
+}
+
+TRANSACTION_SCHEMA(TRANSACTION_OBJECT_FUNCTIONS)
+
+#define TRANSACTION_OBJECT_ENTRY(requestType, name, schema) [requestType] = { transactionProtocolPackEntry##name, transactionProtocolUnpackEntry##name },
+
+static const TransactionSchemaEntry transactionProtocolSchema[256] = {
+	TRANSACTION_SCHEMA(TRANSACTION_OBJECT_ENTRY)
+};
+
 #pragma mark -
-#pragma mark Disconnect
+#pragma mark PeerList
 
-void transactionProtocolPackObjectDisconnect(bitstream_t * bitstream, TransactionObjectDisconnect * objectDisconnect)
+void transactionProtocolInitializeObjectPeerList(TransactionObjectPeerList * objectPeerList)
 {
-	transactionProtocolPackAttributeString(bitstream, objectDisconnect->peerId); // id 
+	objectPeerList->count = 0;
 }
 
-UnpackResult transactionProtocolUnpackObjectDisconnect(bitstream_t * bitstream, TransactionObjectDisconnect * objectDisconnect)
+void transactionProtocolAddPeerToObjectPeerList(TransactionObjectPeerList * objectPeerList, TransactionObjectPeer * objectPeer)
 {
-	UnpackResult unpackResult = UnpackValid;
-	
-	unpackResult = transactionProtocolUnpackAttributeString(bitstream, (char *)&objectDisconnect->peerId, kUniversalPeerIdMaxLength); // id 
-    
-	return unpackResult;
+	memcpy(&objectPeerList->list[objectPeerList->count], objectPeer, sizeof(TransactionObjectPeer));
+	++objectPeerList->count;
 }
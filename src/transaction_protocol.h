@@ -152,15 +152,19 @@ typedef enum {
  * be any of the derived TransactionObject structs bellow.
  *
  * Pack/Unpack: TransactionRequestType
+ *
+ * Sizes follow the transaction socket packet size class, not kNetPacketMaxLen. A request that doesn't fit
+ * the packet is not packed (transactionProtocolPackRequest returns false).
  */
-#define kTransactionProtocolObjectMaxSize (kProtocolMaxLength-4)
+#define kTransactionPacketLen kNetPacketDefaultLen // Transaction socket packet size class
+#define kTransactionProtocolObjectMaxSize (kTransactionPacketLen-kProtocolHeaderLength-4)
 
 typedef struct {
 	TransactionRequestType type;
 	char data[kTransactionProtocolObjectMaxSize];
 } TransactionObject;
 
-void transactionProtocolPackRequest(bitstream_t * bitstream, TransactionObject *);
+bool transactionProtocolPackRequest(bitstream_t * bitstream, TransactionObject *); // False if the object doesn't fit, bitstream error is set
 UnpackResult transactionProtocolUnpackRequest(bitstream_t * bitstream, TransactionObject *);
 
 #define kUniversalUserNameMaxLength 40 // WEAK
@@ -0,0 +1,85 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* transaction_schema.h
+* universal-network-c
+*/
+
+#ifndef __universal_network_transaction_schema_h__
+#define __universal_network_transaction_schema_h__
+
+/*!
+ * @header
+ *
+ * Declarative layout of every TransactionObject body, expanded by transaction_protocol.c into
+ * pack/unpack functions and the request dispatch table (X-macros).
+ *
+ * Each object schema lists its fields in wire order as F(kind, member, argument):
+ *   UInt64   8 Bytes, big-endian                                    argument unused
+ *   String   String attribute (type, length, string)                argument is the member capacity
+ *   Address  Address attribute (type, length, port, host), 8 Bytes  argument unused
+ *   Seconds  Seconds attribute (type, length, uint32), 6 Bytes      argument unused
+ *   Blob     Length (1 Byte) and bytes                              argument is the length member
+ *   Peers    Count attribute and TRANSACTION_SCHEMA_PEER per peer   argument is the count member
+ *
+ * Adding a request type: declare its TransactionObject struct and the public pack/unpack prototypes in
+ * transaction_protocol.h, then add a schema below and an entry in TRANSACTION_SCHEMA.
+ */
+
+#define TRANSACTION_SCHEMA_USER_CREATE(F) \
+	F(UInt64, uid, 0) \
+	F(String, name, kUniversalUserNameMaxLength) \
+	F(String, email, kUniversalUserEmailMaxLength)
+
+#define TRANSACTION_SCHEMA_RESOURCE_CREATE(F) \
+	F(UInt64, rid, 0) \
+	F(UInt64, uid, 0) \
+	F(Blob, data, length)
+
+#define TRANSACTION_SCHEMA_ONLINE(F) \
+	F(UInt64, uid, 0) \
+	F(Address, localAddress, 0) \
+	F(Address, mappedAddress, 0) \
+	F(Seconds, expireSeconds, 0)
+
+#define TRANSACTION_SCHEMA_OFFLINE(F) \
+	F(String, peerId, kUniversalPeerIdMaxLength)
+
+#define TRANSACTION_SCHEMA_PEER(F) \
+	F(String, peerId, kUniversalPeerIdMaxLength) \
+	F(Address, localAddress, 0) \
+	F(Address, mappedAddress, 0)
+
+#define TRANSACTION_SCHEMA_PEER_LIST(F) \
+	F(Peers, list, count)
+
+#define TRANSACTION_SCHEMA_CONNECT(F) \
+	F(String, peerId, kUniversalPeerIdMaxLength) \
+	F(Address, streamAddress, 0)
+
+#define TRANSACTION_SCHEMA_CONNECT_ACCEPT(F) \
+	F(String, peerId, kUniversalPeerIdMaxLength) \
+	F(Address, streamAddress, 0)
+
+#define TRANSACTION_SCHEMA_CONNECT_REFUSE(F) \
+	F(String, peerId, kUniversalPeerIdMaxLength)
+
+#define TRANSACTION_SCHEMA_DISCONNECT(F) \
+	F(String, peerId, kUniversalPeerIdMaxLength)
+
+/*
+ * O(request type, object name, schema), object struct is TransactionObject<name>
+ */
+#define TRANSACTION_SCHEMA(O) \
+	O(TransactionUserCreate, UserCreate, TRANSACTION_SCHEMA_USER_CREATE) \
+	O(TransactionResourceCreate, ResourceCreate, TRANSACTION_SCHEMA_RESOURCE_CREATE) \
+	O(TransactionOnline, Online, TRANSACTION_SCHEMA_ONLINE) \
+	O(TransactionOffline, Offline, TRANSACTION_SCHEMA_OFFLINE) \
+	O(TransactionPeerList, PeerList, TRANSACTION_SCHEMA_PEER_LIST) \
+	O(TransactionConnect, Connect, TRANSACTION_SCHEMA_CONNECT) \
+	O(TransactionConnectAccept, ConnectAccept, TRANSACTION_SCHEMA_CONNECT_ACCEPT) \
+	O(TransactionConnectRefuse, ConnectRefuse, TRANSACTION_SCHEMA_CONNECT_REFUSE) \
+	O(TransactionDisconnect, Disconnect, TRANSACTION_SCHEMA_DISCONNECT)
+
+#endif
@@ -0,0 +1,170 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* bench_bitstream.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "bitstream.h"
+#include "net_time.h"
+
+#define kBenchBitstreamBufferLength 1400 // One packet
+#define kBenchBitstreamBytes (256 * 1024 * 1024) // Per operation
+
+static uint8_t bench_buffer[kBenchBitstreamBufferLength];
+static uint8_t bench_block[kBenchBitstreamBufferLength];
+static volatile uint64_t bench_sink; // Keeps reads from being optimized out
+
+#define LOG_BENCH(name, start, bytes) printf("%-24s %10.1f MB/s\n", name, (double)(bytes) / (1024.0 * 1024.0) / mNetTimeToSeconds(net_time_now() - (start)))
+
+static void bench_integers(const char * name, size_t size)
+{
+	size_t count = kBenchBitstreamBufferLength / size;
+	size_t rounds = kBenchBitstreamBytes / (count * size);
+	
+	bitstream_t bitstream = bitstream_create(bench_buffer, kBenchBitstreamBufferLength);
+	
+	net_time_t start = net_time_now();
+	for(size_t r=0; r<rounds; ++r)
+	{
+		bitstream_reset(&bitstream);
+		for(size_t i=0; i<count; ++i)
+		{
+			switch(size)
+			{
+				case 2: bitstream_write_uint16(&bitstream, (unsigned int)(r + i)); break;
+				case 4: bitstream_write_uint32(&bitstream, (unsigned int)(r + i)); break;
+				default: bitstream_write_uint64(&bitstream, (uint64_t)(r + i)); break;
+			}
+		}
+	}
+	LOG_BENCH(name, start, rounds * count * size);
+}
+
+static void bench_integers_read(const char * name, size_t size)
+{
+	size_t count = kBenchBitstreamBufferLength / size;
+	size_t rounds = kBenchBitstreamBytes / (count * size);
+	uint64_t sum = 0;
+	
+	bitstream_t bitstream = bitstream_create(bench_buffer, kBenchBitstreamBufferLength);
+	
+	net_time_t start = net_time_now();
+	for(size_t r=0; r<rounds; ++r)
+	{
+		bitstream_reset(&bitstream);
+		for(size_t i=0; i<count; ++i)
+		{
+			unsigned int value32;
+			uint64_t value64;
+			switch(size)
+			{
+				case 2: bitstream_read_uint16(&bitstream, &value32); sum += value32; break;
+				case 4: bitstream_read_uint32(&bitstream, &value32); sum += value32; break;
+				default: bitstream_read_uint64(&bitstream, &value64); sum += value64; break;
+			}
+		}
+	}
+	LOG_BENCH(name, start, rounds * count * size);
+	
+	bench_sink = sum;
+}
+
+static void bench_bytes(const char * name, size_t length, bool raw, bool read)
+{
+	size_t count = kBenchBitstreamBufferLength / length;
+	size_t rounds = kBenchBitstreamBytes / (count * length);
+	
+	bitstream_t bitstream = bitstream_create(bench_buffer, kBenchBitstreamBufferLength);
+	
+	net_time_t start = net_time_now();
+	for(size_t r=0; r<rounds; ++r)
+	{
+		bitstream_reset(&bitstream);
+		for(size_t i=0; i<count; ++i)
+		{
+			if(read)
+				raw ? bitstream_read_raw(&bitstream, bench_block, length) : bitstream_read_bytes(&bitstream, bench_block, length);
+			else
+				raw ? bitstream_write_raw(&bitstream, bench_block, length) : bitstream_write_bytes(&bitstream, bench_block, length);
+		}
+	}
+	LOG_BENCH(name, start, rounds * count * length);
+	
+	bench_sink = bench_block[0] + bench_buffer[0];
+}
+
+static void bench_varints(const char * name, uint64_t max, int mode) // 0 write, 1 read, 2 batch read
+{
+	uint64_t values[kBenchBitstreamBufferLength];
+	size_t count = 0;
+	
+	bitstream_t bitstream = bitstream_create(bench_buffer, kBenchBitstreamBufferLength);
+	for(uint64_t seed = 88172645463325252ULL; bitstream_write_varint(&bitstream, seed % max) > 0; ++count)
+		seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+	size_t length = bitstream.offset;
+	size_t rounds = kBenchBitstreamBytes / length;
+	
+	bitstream = bitstream_create(bench_buffer, length);
+	
+	net_time_t start = net_time_now();
+	for(size_t r=0; r<rounds; ++r)
+	{
+		bitstream_reset(&bitstream);
+		if(mode == 2)
+		{
+			bitstream_read_varints(&bitstream, values, count);
+		}
+		else
+		{
+			for(size_t i=0; i<count; ++i)
+			{
+				if(mode == 1)
+					bitstream_read_varint(&bitstream, &values[i]);
+				else
+					bitstream_write_varint(&bitstream, (uint64_t)(r + i) % max);
+			}
+		}
+	}
+	LOG_BENCH(name, start, rounds * length);
+	
+	bench_sink = values[0];
+}
+
+int main(void)
+{
+	LOG_SUITE_START("bitstream throughput");
+	
+	for(int i=0; i<kBenchBitstreamBufferLength; ++i)
+		bench_block[i] = (uint8_t)i;
+	
+	bench_integers("write_uint16", 2);
+	bench_integers("write_uint32", 4);
+	bench_integers("write_uint64", 8);
+	bench_integers_read("read_uint16", 2);
+	bench_integers_read("read_uint32", 4);
+	bench_integers_read("read_uint64", 8);
+	
+	bench_bytes("write_bytes 16", 16, false, false);
+	bench_bytes("write_bytes 100", 100, false, false);
+	bench_bytes("write_bytes 1400", 1400, false, false);
+	bench_bytes("read_bytes 16", 16, false, true);
+	bench_bytes("read_bytes 100", 100, false, true);
+	bench_bytes("read_bytes 1400", 1400, false, true);
+	
+	bench_bytes("write_raw 100", 100, true, false);
+	bench_bytes("write_raw 1400", 1400, true, false);
+	bench_bytes("read_raw 100", 100, true, true);
+	bench_bytes("read_raw 1400", 1400, true, true);
+	
+	bench_varints("write_varint < 128", 128, 0);
+	bench_varints("read_varint < 128", 128, 1);
+	bench_varints("read_varints < 128", 128, 2);
+	bench_varints("write_varint < 2^32", 1ULL << 32, 0);
+	bench_varints("read_varint < 2^32", 1ULL << 32, 1);
+	bench_varints("read_varints < 2^32", 1ULL << 32, 2);
+	
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* bench_stun_server.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "stun_protocol.h"
+#include "stun_utils.h"
+#include "stun_server.h"
+#include "net_time.h"
+
+#include <sched.h>
+
+#define kBenchStunServerRequests 200000 // Per run
+#define kBenchStunServerWindow 32 // Requests sent at once, then waited for (fits the socket packet pool)
+#define kBenchStunServerTimeout (100 * kNetTimeMillisecond) // Responses of a window still missing are counted as lost
+
+static const char * benchStunServerHostname = "127.0.0.1";
+static const char * benchStunServerOtherHostname = "127.0.0.2"; // Second loopback address
+
+static volatile int bench_responses = 0;
+
+static void bench_stun_server(const char * name, stun_server_t server, net_socket_t socket, bool doChangeHost, bool doChangePort)
+{
+	net_addr_t serverAddr;
+	stunServerAddr(server, false, false, &serverAddr);
+
+	StunTransactionId transactionId;
+	stunGenerateTransactionId(&transactionId);
+
+	net_packet_t packets[kBenchStunServerWindow];
+	unsigned int sent = 0;
+	unsigned int lost = 0; // Missing when a window timed out
+	bench_responses = 0;
+
+	net_time_t start = net_time_now();
+	while(sent < kBenchStunServerRequests)
+	{
+		unsigned int count = 0;
+		for(; count<kBenchStunServerWindow && sent+count<kBenchStunServerRequests; ++count)
+		{
+			packets[count] = net_packet_alloc(socket);
+			assert(packets[count]);
+			net_addr_copy(&packets[count]->addr, &serverAddr);
+			stunProtocolPackBindingChangeRequest(&packets[count]->bitstream, transactionId, doChangeHost, doChangePort);
+		}
+
+		net_socket_send_batch(socket, packets, count);
+		for(unsigned int i=0; i<count; ++i)
+			net_packet_release(socket, packets[i]);
+		sent += count;
+
+		// Wait for the window, late responses of lost ones are still counted
+		net_time_t windowStart = net_time_now();
+		while(bench_responses + lost < sent)
+		{
+			if(net_time_now() - windowStart > kBenchStunServerTimeout)
+			{
+				lost = sent - bench_responses;
+				break;
+			}
+			sched_yield();
+		}
+	}
+
+	net_time_t elapsed = net_time_now() - start;
+	printf("%-24s %10.0f requests/s, %u lost\n", name, (double)bench_responses / mNetTimeToSeconds(elapsed), sent - bench_responses);
+}
+
+int main(void)
+{
+	LOG_SUITE_START("stun server throughput");
+
+	NetError netError;
+	stun_server_t server = stunServerCreate(&netError, benchStunServerHostname, benchStunServerOtherHostname, 0, 0);
+	if(!server) // Darwin: sudo ifconfig lo0 alias 127.0.0.2 up
+	{
+		printf("Can't bind STUN server other address %s\n", benchStunServerOtherHostname);
+		return 0;
+	}
+
+	net_socket_t socket = net_socket_create(&netError, AF_INET, benchStunServerHostname, 0);
+	assert(netError == NetNoError);
+
+	net_socket_set_receive_inline(socket, true);
+	net_socket_receive_block_t receiveBlock = Block_copy(^(net_packet_t packet) {
+		__sync_add_and_fetch(&bench_responses, 1);
+		net_packet_release(socket, packet);
+	});
+	net_socket_set_receive_block(socket, receiveBlock);
+
+	bench_stun_server("binding", server, socket, false, false);
+	bench_stun_server("binding change port", server, socket, false, true);
+	bench_stun_server("binding change host", server, socket, true, false);
+
+	net_socket_destroy(socket);
+	stunServerDestroy(server);
+	Block_release(receiveBlock);
+
+	return 0;
+}
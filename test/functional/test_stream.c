@@ -159,6 +159,84 @@ static void test_stream_add_remove()
 	LOG_TEST_END;
 }
 
+#pragma mark -
+#pragma mark Shards
+
+#define kTestStreamShards 4
+#define kTestStreamShardsStreams 400 // Tables grow past kStreamShardTableCapacity
+
+void test_stream_shards_update(void * context, StreamObject * object) {/* empty */ }
+void test_stream_shards_receive(void * context, net_addr_t * address, StreamObject * object) {/* empty */ }
+void test_stream_shards_timeout(void * context, net_addr_t * address) {/* empty */ }
+
+void test_stream_shards_suspend(void * context)
+{
+	bool * didSuspend = (bool *)context;
+	*didSuspend = true;
+}
+
+static void test_stream_shards()
+{
+	LOG_TEST_START;
+	
+	bool didSuspend = false; // must be true
+	
+	// Setup stream
+	StreamConfiguration configuration;
+	assert(streamSetupShards(&configuration, 0, kStreamShardMax + 1, &didSuspend, test_stream_shards_update, test_stream_shards_receive, test_stream_shards_timeout, test_stream_shards_suspend) == NetInvalidError);
+	NetError streamError = streamSetupShards(&configuration, 0, kTestStreamShards, &didSuspend, test_stream_shards_update, test_stream_shards_receive, test_stream_shards_timeout, test_stream_shards_suspend);
+	assert(!streamError);
+	
+	// Add, twice
+	net_addr_t addresses[kTestStreamShardsStreams];
+	for(int i=0; i<kTestStreamShardsStreams; ++i)
+	{
+		net_addr_set(&addresses[i], INADDR_LOOPBACK, 30000 + i, true);
+		streamAdd(&configuration, &addresses[i]);
+		streamAdd(&configuration, &addresses[i]);
+	}
+	
+	// Wait
+	sleep(1);
+	
+	// Check every shard owns some, each stream found in its own shard
+	assert(configuration.streamCount == kTestStreamShardsStreams);
+	unsigned int count = 0;
+	for(int i=0; i<kTestStreamShards; ++i)
+	{
+		assert(configuration.shards[i].count > 0);
+		assert(configuration.shards[i].active == true);
+		count += configuration.shards[i].count;
+	}
+	assert(count == kTestStreamShardsStreams);
+	
+	for(int i=0; i<kTestStreamShardsStreams; ++i)
+	{
+		StreamShard * shard = streamShardForAddress(&configuration, &addresses[i]);
+		Stream * stream = streamShardFind(shard, &addresses[i]);
+		assert(stream != NULL);
+		assert(stream->shard == shard->index);
+		assert(streamDoesExist(&configuration, &addresses[i]) == true);
+	}
+	
+	// Remove
+	for(int i=0; i<kTestStreamShardsStreams; ++i)
+		streamRemove(&configuration, &addresses[i]);
+	
+	// Wait
+	sleep(1);
+	
+	// Check all shards suspended
+	assert(streamListIsEmpty(&configuration) == true);
+	assert(didSuspend == true);
+	for(int i=0; i<kTestStreamShards; ++i)
+		assert(configuration.shards[i].active == false);
+	
+	streamTeardown(&configuration);
+	
+	LOG_TEST_END;
+}
+
 #pragma mark -
 #pragma mark Timeout
 
@@ -279,14 +357,16 @@ static void test_stream_update()
 		Sequence sequence;
 		Ack ack;
 		AckBitField ackBitField;
+		StreamHeaderOptions options;
 		StreamObject object;
 		streamObjectSetup(&object);
-		streamProtocolUnpackHeader(&packet->bitstream, &sequence, &ack, &ackBitField);
+		streamProtocolUnpackHeader(&packet->bitstream, &sequence, &ack, &ackBitField, &options);
 		streamProtocolUnpackData(&packet->bitstream, &object);
 		
 		assert(sequence == 0);
 		assert(ack == 0);
 		assert(ackBitField == 0);
+		assert(options.flags == (StreamHeaderFlagTimestamp | StreamHeaderFlagAckExtended)); // Nothing received yet to echo, SACK not negotiated
 		
 		assert(object.length == strlen(test_stream_update_string));
 		
@@ -326,6 +406,7 @@ int main(void)
 	test_stream();
 	//test_stream_list();
 	test_stream_add_remove();
+	test_stream_shards();
 	test_stream_timeout();
 	test_stream_update();
 	
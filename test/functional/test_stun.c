@@ -10,6 +10,21 @@
 #include "stun_utils.h"
 #include "stun_protocol.h"
 #include "stun.h"
+#include "stun_server.h"
+
+// Local STUN server, other address on a second loopback address (Darwin: sudo ifconfig lo0 alias 127.0.0.2 up)
+static const char * testStunServerHostname = "127.0.0.1";
+static const char * testStunServerOtherHostname = "127.0.0.2";
+static stun_server_t testStunServer;
+static unsigned short testStunServerPort;
+
+static stun_t test_stun_create(net_socket_t socket, StunDidResolve clientDidResolve, StunDidFailResolve clientDidFailResolve)
+{
+	stun_t stun = stunCreate(socket, testStunServerHostname, clientDidResolve, clientDidFailResolve);
+	if(stun)
+		stunSetServerPort(stun, testStunServerPort);
+	return stun;
+}
 
 static void test_stun_utils()
 {
@@ -118,7 +133,6 @@ static void test_stun_client1()
 	NetError netError;
 	net_socket_t socket = net_socket_create(&netError, AF_INET, 0, 0);
 	
-	const char * testStunServerHostname = "universal.laugga.com";
 	// const unsigned short testStunServerPort = kStunServerDefaultPort;
 	// 
 	// net_addr_t testStunServerAddr;
@@ -156,7 +170,7 @@ static void test_stun_client1()
 	StunDidFailResolve clientDidFailResolve = ^(stun_t c) {
 	};
 	
-	stun_t stun = stunCreate(socket, testStunServerHostname, clientDidResolve, clientDidFailResolve);
+	stun_t stun = test_stun_create(socket, clientDidResolve, clientDidFailResolve);
 	
 	stunResolve(stun);
 	
@@ -254,8 +268,7 @@ static void test_socket_stun()
 	StunDidFailResolve clientDidFailResolve = ^(stun_t c) {
 		stunDestroy(c);
 	};
-	const char * testStunServerHostname = "universal.laugga.com";
-	stun_t stun = stunCreate(test_receiveSocket, testStunServerHostname, clientDidResolve, clientDidFailResolve);
+	stun_t stun = test_stun_create(test_receiveSocket, clientDidResolve, clientDidFailResolve);
 	assert(stun);
 	stunResolve(stun);
 	
@@ -357,8 +370,7 @@ static void test_socket_stun_forward()
 	StunDidFailResolve clientDidFailResolve = ^(stun_t c) {
 		stunDestroy(c);
 	};
-	const char * testStunServerHostname = "universal.laugga.com";
-	stun_t stun = stunCreate(forward_test_receiveSocket, testStunServerHostname, clientDidResolve, clientDidFailResolve);
+	stun_t stun = test_stun_create(forward_test_receiveSocket, clientDidResolve, clientDidFailResolve);
 	assert(stun);
 	stunResolve(stun);
 	
@@ -420,6 +432,19 @@ int main(void)
 		
 	test_stun_utils();
 	test_stun_protocol();
+	
+	NetError netError;
+	testStunServer = stunServerCreate(&netError, testStunServerHostname, testStunServerOtherHostname, 0, 0);
+	if(!testStunServer) // No second loopback address, every client test needs the server's other address
+	{
+		printf("Can't bind STUN server other address %s, skipping client tests\n", testStunServerOtherHostname);
+		return 0;
+	}
+	assert(netError == NetNoError);
+	net_addr_t testStunServerAddr;
+	stunServerAddr(testStunServer, false, false, &testStunServerAddr);
+	testStunServerPort = ntohs(testStunServerAddr.sin_port);
+	
 	//test_stun_test();
 	test_stun_client1();
 	//test_stun_client2();
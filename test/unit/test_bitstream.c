@@ -8,6 +8,7 @@
 
 #include "test.h"
 #include "bitstream.h"
+#include <math.h>
 
 void test_bytes()
 {
@@ -33,6 +34,65 @@ void test_bytes()
 	LOG_TEST_END;
 }
 
+void test_bytes_lengths()
+{
+	const size_t data_length = 100; // Covers 32/16/8 byte blocks and remainder
+	
+	uint8_t data[data_length];
+	uint8_t write_bytes[data_length];
+	uint8_t read_bytes[data_length];
+	
+	for(int i=0; i<data_length; ++i)
+		write_bytes[i] = i;
+	
+	for(size_t length=0; length<=data_length; ++length)
+	{
+		memset(read_bytes, 0, data_length);
+		
+		bitstream_t bitstream = bitstream_create(data, data_length);
+		assert(bitstream_write_bytes(&bitstream, write_bytes, length) == length);
+		bitstream_reset(&bitstream);
+		assert(bitstream_read_bytes(&bitstream, read_bytes, length) == length);
+		
+		assert(memcmp(write_bytes, read_bytes, length) == 0);
+		
+#ifdef __LITTLE_ENDIAN__
+		for(size_t b=0; b<length; ++b)
+			assert(data[b] == write_bytes[length-b-1]); // Reversed in stream
+#endif
+	}
+	
+	// Raw, same bytes in stream
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	assert(bitstream_write_raw(&bitstream, write_bytes, data_length) == data_length);
+	assert(bitstream_write_raw(&bitstream, write_bytes, 1) == 0); // Doesn't fit
+	assert(memcmp(data, write_bytes, data_length) == 0);
+
+	LOG_TEST_END;
+}
+
+void test_byte_order()
+{
+	const size_t data_length = 14;
+	const uint8_t expected[] = { 0x12, 0x34, 0x12, 0x34, 0x56, 0x78, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef };
+	
+	uint8_t data[data_length];
+	
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	bitstream_write_uint16(&bitstream, 0x1234);
+	bitstream_write_uint32(&bitstream, 0x12345678);
+	bitstream_write_uint64(&bitstream, 0x0123456789abcdefULL);
+	
+	assert(bitstream.offset == data_length);
+	assert(memcmp(data, expected, data_length) == 0); // Big-endian
+	
+	bitstream_reset(&bitstream);
+	bitstream_write_uint32_endian(&bitstream, 0x12345678);
+	assert(data[0] == 0x78 && data[3] == 0x12); // Little-endian
+	
+	LOG_TEST_END;
+}
+
 static void test_uint8()
 {
 	LOG_TEST_START;
@@ -259,6 +319,256 @@ void test_float32()
 	LOG_TEST_END;
 }
 
+void test_bits()
+{
+	const size_t data_length = 16;
+	
+	uint8_t data[data_length];
+	memset(data, 0xff, data_length);
+	
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	// 1+3+5+32+7+13 = 61 bits, 8 bytes
+	assert(bitstream_write_bool(&bitstream, 1) == 1);
+	assert(bitstream_write_bits(&bitstream, 0x5, 3) == 3);
+	assert(bitstream_write_bits(&bitstream, 0xffffff13, 5) == 5); // Only lowest bits
+	assert(bitstream_write_bits(&bitstream, 0xdeadbeef, 32) == 32);
+	assert(bitstream_write_bits(&bitstream, 0x7f, 7) == 7);
+	assert(bitstream_write_bits(&bitstream, 0x1234, 13) == 13);
+	bitstream_flush_bits(&bitstream);
+	assert(bitstream.offset == 8);
+	assert(data[0] == 0xd9); // 1 101 1001...
+	assert((data[7] & 0x7) == 0); // Padding
+	
+	bitstream_write_uint8(&bitstream, 0xab); // Byte aligned after flush
+	
+	bitstream_reset(&bitstream);
+	
+	int flag = 0;
+	uint32_t value = 0;
+	assert(bitstream_read_bool(&bitstream, &flag) == 1 && flag == 1);
+	assert(bitstream_read_bits(&bitstream, &value, 3) == 3 && value == 0x5);
+	assert(bitstream_read_bits(&bitstream, &value, 5) == 5 && value == 0x13);
+	assert(bitstream_read_bits(&bitstream, &value, 32) == 32 && value == 0xdeadbeef);
+	assert(bitstream_read_bits(&bitstream, &value, 7) == 7 && value == 0x7f);
+	assert(bitstream_read_bits(&bitstream, &value, 13) == 13 && value == 0x1234);
+	bitstream_align_bits(&bitstream);
+	assert(bitstream.offset == 8);
+	
+	unsigned int byte = 0;
+	bitstream_read_uint8(&bitstream, &byte);
+	assert(byte == 0xab);
+	
+	// Doesn't fit
+	bitstream_t bitstream_small = bitstream_create(data, 1);
+	assert(bitstream_write_bits(&bitstream_small, 0x7f, 7) == 7);
+	assert(bitstream_write_bits(&bitstream_small, 0x3, 2) == 0);
+	assert(bitstream_error(&bitstream_small));
+	assert(bitstream_write_bits(&bitstream_small, 0x1, 1) == 0); // Sticky
+	bitstream_flush_bits(&bitstream_small);
+	assert(bitstream_small.offset == 1);
+	
+	bitstream_reset(&bitstream_small);
+	assert(bitstream_read_bits(&bitstream_small, &value, 9) == 0);
+	assert(bitstream_error(&bitstream_small));
+	bitstream_reset(&bitstream_small);
+	assert(bitstream_read_bits(&bitstream_small, &value, 8) == 8 && value == 0xfe);
+	
+	LOG_TEST_END;
+}
+
+void test_bounded()
+{
+	const size_t data_length = 16;
+	
+	uint8_t data[data_length];
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	assert(bitstream_bits_required(0) == 0);
+	assert(bitstream_bits_required(1) == 1);
+	assert(bitstream_bits_required(255) == 8);
+	assert(bitstream_bits_required(256) == 9);
+	
+	assert(bitstream_write_int_bounded(&bitstream, -3, -10, 10) == 5); // 21 values
+	assert(bitstream_write_int_bounded(&bitstream, 500, 0, 100) == 7); // Clamped
+	assert(bitstream_write_int_bounded(&bitstream, 42, 42, 42) == 0); // Single value
+	assert(bitstream_write_int_bounded(&bitstream, INT32_MIN, INT32_MIN, INT32_MAX) == 32);
+	assert(bitstream_write_float_quantized(&bitstream, 3.14159f, -10.0f, 10.0f, 16) == 16);
+	assert(bitstream_write_float_quantized(&bitstream, -20.0f, -10.0f, 10.0f, 10) == 10); // Clamped
+	bitstream_flush_bits(&bitstream);
+	assert(bitstream.offset == 9); // 70 bits, half of 4 bytes per value
+	
+	bitstream_reset(&bitstream);
+	
+	int32_t value = 0;
+	float value_float = 0.0f;
+	assert(bitstream_read_int_bounded(&bitstream, &value, -10, 10) == 5 && value == -3);
+	assert(bitstream_read_int_bounded(&bitstream, &value, 0, 100) == 7 && value == 100);
+	assert(bitstream_read_int_bounded(&bitstream, &value, 42, 42) == 0 && value == 42);
+	assert(bitstream_read_int_bounded(&bitstream, &value, INT32_MIN, INT32_MAX) == 32 && value == INT32_MIN);
+	assert(bitstream_read_float_quantized(&bitstream, &value_float, -10.0f, 10.0f, 16) == 16);
+	assert(fabsf(value_float - 3.14159f) <= 20.0f / 65535.0f / 2.0f + 1e-6f);
+	assert(bitstream_read_float_quantized(&bitstream, &value_float, -10.0f, 10.0f, 10) == 10 && value_float == -10.0f);
+	
+	LOG_TEST_END;
+}
+
+void test_reserve()
+{
+	const size_t data_length = 16;
+	
+	uint8_t data[data_length];
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	bitstream_writer_t writer;
+	assert(bitstream_reserve(&bitstream, &writer, 15) == 1);
+	bitstream_writer_uint8(&writer, 0xab);
+	bitstream_writer_uint16(&writer, 0x1234);
+	bitstream_writer_uint32(&writer, 0x56789abc);
+	bitstream_writer_uint64(&writer, 0x0123456789abcdefULL);
+	bitstream_commit(&bitstream, &writer);
+	assert(bitstream.offset == 15);
+	assert(!bitstream_error(&bitstream));
+	
+	// Same bytes as checked writes
+	uint8_t expected[data_length];
+	bitstream_t bitstream_checked = bitstream_create(expected, data_length);
+	bitstream_write_uint8(&bitstream_checked, 0xab);
+	bitstream_write_uint16(&bitstream_checked, 0x1234);
+	bitstream_write_uint32(&bitstream_checked, 0x56789abc);
+	bitstream_write_uint64(&bitstream_checked, 0x0123456789abcdefULL);
+	assert(memcmp(data, expected, 15) == 0);
+	
+	// Doesn't fit, sticky
+	assert(bitstream_reserve(&bitstream, &writer, 2) == 0);
+	assert(writer.length == 0);
+	assert(bitstream_error(&bitstream));
+	bitstream_write_uint8(&bitstream, 0x1); // Fits, but error is sticky
+	assert(bitstream.offset == 15);
+	
+	// Read back
+	bitstream_reset(&bitstream);
+	assert(!bitstream_error(&bitstream));
+	
+	bitstream_reader_t reader;
+	unsigned int value8, value16, value32;
+	uint64_t value64;
+	assert(bitstream_require(&bitstream, &reader, 15) == 1);
+	bitstream_reader_uint8(&reader, &value8);
+	bitstream_reader_uint16(&reader, &value16);
+	bitstream_reader_uint32(&reader, &value32);
+	bitstream_reader_uint64(&reader, &value64);
+	bitstream_consume(&bitstream, &reader);
+	assert(value8 == 0xab && value16 == 0x1234 && value32 == 0x56789abc && value64 == 0x0123456789abcdefULL);
+	
+	// Read past bound
+	bitstream_read_uint16(&bitstream, &value16);
+	assert(value16 == 0);
+	assert(bitstream_error(&bitstream));
+	
+	LOG_TEST_END;
+}
+
+void test_varint()
+{
+	const size_t data_length = 1024;
+	
+	uint8_t data[data_length];
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	const uint64_t values[] = { 0, 1, 127, 128, 300, 16383, 16384, 0xFFFFFFFF, 0x8000000000000000ULL, UINT64_MAX };
+	const size_t lengths[] = { 1, 1, 1, 2, 2, 2, 3, 5, 10, 10 };
+	const size_t count = sizeof(values) / sizeof(values[0]);
+	
+	for(size_t i=0; i<count; ++i)
+	{
+		assert(bitstream_varint_length(values[i]) == lengths[i]);
+		assert(bitstream_write_varint(&bitstream, values[i]) == lengths[i]);
+	}
+	
+	const int64_t signed_values[] = { 0, -1, 1, -64, 63, -65, INT64_MIN, INT64_MAX };
+	const size_t signed_count = sizeof(signed_values) / sizeof(signed_values[0]);
+	
+	for(size_t i=0; i<signed_count; ++i)
+		assert(bitstream_write_varint_signed(&bitstream, signed_values[i]) > 0);
+	
+	assert(mBitstreamZigzag(-1) == 1 && mBitstreamZigzag(1) == 2);
+	assert(data[0] == 0x00 && data[3] == 0x80 && data[4] == 0x01); // 128, least significant group first
+	
+	size_t length = bitstream.offset;
+	bitstream_reset(&bitstream);
+	
+	for(size_t i=0; i<count; ++i)
+	{
+		uint64_t value;
+		assert(bitstream_read_varint(&bitstream, &value) == lengths[i]);
+		assert(value == values[i]);
+	}
+	
+	for(size_t i=0; i<signed_count; ++i)
+	{
+		int64_t value;
+		assert(bitstream_read_varint_signed(&bitstream, &value) > 0);
+		assert(value == signed_values[i]);
+	}
+	assert(bitstream.offset == length);
+	
+	// Truncated
+	bitstream_t bitstream_truncated = bitstream_create(&data[3], 1); // First byte of 128
+	uint64_t value = 1;
+	assert(bitstream_read_varint(&bitstream_truncated, &value) == 0 && value == 0);
+	assert(bitstream_error(&bitstream_truncated));
+	
+	// Too long
+	memset(data, 0xff, 16);
+	bitstream_t bitstream_long = bitstream_create(data, data_length);
+	assert(bitstream_read_varint(&bitstream_long, &value) == 0);
+	
+	LOG_TEST_END;
+}
+
+void test_varint_batch()
+{
+	const size_t data_length = 2048;
+	const size_t count = 300;
+	
+	uint8_t data[data_length];
+	uint64_t values[count];
+	uint64_t read_values[count];
+	
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	uint64_t seed = 88172645463325252ULL;
+	for(size_t i=0; i<count; ++i)
+	{
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17; // xorshift
+		values[i] = (i % 40) < 20 ? (seed & 0x7F) : seed >> (seed % 64); // Runs of single bytes, then mixed lengths
+		assert(bitstream_write_varint(&bitstream, values[i]) > 0);
+	}
+	size_t length = bitstream.offset;
+	
+	// Batch, across 16 byte blocks
+	bitstream = bitstream_create(data, length);
+	assert(bitstream_read_varints(&bitstream, read_values, count) == count);
+	assert(memcmp(values, read_values, sizeof(values)) == 0);
+	assert(bitstream.offset == length);
+	assert(!bitstream_error(&bitstream));
+	
+	// Partial
+	bitstream_reset(&bitstream);
+	assert(bitstream_read_varints(&bitstream, read_values, 17) == 17);
+	uint64_t value;
+	bitstream_read_varint(&bitstream, &value);
+	assert(value == values[17]);
+	
+	// Truncated, keeps decoded values
+	bitstream = bitstream_create(data, length - 1);
+	assert(bitstream_read_varints(&bitstream, read_values, count) == count - 1);
+	assert(bitstream_error(&bitstream));
+	
+	LOG_TEST_END;
+}
+
 void test_str()
 {
 	const size_t data_fit_length1 = 34+1; // 34+1 Bytes (write string will fit and occuppy all data's memory)
@@ -320,6 +630,16 @@ void test_str()
 	assert(write_bytes_nofit2 == 0);
 	assert(strcmp(read_string_nofit2, write_string) != 0);
 	assert(read_bytes_nofit2 == 0);
+	
+	// Truncated, length prefix claims more bytes than the stream holds
+	uint8_t data_truncated[4] = {10, 'a', 'b', 'c'};
+	char read_string_truncated[data_fit_length1];
+	bitstream_t bitstream_truncated = bitstream_create(data_truncated, sizeof(data_truncated));
+	size_t read_bytes_truncated = bitstream_read_str(&bitstream_truncated, read_string_truncated, data_fit_length1);
+	
+	assert(read_bytes_truncated == 0);
+	assert(read_string_truncated[0] == '\0');
+	assert(bitstream_error(&bitstream_truncated) != 0);
 
 	LOG_TEST_END;
 }
@@ -373,12 +693,19 @@ int main(void)
 	LOG_SUITE_START("bitstream");
 	
 	test_bytes();
+	test_bytes_lengths();
+	test_byte_order();
 	test_uint8();
 	test_uint16();
 	test_uint16_endian();
 	test_uint32();
 	test_uint32_endian();
 	test_uint64();
+	test_bits();
+	test_bounded();
+	test_reserve();
+	test_varint();
+	test_varint_batch();
 	test_float32();
 	test_str();
 	test_snapshot();
@@ -0,0 +1,60 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_crc32.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "crc32.h"
+
+#define kTestCrc32Length 3000
+
+static void test_crc32_check_value()
+{
+	LOG_TEST_START;
+	
+	assert(crc32_compute((const uint8_t *)"", 0) == 0x00000000);
+	assert(crc32_compute((const uint8_t *)"123456789", 9) == 0xCBF43926); // Check value of CRC-32
+	assert(crc32_compute((const uint8_t *)"The quick brown fox jumps over the lazy dog", 43) == 0x414FA339);
+	
+	LOG_TEST_END;
+}
+
+static void test_crc32_update()
+{
+	LOG_TEST_START;
+	
+	uint8_t data[kTestCrc32Length + 16];
+	for(int i=0; i<kTestCrc32Length + 16; ++i)
+		data[i] = (uint8_t)(i * 131 + (i >> 5));
+	
+	// One byte at a time is always the table path, whole buffers of 64 bytes or more may be folded
+	for(size_t offset=0; offset<3; ++offset)
+	{
+		uint32_t crc = 0;
+		for(size_t length=0; length<kTestCrc32Length; ++length)
+		{
+			assert(crc32_compute(&data[offset], length) == crc);
+			crc = crc32_update(crc, &data[offset + length], 1);
+		}
+	}
+	
+	// Split anywhere
+	uint32_t crc = crc32_compute(data, kTestCrc32Length);
+	for(size_t split=0; split<=kTestCrc32Length; split+=7)
+		assert(crc32_update(crc32_compute(data, split), &data[split], kTestCrc32Length - split) == crc);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("crc32");
+	
+	test_crc32_check_value();
+	test_crc32_update();
+	
+	return 0;
+}
@@ -152,12 +152,198 @@ static void test_net_block()
 	Block_release(test_receiveBlock);
 }
 
+static void test_net_body()
+{
+	LOG_TEST_START;
+	
+	NetError netError;
+	
+	const int sendPort = 45302;
+	const int receivePort = 45303;
+	static const char * localhost = "127.0.0.1";
+	const int headerLen = 4;
+	const int bodyLen = 200;
+	
+	net_socket_t receiveSocket = net_socket_create(&netError, AF_INET, localhost, receivePort);
+	net_socket_t sendSocket = net_socket_create(&netError, AF_INET, localhost, sendPort);
+	
+	assert(receiveSocket);
+	assert(sendSocket);
+	
+	__block int receivedCount = 0;
+	
+	net_socket_receive_block_t receiveBlock = Block_copy(^(net_packet_t packet) {
+		assert(net_packet_len(packet) == headerLen + bodyLen); // Header, followed by shared body
+		assert(packet->data[0] == (uint8_t)receivedCount); // In order on loopback
+		for(int b=headerLen; b<headerLen + bodyLen; ++b)
+			assert(packet->data[b] == (uint8_t)b);
+		++receivedCount;
+		net_packet_release(receiveSocket, packet);
+	});
+	
+	net_socket_set_receive_block(receiveSocket, receiveBlock);
+	
+	// Shared body, packed once
+	net_packet_body_t body = net_packet_body_create(bodyLen);
+	for(int b=0; b<bodyLen; ++b)
+		body->data[b] = (uint8_t)(headerLen + b);
+	body->length = bodyLen;
+	
+	for(int i=0; i<10; ++i)
+	{
+		net_packet_t testPacket = net_packet_alloc(sendSocket);
+		net_packet_set(testPacket, localhost, receivePort);
+		
+		for(int b=0; b<headerLen; ++b)
+			bitstream_write_uint8(&testPacket->bitstream, (uint8_t)i); // Own header
+		net_packet_set_body(testPacket, body);
+		
+		net_socket_send(sendSocket, testPacket);
+		net_packet_release(sendSocket, testPacket);
+		
+		usleep(100); // wait 100 microseconds
+	}
+	
+	net_packet_body_release(body); // Freed once every packet is written
+	
+	sleep(1);
+	
+	assert(receivedCount == 10);
+	
+	LOG_TEST_END;
+}
+
+static bool test_demux_match_first(const uint8_t * data, size_t length)
+{
+	return length >= 2 && data[1] == 1;
+}
+
+static bool test_demux_match_second(const uint8_t * data, size_t length)
+{
+	return length >= 2 && data[1] == 2;
+}
+
+static int test_demuxCallbackCount = 0;
+
+static void test_demux_callback(void * context, net_packet_t packet)
+{
+	assert(packet->data[0] == 0xa2 && packet->data[1] == 2);
+	__sync_add_and_fetch(&test_demuxCallbackCount, 1);
+	net_packet_release((net_socket_t)context, packet);
+}
+
+static void test_net_demux_send(net_socket_t sendSocket, const char * host, int port, uint8_t first, uint8_t second, int count)
+{
+	for(int i=0; i<count; ++i)
+	{
+		net_packet_t testPacket = net_packet_alloc(sendSocket);
+		net_packet_set(testPacket, host, port);
+		bitstream_write_uint8(&testPacket->bitstream, first);
+		bitstream_write_uint8(&testPacket->bitstream, second);
+		net_socket_send(sendSocket, testPacket);
+		net_packet_release(sendSocket, testPacket);
+		usleep(100); // wait 100 microseconds
+	}
+}
+
+static void test_net_demux()
+{
+	LOG_TEST_START;
+	
+	NetError netError;
+	
+	const int sendPort = 45304;
+	const int receivePort = 45305;
+	static const char * localhost = "127.0.0.1";
+	
+	net_socket_t receiveSocket = net_socket_create(&netError, AF_INET, localhost, receivePort);
+	net_socket_t sendSocket = net_socket_create(&netError, AF_INET, localhost, sendPort);
+	
+	assert(receiveSocket);
+	assert(sendSocket);
+	
+	__block int firstCount = 0;
+	__block int defaultCount = 0;
+	
+	net_socket_receive_block_t defaultBlock = Block_copy(^(net_packet_t packet) {
+		__sync_add_and_fetch(&defaultCount, 1);
+		net_packet_release(receiveSocket, packet);
+	});
+	net_socket_set_receive_block(receiveSocket, defaultBlock);
+	
+	// Two protocols sharing a first byte, told apart by their match function
+	net_socket_demux_t first = net_socket_demux_add_block(receiveSocket, 0xa2, 0xa2, test_demux_match_first, ^(net_packet_t packet) {
+		assert(packet->data[0] == 0xa2 && packet->data[1] == 1);
+		__sync_add_and_fetch(&firstCount, 1);
+		net_packet_release(receiveSocket, packet);
+	});
+	net_socket_demux_t second = net_socket_demux_add_callback(receiveSocket, 0xa0, 0xaf, test_demux_match_second, receiveSocket, test_demux_callback);
+	assert(first != kNetSocketDemuxNone && second != kNetSocketDemuxNone && first != second);
+	
+	test_net_demux_send(sendSocket, localhost, receivePort, 0xa2, 1, 5);
+	test_net_demux_send(sendSocket, localhost, receivePort, 0xa2, 2, 4);
+	test_net_demux_send(sendSocket, localhost, receivePort, 0xa2, 3, 3); // Claimed first byte, no match
+	test_net_demux_send(sendSocket, localhost, receivePort, 0x00, 1, 2); // Unclaimed first byte
+	
+	sleep(1);
+	
+	assert(firstCount == 5);
+	assert(test_demuxCallbackCount == 4);
+	assert(defaultCount == 5);
+	
+	// Removed protocol falls back to the socket receive block
+	net_socket_demux_remove(receiveSocket, first);
+	net_socket_demux_remove(receiveSocket, first); // Already removed, nothing to do
+	test_net_demux_send(sendSocket, localhost, receivePort, 0xa2, 1, 2);
+	
+	sleep(1);
+	
+	assert(firstCount == 5);
+	assert(defaultCount == 7);
+	
+	// Remove returns once packets being delivered are done
+	__block int slowStarted = 0;
+	__block int slowDone = 0;
+	net_socket_demux_t slow = net_socket_demux_add_block(receiveSocket, 0xa3, 0xa3, NULL, ^(net_packet_t packet) {
+		__sync_add_and_fetch(&slowStarted, 1);
+		usleep(200000);
+		__sync_add_and_fetch(&slowDone, 1);
+		net_packet_release(receiveSocket, packet);
+	});
+	assert(slow != kNetSocketDemuxNone);
+	
+	test_net_demux_send(sendSocket, localhost, receivePort, 0xa3, 1, 3);
+	usleep(100000);
+	
+	net_socket_demux_remove(receiveSocket, slow);
+	int slowStartedAtRemove = slowStarted;
+	assert(slowStartedAtRemove > 0);
+	assert(slowDone == slowStartedAtRemove);
+	
+	sleep(1);
+	
+	assert(slowStarted == slowStartedAtRemove);
+	
+	// Table is full
+	net_socket_demux_t handles[kNetSocketDemuxMaxProtocols];
+	for(int i=0; i<kNetSocketDemuxMaxProtocols-1; ++i)
+	{
+		handles[i] = net_socket_demux_add_callback(receiveSocket, 0xf0, 0xf0, NULL, receiveSocket, test_demux_callback);
+		assert(handles[i] != kNetSocketDemuxNone);
+	}
+	assert(net_socket_demux_add_callback(receiveSocket, 0xf0, 0xf0, NULL, receiveSocket, test_demux_callback) == kNetSocketDemuxNone);
+	
+	LOG_TEST_END;
+}
+
 int main(void)
 {
 	LOG_SUITE_START("net");
 
 	//test_net_callback();
+	test_net_body();
 	test_net_block();
+	test_net_demux();
 	
 	return 0;
 }
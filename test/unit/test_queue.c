@@ -39,6 +39,11 @@ static void test_queue()
 
 	queue_object_t test_obj;
 
+	test_obj = queue_peek(test_queue);
+
+	assert(test_obj == test_obj_1);
+	assert(debug_queue_enqueued_count(test_queue) == 2);
+
 	test_obj = queue_pop(test_queue);
 
 	assert(test_obj == test_obj_1);
@@ -0,0 +1,97 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_sha1.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "sha1.h"
+
+static bool test_sha1_is_digest(const uint8_t digest[kSha1DigestLength], const char * hex)
+{
+	char digestHex[2 * kSha1DigestLength + 1];
+	for(int i=0; i<kSha1DigestLength; ++i)
+		sprintf(&digestHex[2*i], "%02x", digest[i]);
+	
+	return strcmp(digestHex, hex) == 0;
+}
+
+static void test_sha1_digest()
+{
+	LOG_TEST_START;
+	
+	uint8_t digest[kSha1DigestLength];
+	sha1_t sha1;
+	
+	// FIPS 180 examples
+	sha1_init(&sha1);
+	sha1_final(&sha1, digest);
+	assert(test_sha1_is_digest(digest, "da39a3ee5e6b4b0d3255bfef95601890afd80709"));
+	
+	sha1_init(&sha1);
+	sha1_update(&sha1, (const uint8_t *)"abc", 3);
+	sha1_final(&sha1, digest);
+	assert(test_sha1_is_digest(digest, "a9993e364706816aba3e25717850c26c9cd0d89d"));
+	
+	sha1_init(&sha1);
+	sha1_update(&sha1, (const uint8_t *)"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56); // Padding in a second block
+	sha1_final(&sha1, digest);
+	assert(test_sha1_is_digest(digest, "84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+	
+	// Million 'a', uneven updates
+	uint8_t a[1000];
+	memset(a, 'a', sizeof(a));
+	sha1_init(&sha1);
+	for(int i=0, length=1; i<1000000; i+=length, length=(length * 7 + 13) % 1000 + 1)
+		sha1_update(&sha1, a, (1000000 - i) < length ? (1000000 - i) : length);
+	sha1_final(&sha1, digest);
+	assert(test_sha1_is_digest(digest, "34aa973cd4c4daa4f61eeb2bdbad27316534016f"));
+	
+	LOG_TEST_END;
+}
+
+static void test_sha1_hmac()
+{
+	LOG_TEST_START;
+	
+	uint8_t digest[kSha1DigestLength];
+	uint8_t key[80];
+	hmac_sha1_key_t hmacKey;
+	
+	// RFC 2202 test cases 1, 2 and 6 (key longer than a block)
+	memset(key, 0x0b, 20);
+	hmac_sha1_key_init(&hmacKey, key, 20);
+	hmac_sha1(&hmacKey, (const uint8_t *)"Hi There", 8, digest);
+	assert(test_sha1_is_digest(digest, "b617318655057264e28bc0b6fb378c8ef146be00"));
+	
+	hmac_sha1_key_init(&hmacKey, (const uint8_t *)"Jefe", 4);
+	hmac_sha1(&hmacKey, (const uint8_t *)"what do ya want for nothing?", 28, digest);
+	assert(test_sha1_is_digest(digest, "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79"));
+	
+	memset(key, 0xaa, 80);
+	hmac_sha1_key_init(&hmacKey, key, 80);
+	hmac_sha1(&hmacKey, (const uint8_t *)"Test Using Larger Than Block-Size Key - Hash Key First", 54, digest);
+	assert(test_sha1_is_digest(digest, "aa4ae5e15272d00e95705637ce8a3b55ed402112"));
+	
+	// Same key schedule, incremental
+	sha1_t sha1;
+	hmac_sha1_init(&hmacKey, &sha1);
+	sha1_update(&sha1, (const uint8_t *)"Test Using Larger ", 18);
+	sha1_update(&sha1, (const uint8_t *)"Than Block-Size Key - Hash Key First", 36);
+	hmac_sha1_final(&hmacKey, &sha1, digest);
+	assert(test_sha1_is_digest(digest, "aa4ae5e15272d00e95705637ce8a3b55ed402112"));
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("sha1");
+	
+	test_sha1_digest();
+	test_sha1_hmac();
+	
+	return 0;
+}
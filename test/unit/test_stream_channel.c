@@ -0,0 +1,291 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stream_channel.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "protocol.h"
+#include "stream_channel.h"
+
+static unsigned int test_stream_channel_count(const StreamObject * object, unsigned int channel)
+{
+	StreamObject message;
+	streamObjectSetup(&message);
+	
+	unsigned int offset = 0, count = 0;
+	
+	while(streamChannelsUnpack(object, &offset, &message))
+	{
+		assert(message.length > 0 && message.data[0] == message.tag); // First byte is the channel
+		count += (message.tag == channel);
+	}
+	
+	assert(offset == object->length); // Every message unpacked
+	
+	return count;
+}
+
+static void test_stream_channel_push(StreamChannelsRef ref, unsigned int channel, unsigned int length, unsigned int count)
+{
+	uint8_t data[kStreamChannelMessageMaxLength];
+	memset(data, channel, length);
+	
+	for(unsigned int i=0; i<count; ++i)
+		assert(streamChannelsPush(ref, channel, data, length));
+}
+
+static void test_stream_channel_priority()
+{
+	LOG_TEST_START;
+	
+	// Test 1 highest priority first, smaller lower priority messages fill the rest
+	static StreamChannels test_stream_channels;
+	StreamChannelsRef ref = &test_stream_channels;
+	streamChannelsClear(ref);
+	streamChannelsSetup(ref, 0, 0, 1);
+	streamChannelsSetup(ref, 1, 1, 1);
+	streamChannelsSetup(ref, 2, 2, 1);
+	
+	StreamChannelsCursor cursor;
+	streamChannelsCursorClear(ref, &cursor);
+	
+	test_stream_channel_push(ref, 2, 50, 10);
+	test_stream_channel_push(ref, 1, 100, 10);
+	test_stream_channel_push(ref, 0, 200, 3);
+	
+	StreamObject object;
+	streamObjectSetup(&object);
+	object.capacity = 500;
+	streamChannelsPack(ref, &cursor, &object);
+	
+	assert(object.tag == kStreamChannelTag);
+	assert(object.length <= 500);
+	assert(test_stream_channel_count(&object, 0) == 2); // 406 Bytes, third doesn't fit
+	assert(test_stream_channel_count(&object, 1) == 0); // 103 Bytes don't fit
+	assert(test_stream_channel_count(&object, 2) == 1); // 53 Bytes
+	
+	assert(ref->channels[0].back - cursor.channels[0].position == 202); // One left
+	assert(cursor.channels[1].age == 1);
+	assert(cursor.channels[2].age == 0);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_channel_weight()
+{
+	LOG_TEST_START;
+	
+	// Test 2 same priority, budget is shared 3 to 1
+	static StreamChannels test_stream_channels;
+	StreamChannelsRef ref = &test_stream_channels;
+	streamChannelsClear(ref);
+	streamChannelsSetup(ref, 0, 1, 3);
+	streamChannelsSetup(ref, 1, 1, 1);
+	
+	StreamChannelsCursor cursor;
+	streamChannelsCursorClear(ref, &cursor);
+	
+	unsigned int sent[2] = {0, 0};
+	
+	for(int i=0; i<20; ++i)
+	{
+		streamChannelsTrimBegin(ref);
+		streamChannelsTrimCursor(ref, &cursor);
+		streamChannelsTrimEnd(ref);
+		
+		test_stream_channel_push(ref, 0, 61, 20 - (ref->channels[0].back - ref->channels[0].front) / 63); // Both backlogged
+		test_stream_channel_push(ref, 1, 61, 20 - (ref->channels[1].back - ref->channels[1].front) / 63);
+		
+		StreamObject object;
+		streamObjectSetup(&object);
+		object.capacity = 640;
+		streamChannelsPack(ref, &cursor, &object);
+		
+		sent[0] += test_stream_channel_count(&object, 0);
+		sent[1] += test_stream_channel_count(&object, 1);
+		
+		assert(object.length + 64 > 640); // Full
+	}
+	
+	float ratio = (float)sent[0] / sent[1];
+	assert(ratio > 2.5f && ratio < 3.5f);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_channel_aging()
+{
+	LOG_TEST_START;
+	
+	// Test 3 saturated high priority channel, low priority one is promoted after aging
+	static StreamChannels test_stream_channels;
+	StreamChannelsRef ref = &test_stream_channels;
+	streamChannelsClear(ref);
+	streamChannelsSetup(ref, 0, 0, 1);
+	streamChannelsSetup(ref, 1, 2, 1);
+	
+	StreamChannelsCursor cursor;
+	streamChannelsCursorClear(ref, &cursor);
+	
+	test_stream_channel_push(ref, 1, 100, 1);
+	
+	int update = 0;
+	
+	for(; update<4*kStreamChannelAging; ++update)
+	{
+		streamChannelsTrimBegin(ref);
+		streamChannelsTrimCursor(ref, &cursor);
+		streamChannelsTrimEnd(ref);
+		
+		test_stream_channel_push(ref, 0, 100, 5);
+		
+		StreamObject object;
+		streamObjectSetup(&object);
+		object.capacity = 500;
+		streamChannelsPack(ref, &cursor, &object);
+		
+		if(test_stream_channel_count(&object, 1) > 0)
+			break;
+		
+		assert(test_stream_channel_count(&object, 0) == 4);
+	}
+	
+	assert(update == 2*kStreamChannelAging); // Promoted twice
+	assert(cursor.channels[1].position == ref->channels[1].back);
+	assert(cursor.channels[1].age == 0);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_channel_limits()
+{
+	LOG_TEST_START;
+	
+	// Test 4 disabled channel, full queue and truncated body
+	static StreamChannels test_stream_channels;
+	StreamChannelsRef ref = &test_stream_channels;
+	streamChannelsClear(ref);
+	streamChannelsSetup(ref, 3, 0, 1);
+	
+	StreamChannelsCursor cursor;
+	streamChannelsCursorClear(ref, &cursor);
+	
+	uint8_t data[kStreamChannelMessageMaxLength];
+	memset(data, 3, sizeof(data));
+	
+	assert(!streamChannelsPush(ref, 0, data, 10)); // Disabled
+	assert(!streamChannelsPush(ref, 3, data, kStreamChannelMessageMaxLength+1)); // Too long
+	
+	unsigned int pushed = 0;
+	while(streamChannelsPush(ref, 3, data, 1000))
+		++pushed;
+	
+	assert(pushed == kStreamChannelQueueCapacity / 1002);
+	assert(ref->channels[3].totalDropped == 1);
+	
+	StreamObject object;
+	streamObjectSetup(&object);
+	streamChannelsPack(ref, &cursor, &object);
+	assert(test_stream_channel_count(&object, 3) == 1);
+	
+	// Room only once trimmed up to the cursor
+	assert(!streamChannelsHasRoom(ref, 3, 1000));
+	streamChannelsTrimBegin(ref);
+	streamChannelsTrimCursor(ref, &cursor);
+	streamChannelsTrimEnd(ref);
+	assert(streamChannelsHasRoom(ref, 3, 1000));
+	
+	object.length -= 1; // Truncated
+	StreamObject message;
+	streamObjectSetup(&message);
+	unsigned int offset = 0;
+	assert(!streamChannelsUnpack(&object, &offset, &message));
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_channel_cursors()
+{
+	LOG_TEST_START;
+	
+	// Test 5 streams due at different rates, each one sends every message once
+	static StreamChannels test_stream_channels;
+	StreamChannelsRef ref = &test_stream_channels;
+	streamChannelsClear(ref);
+	streamChannelsSetup(ref, 0, 0, 1);
+	
+	StreamChannelsCursor cursors[3];
+	unsigned int received[3] = {0, 0, 0};
+	unsigned int pushed = 0;
+	
+	for(int i=0; i<3; ++i)
+		streamChannelsCursorClear(ref, &cursors[i]);
+	
+	for(int update=0; update<200; ++update)
+	{
+		// Two messages per update, full queue is trimmed to the slowest cursor
+		for(int m=0; m<2; ++m)
+		{
+			if(!streamChannelsHasRoom(ref, 0, 100))
+			{
+				streamChannelsTrimBegin(ref);
+				for(int i=0; i<3; ++i)
+					streamChannelsTrimCursor(ref, &cursors[i]);
+				streamChannelsTrimEnd(ref);
+			}
+			
+			test_stream_channel_push(ref, 0, 100, 1);
+			++pushed;
+		}
+		
+		for(int i=0; i<3; ++i)
+		{
+			if(update % (i + 1) != 0)
+				continue; // Not due
+			
+			StreamObject object;
+			streamObjectSetup(&object);
+			object.capacity = 1000;
+			streamChannelsPack(ref, &cursors[i], &object);
+			received[i] += test_stream_channel_count(&object, 0);
+		}
+	}
+	
+	// Every one behind by less than the queue, then drained
+	for(int i=0; i<3; ++i)
+	{
+		while(streamChannelsCursorIsPending(ref, &cursors[i]))
+		{
+			StreamObject object;
+			streamObjectSetup(&object);
+			object.capacity = 1000;
+			streamChannelsPack(ref, &cursors[i], &object);
+			received[i] += test_stream_channel_count(&object, 0);
+		}
+		
+		assert(received[i] == pushed);
+	}
+	
+	// Late stream starts after the queued messages
+	StreamChannelsCursor late;
+	streamChannelsCursorClear(ref, &late);
+	assert(!streamChannelsCursorIsPending(ref, &late));
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{	
+	LOG_SUITE_START("stream_channel");
+
+	test_stream_channel_priority();
+	test_stream_channel_weight();
+	test_stream_channel_aging();
+	test_stream_channel_limits();
+	test_stream_channel_cursors();
+	
+	return 0;
+}
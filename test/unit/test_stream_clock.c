@@ -0,0 +1,160 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stream_clock.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "protocol.h"
+#include "stream_clock.h"
+
+#define kTestStreamClockSkew 0.0001 // Remote clock runs 100 ppm faster
+#define kTestStreamClockOffset (3600 * kNetTimeSecond + 12345678) // Remote clock is 1h ahead
+
+static net_time_t test_stream_clock_step = 0; // Remote clock adjusted
+
+static net_time_t test_stream_clock_remote(net_time_t local)
+{
+	return kTestStreamClockOffset + test_stream_clock_step + local + (net_time_t)(local * kTestStreamClockSkew);
+}
+
+static float test_stream_clock_error(StreamClockRef ref, net_time_t now)
+{
+	net_time_t remote = test_stream_clock_remote(now);
+	return fabsf(mNetTimeToSeconds((int64_t)(streamClockRemoteToLocal(ref, remote, now) - now)));
+}
+
+static void test_stream_clock_exchange(StreamReliabilityRef A, StreamReliabilityRef B, StreamClockRef clock, net_time_t * now)
+{
+	StreamHeaderOptions options;
+	
+	// A to B, 10 ms one-way delay plus up to 10 ms jitter, B uses its own clock
+	streamHeaderOptionsSetup(&options);
+	streamReliabilityTimestamps(A, &options, *now);
+	*now += 10 * kNetTimeMillisecond + (rand() % 10000) * kNetTimeMicrosecond;
+	streamReliabilityProcessTimestamps(B, &options, test_stream_clock_remote(*now));
+	
+	// B holds
+	*now += (rand() % 30000) * kNetTimeMicrosecond;
+	
+	// B to A
+	streamHeaderOptionsSetup(&options);
+	streamReliabilityTimestamps(B, &options, test_stream_clock_remote(*now));
+	*now += 10 * kNetTimeMillisecond + (rand() % 10000) * kNetTimeMicrosecond;
+	streamReliabilityProcessTimestamps(A, &options, *now);
+	streamClockProcessTimestamps(clock, &options, *now);
+	
+	// A holds
+	*now += (rand() % 20000) * kNetTimeMicrosecond;
+}
+
+static void test_stream_clock_skew()
+{
+	LOG_TEST_START;
+	
+	// Test 1 exchanging headers at ~15 Hz, remote clock skewed
+	StreamReliability test_stream_reliability_A;
+	streamReliabilityClear(&test_stream_reliability_A);
+	
+	StreamReliability test_stream_reliability_B;
+	streamReliabilityClear(&test_stream_reliability_B);
+	
+	StreamClock test_stream_clock;
+	StreamClockRef test_stream_clock_ref = &test_stream_clock;
+	streamClockClear(test_stream_clock_ref);
+	
+	srand(7);
+	
+	net_time_t now = 10 * kNetTimeSecond;
+	net_time_t start = now;
+	bool converged = false;
+	
+	for(int i=0; i<15*40; ++i) // 40 seconds
+	{
+		test_stream_clock_exchange(&test_stream_reliability_A, &test_stream_reliability_B, test_stream_clock_ref, &now);
+		
+		assert(test_stream_clock.valid);
+		
+		if(!converged && now - start < kNetTimeSecond && test_stream_clock_error(test_stream_clock_ref, now) < 0.003f)
+			converged = true; // Within rtt asymmetry
+	}
+	
+	assert(converged); // Within a second
+	assert(fabsf(test_stream_clock.drift - kTestStreamClockSkew) < kTestStreamClockSkew * 0.2f);
+	assert(test_stream_clock.fitValid);
+	assert(test_stream_clock_error(test_stream_clock_ref, now) < 0.0005f); // Fit averages asymmetry
+	assert(test_stream_clock_error(test_stream_clock_ref, now + 5 * kNetTimeSecond) < 0.0005f); // Drift corrected, 500 us otherwise
+	assert(test_stream_clock.rtt >= 0.02f && test_stream_clock.rtt < 0.03f);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_clock_stepped()
+{
+	LOG_TEST_START;
+	
+	// Test 2 remote clock is stepped after synchronizing, fit is discarded
+	StreamReliability test_stream_reliability_A;
+	streamReliabilityClear(&test_stream_reliability_A);
+	
+	StreamReliability test_stream_reliability_B;
+	streamReliabilityClear(&test_stream_reliability_B);
+	
+	StreamClock test_stream_clock;
+	StreamClockRef test_stream_clock_ref = &test_stream_clock;
+	streamClockClear(test_stream_clock_ref);
+	
+	srand(11);
+	
+	net_time_t now = 10 * kNetTimeSecond;
+	
+	for(int i=0; i<15*10; ++i)
+		test_stream_clock_exchange(&test_stream_reliability_A, &test_stream_reliability_B, test_stream_clock_ref, &now);
+	
+	assert(test_stream_clock.fitValid);
+	
+	test_stream_clock_step = 2 * kNetTimeSecond;
+	
+	for(int i=0; i<15; ++i)
+		test_stream_clock_exchange(&test_stream_reliability_A, &test_stream_reliability_B, test_stream_clock_ref, &now);
+	
+	test_stream_clock_step = 0;
+	
+	assert(test_stream_clock_error(test_stream_clock_ref, now) > 1.9f); // Offset follows the stepped clock
+	assert(test_stream_clock.driftCount < 3);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_clock_no_echo()
+{
+	LOG_TEST_START;
+	
+	// Test 3 headers without echo are not samples
+	StreamClock test_stream_clock;
+	streamClockClear(&test_stream_clock);
+	
+	StreamHeaderOptions options;
+	streamHeaderOptionsSetup(&options);
+	options.flags = StreamHeaderFlagTimestamp;
+	options.timestamp = 1000;
+	
+	streamClockProcessTimestamps(&test_stream_clock, &options, kNetTimeSecond);
+	assert(!test_stream_clock.valid);
+	assert(test_stream_clock.sampleCount == 0);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{	
+	LOG_SUITE_START("stream_clock");
+
+	test_stream_clock_skew();
+	test_stream_clock_stepped();
+	test_stream_clock_no_echo();
+	
+	return 0;
+}
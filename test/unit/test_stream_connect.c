@@ -0,0 +1,361 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stream_connect.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "stream_connect.h"
+
+// Simulated network: two peers, each on a private network behind its own NAT, or on the same one
+
+#define kTestConnectLanLatency (1 * kNetTimeMillisecond) // One way
+#define kTestConnectWanLatency (10 * kNetTimeMillisecond) // One way, RTT between peers is 20 ms
+#define kTestConnectDatagramsMax 1024
+#define kTestConnectMappingsMax 32
+
+typedef enum {
+	TestNatEndpointIndependent,
+	TestNatAddressAndPortDependent
+} TestNatType;
+
+typedef struct {
+	net_addr_t internalAddr;
+	net_addr_t remoteAddr; // Only for address and port dependent mapping
+	unsigned short externalPort;
+} TestNatMapping;
+
+typedef struct {
+	unsigned int publicHost;
+	TestNatType mapping;
+	TestNatType filtering;
+	TestNatMapping mappings[kTestConnectMappingsMax];
+	unsigned int mappingCount;
+	net_addr_t permissions[kTestConnectMappingsMax]; // Remote endpoints the NAT sent to
+	unsigned int permissionCount;
+	unsigned short nextPort;
+} TestNat;
+
+typedef struct {
+	StreamConnect checks;
+	net_addr_t localAddr;
+	TestNat * nat;
+} TestPeer;
+
+typedef struct {
+	net_addr_t from;
+	net_addr_t to;
+	uint8_t data[kStreamConnectMessageMaxLen];
+	size_t length;
+	net_time_t time;
+} TestDatagram;
+
+static TestPeer test_peers[2];
+static TestDatagram test_datagrams[kTestConnectDatagramsMax];
+static unsigned int test_datagramCount;
+static net_time_t test_now;
+
+static TestNatMapping * test_nat_mapping(TestNat * nat, const net_addr_t * internalAddr, const net_addr_t * remoteAddr)
+{
+	for(unsigned int i=0; i<nat->mappingCount; ++i)
+	{
+		TestNatMapping * mapping = &nat->mappings[i];
+		if(net_addr_is_equal(&mapping->internalAddr, internalAddr) && (nat->mapping == TestNatEndpointIndependent || net_addr_is_equal(&mapping->remoteAddr, remoteAddr)))
+			return mapping;
+	}
+
+	assert(nat->mappingCount < kTestConnectMappingsMax);
+	TestNatMapping * mapping = &nat->mappings[nat->mappingCount++];
+	net_addr_copy(&mapping->internalAddr, internalAddr);
+	net_addr_copy(&mapping->remoteAddr, remoteAddr);
+	mapping->externalPort = nat->nextPort++;
+	return mapping;
+}
+
+static void test_nat_setup(TestNat * nat, unsigned int publicHost, TestNatType mapping, TestNatType filtering)
+{
+	memset(nat, 0, sizeof(TestNat));
+	nat->publicHost = publicHost;
+	nat->mapping = mapping;
+	nat->filtering = filtering;
+	nat->nextPort = 40000;
+}
+
+static void test_peer_setup(TestPeer * peer, unsigned int localHost, TestNat * nat, bool isControlling, net_addr_t * mappedAddr)
+{
+	net_addr_set(&peer->localAddr, localHost, 5000, true);
+	peer->nat = nat;
+
+	// Binding test result, mapping towards a STUN server
+	StunResults results;
+	memset(&results, 0, sizeof(StunResults));
+	results.didBindingTestSuccess = true;
+	net_addr_copy(&results.localAddr, &peer->localAddr);
+
+	if(nat)
+	{
+		net_addr_t serverAddr;
+		net_addr_set(&serverAddr, 0x08080808, 3478, true);
+		net_addr_set(&results.mappedAddr, nat->publicHost, test_nat_mapping(nat, &peer->localAddr, &serverAddr)->externalPort, true);
+	}
+	else
+	{
+		net_addr_copy(&results.mappedAddr, &peer->localAddr);
+		results.isMappingDirect = true;
+	}
+
+	net_addr_copy(mappedAddr, &results.mappedAddr);
+	streamConnectClear(&peer->checks, isControlling, &results, peer, NULL);
+}
+
+static void test_send(void * context, const net_addr_t * to, const uint8_t * data, size_t length)
+{
+	TestPeer * peer = (TestPeer *)context;
+	TestPeer * other = (peer == &test_peers[0]) ? &test_peers[1] : &test_peers[0];
+	net_time_t latency = kTestConnectWanLatency;
+
+	assert(stunProtocolHasValidFingerprint(data, length)); // Passes the stream socket demux
+
+	TestDatagram * datagram = &test_datagrams[test_datagramCount++];
+	assert(test_datagramCount <= kTestConnectDatagramsMax);
+	net_addr_copy(&datagram->from, &peer->localAddr);
+	net_addr_copy(&datagram->to, to);
+	memcpy(datagram->data, data, length);
+	datagram->length = length;
+
+	if(peer->nat && peer->nat == other->nat && net_addr_is_equal(to, &other->localAddr)) // Same private network
+		latency = kTestConnectLanLatency;
+	else if(peer->nat) // Outbound translation
+	{
+		net_addr_set(&datagram->from, peer->nat->publicHost, test_nat_mapping(peer->nat, &peer->localAddr, to)->externalPort, true);
+		assert(peer->nat->permissionCount < kTestConnectMappingsMax);
+		net_addr_copy(&peer->nat->permissions[peer->nat->permissionCount++], to);
+	}
+
+	datagram->time = test_now + latency;
+}
+
+static TestPeer * test_route(TestDatagram * datagram, net_addr_t * from)
+{
+	net_addr_copy(from, &datagram->from);
+
+	for(int i=0; i<2; ++i)
+	{
+		TestPeer * peer = &test_peers[i];
+
+		if(net_addr_is_equal(&datagram->to, &peer->localAddr))
+		{
+			TestPeer * other = (peer == &test_peers[0]) ? &test_peers[1] : &test_peers[0];
+			if(peer->nat == NULL || (other->nat == peer->nat && net_addr_is_equal(from, &other->localAddr)))
+				return peer; // Public host or same private network
+			return NULL; // Private address of another network
+		}
+
+		TestNat * nat = peer->nat;
+		if(nat && datagram->to.sin_addr.s_addr == htonl(nat->publicHost)) // Inbound translation
+		{
+			for(unsigned int m=0; m<nat->mappingCount; ++m)
+			{
+				if(nat->mappings[m].externalPort != ntohs(datagram->to.sin_port) || !net_addr_is_equal(&nat->mappings[m].internalAddr, &peer->localAddr))
+					continue;
+
+				if(nat->filtering == TestNatEndpointIndependent)
+					return peer;
+
+				for(unsigned int p=0; p<nat->permissionCount; ++p)
+					if(net_addr_is_equal(&nat->permissions[p], from))
+						return peer;
+			}
+		}
+	}
+
+	return NULL; // Filtered or unreachable
+}
+
+static bool test_peer_is_done(TestPeer * peer)
+{
+	return peer->checks.state == StreamConnectSucceeded || peer->checks.state == StreamConnectFailed;
+}
+
+// Runs both peers until done, returns time to complete
+static net_time_t test_run(net_addr_t * candidates)
+{
+	// Peer 0 gets peer 1 candidates (local, mapped) and vice versa
+	for(int i=0; i<2; ++i)
+	{
+		TestPeer * peer = &test_peers[i];
+		peer->checks.context = peer;
+		peer->checks.sendCallback = test_send;
+		assert(streamConnectAddCandidate(&peer->checks, &candidates[(1-i)*2], StreamCandidateHost));
+		assert(streamConnectAddCandidate(&peer->checks, &candidates[(1-i)*2+1], StreamCandidateReflexive));
+	}
+
+	test_datagramCount = 0;
+	test_now = kNetTimeSecond;
+
+	net_time_t deadlines[2];
+	for(int i=0; i<2; ++i)
+	{
+		streamConnectStart(&test_peers[i].checks, test_now);
+		deadlines[i] = streamConnectUpdate(&test_peers[i].checks, test_now);
+	}
+
+	while(!test_peer_is_done(&test_peers[0]) || !test_peer_is_done(&test_peers[1]))
+	{
+		// Next event
+		net_time_t next = 0;
+		for(int i=0; i<2; ++i)
+			if(deadlines[i] > 0 && (next == 0 || deadlines[i] < next))
+				next = deadlines[i];
+		for(unsigned int d=0; d<test_datagramCount; ++d)
+			if(next == 0 || test_datagrams[d].time < next)
+				next = test_datagrams[d].time;
+		assert(next > 0);
+		test_now = next;
+
+		// Deliver due datagrams
+		for(unsigned int d=0; d<test_datagramCount; )
+		{
+			if(test_datagrams[d].time > test_now)
+			{
+				++d;
+				continue;
+			}
+
+			TestDatagram datagram = test_datagrams[d];
+			test_datagrams[d] = test_datagrams[--test_datagramCount];
+
+			net_addr_t from;
+			TestPeer * peer = test_route(&datagram, &from);
+			if(peer)
+			{
+				bitstream_t bitstream = bitstream_create(datagram.data, datagram.length);
+				assert(streamConnectReceive(&peer->checks, &from, &bitstream, test_now) == true);
+				deadlines[peer - test_peers] = streamConnectUpdate(&peer->checks, test_now);
+			}
+		}
+
+		for(int i=0; i<2; ++i)
+			if(deadlines[i] > 0 && deadlines[i] <= test_now)
+				deadlines[i] = streamConnectUpdate(&test_peers[i].checks, test_now);
+	}
+
+	net_time_t end = test_now;
+	return end - kNetTimeSecond;
+}
+
+static void test_stream_connect_cone()
+{
+	LOG_TEST_START;
+
+	// Port restricted cone NATs on both sides
+	TestNat natA, natB;
+	test_nat_setup(&natA, 0x01010101, TestNatEndpointIndependent, TestNatAddressAndPortDependent);
+	test_nat_setup(&natB, 0x02020202, TestNatEndpointIndependent, TestNatAddressAndPortDependent);
+
+	net_addr_t candidates[4];
+	test_peer_setup(&test_peers[0], 0x0a000001, &natA, true, &candidates[1]);
+	net_addr_copy(&candidates[0], &test_peers[0].localAddr);
+	test_peer_setup(&test_peers[1], 0x0a010001, &natB, false, &candidates[3]);
+	net_addr_copy(&candidates[2], &test_peers[1].localAddr);
+
+	net_time_t duration = test_run(candidates);
+
+	assert(test_peers[0].checks.state == StreamConnectSucceeded);
+	assert(test_peers[1].checks.state == StreamConnectSucceeded);
+	assert(net_addr_is_equal(&test_peers[0].checks.selectedAddr, &candidates[3]) == true);
+	assert(net_addr_is_equal(&test_peers[1].checks.selectedAddr, &candidates[1]) == true);
+	assert(test_peers[0].checks.selectedRtt == 2 * kTestConnectWanLatency);
+	assert(duration < 10 * 2 * kTestConnectWanLatency); // A few RTTs
+
+	LOG_TEST_END;
+}
+
+static void test_stream_connect_symmetric()
+{
+	LOG_TEST_START;
+
+	// Peer 1 behind a symmetric NAT, its mapping towards peer 0 is not the one the STUN server saw
+	TestNat natA, natB;
+	test_nat_setup(&natA, 0x01010101, TestNatEndpointIndependent, TestNatEndpointIndependent);
+	test_nat_setup(&natB, 0x02020202, TestNatAddressAndPortDependent, TestNatAddressAndPortDependent);
+
+	net_addr_t candidates[4];
+	test_peer_setup(&test_peers[0], 0x0a000001, &natA, true, &candidates[1]);
+	net_addr_copy(&candidates[0], &test_peers[0].localAddr);
+	test_peer_setup(&test_peers[1], 0x0a010001, &natB, false, &candidates[3]);
+	net_addr_copy(&candidates[2], &test_peers[1].localAddr);
+
+	net_time_t duration = test_run(candidates);
+
+	assert(test_peers[0].checks.state == StreamConnectSucceeded);
+	assert(test_peers[1].checks.state == StreamConnectSucceeded);
+	assert(net_addr_is_equal(&test_peers[0].checks.selectedAddr, &candidates[3]) == false); // Peer reflexive
+	assert(test_peers[0].checks.selectedAddr.sin_addr.s_addr == htonl(natB.publicHost));
+	assert(net_addr_is_equal(&test_peers[1].checks.selectedAddr, &candidates[1]) == true);
+	assert(duration < 10 * 2 * kTestConnectWanLatency);
+
+	LOG_TEST_END;
+}
+
+static void test_stream_connect_same_nat()
+{
+	LOG_TEST_START;
+
+	// Same NAT without hairpinning, only host candidates work
+	TestNat nat;
+	test_nat_setup(&nat, 0x01010101, TestNatEndpointIndependent, TestNatAddressAndPortDependent);
+
+	net_addr_t candidates[4];
+	test_peer_setup(&test_peers[0], 0x0a000001, &nat, false, &candidates[1]);
+	net_addr_copy(&candidates[0], &test_peers[0].localAddr);
+	test_peer_setup(&test_peers[1], 0x0a000002, &nat, true, &candidates[3]);
+	net_addr_copy(&candidates[2], &test_peers[1].localAddr);
+
+	test_run(candidates);
+
+	assert(test_peers[0].checks.state == StreamConnectSucceeded);
+	assert(test_peers[1].checks.state == StreamConnectSucceeded);
+	assert(net_addr_is_equal(&test_peers[0].checks.selectedAddr, &candidates[2]) == true);
+	assert(net_addr_is_equal(&test_peers[1].checks.selectedAddr, &candidates[0]) == true);
+	assert(test_peers[1].checks.selectedRtt == 2 * kTestConnectLanLatency);
+
+	LOG_TEST_END;
+}
+
+static void test_stream_connect_fail()
+{
+	LOG_TEST_START;
+
+	// Symmetric NATs on both sides, no direct path
+	TestNat natA, natB;
+	test_nat_setup(&natA, 0x01010101, TestNatAddressAndPortDependent, TestNatAddressAndPortDependent);
+	test_nat_setup(&natB, 0x02020202, TestNatAddressAndPortDependent, TestNatAddressAndPortDependent);
+
+	net_addr_t candidates[4];
+	test_peer_setup(&test_peers[0], 0x0a000001, &natA, true, &candidates[1]);
+	net_addr_copy(&candidates[0], &test_peers[0].localAddr);
+	test_peer_setup(&test_peers[1], 0x0a010001, &natB, false, &candidates[3]);
+	net_addr_copy(&candidates[2], &test_peers[1].localAddr);
+
+	test_run(candidates);
+
+	assert(test_peers[0].checks.state == StreamConnectFailed);
+	assert(test_peers[1].checks.state == StreamConnectFailed); // Timeout, nothing was nominated
+
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("stream_connect");
+
+	test_stream_connect_cone();
+	test_stream_connect_symmetric();
+	test_stream_connect_same_nat();
+	test_stream_connect_fail();
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stream_fec.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "protocol.h"
+#include "stream_fec.h"
+
+#define kTestStreamFecGroupSize 4
+
+typedef struct {
+	StreamHeaderOptions options;
+	StreamObject object;
+} test_stream_fec_packet;
+
+static unsigned int test_stream_fec_send_group(StreamFecRef sender, test_stream_fec_packet * packets, unsigned int group)
+{
+	unsigned int count = 0;
+	
+	for(unsigned int i=0; i<kTestStreamFecGroupSize; ++i)
+	{
+		test_stream_fec_packet * packet = &packets[count++];
+		
+		streamHeaderOptionsSetup(&packet->options);
+		streamObjectSetup(&packet->object);
+		packet->object.tag = group * 100 + i;
+		
+		uint8_t data[64];
+		for(unsigned int d=0; d<sizeof(data); ++d)
+			data[d] = (uint8_t)(group * 7 + i * 13 + d);
+		streamObjectCopyData(&packet->object, data, 10 + i * 17); // Different lengths
+		
+		streamFecPackData(sender, &packet->options, &packet->object);
+		
+		assert(packet->options.flags & StreamHeaderFlagFec);
+		assert(packet->options.fecIndex == i);
+		
+		StreamHeaderOptions parityOptions;
+		streamHeaderOptionsSetup(&parityOptions);
+		StreamObject * parity = streamFecParity(sender, &parityOptions);
+		
+		if(i < kTestStreamFecGroupSize-1)
+		{
+			assert(parity == NULL);
+		}
+		else
+		{
+			assert(parity != NULL);
+			assert(parityOptions.flags & StreamHeaderFlagParity);
+			
+			packet = &packets[count++];
+			packet->options = parityOptions;
+			packet->object = *parity;
+		}
+	}
+	
+	return count;
+}
+
+static void test_stream_fec_recover()
+{
+	LOG_TEST_START;
+	
+	StreamFec sender;
+	StreamFec receiver;
+	
+	streamFecClear(&sender, kTestStreamFecGroupSize);
+	streamFecClear(&receiver, 0);
+	
+	test_stream_fec_packet packets[kTestStreamFecGroupSize+1];
+	
+	// Lose each packet in turn, including parity
+	for(unsigned int group=0; group<=kTestStreamFecGroupSize; ++group)
+	{
+		unsigned int lost = group;
+		unsigned int count = test_stream_fec_send_group(&sender, packets, group);
+		
+		assert(count == kTestStreamFecGroupSize+1);
+		
+		unsigned int forwarded = 0;
+		unsigned int recovered = 0;
+		
+		for(unsigned int p=0; p<count; ++p)
+		{
+			if(p == lost)
+				continue;
+			
+			if(streamFecReceive(&receiver, &packets[p].options, &packets[p].object))
+			{
+				assert(p < kTestStreamFecGroupSize); // Parity is never forwarded
+				++forwarded;
+			}
+			
+			StreamObject object;
+			streamObjectSetup(&object);
+			if(streamFecRecover(&receiver, &object))
+			{
+				assert(object.tag == packets[lost].object.tag);
+				assert(object.length == packets[lost].object.length);
+				assert(memcmp(object.data, packets[lost].object.data, object.length) == 0);
+				assert(receiver.receiveRecoveredIndex == packets[lost].options.fecIndex);
+				++recovered;
+			}
+		}
+		
+		assert(forwarded == (lost < kTestStreamFecGroupSize ? kTestStreamFecGroupSize-1 : kTestStreamFecGroupSize));
+		assert(recovered == (lost < kTestStreamFecGroupSize ? 1 : 0));
+		
+		// Late arrival of lost packet is a duplicate
+		if(lost < kTestStreamFecGroupSize)
+			assert(streamFecReceive(&receiver, &packets[lost].options, &packets[lost].object) == false);
+	}
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_fec_two_losses()
+{
+	LOG_TEST_START;
+	
+	StreamFec sender;
+	StreamFec receiver;
+	
+	streamFecClear(&sender, kTestStreamFecGroupSize);
+	streamFecClear(&receiver, 0);
+	
+	test_stream_fec_packet packets[kTestStreamFecGroupSize+1];
+	unsigned int count = test_stream_fec_send_group(&sender, packets, 0);
+	
+	for(unsigned int p=2; p<count; ++p) // Lose first two
+	{
+		streamFecReceive(&receiver, &packets[p].options, &packets[p].object);
+		
+		StreamObject object;
+		streamObjectSetup(&object);
+		assert(streamFecRecover(&receiver, &object) == false);
+	}
+	
+	// Next group resets
+	count = test_stream_fec_send_group(&sender, packets, 1);
+	
+	assert(packets[0].options.fecGroup == 1);
+	
+	for(unsigned int p=1; p<count; ++p) // Lose first
+		streamFecReceive(&receiver, &packets[p].options, &packets[p].object);
+	
+	StreamObject object;
+	streamObjectSetup(&object);
+	assert(streamFecRecover(&receiver, &object) == true);
+	assert(object.tag == packets[0].object.tag);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_fec_disabled()
+{
+	LOG_TEST_START;
+	
+	StreamFec sender;
+	streamFecClear(&sender, 0);
+	
+	StreamHeaderOptions options;
+	streamHeaderOptionsSetup(&options);
+	
+	StreamObject object;
+	streamObjectSetup(&object);
+	
+	streamFecPackData(&sender, &options, &object);
+	
+	assert(options.flags == 0);
+	assert(streamFecParity(&sender, &options) == NULL);
+	assert(streamFecReceive(&sender, &options, &object) == true);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{	
+	LOG_SUITE_START("stream_fec");
+
+	test_stream_fec_recover();
+	test_stream_fec_two_losses();
+	test_stream_fec_disabled();
+	
+	return 0;
+}
@@ -40,11 +40,80 @@ static void test_stream_flow_mode()
 	LOG_TEST_END;
 }
 
+static void test_stream_flow_simulate(StreamFlowRef ref, float capacity, float appRate, float seconds)
+{
+	const float dt = 1.0f/kStreamFlowMaxRate;
+	
+	StreamFlowSample sample;
+	sample.rtt = 0.05f;
+	sample.rttMin = 0.05f;
+	sample.lossRatio = 0.0f;
+	
+	for(float t=0.0f; t<seconds; t+=dt)
+	{
+		float packetSize = fminf(ref->packetBudget, appRate / kStreamFlowMaxRate); // App fills packet up to appRate
+		
+		sample.sentRate = packetSize / ref->updateInterval;
+		sample.deliveryRate = fminf(sample.sentRate, capacity);
+		sample.lossRatio += ((sample.sentRate > capacity ? 1.0f - capacity / sample.sentRate : 0.0f) - sample.lossRatio) * 0.05f;
+		sample.packetSize = packetSize;
+		
+		streamFlowUpdate(ref, sample.rtt, dt);
+		streamFlowUpdateRate(ref, &sample, dt);
+		
+		assert(ref->updateInterval >= 1.0f/kStreamFlowMaxRate - 0.0001f && ref->updateInterval <= 1.0f/kStreamFlowModeBadRate + 0.0001f);
+		assert(ref->packetBudget >= kStreamFlowMinPacketBudget && ref->packetBudget <= kStreamFlowMaxPacketBudget);
+	}
+}
+
+static void test_stream_flow_rate()
+{
+	LOG_TEST_START;
+	
+	StreamFlow test_stream_flow;
+	StreamFlowRef test_stream_flow_ref = &test_stream_flow;
+	
+	// Well connected
+	streamFlowClear(test_stream_flow_ref);
+	
+	assert(test_stream_flow.sendRate == kStreamFlowMinSendRate);
+	assert(test_stream_flow.packetBudget == kStreamFlowMinPacketBudget);
+	
+	test_stream_flow_simulate(test_stream_flow_ref, 1000000.0f, 1000000.0f, 60.0f);
+	
+	assert(test_stream_flow.mode == StreamFlowModeGood);
+	assert(test_stream_flow.sendRate == kStreamFlowMaxSendRate);
+	assert(fabsf(test_stream_flow.updateInterval - 1.0f/kStreamFlowMaxRate) < 0.0001f);
+	assert(test_stream_flow.packetBudget == kStreamFlowMaxPacketBudget);
+	
+	// Constrained link, 8 KB/s
+	const float capacity = 8000.0f;
+	
+	streamFlowClear(test_stream_flow_ref);
+	
+	test_stream_flow_simulate(test_stream_flow_ref, capacity, 1000000.0f, 60.0f);
+	
+	assert(test_stream_flow.sendRate > capacity * 0.5f && test_stream_flow.sendRate < capacity * kStreamFlowBandwidthGain);
+	assert(test_stream_flow.bandwidth <= capacity);
+	assert(test_stream_flow.bandwidth > capacity * 0.5f);
+	
+	// Small updates, app limited
+	streamFlowClear(test_stream_flow_ref);
+	
+	test_stream_flow_simulate(test_stream_flow_ref, 1000000.0f, 1500.0f, 60.0f); // 100 bytes per packet at max. rate
+	
+	assert(test_stream_flow.sendRate < kStreamFlowMinSendRate * 2.0f);
+	assert(fabsf(test_stream_flow.updateInterval - 1.0f/kStreamFlowMaxRate) < 0.0001f);
+	
+	LOG_TEST_END;
+}
+
 int main(void)
 {	
 	LOG_SUITE_START("stream_flow");
 
 	test_stream_flow_mode();
+	test_stream_flow_rate();
 	
 	return 0;
 }
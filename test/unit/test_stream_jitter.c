@@ -0,0 +1,150 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stream_jitter.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "protocol.h"
+#include "stream_jitter.h"
+
+#define kTestStreamJitterPackets 300
+#define kTestStreamJitterInterval (kNetTimeSecond / 15) // Sender update rate
+
+typedef struct {
+	Sequence sequence;
+	net_time_t arrival;
+	StreamHeaderOptions options;
+} test_stream_jitter_packet;
+
+static void test_stream_jitter_packet_setup(test_stream_jitter_packet * packet, Sequence sequence, net_time_t sent, net_time_t arrival)
+{
+	const net_time_t remoteClockOffset = 123 * kNetTimeSecond; // Remote clock is unrelated to the local one
+	
+	packet->sequence = sequence;
+	packet->arrival = arrival;
+	streamHeaderOptionsSetup(&packet->options);
+	packet->options.flags = StreamHeaderFlagTimestamp;
+	packet->options.timestamp = (unsigned int)((sent + remoteClockOffset) / kNetTimeMicrosecond);
+}
+
+static void test_stream_jitter_playout()
+{
+	LOG_TEST_START;
+	
+	// Test 1 packets sent at 15 Hz, 20 ms delay plus up to 40 ms jitter, so they arrive bunched and out of order
+	StreamJitter test_stream_jitter;
+	StreamJitterRef test_stream_jitter_ref = &test_stream_jitter;
+	streamJitterClear(test_stream_jitter_ref);
+	
+	static test_stream_jitter_packet packets[kTestStreamJitterPackets];
+	
+	srand(3);
+	
+	for(int i=0; i<kTestStreamJitterPackets; ++i)
+	{
+		net_time_t sent = kNetTimeSecond + i * kTestStreamJitterInterval;
+		net_time_t arrival = sent + 20 * kNetTimeMillisecond + (rand() % 40000) * kNetTimeMicrosecond;
+		test_stream_jitter_packet_setup(&packets[i], i, sent, arrival);
+	}
+	
+	StreamObject object;
+	streamObjectSetup(&object);
+	
+	net_time_t lastRelease = 0;
+	int lastSequence = -1;
+	int released = 0;
+	float deviation = 0.0f;
+	
+	for(net_time_t now = kNetTimeSecond; now < kNetTimeSecond + (kTestStreamJitterPackets + 20) * kTestStreamJitterInterval; now += kNetTimeMillisecond)
+	{
+		for(int i=0; i<kTestStreamJitterPackets; ++i) // Arrivals in this millisecond
+		{
+			if(packets[i].arrival >= now && packets[i].arrival < now + kNetTimeMillisecond)
+			{
+				StreamObject snapshot;
+				streamObjectSetup(&snapshot);
+				snapshot.tag = packets[i].sequence;
+				snapshot.length = 1;
+				streamJitterPush(test_stream_jitter_ref, packets[i].sequence, &packets[i].options, &snapshot, now);
+			}
+		}
+		
+		while(streamJitterPop(test_stream_jitter_ref, &object, now))
+		{
+			assert((int)object.tag > lastSequence); // Ordered
+			
+			if(lastRelease > 0 && object.tag > kTestStreamJitterPackets / 2) // Steady clock, once delay has converged
+				deviation += fabsf(mNetTimeToSeconds(now - lastRelease) - mNetTimeToSeconds(kTestStreamJitterInterval) * (object.tag - lastSequence));
+			
+			lastSequence = (int)object.tag;
+			lastRelease = now;
+			released += 1;
+		}
+	}
+	
+	deviation /= kTestStreamJitterPackets / 2;
+	
+	assert(released == test_stream_jitter.totalReleased);
+	assert(released + test_stream_jitter.totalDropped == kTestStreamJitterPackets); // Only the first ones may be stale, until delay adapts
+	assert(test_stream_jitter.totalDropped < 5);
+	assert(deviation < 0.002f); // Mean deviation below 2 ms, arrivals deviate ~13 ms
+	assert(test_stream_jitter.delay > 0.04f && test_stream_jitter.delay <= kStreamJitterMaxDelay);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_jitter_stale()
+{
+	LOG_TEST_START;
+	
+	// Test 2 stale and duplicate snapshots are dropped
+	StreamJitter test_stream_jitter;
+	StreamJitterRef test_stream_jitter_ref = &test_stream_jitter;
+	streamJitterClear(test_stream_jitter_ref);
+	
+	test_stream_jitter_packet packet;
+	StreamObject object;
+	streamObjectSetup(&object);
+	
+	net_time_t now = kNetTimeSecond;
+	
+	test_stream_jitter_packet_setup(&packet, 10, now, now);
+	assert(streamJitterPush(test_stream_jitter_ref, packet.sequence, &packet.options, &object, now));
+	assert(!streamJitterPush(test_stream_jitter_ref, packet.sequence, &packet.options, &object, now)); // Duplicate
+	assert(!streamJitterPop(test_stream_jitter_ref, &object, now)); // Not yet
+	assert(streamJitterNextTime(test_stream_jitter_ref, now) == now + (net_time_t)(test_stream_jitter.delay * 1e6f) * kNetTimeMicrosecond);
+	
+	now += kNetTimeSecond;
+	assert(streamJitterPop(test_stream_jitter_ref, &object, now));
+	assert(streamJitterNextTime(test_stream_jitter_ref, now) == 0);
+	
+	test_stream_jitter_packet_setup(&packet, 9, now - kNetTimeSecond, now);
+	assert(!streamJitterPush(test_stream_jitter_ref, packet.sequence, &packet.options, &object, now)); // Stale
+	assert(test_stream_jitter.totalDropped == 2);
+	
+	// Late arrival is released right away and raises playout delay for the next ones
+	test_stream_jitter_packet_setup(&packet, 11, now - 200 * kNetTimeMillisecond, now);
+	assert(streamJitterPush(test_stream_jitter_ref, packet.sequence, &packet.options, &object, now));
+	assert(test_stream_jitter.delay >= 0.2f);
+	assert(streamJitterPop(test_stream_jitter_ref, &object, now));
+	
+	test_stream_jitter_packet_setup(&packet, 12, now, now);
+	assert(streamJitterPush(test_stream_jitter_ref, packet.sequence, &packet.options, &object, now));
+	assert(!streamJitterPop(test_stream_jitter_ref, &object, now + 100 * kNetTimeMillisecond));
+	assert(streamJitterPop(test_stream_jitter_ref, &object, now + 200 * kNetTimeMillisecond));
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{	
+	LOG_SUITE_START("stream_jitter");
+
+	test_stream_jitter_playout();
+	test_stream_jitter_stale();
+	
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stream_mtu.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "protocol.h"
+#include "stream_mtu.h"
+
+static void test_stream_mtu_search(size_t path_mtu)
+{
+	LOG_TEST_START;
+	
+	const float dt = kStreamMtuProbeInterval; 
+	
+	StreamMtu test_stream_mtu;
+	StreamMtuRef test_stream_mtu_ref = &test_stream_mtu;
+	
+	streamMtuClear(test_stream_mtu_ref);
+	
+	assert(test_stream_mtu.state == StreamMtuSearching);
+	assert(test_stream_mtu.size == kStreamMtuMin);
+	
+	Sequence sequence = 0;
+	int i;
+	for(i=0; i<1000 && test_stream_mtu.state == StreamMtuSearching; ++i)
+	{
+		streamMtuUpdate(test_stream_mtu_ref, dt);
+		
+		size_t probeSize = streamMtuProbeSize(test_stream_mtu_ref);
+		if(probeSize > 0)
+		{
+			assert(probeSize > test_stream_mtu.size);
+			assert(probeSize <= kStreamMtuMax);
+			
+			streamMtuProbeSent(test_stream_mtu_ref, sequence, probeSize);
+			
+			if(probeSize <= path_mtu) // Delivered, acked by a later packet
+				streamMtuProcessAck(test_stream_mtu_ref, sequence+1, 0x3);
+		}
+		
+		sequence++;
+	}
+	
+	assert(test_stream_mtu.state == StreamMtuSettled);
+	assert(test_stream_mtu.size <= path_mtu);
+	assert(test_stream_mtu.size + kStreamMtuProbeResolution >= path_mtu || test_stream_mtu.size == kStreamMtuMax);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_mtu_ack_wrap_around()
+{
+	LOG_TEST_START;
+	
+	StreamMtu test_stream_mtu;
+	StreamMtuRef test_stream_mtu_ref = &test_stream_mtu;
+	
+	streamMtuClear(test_stream_mtu_ref);
+	
+	streamMtuProbeSent(test_stream_mtu_ref, kStreamReliabilityMaxSequence-1, 512);
+	
+	streamMtuProcessAck(test_stream_mtu_ref, 2, 0x1); // Probe not acked
+	
+	assert(test_stream_mtu.size == kStreamMtuMin);
+	
+	streamMtuProcessAck(test_stream_mtu_ref, 2, 0x9); // Probe acked (3 packets before)
+	
+	assert(test_stream_mtu.size == 512);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{	
+	LOG_SUITE_START("stream_mtu");
+
+	test_stream_mtu_search(576);
+	test_stream_mtu_search(1400);
+	test_stream_mtu_search(kStreamMtuMax);
+	test_stream_mtu_ack_wrap_around();
+	
+	return 0;
+}
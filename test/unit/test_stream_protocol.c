@@ -26,13 +26,50 @@ static void test_stream_protocol_header()
 	Ack unpack_test_ack = 0;
 	AckBitField unpack_test_ackBitField = 0;
 	
-	streamProtocolPackHeader(&bitstream, test_sequence, test_ack, test_ackBitField);
+	StreamHeaderOptions unpack_test_timestamps;
+	
+	streamProtocolPackHeader(&bitstream, test_sequence, test_ack, test_ackBitField, NULL);
 	bitstream_reset(&bitstream);
-	streamProtocolUnpackHeader(&bitstream, &unpack_test_sequence, &unpack_test_ack, &unpack_test_ackBitField);
+	streamProtocolUnpackHeader(&bitstream, &unpack_test_sequence, &unpack_test_ack, &unpack_test_ackBitField, &unpack_test_timestamps);
 	
 	assert(unpack_test_sequence == test_sequence);
 	assert(unpack_test_ack == test_ack);
 	assert(unpack_test_ackBitField == test_ackBitField);
+	assert(unpack_test_timestamps.flags == 0);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_protocol_header_options()
+{
+	LOG_TEST_START;
+	
+	const size_t data_length = 100;
+	uint8_t data[data_length];
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	StreamHeaderOptions test_timestamps;
+	test_timestamps.flags = StreamHeaderFlagTimestamp | StreamHeaderFlagEcho;
+	test_timestamps.timestamp = 0xfffffff0;
+	test_timestamps.echoTimestamp = 2372393;
+	test_timestamps.echoDelay = 15320;
+	
+	Sequence unpack_test_sequence = 0;
+	Ack unpack_test_ack = 0;
+	AckBitField unpack_test_ackBitField = 0;
+	StreamHeaderOptions unpack_test_timestamps;
+	
+	streamProtocolPackHeader(&bitstream, 23, 22, 0x3, &test_timestamps);
+	size_t length = bitstream.offset;
+	bitstream_reset(&bitstream);
+	streamProtocolUnpackHeader(&bitstream, &unpack_test_sequence, &unpack_test_ack, &unpack_test_ackBitField, &unpack_test_timestamps);
+	
+	assert(bitstream.offset == length);
+	assert(unpack_test_sequence == 23);
+	assert(unpack_test_timestamps.flags == test_timestamps.flags);
+	assert(unpack_test_timestamps.timestamp == test_timestamps.timestamp);
+	assert(unpack_test_timestamps.echoTimestamp == test_timestamps.echoTimestamp);
+	assert(unpack_test_timestamps.echoDelay == test_timestamps.echoDelay);
 	
 	LOG_TEST_END;
 }
@@ -63,6 +100,61 @@ static void test_stream_protocol_data()
 	assert(unpack_test_object.length == test_object.length);
 	assert(memcmp(unpack_test_object.data, test_object.data, test_object.length) == 0);
 	
+	// Length larger than an object holds, in a packet large enough for it
+	uint8_t large_data[kNetPacketMaxLen];
+	memset(large_data, 0xab, kNetPacketMaxLen);
+	bitstream = bitstream_create(large_data, kNetPacketMaxLen);
+	bitstream_write_uint64(&bitstream, 1);
+	bitstream_write_uint16(&bitstream, kStreamObjectDataMaxLength + 1);
+	bitstream_reset(&bitstream);
+	assert(streamProtocolUnpackData(&bitstream, &unpack_test_object) == UnpackInvalid);
+	assert(unpack_test_object.length == 0);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_protocol_view()
+{
+	LOG_TEST_START;
+	
+	const size_t data_length = 100;
+	uint8_t data[data_length];
+	bitstream_t bitstream = bitstream_create(data, data_length);
+	
+	// Written in place, read back as an object
+	StreamView test_view;
+	streamProtocolPackViewBegin(&bitstream, &test_view, 32);
+	assert(test_view.bitstream.bound == 32);
+	test_view.tag = 49284398493;
+	bitstream_write_uint32(&test_view.bitstream, 0xdeadbeef);
+	bitstream_write_raw(&test_view.bitstream, (const uint8_t *)"view", 4);
+	streamProtocolPackViewEnd(&bitstream, &test_view);
+	assert(bitstream.offset == kStreamProtocolDataOverheadLength + 8);
+	
+	StreamObject unpack_test_object;
+	streamObjectSetup(&unpack_test_object);
+	bitstream_reset(&bitstream);
+	streamProtocolUnpackData(&bitstream, &unpack_test_object);
+	assert(unpack_test_object.tag == test_view.tag);
+	assert(unpack_test_object.length == 8);
+	assert(memcmp(&unpack_test_object.data[4], "view", 4) == 0);
+	
+	// Read in place
+	StreamView unpack_test_view;
+	bitstream_reset(&bitstream);
+	assert(streamProtocolUnpackView(&bitstream, &unpack_test_view) == UnpackValid);
+	assert(unpack_test_view.tag == test_view.tag);
+	assert(unpack_test_view.bitstream.bound == 8);
+	assert(unpack_test_view.bitstream.data == &data[kStreamProtocolDataOverheadLength]);
+	
+	unsigned int value = 0;
+	bitstream_read_uint32(&unpack_test_view.bitstream, &value);
+	assert(value == 0xdeadbeef);
+	
+	// Truncated
+	bitstream = bitstream_create(data, kStreamProtocolDataOverheadLength + 7);
+	assert(streamProtocolUnpackView(&bitstream, &unpack_test_view) == UnpackInvalid);
+	
 	LOG_TEST_END;
 }
 
@@ -71,7 +163,9 @@ int main(void)
 	LOG_SUITE_START("stream_protocol");
 
 	test_stream_protocol_header();
+	test_stream_protocol_header_options();
 	test_stream_protocol_data();
+	test_stream_protocol_view();
 	
 	return 0;
 }
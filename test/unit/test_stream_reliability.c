@@ -33,6 +33,7 @@ static void test_stream_reliability_no_loss()
 	// Test 1 sending fixed packet length (100 bytes), with 0.0% loss from A to B and 0.0% loss from B to A
 	// Simulation over a period of 10 seconds, with 1/10th second delta
 	const float dt = 0.1;
+	const net_time_t dt_time = 100 * kNetTimeMillisecond; // dt
 	const size_t packet_size = 100;
 	
 	StreamReliability test_stream_reliability_A;
@@ -65,17 +66,19 @@ static void test_stream_reliability_no_loss()
 	{
 		for(int ds=1; ds<=10; ++ds)
 		{
+			net_time_t now = ((s-1)*10+ds) * dt_time;
+			
 			// A to B
-			streamReliabilityPacketReceived(test_stream_reliability_ref_B, test_stream_reliability_ref_A->sequence, test_stream_reliability_ref_A->ack, test_stream_reliability_ref_A->ackBits);
-			streamReliabilityPacketSent(test_stream_reliability_ref_A, packet_size);
+			streamReliabilityPacketReceived(test_stream_reliability_ref_B, test_stream_reliability_ref_A->sequence, test_stream_reliability_ref_A->ack, test_stream_reliability_ref_A->ackBits, now);
+			streamReliabilityPacketSent(test_stream_reliability_ref_A, packet_size, now);
 			
 			// B to A
-			streamReliabilityPacketReceived(test_stream_reliability_ref_A, test_stream_reliability_ref_B->sequence, test_stream_reliability_ref_B->ack, test_stream_reliability_ref_B->ackBits);
-			streamReliabilityPacketSent(test_stream_reliability_ref_B, packet_size);
+			streamReliabilityPacketReceived(test_stream_reliability_ref_A, test_stream_reliability_ref_B->sequence, test_stream_reliability_ref_B->ack, test_stream_reliability_ref_B->ackBits, now);
+			streamReliabilityPacketSent(test_stream_reliability_ref_B, packet_size, now);
 			
-			// Update
-			streamReliabilityUpdate(test_stream_reliability_ref_A, dt);
-			streamReliabilityUpdate(test_stream_reliability_ref_B, dt);
+			// Update, dt elapsed
+			streamReliabilityUpdate(test_stream_reliability_ref_A, now + dt_time);
+			streamReliabilityUpdate(test_stream_reliability_ref_B, now + dt_time);
 		}
 		
 		// Check
@@ -89,7 +92,7 @@ static void test_stream_reliability_no_loss()
 		assert(test_stream_reliability_ref_A->ackedBytesPerSecond <= 10*packet_size);
 		assert(test_stream_reliability_ref_A->sentBandwidth <= 10*packet_size*0.008);
 		assert(test_stream_reliability_ref_A->ackedBandwidth <= 10*packet_size*0.008);
-		assert(test_stream_reliability_ref_A->rtt <= 0.1);
+		assert(test_stream_reliability_ref_A->rtt <= dt);
 		
 		assert(test_stream_reliability_ref_B->totalSentPackets == s*10);
 		assert(test_stream_reliability_ref_B->totalReceivedPackets == s*10);
@@ -101,7 +104,7 @@ static void test_stream_reliability_no_loss()
 		assert(test_stream_reliability_ref_B->ackedBytesPerSecond <= 10*packet_size);
 		assert(test_stream_reliability_ref_B->sentBandwidth <= 10*packet_size*0.008);
 		assert(test_stream_reliability_ref_B->ackedBandwidth <= 10*packet_size*0.008);
-		assert(test_stream_reliability_ref_B->rtt <= 0.1);
+		assert(test_stream_reliability_ref_B->rtt <= dt);
 	}
 	
 	LOG_TEST_END;
@@ -114,6 +117,7 @@ static void test_stream_reliability_with_loss()
 	// Test 2 sending fixed packet length (100 bytes), with 10.0% loss (1 in 10) from A to B and 0.0% loss from B to A
 	// Simulation over a period of 10 seconds, with 1/10th second delta
 	const float dt = 0.1;
+	const net_time_t dt_time = 100 * kNetTimeMillisecond; // dt
 	const size_t packet_size = 100;
 	
 	StreamReliability test_stream_reliability_A;
@@ -146,18 +150,20 @@ static void test_stream_reliability_with_loss()
 	{
 		for(int ds=1; ds<=10; ++ds)
 		{
+			net_time_t now = ((s-1)*10+ds) * dt_time;
+			
 			// A to B
 			if(ds != 10) // every 10th, loose 1 packet from A to B
-				streamReliabilityPacketReceived(test_stream_reliability_ref_B, test_stream_reliability_ref_A->sequence, test_stream_reliability_ref_A->ack, test_stream_reliability_ref_A->ackBits);	
-			streamReliabilityPacketSent(test_stream_reliability_ref_A, packet_size);
+				streamReliabilityPacketReceived(test_stream_reliability_ref_B, test_stream_reliability_ref_A->sequence, test_stream_reliability_ref_A->ack, test_stream_reliability_ref_A->ackBits, now);	
+			streamReliabilityPacketSent(test_stream_reliability_ref_A, packet_size, now);
 			
 			// B to A
-			streamReliabilityPacketReceived(test_stream_reliability_ref_A, test_stream_reliability_ref_B->sequence, test_stream_reliability_ref_B->ack, test_stream_reliability_ref_B->ackBits);
-			streamReliabilityPacketSent(test_stream_reliability_ref_B, packet_size);
+			streamReliabilityPacketReceived(test_stream_reliability_ref_A, test_stream_reliability_ref_B->sequence, test_stream_reliability_ref_B->ack, test_stream_reliability_ref_B->ackBits, now);
+			streamReliabilityPacketSent(test_stream_reliability_ref_B, packet_size, now);
 			
-			// Update
-			streamReliabilityUpdate(test_stream_reliability_ref_A, dt);
-			streamReliabilityUpdate(test_stream_reliability_ref_B, dt);
+			// Update, dt elapsed
+			streamReliabilityUpdate(test_stream_reliability_ref_A, now + dt_time);
+			streamReliabilityUpdate(test_stream_reliability_ref_B, now + dt_time);
 		}
 		
 		// Check
@@ -170,7 +176,7 @@ static void test_stream_reliability_with_loss()
 		assert(test_stream_reliability_ref_A->ackedBytesPerSecond <= 10*packet_size);
 		assert(test_stream_reliability_ref_A->sentBandwidth <= 10*packet_size*0.008);
 		assert(test_stream_reliability_ref_A->ackedBandwidth <= 10*packet_size*0.008);
-		assert(test_stream_reliability_ref_A->rtt <= 0.1);
+		assert(test_stream_reliability_ref_A->rtt <= dt);
 		
 		assert(test_stream_reliability_ref_B->totalSentPackets == s*10);
 		assert(test_stream_reliability_ref_B->totalReceivedPackets < s*10);
@@ -190,7 +196,212 @@ static void test_stream_reliability_with_loss()
 	LOG_TEST_END;
 }
 
+static void test_stream_reliability_incremental()
+{
+	LOG_TEST_START;
+	
+	// Test 4 acked counters are maintained incrementally, check against a full scan of the acked list
+	// Variable packet length, random loss and late acks, 4 packets per update so that the buffer overflows
+	const net_time_t dt_time = 20 * kNetTimeMillisecond;
+	
+	StreamReliability test_stream_reliability;
+	StreamReliabilityRef test_stream_reliability_ref = &test_stream_reliability;
+	streamReliabilityClear(test_stream_reliability_ref);
+	
+	srand(1);
+	
+	for(int i=1; i<=1000; ++i)
+	{
+		net_time_t now = i * dt_time;
+		
+		for(int j=0; j<4; ++j)
+			streamReliabilityPacketSent(test_stream_reliability_ref, 50 + rand() % 100, now);
+		
+		if(rand() % 4 != 0) // Ack with some delay, up to 32 packets behind
+		{
+			Ack ack = (test_stream_reliability.sequence + kStreamReliabilityMaxSequence - 1 - rand() % 16) % kStreamReliabilityMaxSequence;
+			streamReliabilityProcessAck(test_stream_reliability_ref, ack, rand() | 0x1, now);
+		}
+		
+		streamReliabilityUpdate(test_stream_reliability_ref, now + dt_time);
+		
+		unsigned int ackedPackets = 0;
+		unsigned int ackedBytes = 0;
+		unsigned int sentPackets = 0;
+		unsigned int sentBytes = 0;
+		
+		for(unsigned int pivot = test_stream_reliability.frontAcked; pivot != test_stream_reliability.frontSent; increase(&pivot, kStreamReliabilityBufferCapacity))
+		{
+			if(test_stream_reliability.packets[pivot].acked)
+			{
+				ackedPackets += 1;
+				ackedBytes += test_stream_reliability.packets[pivot].size;
+			}
+		}
+		
+		for(unsigned int pivot = test_stream_reliability.frontSent; pivot != test_stream_reliability.back; increase(&pivot, kStreamReliabilityBufferCapacity))
+		{
+			sentPackets += 1;
+			sentBytes += test_stream_reliability.packets[pivot].size;
+		}
+		
+		assert(test_stream_reliability.ackedPackets == ackedPackets);
+		assert(test_stream_reliability.ackedBytes == ackedBytes);
+		assert(test_stream_reliability.sentPackets == sentPackets);
+		assert(test_stream_reliability.sentBytes == sentBytes);
+	}
+	
+	assert(test_stream_reliability.totalLostPackets > 0);
+	assert(test_stream_reliability.lossRatio > 0.0f && test_stream_reliability.lossRatio < 1.0f);
+	assert(test_stream_reliability.totalAckedPackets > 0);
+	
+	LOG_TEST_END;
+}
+
+static void test_stream_reliability_sack()
+{
+	LOG_TEST_START;
+	
+	// Test 5 acks older than the 64-bit ack bit field are reported in SACK blocks, once negotiated
+	StreamReliability test_stream_reliability_A;
+	StreamReliabilityRef test_stream_reliability_ref_A = &test_stream_reliability_A;
+	streamReliabilityClear(test_stream_reliability_ref_A);
+	
+	StreamReliability test_stream_reliability_B;
+	StreamReliabilityRef test_stream_reliability_ref_B = &test_stream_reliability_B;
+	streamReliabilityClear(test_stream_reliability_ref_B);
+	
+	net_time_t now = kNetTimeSecond;
+	StreamHeaderOptions options;
+	
+	// B hasn't heard from A, no SACK blocks yet
+	streamHeaderOptionsSetup(&options);
+	streamReliabilityAckOptions(test_stream_reliability_ref_B, &options);
+	assert(options.flags == StreamHeaderFlagAckExtended);
+	
+	// A sends 200 packets in a burst, B receives all but 1 in 3 (2, 5, ...)
+	for(int i=0; i<200; ++i)
+	{
+		Sequence sequence = test_stream_reliability_A.sequence;
+		
+		streamHeaderOptionsSetup(&options);
+		streamReliabilityAckOptions(test_stream_reliability_ref_A, &options);
+		streamReliabilityPacketSent(test_stream_reliability_ref_A, 100, now);
+		
+		if(i % 3 != 2)
+		{
+			streamReliabilityPacketReceived(test_stream_reliability_ref_B, sequence, test_stream_reliability_A.ack, test_stream_reliability_A.ackBits, now);
+			streamReliabilityProcessAckOptions(test_stream_reliability_ref_B, test_stream_reliability_A.ack, &options, now);
+		}
+	}
+	
+	assert(test_stream_reliability_B.remoteAckExtended);
+	assert(test_stream_reliability_B.ack == 199);
+	
+	// B replies once, 64 bits plus SACK blocks
+	streamHeaderOptionsSetup(&options);
+	streamReliabilityAckOptions(test_stream_reliability_ref_B, &options);
+	assert(options.flags & StreamHeaderFlagSack);
+	assert(options.sackCount == kStreamProtocolMaxSackBlocks);
+	assert(options.sack[0].offset == 64 && options.sack[0].length == 1); // 135
+	assert(options.sack[1].offset == 66 && options.sack[1].length == 2); // 133, 132
+	
+	// Header round trip
+	uint8_t data[100];
+	bitstream_t bitstream = bitstream_create(data, 100);
+	Sequence unpack_sequence;
+	Ack unpack_ack;
+	AckBitField unpack_ackBits;
+	StreamHeaderOptions unpack_options;
+	
+	streamProtocolPackHeader(&bitstream, test_stream_reliability_B.sequence, test_stream_reliability_B.ack, test_stream_reliability_B.ackBits, &options);
+	bitstream_reset(&bitstream);
+	streamProtocolUnpackHeader(&bitstream, &unpack_sequence, &unpack_ack, &unpack_ackBits, &unpack_options);
+	assert(unpack_ackBits == test_stream_reliability_B.ackBits);
+	assert(unpack_options.sackCount == options.sackCount);
+	
+	streamReliabilityPacketReceived(test_stream_reliability_ref_A, unpack_sequence, unpack_ack, unpack_ackBits, now);
+	streamReliabilityProcessAckOptions(test_stream_reliability_ref_A, unpack_ack, &unpack_options, now);
+	
+	// 64 bits cover 136..199, SACK blocks cover 4 runs below
+	unsigned int expectedAcked = 0;
+	
+	for(int i=136; i<200; ++i)
+		expectedAcked += (i % 3 != 2);
+	
+	for(unsigned int i=0; i<options.sackCount; ++i)
+		expectedAcked += options.sack[i].length;
+	
+	assert(test_stream_reliability_A.totalAckedPackets == expectedAcked);
+	
+	for(int i=0; i<200; ++i)
+	{
+		unsigned int offset = 199 - i;
+		bool reported = offset < 64 || (offset < options.sack[options.sackCount-1].offset + options.sack[options.sackCount-1].length);
+		assert(test_stream_reliability_A.packets[i].acked == (reported && i % 3 != 2));
+	}
+	
+	LOG_TEST_END;
+}
 
+static void test_stream_reliability_timestamps()
+{
+	LOG_TEST_START;
+	
+	// Test 3 exchanging options, 1.5ms one-way delay, remote side holding packets for 20ms to 60ms before replying
+	const net_time_t delay = 1500 * kNetTimeMicrosecond;
+	const net_time_t rtt = 2 * delay;
+	
+	StreamReliability test_stream_reliability_A;
+	StreamReliabilityRef test_stream_reliability_ref_A = &test_stream_reliability_A;
+	streamReliabilityClear(test_stream_reliability_ref_A);
+	
+	StreamReliability test_stream_reliability_B;
+	StreamReliabilityRef test_stream_reliability_ref_B = &test_stream_reliability_B;
+	streamReliabilityClear(test_stream_reliability_ref_B);
+	
+	net_time_t now = 5 * kNetTimeSecond;
+	
+	for(int i=0; i<100; ++i)
+	{
+		StreamHeaderOptions options;
+		
+		// A to B
+		streamHeaderOptionsSetup(&options);
+		streamReliabilityTimestamps(test_stream_reliability_ref_A, &options, now);
+		assert(options.flags & StreamHeaderFlagTimestamp);
+		assert(i == 0 || (options.flags & StreamHeaderFlagEcho));
+		now += delay;
+		streamReliabilityProcessTimestamps(test_stream_reliability_ref_B, &options, now);
+		
+		// B holds
+		now += (20 + (i % 5) * 10) * kNetTimeMillisecond;
+		
+		// B to A
+		streamHeaderOptionsSetup(&options);
+		streamReliabilityTimestamps(test_stream_reliability_ref_B, &options, now);
+		assert(options.flags & StreamHeaderFlagEcho);
+		now += delay;
+		streamReliabilityProcessTimestamps(test_stream_reliability_ref_A, &options, now);
+		
+		// A holds
+		now += 10 * kNetTimeMillisecond;
+	}
+	
+	const float epsilon = 0.00001f; // Microsecond rounding
+	
+	assert(test_stream_reliability_ref_A->echoValid);
+	assert(test_stream_reliability_ref_A->rttSamples == 100);
+	assert(fabsf(test_stream_reliability_ref_A->rtt - mNetTimeToSeconds(rtt)) < epsilon);
+	assert(fabsf(test_stream_reliability_ref_A->rttMin - mNetTimeToSeconds(rtt)) < epsilon);
+	assert(test_stream_reliability_ref_A->rttVariance < epsilon);
+	
+	assert(test_stream_reliability_ref_B->echoValid);
+	assert(test_stream_reliability_ref_B->rttSamples == 99);
+	assert(fabsf(test_stream_reliability_ref_B->rtt - mNetTimeToSeconds(rtt)) < epsilon);
+	
+	LOG_TEST_END;
+}
 
 int main(void)
 {	
@@ -199,6 +410,9 @@ int main(void)
 	test_stream_reliability_clear();
 	test_stream_reliability_no_loss();
 	test_stream_reliability_with_loss();
+	test_stream_reliability_incremental();
+	test_stream_reliability_sack();
+	test_stream_reliability_timestamps();
 	
 	return 0;
 }
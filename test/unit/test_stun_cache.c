@@ -0,0 +1,105 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stun_cache.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "stun_cache.h"
+
+#include <unistd.h>
+
+static void test_stun_cache_entry(StunCacheEntry * entry, unsigned int localHost, const char * serverHostname, uint64_t time)
+{
+	memset(entry, 0, sizeof(StunCacheEntry));
+	net_addr_set(&entry->localAddr, localHost, 0, true);
+	strcpy(entry->serverHostname, serverHostname);
+	net_addr_set(&entry->serverAddr, 0x0a000001, 3478, true);
+	entry->time = time;
+	
+	StunResults * results = &entry->results;
+	results->didBindingTestSuccess = true;
+	net_addr_set(&results->localAddr, localHost, 5000, true);
+	net_addr_set(&results->mappedAddr, 0x0b000001, 6000, true);
+	results->hasOtherServerAddress = true;
+	net_addr_set(&results->otherServerAddr, 0x0a000002, 3479, true);
+	results->didBehaviorTestSuccess = true;
+	results->natBehavior = AddressDependentMapping;
+	results->didFilteringTestSuccess = true;
+	results->natFiltering = AddressAndPortDependentFiltering;
+}
+
+static void test_stun_cache_store_load()
+{
+	LOG_TEST_START;
+	
+	char path[] = "/tmp/test_stun_cache_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+	unlink(path); // Missing file
+	
+	StunCacheEntry entry, loaded;
+	test_stun_cache_entry(&entry, 0xc0a80001, "stun.example.com", 1000);
+	
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.com", 1000, 60, &loaded) == false);
+	assert(stunCacheStore(path, &entry) == NetNoError);
+	
+	// Fresh
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.com", 1059, 60, &loaded) == true);
+	assert(loaded.time == 1000);
+	assert(net_addr_is_equal(&loaded.serverAddr, &entry.serverAddr));
+	assert(net_addr_is_equal(&loaded.results.mappedAddr, &entry.results.mappedAddr));
+	assert(net_addr_is_equal(&loaded.results.otherServerAddr, &entry.results.otherServerAddr));
+	assert(loaded.results.didBindingTestSuccess && loaded.results.hasOtherServerAddress && !loaded.results.isMappingDirect);
+	assert(loaded.results.natBehavior == AddressDependentMapping);
+	assert(loaded.results.natFiltering == AddressAndPortDependentFiltering);
+	
+	// Expired, other server, other interface
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.com", 1060, 60, &loaded) == false);
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.org", 1000, 60, &loaded) == false);
+	net_addr_t otherLocalAddr;
+	net_addr_set(&otherLocalAddr, 0xc0a80002, 0, true);
+	assert(stunCacheLoad(path, &otherLocalAddr, "stun.example.com", 1000, 60, &loaded) == false);
+	
+	// Replace same key
+	entry.time = 2000;
+	entry.results.natBehavior = EndpointIndependentMapping;
+	assert(stunCacheStore(path, &entry) == NetNoError);
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.com", 2000, 60, &loaded) == true);
+	assert(loaded.results.natBehavior == EndpointIndependentMapping);
+	
+	// Full, oldest is replaced
+	for(unsigned int i=1; i<=kStunCacheMaxEntries; ++i)
+	{
+		StunCacheEntry other;
+		test_stun_cache_entry(&other, 0xc0a80001 + i, "stun.example.com", 2000 + i);
+		assert(stunCacheStore(path, &other) == NetNoError);
+	}
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.com", 2000, 60, &loaded) == false); // Oldest, evicted
+	net_addr_set(&otherLocalAddr, 0xc0a80001 + kStunCacheMaxEntries, 0, true);
+	assert(stunCacheLoad(path, &otherLocalAddr, "stun.example.com", 2020, 60, &loaded) == true);
+	
+	// Corrupted file is ignored and rewritten
+	FILE * file = fopen(path, "wb");
+	fputs("garbage", file);
+	fclose(file);
+	assert(stunCacheLoad(path, &otherLocalAddr, "stun.example.com", 2020, 60, &loaded) == false);
+	assert(stunCacheStore(path, &entry) == NetNoError);
+	assert(stunCacheLoad(path, &entry.localAddr, "stun.example.com", 2000, 60, &loaded) == true);
+	
+	unlink(path);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("stun_cache");
+	
+	test_stun_cache_store_load();
+	
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stun_keepalive.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "stun_keepalive.h"
+
+#define kTestStunKeepaliveBindings (kStunKeepaliveBatchMax + 100)
+#define kTestStunKeepaliveLifetime 2.0 // Interval between 0.8 and 1 second
+
+static volatile int test_receivedIndications = 0;
+
+static void test_stun_keepalive_interval()
+{
+	LOG_TEST_START;
+	
+	net_time_t longest = stunKeepaliveInterval(kStunKeepaliveDefaultLifetime, 0.0);
+	net_time_t shortest = stunKeepaliveInterval(kStunKeepaliveDefaultLifetime, 0.999999);
+	
+	assert(longest == mNetTimeFromSeconds(kStunKeepaliveDefaultLifetime * kStunKeepaliveLifetimeRatio));
+	assert(shortest < longest);
+	assert(shortest >= mNetTimeFromSeconds(kStunKeepaliveDefaultLifetime * kStunKeepaliveLifetimeRatio * (1.0 - kStunKeepaliveJitter)));
+	
+	// Lifetime bounds
+	net_addr_t addr;
+	net_addr_set(&addr, 0x7f000001, 3478, true);
+	StunKeepaliveBinding binding;
+	stunKeepaliveBindingInit(&binding, &addr, 0.0);
+	assert(binding.lifetime == kStunKeepaliveDefaultLifetime);
+	stunKeepaliveBindingInit(&binding, &addr, 0.1);
+	assert(binding.lifetime == kStunKeepaliveMinLifetime);
+	assert(binding.entry.scheduled == false);
+	
+	LOG_TEST_END;
+}
+
+static void test_stun_keepalive_receiveCallback(void * context, net_packet_t packet)
+{
+	net_socket_t socket = (net_socket_t)context;
+	
+	StunMsgType msgType;
+	StunMsgClass msgClass;
+	StunTransactionId transactionId;
+	unsigned int length;
+	
+	assert(stunProtocolIsMessage(packet->data, packet->length) == true);
+	assert(stunProtocolUnpackHeader(&packet->bitstream, &msgType, &msgClass, &transactionId, &length) == kStunValid);
+	assert(msgType == StunMsgTypeBinding);
+	assert(msgClass == StunMsgClassIndication);
+	assert(length == 0);
+	
+	__sync_add_and_fetch(&test_receivedIndications, 1);
+	net_packet_release(socket, packet);
+}
+
+static void test_stun_keepalive_send()
+{
+	LOG_TEST_START;
+	
+	NetError netError;
+	static const char * localhost = "127.0.0.1";
+	
+	net_socket_t receiveSocket = net_socket_create(&netError, AF_INET, localhost, 45310);
+	assert(netError == NetNoError);
+	net_socket_t sendSocket = net_socket_create(&netError, AF_INET, localhost, 45311);
+	assert(netError == NetNoError);
+	net_socket_set_receive_callback(receiveSocket, receiveSocket, test_stun_keepalive_receiveCallback);
+	
+	net_addr_t addr;
+	net_addr_copy(&addr, &receiveSocket->sockaddr);
+	
+	stun_keepalive_t keepalive = stunKeepaliveCreate(sendSocket);
+	assert(keepalive);
+	
+	// Added at once, more than a burst
+	StunKeepaliveBinding * bindings = (StunKeepaliveBinding *)calloc(kTestStunKeepaliveBindings, sizeof(StunKeepaliveBinding));
+	for(int i=0; i<kTestStunKeepaliveBindings; ++i)
+	{
+		stunKeepaliveBindingInit(&bindings[i], &addr, kTestStunKeepaliveLifetime);
+		stunKeepaliveAdd(keepalive, &bindings[i]);
+	}
+	assert(stunKeepaliveCount(keepalive) == kTestStunKeepaliveBindings);
+	
+	usleep(700000); // Nothing due before 0.8 seconds
+	assert(test_receivedIndications == 0);
+	
+	usleep(1600000); // Two keepalives each by 2.3 seconds, third not before 2.4
+	for(int i=0; i<kTestStunKeepaliveBindings; ++i)
+		assert(bindings[i].sentCount == 2);
+	assert(keepalive->sentCount == 2 * kTestStunKeepaliveBindings);
+	assert(test_receivedIndications == 2 * kTestStunKeepaliveBindings); // Loopback, no loss
+	
+	// Lost binding, refreshed right away
+	stunKeepaliveDidExpire(keepalive, &bindings[0]);
+	assert(bindings[0].lifetime == kStunKeepaliveMinLifetime);
+	usleep(100000);
+	assert(bindings[0].sentCount == 3);
+	
+	// Removed bindings stop
+	for(int i=0; i<kTestStunKeepaliveBindings; ++i)
+		stunKeepaliveRemove(keepalive, &bindings[i]);
+	assert(stunKeepaliveCount(keepalive) == 0);
+	
+	uint64_t sentCount = keepalive->sentCount;
+	usleep(1100000);
+	assert(keepalive->sentCount == sentCount);
+	
+	stunKeepaliveDestroy(keepalive);
+	free(bindings);
+	
+	net_socket_destroy(sendSocket);
+	net_socket_destroy(receiveSocket);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("stun_keepalive");
+	
+	test_stun_keepalive_interval();
+	test_stun_keepalive_send();
+	
+	return 0;
+}
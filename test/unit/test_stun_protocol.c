@@ -0,0 +1,133 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stun_protocol.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "stun_protocol.h"
+#include "stun_utils.h"
+
+// RFC 5769 2.1, sample request up to MESSAGE-INTEGRITY (SOFTWARE, PRIORITY, ICE-CONTROLLED and USERNAME)
+static const uint8_t test_stun_sample_request[] = {
+	0x00, 0x01, 0x00, 0x58, 0x21, 0x12, 0xa4, 0x42, 0xb7, 0xe7, 0xa7, 0x01, 0xbc, 0x34, 0xd6, 0x86, 0xfa, 0x87, 0xdf, 0xae,
+	0x80, 0x22, 0x00, 0x10, 'S', 'T', 'U', 'N', ' ', 't', 'e', 's', 't', ' ', 'c', 'l', 'i', 'e', 'n', 't',
+	0x00, 0x24, 0x00, 0x04, 0x6e, 0x00, 0x01, 0xff,
+	0x80, 0x29, 0x00, 0x08, 0x93, 0x2f, 0xf9, 0xb1, 0x51, 0x26, 0x3b, 0x36,
+	0x00, 0x06, 0x00, 0x09, 'e', 'v', 't', 'j', ':', 'h', '6', 'v', 'Y', 0x20, 0x20, 0x20
+};
+
+static const uint8_t test_stun_sample_integrity[] = {
+	0x00, 0x08, 0x00, 0x14, 0x9a, 0xea, 0xa7, 0x0c, 0xbf, 0xd8, 0xcb, 0x56, 0x78, 0x1e, 0xf2, 0xb5, 0xb2, 0xd3, 0xf2, 0x49, 0xc1, 0xb5, 0x71, 0xa2,
+	0x80, 0x28, 0x00, 0x04, 0xe5, 0x7a, 0x3b, 0xcf
+};
+
+#define kTestStunSamplePassword "VOkJxbRl1RmTxUk/WvJxBt"
+#define kTestStunSampleLen (sizeof(test_stun_sample_request) + kStunMessageIntegrityLen + kStunFingerprintLen)
+
+static void test_stun_protocol_sample()
+{
+	LOG_TEST_START;
+	
+	hmac_sha1_key_t key;
+	hmac_sha1_key_init(&key, (const uint8_t *)kTestStunSamplePassword, strlen(kTestStunSamplePassword));
+	
+	uint8_t data[kTestStunSampleLen];
+	bitstream_t bitstream = bitstream_create(data, kTestStunSampleLen);
+	bitstream_write_raw(&bitstream, test_stun_sample_request, sizeof(test_stun_sample_request));
+	stunProtocolPackMessageIntegrity(&bitstream, &key);
+	stunProtocolPackFingerprint(&bitstream);
+	
+	assert(bitstream_error(&bitstream) == 0);
+	assert(bitstream.offset == kTestStunSampleLen);
+	assert(memcmp(data, test_stun_sample_request, sizeof(test_stun_sample_request)) == 0); // Header length was already final
+	assert(memcmp(&data[sizeof(test_stun_sample_request)], test_stun_sample_integrity, sizeof(test_stun_sample_integrity)) == 0);
+	
+	assert(stunProtocolHasValidFingerprint(data, kTestStunSampleLen) == true);
+	assert(stunProtocolHasValidMessageIntegrity(data, kTestStunSampleLen, &key) == true);
+	
+	// Wrong password
+	hmac_sha1_key_t otherKey;
+	hmac_sha1_key_init(&otherKey, (const uint8_t *)"VOkJxbRl1RmTxUk/WvJxBT", strlen(kTestStunSamplePassword));
+	assert(stunProtocolHasValidMessageIntegrity(data, kTestStunSampleLen, &otherKey) == false);
+	
+	// Any flipped bit, fingerprint is the last 4 bytes
+	for(size_t i=0; i<kTestStunSampleLen; ++i)
+	{
+		data[i] ^= 0x10;
+		assert(stunProtocolHasValidFingerprint(data, kTestStunSampleLen) == false);
+		if(i >= 4 && i < kTestStunSampleLen - kStunFingerprintLen) // Type and length bytes change what is checked
+			assert(stunProtocolHasValidMessageIntegrity(data, kTestStunSampleLen, &key) == false);
+		data[i] ^= 0x10;
+	}
+	
+	// Truncated or padded datagram
+	assert(stunProtocolHasValidFingerprint(data, kTestStunSampleLen - 4) == false);
+	assert(stunProtocolHasValidFingerprint(data, sizeof(test_stun_sample_request)) == false);
+	
+	LOG_TEST_END;
+}
+
+static void test_stun_protocol_fingerprint()
+{
+	LOG_TEST_START;
+	
+	uint8_t data[64];
+	StunTransactionId transactionId, testTransactionId;
+	stunGenerateTransactionId(&transactionId);
+	
+	// No FINGERPRINT
+	bitstream_t bitstream = bitstream_create(data, sizeof(data));
+	stunProtocolPackBindingCheck(&bitstream, transactionId, false);
+	assert(stunProtocolIsMessage(data, bitstream.offset) == true);
+	assert(stunProtocolHasValidFingerprint(data, bitstream.offset) == false);
+	
+	// Check, still parsed as before
+	bitstream = bitstream_create(data, sizeof(data));
+	stunProtocolPackBindingCheck(&bitstream, transactionId, true);
+	stunProtocolPackFingerprint(&bitstream);
+	size_t length = bitstream.offset;
+	assert(length == kStunHeaderLen + 4 + kStunFingerprintLen);
+	assert(stunProtocolHasValidFingerprint(data, length) == true);
+	
+	StunBindingRequest bindingRequest;
+	bitstream = bitstream_create(data, length);
+	assert(stunProtocolUnpackBindingRequest(&bitstream, &testTransactionId, &bindingRequest) == kStunValid);
+	assert(stunIsEqualTransactionId(&transactionId, &testTransactionId) == true);
+	assert(bindingRequest.hasUseCandidate == true);
+	
+	// Check response
+	net_addr_t mappedAddr;
+	net_addr_set(&mappedAddr, 0xCB007107, 40000, true); // 203.0.113.7
+	bitstream = bitstream_create(data, sizeof(data));
+	stunProtocolPackBindingCheckResponse(&bitstream, transactionId, &mappedAddr);
+	stunProtocolPackFingerprint(&bitstream);
+	length = bitstream.offset;
+	assert(stunProtocolHasValidFingerprint(data, length) == true);
+	
+	StunBindingResponse bindingResponse;
+	bitstream = bitstream_create(data, length);
+	assert(stunProtocolUnpackBindingResponse(&bitstream, &testTransactionId, &bindingResponse) == kStunValid);
+	assert(bindingResponse.hasXorMappedAddress == true);
+	assert(net_addr_is_equal(&bindingResponse.xorMappedAddressAddr, &mappedAddr) == true);
+	
+	// Does not fit, nothing appended
+	bitstream = bitstream_create(data, kStunHeaderLen + 4);
+	stunProtocolPackBindingCheck(&bitstream, transactionId, true);
+	stunProtocolPackFingerprint(&bitstream);
+	assert(bitstream_error(&bitstream) != 0);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("stun_protocol");
+	
+	test_stun_protocol_sample();
+	test_stun_protocol_fingerprint();
+	
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_stun_server.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "stun_protocol.h"
+#include "stun_utils.h"
+
+static void test_stun_server_request()
+{
+	LOG_TEST_START;
+	
+	uint8_t data[64];
+	StunTransactionId transactionId, testTransactionId;
+	StunBindingRequest bindingRequest;
+	stunGenerateTransactionId(&transactionId);
+	
+	// Plain binding request
+	bitstream_t bitstream = bitstream_create(data, sizeof(data));
+	stunProtocolPackBindingRequest(&bitstream, transactionId);
+	size_t length = bitstream.offset;
+	
+	bitstream = bitstream_create(data, length);
+	assert(stunProtocolUnpackBindingRequest(&bitstream, &testTransactionId, &bindingRequest) == kStunValid);
+	assert(stunIsEqualTransactionId(&transactionId, &testTransactionId) == true);
+	assert(bindingRequest.hasChangeRequest == false);
+	
+	// CHANGE-REQUEST, host and port flags
+	for(int flags=0; flags<4; ++flags)
+	{
+		bitstream = bitstream_create(data, sizeof(data));
+		stunProtocolPackBindingChangeRequest(&bitstream, transactionId, (flags & 2) != 0, (flags & 1) != 0);
+		length = bitstream.offset;
+		
+		bitstream = bitstream_create(data, length);
+		assert(stunProtocolUnpackBindingRequest(&bitstream, &testTransactionId, &bindingRequest) == kStunValid);
+		assert(bindingRequest.hasChangeRequest == true);
+		assert(bindingRequest.doChangeHost == ((flags & 2) != 0));
+		assert(bindingRequest.doChangePort == ((flags & 1) != 0));
+	}
+	
+	// Truncated attribute
+	bitstream = bitstream_create(data, length - 2);
+	assert(stunProtocolUnpackBindingRequest(&bitstream, &testTransactionId, &bindingRequest) == kStunInvalid);
+	
+	// Responses are not requests
+	net_addr_t addr;
+	net_addr_set(&addr, 0x7f000001, 3478, true);
+	bitstream = bitstream_create(data, sizeof(data));
+	stunProtocolPackBindingResponse(&bitstream, transactionId, &addr, &addr, &addr);
+	bitstream = bitstream_create(data, kStunBindingResponseLen);
+	assert(stunProtocolUnpackBindingRequest(&bitstream, &testTransactionId, &bindingRequest) == kStunUnexpected);
+	
+	LOG_TEST_END;
+}
+
+static void test_stun_server_response()
+{
+	LOG_TEST_START;
+	
+	uint8_t data[kStunBindingResponseLen];
+	StunTransactionId transactionId, testTransactionId;
+	stunGenerateTransactionId(&transactionId);
+	
+	net_addr_t mappedAddr, otherAddr, originAddr;
+	net_addr_set(&mappedAddr, 0xbc52c006, 62858, true);
+	net_addr_set(&otherAddr, 0x7f000002, 3479, true);
+	net_addr_set(&originAddr, 0x7f000001, 3479, true);
+	
+	bitstream_t bitstream = bitstream_create(data, sizeof(data));
+	stunProtocolPackBindingResponse(&bitstream, transactionId, &mappedAddr, &otherAddr, &originAddr);
+	assert(bitstream.offset == kStunBindingResponseLen);
+	assert(stunProtocolIsMessage(data, sizeof(data)) == true);
+	
+	// Decoded by the client
+	StunBindingResponse bindingResponse;
+	memset(&bindingResponse, 0, sizeof(StunBindingResponse));
+	bitstream = bitstream_create(data, sizeof(data));
+	assert(stunProtocolUnpackBindingResponse(&bitstream, &testTransactionId, &bindingResponse) == kStunValid);
+	assert(stunIsEqualTransactionId(&transactionId, &testTransactionId) == true);
+	
+	assert(bindingResponse.hasXorMappedAddress == true);
+	assert(net_addr_is_equal(&bindingResponse.xorMappedAddressAddr, &mappedAddr) == true);
+	assert(bindingResponse.hasMappedAddress == true);
+	assert(net_addr_is_equal(&bindingResponse.mappedAddressAddr, &mappedAddr) == true);
+	assert(bindingResponse.hasAlternateServer == true); // OTHER-ADDRESS
+	assert(net_addr_is_equal(&bindingResponse.alternateServerAddr, &otherAddr) == true);
+	assert(bindingResponse.hasResponseOrigin == true);
+	assert(net_addr_is_equal(&bindingResponse.responseOriginAddr, &originAddr) == true);
+	assert(bindingResponse.hasErrorCode == false);
+	
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("stun_server");
+	
+	test_stun_server_request();
+	test_stun_server_response();
+	
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+* Copyright (cc) 2012 Luis Laugga. Some rights reserved, all wrongs deserved.
+* Licensed under a Creative Commons Attribution, Share Alike 3.0 Unported License (CC BY-SA 3.0).
+*
+* test_timer_wheel.c
+* universal-network-c
+*/
+
+#include "test.h"
+#include "timer_wheel.h"
+
+#define kTestTimerWheelResolution 10
+#define kTestTimerWheelEntries 100
+
+static void test_timer_wheel_expire()
+{
+	LOG_TEST_START;
+
+	timer_wheel_t test_timer_wheel = timer_wheel_create(kTestTimerWheelResolution, 6, 1000); // Rounded to 8 slots
+
+	timer_wheel_entry_t entries[kTestTimerWheelEntries];
+	__block uint64_t deadlines[kTestTimerWheelEntries];
+	__block unsigned int expired = 0;
+
+	for(int i=0; i<kTestTimerWheelEntries; ++i)
+	{
+		deadlines[i] = 1000 + (i * 37) % 500; // Up to 6 revolutions ahead, out of order
+		timer_wheel_entry_init(&entries[i], &deadlines[i]);
+		timer_wheel_schedule(test_timer_wheel, &entries[i], deadlines[i]);
+	}
+
+	assert(timer_wheel_count(test_timer_wheel) == kTestTimerWheelEntries);
+	assert(timer_wheel_next(test_timer_wheel) == 1000);
+
+	// Never early, at most one tick late
+	for(uint64_t now=1000; now<1600; now+=3)
+	{
+		__block uint64_t blockNow = now;
+		expired += timer_wheel_advance(test_timer_wheel, now, ^(timer_wheel_entry_t * entry){
+			uint64_t deadline = *(uint64_t *)entry->object;
+			assert(entry->scheduled == false);
+			assert(deadline <= blockNow);
+			assert(blockNow < deadline + kTestTimerWheelResolution + 3);
+		});
+	}
+
+	assert(expired == kTestTimerWheelEntries);
+	assert(timer_wheel_count(test_timer_wheel) == 0);
+	assert(timer_wheel_next(test_timer_wheel) == 0);
+
+	timer_wheel_destroy(test_timer_wheel);
+
+	LOG_TEST_END;
+}
+
+static void test_timer_wheel_cancel_reschedule()
+{
+	LOG_TEST_START;
+
+	timer_wheel_t test_timer_wheel = timer_wheel_create(kTestTimerWheelResolution, kTimerWheelDefaultSlots, 0);
+
+	timer_wheel_entry_t entryA, entryB;
+	timer_wheel_entry_init(&entryA, NULL);
+	timer_wheel_entry_init(&entryB, NULL);
+
+	timer_wheel_schedule(test_timer_wheel, &entryA, 50);
+	timer_wheel_schedule(test_timer_wheel, &entryB, 50); // Same slot
+	timer_wheel_cancel(test_timer_wheel, &entryA);
+	timer_wheel_cancel(test_timer_wheel, &entryA); // Not scheduled, nothing to do
+	assert(timer_wheel_count(test_timer_wheel) == 1);
+
+	timer_wheel_schedule(test_timer_wheel, &entryB, 2000); // Moved, more than one revolution ahead
+	assert(timer_wheel_next(test_timer_wheel) == 2000);
+
+	// Periodic, re-scheduled from the block every 100
+	__block unsigned int expired = 0;
+	for(uint64_t now=0; now<=1000; now+=10)
+	{
+		timer_wheel_advance(test_timer_wheel, now, ^(timer_wheel_entry_t * entry){
+			assert(entry == &entryB);
+			++expired;
+		});
+	}
+	assert(expired == 0); // Not before 2000
+
+	timer_wheel_schedule(test_timer_wheel, &entryA, 500); // In the past
+	for(uint64_t now=1010; now<=2000; now+=10)
+	{
+		__block uint64_t blockNow = now;
+		timer_wheel_advance(test_timer_wheel, now, ^(timer_wheel_entry_t * entry){
+			if(entry == &entryA)
+				timer_wheel_schedule(test_timer_wheel, entry, blockNow + 100);
+			++expired;
+		});
+	}
+	assert(expired == 11); // A at 1010, then every 100 up to 1910, and B at 2000
+	assert(timer_wheel_count(test_timer_wheel) == 1);
+
+	timer_wheel_destroy(test_timer_wheel);
+
+	LOG_TEST_END;
+}
+
+int main(void)
+{
+	LOG_SUITE_START("timer_wheel");
+
+	test_timer_wheel_expire();
+	test_timer_wheel_cancel_reschedule();
+
+	return 0;
+}
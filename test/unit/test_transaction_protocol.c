@@ -101,6 +101,72 @@ static void test_pack_unpack_ResourceCreateObject()
 	LOG_TEST_END;
 }
 
+#pragma mark -
+#pragma mark Request dispatch
+
+static void test_pack_unpack_request()
+{
+	LOG_TEST_START;
+	
+	TransactionObjectPeerList packPeerList;
+	packPeerList.type = TransactionPeerList;
+	transactionProtocolInitializeObjectPeerList(&packPeerList);
+	
+	for(int i=0; i<3; ++i)
+	{
+		TransactionObjectPeer peer;
+		sprintf(peer.peerId, "peer%d", i);
+		net_addr_set(&peer.localAddress, 0x0a000001+i, 5000+i, true);
+		net_addr_set(&peer.mappedAddress, 0x0b000001+i, 6000+i, true);
+		transactionProtocolAddPeerToObjectPeerList(&packPeerList, &peer);
+	}
+	
+	uint8_t bitstream_data[kNetPacketMaxLen]; 
+	bitstream_t bitstream = bitstream_create(bitstream_data, kNetPacketMaxLen);	
+	assert(transactionProtocolPackRequest(&bitstream, (TransactionObject *)&packPeerList) == true);
+	size_t length = bitstream.offset;
+	assert(length == 1 + 4 + 3 * (8 + 8 + 8)); // Type, count attribute, 3 x (peerId, 2 addresses)
+	
+	TransactionObject unpackObject;
+	bitstream = bitstream_create(bitstream_data, length);
+	assert(transactionProtocolUnpackRequest(&bitstream, &unpackObject) == UnpackValid);
+	
+	TransactionObjectPeerList * unpackPeerList = (TransactionObjectPeerList *)&unpackObject;
+	assert(unpackPeerList->type == TransactionPeerList);
+	assert(unpackPeerList->count == 3);
+	assert(strcmp(unpackPeerList->list[2].peerId, "peer2") == 0);
+	assert(net_addr_is_equal(&unpackPeerList->list[1].mappedAddress, &packPeerList.list[1].mappedAddress));
+	
+	// Truncated
+	bitstream = bitstream_create(bitstream_data, length - 1);
+	assert(transactionProtocolUnpackRequest(&bitstream, &unpackObject) == UnpackInvalid);
+	
+	// More peers than fit the list
+	bitstream_data[4] = 11;
+	bitstream = bitstream_create(bitstream_data, length);
+	assert(transactionProtocolUnpackRequest(&bitstream, &unpackObject) == UnpackInvalid);
+	
+	// Unknown type
+	bitstream_data[0] = 0x33;
+	bitstream = bitstream_create(bitstream_data, length);
+	assert(transactionProtocolUnpackRequest(&bitstream, &unpackObject) == UnpackUnexpected);
+	
+	// Doesn't fit the transaction packet size class, rejected
+	TransactionObjectPeer longPeer;
+	memset(longPeer.peerId, 'p', kUniversalPeerIdMaxLength - 1);
+	longPeer.peerId[kUniversalPeerIdMaxLength - 1] = '\0';
+	net_addr_set(&longPeer.localAddress, 0x0a000001, 5000, true);
+	net_addr_set(&longPeer.mappedAddress, 0x0b000001, 6000, true);
+	while(packPeerList.count < 10)
+		transactionProtocolAddPeerToObjectPeerList(&packPeerList, &longPeer);
+	
+	bitstream = bitstream_create(bitstream_data, kTransactionPacketLen);
+	assert(transactionProtocolPackRequest(&bitstream, (TransactionObject *)&packPeerList) == false);
+	assert(bitstream_error(&bitstream) != 0);
+	
+	LOG_TEST_END;
+}
+
 #pragma mark -
 #pragma mark Online Object
 
@@ -538,6 +604,9 @@ int main(void)
 	// resource objects pack/unpack
 	test_pack_unpack_ResourceCreateObject();
 	
+	// request type dispatch
+	test_pack_unpack_request();
+	
 	// objects
 	test_object_online();
 	test_object_offline();